@@ -89,7 +89,15 @@ Level = {
         { type = "texture", id = "radar-texture",               file = "./assets/images/radar-spritesheet.png" },
         { type = "font"   , id = "charriot-font",               file = "./assets/fonts/charriot.ttf", font_size = 8 },
         { type = "font"   , id = "pico8-font-8",                file = "./assets/fonts/charriot.ttf", font_size = 10 },
-        { type = "font"   , id = "pico8-font-10",               file = "./assets/fonts/charriot.ttf", font_size = 18 }
+        { type = "font"   , id = "pico8-font-10",               file = "./assets/fonts/charriot.ttf", font_size = 18 },
+
+        -- animation clips (one sprite sheet row per direction) and the state machine picking them
+        { type = "animation", id = "chopper-up", row = 0, num_frames = 2, frame_width = 32, frame_height = 32, frame_rate = 10 },
+        { type = "animation", id = "chopper-right", row = 1, num_frames = 2, frame_width = 32, frame_height = 32, frame_rate = 10 },
+        { type = "animation", id = "chopper-down", row = 2, num_frames = 2, frame_width = 32, frame_height = 32, frame_rate = 10 },
+        { type = "animation", id = "chopper-left", row = 3, num_frames = 2, frame_width = 32, frame_height = 32, frame_rate = 10 },
+        { type = "animation_state_machine", id = "chopper-states",
+          transitions = { up = "chopper-up", right = "chopper-right", down = "chopper-down", left = "chopper-left" } }
     },
 
     ----------------------------------------------------
@@ -131,8 +139,8 @@ Level = {
                     src_rect_y = 0
                 },
                 animation = {
-                    num_frames = 2,
-                    speed_rate = 10 -- fps
+                    clip = "chopper-up",
+                    state_machine = "chopper-states"
                 },
                 boxcollider = {
                     width = 32,
@@ -156,6 +164,12 @@ Level = {
                     down_velocity = { x = 0, y = 120 },
                     left_velocity = { x = -120, y = 0 }
                 },
+                map_clamp = {
+                    padding_left = 10,
+                    padding_top = 10,
+                    padding_right = 50,
+                    padding_bottom = 50
+                },
                 camera_follow = {
                     follow = true
                 }
@@ -76,7 +76,15 @@ Level = {
         { type = "texture", id = "radar-texture",               file = "./assets/images/radar-spritesheet.png" },
         { type = "font"   , id = "charriot-font",               file = "./assets/fonts/charriot.ttf", font_size = 8 },
         { type = "font"   , id = "pico8-font-8",                file = "./assets/fonts/pico8.ttf", font_size = 8 },
-        { type = "font"   , id = "pico8-font-10",               file = "./assets/fonts/pico8.ttf", font_size = 10 }
+        { type = "font"   , id = "pico8-font-10",               file = "./assets/fonts/pico8.ttf", font_size = 10 },
+
+        -- animation clips (one sprite sheet row per direction) and the state machine picking them
+        { type = "animation", id = "tank-up", row = 0, num_frames = 1, frame_width = 32, frame_height = 32, frame_rate = 0 },
+        { type = "animation", id = "tank-right", row = 1, num_frames = 1, frame_width = 32, frame_height = 32, frame_rate = 0 },
+        { type = "animation", id = "tank-down", row = 2, num_frames = 1, frame_width = 32, frame_height = 32, frame_rate = 0 },
+        { type = "animation", id = "tank-left", row = 3, num_frames = 1, frame_width = 32, frame_height = 32, frame_rate = 0 },
+        { type = "animation_state_machine", id = "tank-states",
+          transitions = { up = "tank-up", right = "tank-right", down = "tank-down", left = "tank-left" } }
     },
 
     ----------------------------------------------------
@@ -117,6 +125,10 @@ Level = {
                     src_rect_x = 0,
                     src_rect_y = 0
                 },
+                animation = {
+                    clip = "tank-up",
+                    state_machine = "tank-states"
+                },
                 boxcollider = {
                     width = 32,
                     height = 25,
@@ -139,6 +151,12 @@ Level = {
                     down_velocity = { x = 0, y = 75 },
                     left_velocity = { x = -75, y = 0 }
                 },
+                map_clamp = {
+                    padding_left = 10,
+                    padding_top = 10,
+                    padding_right = 50,
+                    padding_bottom = 50
+                },
                 camera_follow = {
                     follow = true
                 }
@@ -2597,10 +2615,32 @@ Level = {
                         local angle_in_degrees = 180 + angle * 180 / math.pi
                         set_rotation(entity, angle_in_degrees)
                     end
-                }
+                },
                 --]]
+                -- batched version of the script above, one call per frame for all the entities with this batch script
+                batch_script = "circular_path"
             }
         }
+    },
+
+    ----------------------------------------------------
+    -- batch scripts, called once per frame with all the entities using them
+    -- function(entities, count, delta_time, elapsed_time), entity i (1 to count) is accessed with the batch_* functions
+    ----------------------------------------------------
+    batch_scripts = {
+        circular_path = function(entities, count, delta_time, ellapsed_time)
+            local radius = 170
+            local distance_from_origin = 500
+            local angle = ellapsed_time * 0.0009
+            local new_x = (math.cos(angle) * radius) + distance_from_origin
+            local new_y = (math.sin(angle) * radius) + distance_from_origin
+            local angle_in_degrees = 180 + angle * 180 / math.pi
+
+            for i = 1, count do
+                batch_set_position(entities, i, new_x, new_y)
+                batch_set_rotation(entities, i, angle_in_degrees)
+            end
+        end
     }
 }
 
@@ -0,0 +1,144 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+#ifndef ENGINE_VERSION
+#define ENGINE_VERSION "unknown"
+#endif
+
+namespace
+{
+	std::string GetCompilerName() noexcept
+	{
+#if defined(__clang__)
+		return "clang " __clang_version__;
+#elif defined(__GNUC__)
+		return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+		return "msvc " + std::to_string(_MSC_VER);
+#else
+		return "unknown";
+#endif
+	}
+
+	std::string FormatDouble(double value) noexcept
+	{
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.3f", value);
+		return buffer;
+	}
+}
+
+BenchmarkRunner::BenchmarkRunner(uint32_t repetitions, const std::string& filter) noexcept :
+	m_repetitions(std::max<uint32_t>(repetitions, 1)),
+	m_filter(filter)
+{
+}
+
+/// <summary>
+/// Runs setup + body (repetitions + 1) times, the first run is a warm-up and is not recorded
+/// </summary>
+void BenchmarkRunner::Run(const std::string& name, const std::vector<std::pair<std::string, int64_t>>& parameters,
+						  const std::string& operation, uint64_t operations,
+						  const std::function<void()>& setup, const std::function<void()>& body) noexcept
+{
+	std::string fullName = name;
+	for (const auto& parameter : parameters)
+		fullName += "/" + parameter.first + ":" + std::to_string(parameter.second);
+
+	if (!m_filter.empty() && fullName.find(m_filter) == std::string::npos)
+		return;
+
+	operations = std::max<uint64_t>(operations, 1);
+
+	std::vector<double> samples;
+	samples.reserve(m_repetitions);
+	for (uint32_t repetition = 0; repetition <= m_repetitions; ++repetition)
+	{
+		setup();
+		const auto start = std::chrono::steady_clock::now();
+		body();
+		const auto end = std::chrono::steady_clock::now();
+
+		if (repetition > 0)
+			samples.push_back(std::chrono::duration<double, std::nano>(end - start).count() / operations);
+	}
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (double sample : samples) sum += sample;
+
+	BenchmarkResult result;
+	result.name = name;
+	result.parameters = parameters;
+	result.operation = operation;
+	result.operations = operations;
+	result.repetitions = m_repetitions;
+	result.minNs = samples.front();
+	result.medianNs = samples[samples.size() / 2];
+	result.meanNs = sum / samples.size();
+	result.maxNs = samples.back();
+
+	std::printf("%-56s %12s ns/%-8s (min %s, max %s)\n", fullName.c_str(), FormatDouble(result.medianNs).c_str(),
+				operation.c_str(), FormatDouble(result.minNs).c_str(), FormatDouble(result.maxNs).c_str());
+	std::fflush(stdout);
+
+	m_results.push_back(result);
+}
+
+/// <summary>
+/// Writes the run metadata and all the results to a JSON file
+/// </summary>
+/// <param name="filePath"></param>
+/// <returns></returns>
+bool BenchmarkRunner::WriteJson(const std::string& filePath) const noexcept
+{
+	std::ofstream file(filePath, std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cerr << "Error opening the benchmark results file: " << filePath << "\n";
+		return false;
+	}
+
+	char timestamp[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+	file << "{\n";
+	file << "  \"version\": \"" << ENGINE_VERSION << "\",\n";
+	file << "  \"compiler\": \"" << GetCompilerName() << "\",\n";
+#ifdef NDEBUG
+	file << "  \"build\": \"release\",\n";
+#else
+	file << "  \"build\": \"debug\",\n";
+#endif
+	file << "  \"timestamp\": \"" << timestamp << "\",\n";
+#ifdef ENGINE_USE_LUAJIT
+	file << "  \"lua\": \"luajit\",\n";
+#else
+	file << "  \"lua\": \"lua5.3\",\n";
+#endif
+	file << "  \"seed\": " << BENCHMARK_SEED << ",\n";
+	file << "  \"repetitions\": " << m_repetitions << ",\n";
+	file << "  \"benchmarks\": [";
+
+	for (size_t i = 0; i < m_results.size(); ++i)
+	{
+		const BenchmarkResult& result = m_results[i];
+		file << (i == 0 ? "\n" : ",\n");
+		file << "    {\"name\": \"" << result.name << "\", \"parameters\": {";
+		for (size_t p = 0; p < result.parameters.size(); ++p)
+			file << (p == 0 ? "" : ", ") << "\"" << result.parameters[p].first << "\": " << result.parameters[p].second;
+		file << "}, \"operation\": \"" << result.operation << "\", \"operations\": " << result.operations
+			 << ", \"ns_per_op\": {\"min\": " << FormatDouble(result.minNs) << ", \"median\": " << FormatDouble(result.medianNs)
+			 << ", \"mean\": " << FormatDouble(result.meanNs) << ", \"max\": " << FormatDouble(result.maxNs) << "}}";
+	}
+
+	file << "\n  ]\n}\n";
+	return file.good();
+}
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// fixed seed so every run (and every version) measures the same workloads
+constexpr uint32_t BENCHMARK_SEED = 1337;
+
+// Timing of one benchmark case, times are in nanoseconds per operation
+struct BenchmarkResult
+{
+	std::string name;
+	std::vector<std::pair<std::string, int64_t>> parameters;
+	std::string operation; // what one operation is (entity, pair, publish...)
+	uint64_t operations; // operations per repetition
+	uint32_t repetitions;
+	double minNs;
+	double medianNs;
+	double meanNs;
+	double maxNs;
+};
+
+/// <summary>
+/// Minimal benchmark runner. Every case runs an untimed setup and a timed body per repetition
+/// (plus one warm-up repetition), and reports the min/median/mean/max time per operation.
+/// The results are written as JSON so they can be compared across versions.
+/// </summary>
+class BenchmarkRunner
+{
+public:
+
+	BenchmarkRunner(uint32_t repetitions, const std::string& filter) noexcept;
+
+	// runs the case if its name contains the filter
+	void Run(const std::string& name, const std::vector<std::pair<std::string, int64_t>>& parameters,
+			 const std::string& operation, uint64_t operations,
+			 const std::function<void()>& setup, const std::function<void()>& body) noexcept;
+
+	bool WriteJson(const std::string& filePath) const noexcept;
+
+	inline const std::vector<BenchmarkResult>& GetResults() const noexcept { return m_results; }
+
+private:
+
+	uint32_t m_repetitions;
+	std::string m_filter;
+	std::vector<BenchmarkResult> m_results;
+};
+
+// keeps the compiler from optimizing away a value computed by a benchmark body
+template<typename T>
+inline void DoNotOptimize(const T& value) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void* sink;
+	sink = &value;
+#endif
+}
+
+// one function per benchmark file, called by BenchmarkMain.cpp
+void RegisterEcsBenchmarks(BenchmarkRunner& runner) noexcept;
+void RegisterScriptBenchmarks(BenchmarkRunner& runner) noexcept;
+void RegisterTilemapBenchmarks(BenchmarkRunner& runner) noexcept;
+
+#endif // BENCHMARK_H
@@ -0,0 +1,51 @@
+#include "Benchmark.h"
+
+#include "../src/Logger/Logger.h"
+#include "../src/Profiler/Profiler.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/// <summary>
+/// ecs_bench [--filter text] [--repetitions N] [--out file.json]
+/// </summary>
+int main(int argc, char* argv[])
+{
+	std::string filter;
+	std::string outFilePath = "ecs_bench.json";
+	uint32_t repetitions = 15;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (argument == "--filter" && hasValue)
+			filter = argv[++i];
+		else if (argument == "--repetitions" && hasValue)
+			repetitions = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+		else if (argument == "--out" && hasValue)
+			outFilePath = argv[++i];
+		else
+		{
+			std::cerr << "usage: ecs_bench [--filter text] [--repetitions N] [--out file.json]\n";
+			return 1;
+		}
+	}
+
+	// the engine logs every entity and component creation, that would dominate the timings
+	Logger::SetMuted(true);
+	Profiler::SetEnabled(false);
+
+	BenchmarkRunner runner(repetitions, filter);
+	RegisterEcsBenchmarks(runner);
+	RegisterScriptBenchmarks(runner);
+	RegisterTilemapBenchmarks(runner);
+
+	if (!runner.WriteJson(outFilePath))
+		return 1;
+
+	std::cout << runner.GetResults().size() << " benchmarks written to " << outFilePath << "\n";
+	return 0;
+}
@@ -0,0 +1,664 @@
+#include "Benchmark.h"
+
+#include "../src/Systems/Systems.h"
+#include "../src/Rollback/RollbackBuffer.h"
+#include "../src/Network/Replication.h"
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// registry + the objects the systems need, without window or renderer
+	struct BenchmarkWorld
+	{
+		std::unique_ptr<Registry> registry = std::make_unique<Registry>();
+		std::unique_ptr<EventBus> eventBus = std::make_unique<EventBus>();
+		std::unique_ptr<AssetStore> assetStore = std::make_unique<AssetStore>();
+		SDL_Rect camera = { 0, 0, 800, 600 };
+
+		void Update(float deltaTime = 1.0f / 60.0f) noexcept
+		{
+			registry->Update(deltaTime, eventBus, camera, registry, assetStore, nullptr, Clock::GetTicks());
+		}
+	};
+
+	class BenchmarkEvent : public Event
+	{
+	public:
+		int m_value;
+
+		BenchmarkEvent(int value) noexcept : m_value(value) {}
+	};
+
+	class EventCounter
+	{
+	public:
+		int64_t m_sum = 0;
+
+		void OnEvent(BenchmarkEvent& event) noexcept { m_sum += event.m_value; }
+
+		void OnEvents(EventSpan<BenchmarkEvent>& events) noexcept
+		{
+			for (const auto& event : events)
+				m_sum += event.m_value;
+		}
+	};
+
+	// entities that the MovementSystem and the RenderSystem both pick up
+	Entity CreateMovingSprite(Registry& registry, std::mt19937& rng, float worldSize) noexcept
+	{
+		std::uniform_real_distribution<float> position(0.0f, worldSize);
+		std::uniform_real_distribution<float> velocity(-50.0f, 50.0f);
+		std::uniform_int_distribution<int> zIndex(0, 9);
+
+		Entity entity = registry.CreateEntity();
+		entity.AddComponent<TransformComponent>(glm::vec2(position(rng), position(rng)));
+		entity.AddComponent<RigidbodyComponent>(glm::vec2(velocity(rng), velocity(rng)));
+		entity.AddComponent<SpriteComponent>("bench-image", 32, 32, zIndex(rng));
+		return entity;
+	}
+
+	void RegisterEntityChurn(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 5000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<MovementSystem>();
+			world->registry->AddSystem<RenderSystem>();
+			auto entities = std::make_shared<std::vector<Entity>>();
+			auto rng = std::make_shared<std::mt19937>(BENCHMARK_SEED);
+
+			// create the entities, let the systems pick them up, destroy them and remove them from the systems
+			runner.Run("entity_churn", { { "entities", entityCount } }, "entity", entityCount, [] {},
+				[=]
+				{
+					entities->clear();
+					for (int i = 0; i < entityCount; ++i)
+						entities->push_back(CreateMovingSprite(*world->registry, *rng, 1000.0f));
+					world->Update(0.0f);
+
+					for (auto& entity : *entities)
+						entity.Destroy();
+					world->Update(0.0f);
+				});
+		}
+	}
+
+	void RegisterComponentAccess(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 10000 })
+		{
+			auto world = std::make_shared<std::unique_ptr<BenchmarkWorld>>();
+			auto entities = std::make_shared<std::vector<Entity>>();
+
+			runner.Run("add_component", { { "entities", entityCount } }, "component", entityCount,
+				[=]
+				{
+					*world = std::make_unique<BenchmarkWorld>();
+					entities->clear();
+					for (int i = 0; i < entityCount; ++i)
+						entities->push_back((*world)->registry->CreateEntity());
+				},
+				[=]
+				{
+					for (auto& entity : *entities)
+						entity.AddComponent<TransformComponent>(glm::vec2(static_cast<float>(entity.GetID()), 0.0f));
+				});
+
+			auto filledWorld = std::make_shared<BenchmarkWorld>();
+			auto filledEntities = std::make_shared<std::vector<Entity>>();
+			for (int i = 0; i < entityCount; ++i)
+			{
+				Entity entity = filledWorld->registry->CreateEntity();
+				entity.AddComponent<TransformComponent>(glm::vec2(static_cast<float>(i), 0.0f));
+				filledEntities->push_back(entity);
+			}
+
+			runner.Run("get_component", { { "entities", entityCount } }, "component", entityCount, [] {},
+				[=]
+				{
+					float sum = 0.0f;
+					for (const auto& entity : *filledEntities)
+						sum += entity.GetComponent<TransformComponent>().m_position.x;
+					DoNotOptimize(sum);
+				});
+		}
+	}
+
+	void RegisterPoolRemove(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 10000 })
+		{
+			auto pool = std::make_shared<std::unique_ptr<Pool<TransformComponent>>>();
+			auto removeOrder = std::make_shared<std::vector<int>>();
+
+			// removes every element in random order, each removal swaps the last element into the hole
+			runner.Run("pool_remove", { { "entities", entityCount } }, "remove", entityCount,
+				[=]
+				{
+					*pool = std::make_unique<Pool<TransformComponent>>();
+					removeOrder->clear();
+					for (int entityId = 0; entityId < entityCount; ++entityId)
+					{
+						(*pool)->Set(entityId, TransformComponent(glm::vec2(static_cast<float>(entityId), 0.0f)));
+						removeOrder->push_back(entityId);
+					}
+					std::shuffle(removeOrder->begin(), removeOrder->end(), std::mt19937(BENCHMARK_SEED));
+				},
+				[=]
+				{
+					for (int entityId : *removeOrder)
+						(*pool)->Remove(entityId);
+				});
+		}
+	}
+
+	void RegisterSystemIteration(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 10000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<MovementSystem>();
+			std::mt19937 rng(BENCHMARK_SEED);
+
+			// keep every entity inside the map so that nothing gets destroyed between repetitions
+			Game::mapWidth = 1 << 20;
+			Game::mapHeight = 1 << 20;
+			for (int i = 0; i < entityCount; ++i)
+				CreateMovingSprite(*world->registry, rng, static_cast<float>(Game::mapWidth));
+			world->Update(0.0f);
+
+			runner.Run("movement_system_update", { { "entities", entityCount } }, "entity", entityCount, [] {},
+				[=]
+				{
+					world->registry->GetSystem<MovementSystem>().Update(1.0f / 60.0f, world->eventBus, world->camera,
+						world->registry, world->assetStore, nullptr, Clock::GetTicks());
+				});
+		}
+	}
+
+	void RegisterAnimation(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 10000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<AnimationSystem>();
+			std::mt19937 rng(BENCHMARK_SEED);
+
+			// the entities share a few clips of 8 frames at 4 to 16 fps
+			std::vector<int> clips;
+			for (int frameRate = 4; frameRate <= 16; ++frameRate)
+				clips.push_back(world->assetStore->AddAnimationClipRow("bench-clip-" + std::to_string(frameRate), 0, 8, 32, 32, frameRate, true));
+			std::uniform_int_distribution<size_t> clip(0, clips.size() - 1);
+
+			for (int i = 0; i < entityCount; ++i)
+			{
+				Entity entity = CreateMovingSprite(*world->registry, rng, 1000.0f);
+				entity.AddComponent<AnimationComponent>(clips[clip(rng)]);
+			}
+			world->Update(0.0f);
+
+			// 60 updates per second, most of them do not change the animation frame
+			runner.Run("animation_system_update", { { "entities", entityCount } }, "entity", entityCount, [] {},
+				[=]
+				{
+					world->registry->GetSystem<AnimationSystem>().Update(1.0f / 60.0f, world->eventBus, world->camera,
+						world->registry, world->assetStore, nullptr, Clock::GetTicks());
+				});
+		}
+	}
+
+	void RegisterCollision(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int colliderSize = 32;
+
+		for (int entityCount : { 250, 1000, 2000 })
+		{
+			// percentage of the world area covered by colliders
+			for (int coverage : { 5, 50 })
+			{
+				auto world = std::make_shared<BenchmarkWorld>();
+				world->registry->AddSystem<CollisionSystem>();
+
+				const float worldSize = std::sqrt(entityCount * colliderSize * colliderSize * 100.0f / coverage);
+				std::mt19937 rng(BENCHMARK_SEED);
+				std::uniform_real_distribution<float> position(0.0f, worldSize);
+				for (int i = 0; i < entityCount; ++i)
+				{
+					Entity entity = world->registry->CreateEntity();
+					entity.AddComponent<TransformComponent>(glm::vec2(position(rng), position(rng)));
+					entity.AddComponent<BoxColliderComponent>(colliderSize, colliderSize);
+				}
+				world->Update(0.0f);
+
+				runner.Run("collision_system_update", { { "entities", entityCount }, { "coverage_pct", coverage } }, "update", 1, [] {},
+					[=]
+					{
+						world->registry->GetSystem<CollisionSystem>().Update(1.0f / 60.0f, world->eventBus, world->camera,
+							world->registry, world->assetStore, nullptr, Clock::GetTicks());
+						world->eventBus->DispatchQueuedEvents();
+					});
+			}
+		}
+	}
+
+	void RegisterLayeredCollision(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int colliderSize = 32;
+		constexpr int coverage = 50;
+
+		// game-like mix: 90% enemies and 10% projectiles, the layer masks reject enemy/enemy and projectile/projectile pairs
+		for (int entityCount : { 1000, 2000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<CollisionSystem>();
+
+			const float worldSize = std::sqrt(entityCount * colliderSize * colliderSize * 100.0f / coverage);
+			std::mt19937 rng(BENCHMARK_SEED);
+			std::uniform_real_distribution<float> position(0.0f, worldSize);
+			for (int i = 0; i < entityCount; ++i)
+			{
+				const uint32_t layer = i % 10 == 0 ? COLLISION_LAYER_PROJECTILE : COLLISION_LAYER_ENEMY;
+				Entity entity = world->registry->CreateEntity();
+				entity.AddComponent<TransformComponent>(glm::vec2(position(rng), position(rng)));
+				entity.AddComponent<BoxColliderComponent>(colliderSize, colliderSize, glm::vec2(0), false, layer);
+			}
+			world->Update(0.0f);
+
+			runner.Run("collision_system_update_layers", { { "entities", entityCount }, { "coverage_pct", coverage } }, "update", 1, [] {},
+				[=]
+				{
+					world->registry->GetSystem<CollisionSystem>().Update(1.0f / 60.0f, world->eventBus, world->camera,
+						world->registry, world->assetStore, nullptr, Clock::GetTicks());
+					world->eventBus->DispatchQueuedEvents();
+				});
+		}
+	}
+
+	void RegisterContinuousCollision(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int colliderSize = 32;
+		constexpr int coverage = 50;
+		constexpr float projectileStep = 96.0f; // 3 collider sizes per update, a discrete test would miss most hits
+
+		// same mix as collision_system_update_layers, the projectiles are continuous and move every update
+		for (int entityCount : { 1000, 2000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<CollisionSystem>();
+			auto projectiles = std::make_shared<std::vector<Entity>>();
+
+			const float worldSize = std::sqrt(entityCount * colliderSize * colliderSize * 100.0f / coverage);
+			std::mt19937 rng(BENCHMARK_SEED);
+			std::uniform_real_distribution<float> position(0.0f, worldSize);
+			for (int i = 0; i < entityCount; ++i)
+			{
+				const bool isProjectile = i % 10 == 0;
+				Entity entity = world->registry->CreateEntity();
+				entity.AddComponent<TransformComponent>(glm::vec2(position(rng), position(rng)));
+				entity.AddComponent<BoxColliderComponent>(isProjectile ? 4 : colliderSize, isProjectile ? 4 : colliderSize, glm::vec2(0), false,
+					isProjectile ? COLLISION_LAYER_PROJECTILE : COLLISION_LAYER_ENEMY, COLLISION_LAYER_NONE, isProjectile);
+				if (isProjectile)
+					projectiles->push_back(entity);
+			}
+			world->Update(0.0f);
+
+			runner.Run("collision_system_update_continuous", { { "entities", entityCount }, { "coverage_pct", coverage } }, "update", 1,
+				[=]
+				{
+					for (auto& projectile : *projectiles)
+					{
+						auto& transform = projectile.GetComponent<TransformComponent>();
+						transform.m_position.x = std::fmod(transform.m_position.x + projectileStep, worldSize);
+					}
+				},
+				[=]
+				{
+					world->registry->GetSystem<CollisionSystem>().Update(1.0f / 60.0f, world->eventBus, world->camera,
+						world->registry, world->assetStore, nullptr, Clock::GetTicks());
+					world->eventBus->DispatchQueuedEvents();
+				});
+		}
+	}
+
+	void RegisterRenderSort(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 1000, 10000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<RenderSystem>();
+			std::mt19937 rng(BENCHMARK_SEED);
+			for (int i = 0; i < entityCount; ++i)
+				CreateMovingSprite(*world->registry, rng, 1000.0f);
+			world->Update(0.0f);
+
+			auto entities = std::make_shared<std::vector<Entity>>();
+
+			// the RenderSystem sorts a copy of its entities every frame
+			runner.Run("render_system_sort", { { "entities", entityCount } }, "entity", entityCount,
+				[=]
+				{
+					*entities = world->registry->GetSystem<RenderSystem>().GetSystemEntities();
+				},
+				[=]
+				{
+					world->registry->GetSystem<RenderSystem>().SortByZIndex(*entities);
+				});
+		}
+	}
+
+	void RegisterRegistrySnapshot(BenchmarkRunner& runner) noexcept
+	{
+		for (int entityCount : { 10000, 100000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<MovementSystem>();
+			world->registry->AddSystem<RenderSystem>();
+			Game::mapWidth = 1 << 20;
+			Game::mapHeight = 1 << 20;
+			std::mt19937 rng(BENCHMARK_SEED);
+			for (int i = 0; i < entityCount; ++i)
+			{
+				Entity entity = CreateMovingSprite(*world->registry, rng, 1000.0f);
+				entity.AddComponent<BoxColliderComponent>(32, 32);
+				entity.AddComponent<HealthComponent>();
+				entity.Group("enemies");
+			}
+			world->Update(0.0f);
+
+			auto blob = std::make_shared<std::vector<uint8_t>>();
+			world->registry->Serialize(*blob);
+			runner.Run("registry_serialize", { { "entities", entityCount } }, "entity", entityCount, [] {},
+				[=]
+				{
+					world->registry->Serialize(*blob);
+					DoNotOptimize(blob->data());
+				});
+
+			// restores the snapshot and puts the entities back in the systems
+			runner.Run("registry_deserialize", { { "entities", entityCount } }, "entity", entityCount, [] {},
+				[=]
+				{
+					const bool isRestored = world->registry->Deserialize(*blob);
+					DoNotOptimize(isRestored);
+				});
+		}
+	}
+
+	// only the transforms, the swept boxes and the collision contacts change between ticks, the other pools are shared
+	// by the frames. The boxes are spread out: a few contacts per hundred entities, like in a level
+	void RegisterRollback(BenchmarkRunner& runner) noexcept
+	{
+		constexpr uint32_t rollbackTicks = 8;
+
+		for (int entityCount : { 10000, 100000 })
+		{
+			auto world = std::make_shared<BenchmarkWorld>();
+			world->registry->AddSystem<MovementSystem>();
+			world->registry->AddSystem<RenderSystem>();
+			world->registry->AddSystem<CollisionSystem>();
+			Game::mapWidth = 1 << 20;
+			Game::mapHeight = 1 << 20;
+			std::mt19937 rng(BENCHMARK_SEED);
+			for (int i = 0; i < entityCount; ++i)
+			{
+				Entity entity = CreateMovingSprite(*world->registry, rng, 100000.0f);
+				entity.AddComponent<BoxColliderComponent>(32, 32);
+				entity.AddComponent<HealthComponent>();
+				entity.Group("enemies");
+			}
+			world->Update(0.0f);
+
+			auto buffer = std::make_shared<RollbackBuffer>(rollbackTicks + 1);
+			auto tick = std::make_shared<uint32_t>(0);
+			buffer->Capture((*tick)++, *world->registry, world->camera);
+
+			runner.Run("rollback_capture", { { "entities", entityCount } }, "entity", entityCount,
+				[=] { world->Update(); },
+				[=] { buffer->Capture((*tick)++, *world->registry, world->camera); });
+
+			// rewinds rollbackTicks ticks, the setup simulates and captures them again
+			runner.Run("rollback_restore", { { "entities", entityCount }, { "ticks", rollbackTicks } }, "entity", entityCount,
+				[=]
+				{
+					for (uint32_t i = 0; i < rollbackTicks; ++i)
+					{
+						world->Update();
+						buffer->Capture((*tick)++, *world->registry, world->camera);
+					}
+				},
+				[=]
+				{
+					*tick -= rollbackTicks;
+					const bool isRestored = buffer->Restore(*tick - 1, *world->registry, world->camera);
+					DoNotOptimize(isRestored);
+				});
+		}
+	}
+
+	// a server replicating a moving world to clients over the loopback network, each client viewing its own part of the
+	// world. The world grows with the entity count, a view holds about 90 entities for both sizes
+	void RegisterReplication(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int clientCount = 8;
+		constexpr float worldSize = 10000.0f;
+
+		// client with its own registry, the views are spread over the world
+		struct BenchmarkClient
+		{
+			std::unique_ptr<LoopbackTransport> transport;
+			std::unique_ptr<Registry> registry = std::make_unique<Registry>();
+			std::unique_ptr<EventBus> eventBus = std::make_unique<EventBus>();
+			std::unique_ptr<ReplicationClient> client;
+			SDL_Rect view;
+		};
+
+		struct ReplicationWorld
+		{
+			BenchmarkWorld world;
+			LoopbackNetwork network;
+			std::unique_ptr<LoopbackTransport> serverTransport = network.CreateEndpoint();
+			std::unique_ptr<ReplicationServer> server;
+			std::vector<BenchmarkClient> clients;
+			uint32_t tick = 0;
+
+			void UpdateClients() noexcept
+			{
+				for (auto& client : clients)
+				{
+					client.client->Update(client.view);
+					client.registry->Update(0.0f, client.eventBus, client.view, client.registry, world.assetStore, nullptr, 0);
+				}
+			}
+		};
+
+		for (int entityCount : { 10000, 100000 })
+		{
+			auto replication = std::make_shared<ReplicationWorld>();
+			Registry& registry = *replication->world.registry;
+			registry.AddSystem<MovementSystem>();
+			registry.AddSystem<ReplicationSystem>();
+			Game::mapWidth = 1 << 20;
+			Game::mapHeight = 1 << 20;
+			std::mt19937 rng(BENCHMARK_SEED);
+			for (int i = 0; i < entityCount; ++i)
+			{
+				Entity entity = CreateMovingSprite(registry, rng, worldSize * std::sqrt(entityCount / 10000.0f));
+				entity.AddComponent<HealthComponent>();
+			}
+			replication->world.Update(0.0f);
+
+			replication->server = std::make_unique<ReplicationServer>(*replication->serverTransport, registry);
+			const int viewStep = static_cast<int>(worldSize * std::sqrt(entityCount / 10000.0f)) / clientCount;
+			for (int i = 0; i < clientCount; ++i)
+			{
+				BenchmarkClient client;
+				client.transport = replication->network.CreateEndpoint();
+				client.client = std::make_unique<ReplicationClient>(*client.transport, 0, *client.registry);
+				client.view = { i * viewStep, i * viewStep, 800, 600 };
+				replication->clients.push_back(std::move(client));
+			}
+
+			// connects the clients (acknowledgment, challenge, acknowledgment with the token) and sends the full
+			// snapshots, the next ones are deltas
+			for (int i = 0; i < 4; ++i)
+			{
+				replication->world.Update();
+				replication->server->Update(replication->tick++);
+				replication->UpdateClients();
+			}
+			const int64_t bytesPerClient = static_cast<int64_t>(replication->server->GetTickStats().bytesSent / clientCount);
+
+			runner.Run("replication_server", { { "entities", entityCount }, { "clients", clientCount }, { "bytes_per_client", bytesPerClient } },
+				"client", clientCount,
+				[=] { replication->world.Update(); },
+				[=] { replication->server->Update(replication->tick++); });
+
+			runner.Run("replication_client", { { "entities", entityCount }, { "clients", clientCount }, { "bytes_per_client", bytesPerClient } },
+				"client", clientCount,
+				[=]
+				{
+					replication->world.Update();
+					replication->server->Update(replication->tick++);
+				},
+				[=] { replication->UpdateClients(); });
+		}
+	}
+
+	void RegisterEventFanOut(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int eventCount = 10000;
+
+		for (int subscriberCount : { 1, 8, 64 })
+		{
+			auto eventBus = std::make_shared<EventBus>();
+			auto counters = std::make_shared<std::vector<std::unique_ptr<EventCounter>>>();
+			for (int i = 0; i < subscriberCount; ++i)
+			{
+				counters->push_back(std::make_unique<EventCounter>());
+				eventBus->SubscribeEvent<&EventCounter::OnEvent>(counters->back().get());
+			}
+
+			runner.Run("eventbus_publish", { { "subscribers", subscriberCount } }, "publish", eventCount, [] {},
+				[=]
+				{
+					for (int i = 0; i < eventCount; ++i)
+						eventBus->PublishEvent<BenchmarkEvent>(i);
+				});
+
+			DoNotOptimize(counters->front()->m_sum);
+		}
+
+		// same flow through the queue: events appended to a contiguous queue, then handed out in one batch per subscriber
+		for (int subscriberCount : { 1, 8, 64 })
+		{
+			auto eventBus = std::make_shared<EventBus>();
+			auto counters = std::make_shared<std::vector<std::unique_ptr<EventCounter>>>();
+			for (int i = 0; i < subscriberCount; ++i)
+			{
+				counters->push_back(std::make_unique<EventCounter>());
+				eventBus->SubscribeEventBatch<&EventCounter::OnEvents>(counters->back().get());
+			}
+
+			runner.Run("eventbus_queue_dispatch", { { "subscribers", subscriberCount } }, "event", eventCount, [] {},
+				[=]
+				{
+					for (int i = 0; i < eventCount; ++i)
+						eventBus->QueueEvent<BenchmarkEvent>(i);
+					eventBus->DispatchQueuedEvents();
+				});
+
+			DoNotOptimize(counters->front()->m_sum);
+		}
+	}
+
+	void RegisterConcurrentEvents(BenchmarkRunner& runner) noexcept
+	{
+		constexpr int eventsPerProducer = 100000;
+
+		// each producer thread fills its own buffer, then the main thread drains all of them in one dispatch
+		for (int producerCount : { 1, 2, 4, 8 })
+		{
+			auto eventBus = std::make_shared<EventBus>();
+			auto counter = std::make_shared<EventCounter>();
+			eventBus->SubscribeEventBatch<&EventCounter::OnEvents>(counter.get());
+			eventBus->SetProducerCount(producerCount);
+			eventBus->RegisterConcurrentEvent<BenchmarkEvent>();
+
+			runner.Run("eventbus_concurrent_queue", { { "producers", producerCount } }, "event", static_cast<uint64_t>(eventsPerProducer) * producerCount, [] {},
+				[=]
+				{
+					std::vector<std::thread> producers;
+					for (int producer = 0; producer < producerCount; ++producer)
+					{
+						producers.emplace_back([=]
+							{
+								for (int i = 0; i < eventsPerProducer; ++i)
+									eventBus->QueueEventConcurrent<BenchmarkEvent>(producer, i);
+							});
+					}
+					for (auto& producer : producers)
+						producer.join();
+					eventBus->DispatchQueuedEvents();
+				});
+
+			DoNotOptimize(counter->m_sum);
+		}
+
+		// reference point: the same 8 producers sharing the main queue behind a mutex
+		{
+			constexpr int producerCount = 8;
+			auto eventBus = std::make_shared<EventBus>();
+			auto counter = std::make_shared<EventCounter>();
+			auto queueMutex = std::make_shared<std::mutex>();
+			eventBus->SubscribeEventBatch<&EventCounter::OnEvents>(counter.get());
+
+			runner.Run("eventbus_mutex_queue", { { "producers", producerCount } }, "event", static_cast<uint64_t>(eventsPerProducer) * producerCount, [] {},
+				[=]
+				{
+					std::vector<std::thread> producers;
+					for (int producer = 0; producer < producerCount; ++producer)
+					{
+						producers.emplace_back([=]
+							{
+								for (int i = 0; i < eventsPerProducer; ++i)
+								{
+									std::lock_guard<std::mutex> lock(*queueMutex);
+									eventBus->QueueEvent<BenchmarkEvent>(i);
+								}
+							});
+					}
+					for (auto& producer : producers)
+						producer.join();
+					eventBus->DispatchQueuedEvents();
+				});
+
+			DoNotOptimize(counter->m_sum);
+		}
+	}
+}
+
+void RegisterEcsBenchmarks(BenchmarkRunner& runner) noexcept
+{
+	Clock::SetTicks(0);
+
+	RegisterEntityChurn(runner);
+	RegisterComponentAccess(runner);
+	RegisterPoolRemove(runner);
+	RegisterSystemIteration(runner);
+	RegisterAnimation(runner);
+	RegisterCollision(runner);
+	RegisterLayeredCollision(runner);
+	RegisterContinuousCollision(runner);
+	RegisterRenderSort(runner);
+	RegisterRegistrySnapshot(runner);
+	RegisterRollback(runner);
+	RegisterReplication(runner);
+	RegisterEventFanOut(runner);
+	RegisterConcurrentEvents(runner);
+}
@@ -0,0 +1,149 @@
+#include "Benchmark.h"
+
+#include "../src/Systems/Systems.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr int scriptedEntityCount = 10000;
+
+	// the circular path of Level2.lua, written once per binding flavour
+	const char* const batchScripts = R"(
+		bench_scripts = {}
+
+		-- per-entity call, what on_update_script costs before touching any component. The ScriptSystem calls it without
+		-- arguments, the angle advances with a call counter
+		local per_entity_calls = 0
+		function bench_scripts.per_entity()
+			per_entity_calls = per_entity_calls + 1
+			local angle = per_entity_calls * 0.0009
+			return math.cos(angle) * 170 + 500, math.sin(angle) * 170 + 500
+		end
+
+		-- batch through the raw C bindings (Lua 5.3 and LuaJIT)
+		function bench_scripts.batch_capi(entities, count, delta_time, elapsed_time)
+			for i = 1, count do
+				local angle = elapsed_time * 0.0009 + i
+				batch_set_position(entities, i, math.cos(angle) * 170 + 500, math.sin(angle) * 170 + 500)
+				batch_set_rotation(entities, i, 180 + angle * 180 / math.pi)
+			end
+		end
+
+		-- batch through FFI cdata (LuaJIT only), no call leaves the JIT-compiled loop
+		function bench_scripts.batch_ffi(entities, count, delta_time, elapsed_time)
+			local views = batch_views(entities)
+			for i = 0, count - 1 do
+				local angle = elapsed_time * 0.0009 + i + 1
+				local transform = views[i].transform
+				transform.position.x = math.cos(angle) * 170 + 500
+				transform.position.y = math.sin(angle) * 170 + 500
+				transform.rotation = 180 + angle * 180 / math.pi
+			end
+		end
+
+		-- the script shards look the batches up in the level table
+		Level = { batch_scripts = bench_scripts }
+	)";
+
+	// the script shards load their level script from a file
+	const char* const shardScriptPath = "script_benchmark.lua";
+
+	struct ScriptWorld
+	{
+		std::unique_ptr<Registry> registry = std::make_unique<Registry>();
+		std::unique_ptr<EventBus> eventBus = std::make_unique<EventBus>();
+		std::unique_ptr<AssetStore> assetStore = std::make_unique<AssetStore>();
+		SDL_Rect camera = { 0, 0, 800, 600 };
+		sol::state lua;
+		int elapsedTime = 0;
+
+		ScriptWorld() noexcept
+		{
+			lua.open_libraries(sol::lib::base, sol::lib::math);
+			ScriptSystem::CreateLuaBindings(lua);
+			lua.script(batchScripts);
+			registry->AddSystem<ScriptSystem>();
+		}
+
+		void Update() noexcept
+		{
+			elapsedTime += 16;
+			registry->GetSystem<ScriptSystem>().Update(1.0f / 60.0f, eventBus, camera, registry, assetStore, nullptr, elapsedTime);
+		}
+	};
+
+	// every entity runs the same script, either its own per-entity call or one shared batch
+	std::shared_ptr<ScriptWorld> CreateScriptWorld(const std::string& script, bool isBatch, unsigned int shardCount = 0) noexcept
+	{
+		auto world = std::make_shared<ScriptWorld>();
+		sol::protected_function func = world->lua["bench_scripts"][script];
+		const int batch = isBatch ? world->registry->GetSystem<ScriptSystem>().AddScriptBatch(script, func) : -1;
+
+		std::mt19937 rng(BENCHMARK_SEED);
+		std::uniform_real_distribution<float> position(0.0f, 1000.0f);
+		for (int i = 0; i < scriptedEntityCount; ++i)
+		{
+			Entity entity = world->registry->CreateEntity();
+			entity.AddComponent<TransformComponent>(glm::vec2(position(rng), position(rng)));
+			entity.AddComponent<RigidbodyComponent>();
+			entity.AddComponent<ScriptComponent>(isBatch ? sol::protected_function(sol::lua_nil) : func, batch);
+		}
+		world->registry->Update(0.0f, world->eventBus, world->camera, world->registry, world->assetStore, nullptr, 0);
+
+		if (shardCount > 0)
+		{
+			std::ofstream(shardScriptPath, std::ios::trunc) << batchScripts;
+			world->registry->GetSystem<ScriptSystem>().CreateShards(shardCount, shardScriptPath, BENCHMARK_SEED);
+			std::remove(shardScriptPath);
+		}
+
+		// a failing script would time the error logging instead of the script, one frame must run clean first
+		const size_t messageCount = Logger::messagesStack.size();
+		world->Update();
+		for (size_t i = messageCount; i < Logger::messagesStack.size(); ++i)
+		{
+			if (Logger::messagesStack[i].type == LOG_ERROR)
+				return nullptr;
+		}
+		return world;
+	}
+
+	void RegisterScriptUpdate(BenchmarkRunner& runner, const std::string& name, const std::string& script, bool isBatch,
+							  unsigned int shardCount = 0) noexcept
+	{
+		auto world = CreateScriptWorld(script, isBatch, shardCount);
+		if (!world)
+		{
+			std::cerr << name << ": the script " << script << " fails, case skipped\n";
+			return;
+		}
+		std::vector<std::pair<std::string, int64_t>> parameters = { { "entities", scriptedEntityCount } };
+		if (shardCount > 0)
+			parameters.push_back({ "shards", shardCount });
+		runner.Run(name, parameters, "entity", scriptedEntityCount, [] {},
+			[=]
+			{
+				world->Update();
+			});
+	}
+}
+
+void RegisterScriptBenchmarks(BenchmarkRunner& runner) noexcept
+{
+	Clock::SetTicks(0);
+
+	RegisterScriptUpdate(runner, "script_per_entity", "per_entity", false);
+	RegisterScriptUpdate(runner, "script_batch_capi", "batch_capi", true);
+	RegisterScriptUpdate(runner, "script_batch_sharded", "batch_capi", true, 2);
+	RegisterScriptUpdate(runner, "script_batch_sharded", "batch_capi", true, 4);
+#ifdef ENGINE_USE_LUAJIT
+	RegisterScriptUpdate(runner, "script_batch_ffi", "batch_ffi", true);
+#endif
+}
@@ -0,0 +1,87 @@
+#include "Benchmark.h"
+
+#include "../src/GameEngine/TilemapParser.h"
+
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	constexpr int tilemapSize = 4096;
+
+	// synthetic .map text: tilemapSize x tilemapSize tiles with indices below maxIndex (written with as many digits as they need,
+	// or always two digits like the original maps)
+	std::shared_ptr<const std::string> CreateTilemapText(uint16_t maxIndex, bool isTwoDigits) noexcept
+	{
+		std::mt19937 rng(BENCHMARK_SEED);
+		std::uniform_int_distribution<int> index(0, maxIndex - 1);
+
+		auto text = std::make_shared<std::string>();
+		text->reserve(static_cast<size_t>(tilemapSize) * tilemapSize * 5);
+		char digits[8];
+		for (int row = 0; row < tilemapSize; ++row)
+		{
+			for (int col = 0; col < tilemapSize; ++col)
+			{
+				const int length = std::snprintf(digits, sizeof(digits), isTwoDigits ? "%02d" : "%d", index(rng));
+				text->append(digits, length);
+				text->push_back(col + 1 < tilemapSize ? ',' : '\n');
+			}
+		}
+		return text;
+	}
+
+	// the reader LevelLoader used before TilemapParser: two get() per tile, atoi on the digits, one ignore() per separator
+	void ParseLegacy(std::istream& mapFile, std::vector<uint16_t>& tiles) noexcept
+	{
+		for (int row = 0; row < tilemapSize; ++row)
+		{
+			for (int col = 0; col < tilemapSize; ++col)
+			{
+				char ch[2] = { 0, 0 };
+				mapFile.get(ch[0]);
+				int srcRectY = std::atoi(&ch[0]);
+				mapFile.get(ch[1]);
+				int srcRectX = std::atoi(&ch[1]);
+				mapFile.ignore();
+				tiles[static_cast<size_t>(row) * tilemapSize + col] = static_cast<uint16_t>(srcRectY * 10 + srcRectX);
+			}
+		}
+	}
+
+	void RegisterParse(BenchmarkRunner& runner, const std::string& name, uint16_t maxIndex, bool isTwoDigits) noexcept
+	{
+		auto text = CreateTilemapText(maxIndex, isTwoDigits);
+		auto tiles = std::make_shared<std::vector<uint16_t>>();
+		runner.Run(name, { { "size", tilemapSize }, { "max_index", maxIndex } }, "tile", static_cast<uint64_t>(tilemapSize) * tilemapSize,
+			[=] { tiles->clear(); },
+			[=]
+			{
+				std::string error;
+				const bool isValid = TilemapParser::Parse(text->data(), text->size(), tilemapSize, tilemapSize, *tiles, error);
+				DoNotOptimize(isValid);
+				DoNotOptimize(tiles->data());
+			});
+	}
+}
+
+void RegisterTilemapBenchmarks(BenchmarkRunner& runner) noexcept
+{
+	RegisterParse(runner, "tilemap_parse", 100, true);
+	RegisterParse(runner, "tilemap_parse", 1024, false);
+
+	auto text = CreateTilemapText(100, true);
+	auto tiles = std::make_shared<std::vector<uint16_t>>(static_cast<size_t>(tilemapSize) * tilemapSize);
+	auto mapFile = std::make_shared<std::istringstream>();
+	runner.Run("tilemap_parse_legacy", { { "size", tilemapSize }, { "max_index", 100 } }, "tile", static_cast<uint64_t>(tilemapSize) * tilemapSize,
+		[=] { mapFile->clear(); mapFile->str(*text); },
+		[=]
+		{
+			ParseLegacy(*mapFile, *tiles);
+			DoNotOptimize(tiles->data());
+		});
+}
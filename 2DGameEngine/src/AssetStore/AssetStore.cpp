@@ -21,15 +21,24 @@ void AssetStore::ClearAssets() noexcept
 {
 	for (auto& texture : textures)
 	{
-		SDL_DestroyTexture(texture.second);
+		if (texture.second)
+			SDL_DestroyTexture(texture.second);
 	}
 	textures.clear();
 
 	for (auto& font : fonts)
 	{
-		TTF_CloseFont(font.second);
+		if (font.second)
+			TTF_CloseFont(font.second);
 	}
 	fonts.clear();
+
+	animationClips.clear();
+	animationFrames.clear();
+	animationFrameDurations.clear();
+	animationClipIndices.clear();
+	animationTransitions.clear();
+	animationStateMachineIndices.clear();
 }
 
 /// <summary>
@@ -40,7 +49,25 @@ void AssetStore::ClearAssets() noexcept
 /// <param name="filePath"></param>
 void AssetStore::AddTexture(SDL_Renderer* renderer, const std::string& assetId, const std::string& filePath) noexcept
 {
-	SDL_Surface* surface = IMG_Load(filePath.c_str());
+	if (isHeadless)
+	{
+		// keep the asset id resolvable without decoding the image
+		textures.emplace(assetId, nullptr);
+		return;
+	}
+
+	AddTexture(renderer, assetId, filePath, IMG_Load(filePath.c_str()));
+}
+
+/// <summary>
+/// Add a texture from an image already decoded (IMG_Load can run on a worker thread, the texture is created on the render thread)
+/// </summary>
+/// <param name="renderer"></param>
+/// <param name="assetId"></param>
+/// <param name="filePath">only used in the error messages</param>
+/// <param name="surface">freed by the AssetStore, nullptr if the image could not be decoded</param>
+void AssetStore::AddTexture(SDL_Renderer* renderer, const std::string& assetId, const std::string& filePath, SDL_Surface* surface) noexcept
+{
 	if (!surface)
 	{
 		Logger::Error("Error loading image: " + filePath);
@@ -48,16 +75,25 @@ void AssetStore::AddTexture(SDL_Renderer* renderer, const std::string& assetId,
 	}
 
 	SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+	SDL_FreeSurface(surface);
 	if (!texture)
 	{
 		Logger::Error("Error creating texture from surface: " + filePath);
 		return;
 	}
 
-	SDL_FreeSurface(surface);
-
-	// Add the texture to the AssetStore using the assetId as the key
-	textures.emplace(assetId, texture);
+	// Add the texture to the AssetStore using the assetId as the key, a reloaded asset replaces the previous texture
+	auto existing = textures.find(assetId);
+	if (existing != textures.end())
+	{
+		if (existing->second)
+			SDL_DestroyTexture(existing->second);
+		existing->second = texture;
+	}
+	else
+	{
+		textures.emplace(assetId, texture);
+	}
 
 	Logger::Log("New texture added to Asset Store with id = " + assetId);
 }
@@ -80,6 +116,13 @@ SDL_Texture* AssetStore::GetTexture(const std::string& assetId) const noexcept
 /// <param name="fontSize"></param>
 void AssetStore::AddFont(const std::string& assetId, const std::string& filePath, unsigned int fontSize) noexcept
 {
+	if (isHeadless)
+	{
+		// SDL_ttf is not initialized in headless mode
+		fonts.emplace(assetId, nullptr);
+		return;
+	}
+
 	TTF_Font* font = TTF_OpenFont(filePath.c_str(), fontSize);
 	if (!font)
 	{
@@ -87,8 +130,18 @@ void AssetStore::AddFont(const std::string& assetId, const std::string& filePath
 		return;
 	}
 
-	// Add the font to the AssetStore using the assetId as the key
-	fonts.emplace(assetId, font);
+	// Add the font to the AssetStore using the assetId as the key, a reloaded asset replaces the previous font
+	auto existing = fonts.find(assetId);
+	if (existing != fonts.end())
+	{
+		if (existing->second)
+			TTF_CloseFont(existing->second);
+		existing->second = font;
+	}
+	else
+	{
+		fonts.emplace(assetId, font);
+	}
 
 	Logger::Log("New font added to Asset Store with id = " + assetId);
 }
@@ -102,3 +155,98 @@ TTF_Font* AssetStore::GetFont(const std::string& assetId) const noexcept
 {
 	return fonts.at(assetId);
 }
+
+/// <summary>
+/// Add an animation clip, its frames are appended to the flat frame arrays.
+/// A clip id that already exists returns the existing clip, so entities declaring the same clip share it
+/// </summary>
+/// <param name="clipId"></param>
+/// <param name="frames">source rectangle position of every frame</param>
+/// <param name="frameDurations">seconds per frame, same size as frames</param>
+/// <param name="shouldLoop"></param>
+/// <returns>index of the clip</returns>
+int AssetStore::AddAnimationClip(const std::string& clipId, const std::vector<SDL_Point>& frames, const std::vector<float>& frameDurations, bool shouldLoop) noexcept
+{
+	const auto existing = animationClipIndices.find(clipId);
+	if (existing != animationClipIndices.end())
+		return existing->second;
+
+	if (frames.empty() || frames.size() != frameDurations.size())
+	{
+		Logger::Error("Invalid animation clip: " + clipId);
+		return -1;
+	}
+
+	AnimationClip clip;
+	clip.firstFrame = static_cast<int>(animationFrames.size());
+	clip.numFrames = static_cast<int>(frames.size());
+	clip.shouldLoop = shouldLoop;
+	animationFrames.insert(animationFrames.end(), frames.begin(), frames.end());
+	animationFrameDurations.insert(animationFrameDurations.end(), frameDurations.begin(), frameDurations.end());
+
+	const int index = static_cast<int>(animationClips.size());
+	animationClips.push_back(clip);
+	animationClipIndices.emplace(clipId, index);
+
+	Logger::Log("New animation clip added to Asset Store with id = " + clipId);
+	return index;
+}
+
+/// <summary>
+/// Add an animation clip made of the frames of one sprite sheet row, played at a constant frame rate
+/// </summary>
+/// <returns>index of the clip</returns>
+int AssetStore::AddAnimationClipRow(const std::string& clipId, int row, int numFrames, int frameWidth, int frameHeight, int frameRate, bool shouldLoop) noexcept
+{
+	std::vector<SDL_Point> frames;
+	std::vector<float> frameDurations;
+	for (int i = 0; i < numFrames; ++i)
+	{
+		frames.push_back({ i * frameWidth, row * frameHeight });
+		// a frame rate of 0 holds the first frame
+		frameDurations.push_back(frameRate > 0 ? 1.0f / frameRate : 0.0f);
+	}
+	return AddAnimationClip(clipId, frames, frameDurations, shouldLoop);
+}
+
+/// <summary>
+/// Get the index of an animation clip
+/// </summary>
+/// <param name="clipId"></param>
+/// <returns>index of the clip, -1 if it does not exist</returns>
+int AssetStore::GetAnimationClipIndex(const std::string& clipId) const noexcept
+{
+	const auto clip = animationClipIndices.find(clipId);
+	return clip != animationClipIndices.end() ? clip->second : -1;
+}
+
+/// <summary>
+/// Add an animation state machine, transitions[trigger] is the clip played when the trigger fires (-1: ignored)
+/// </summary>
+/// <param name="stateMachineId"></param>
+/// <param name="transitions"></param>
+/// <returns>index of the state machine</returns>
+int AssetStore::AddAnimationStateMachine(const std::string& stateMachineId, const std::array<int, ANIMATION_TRIGGER_COUNT>& transitions) noexcept
+{
+	const auto existing = animationStateMachineIndices.find(stateMachineId);
+	if (existing != animationStateMachineIndices.end())
+		return existing->second;
+
+	const int index = static_cast<int>(animationTransitions.size() / ANIMATION_TRIGGER_COUNT);
+	animationTransitions.insert(animationTransitions.end(), transitions.begin(), transitions.end());
+	animationStateMachineIndices.emplace(stateMachineId, index);
+
+	Logger::Log("New animation state machine added to Asset Store with id = " + stateMachineId);
+	return index;
+}
+
+/// <summary>
+/// Get the index of an animation state machine
+/// </summary>
+/// <param name="stateMachineId"></param>
+/// <returns>index of the state machine, -1 if it does not exist</returns>
+int AssetStore::GetAnimationStateMachineIndex(const std::string& stateMachineId) const noexcept
+{
+	const auto stateMachine = animationStateMachineIndices.find(stateMachineId);
+	return stateMachine != animationStateMachineIndices.end() ? stateMachine->second : -1;
+}
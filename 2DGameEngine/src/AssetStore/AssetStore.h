@@ -8,8 +8,30 @@
 #include <SDL_mixer.h>
 
 #include <map>
+#include <array>
+#include <vector>
 #include <string>
 #include <fstream>
+#include <unordered_map>
+
+// what the gameplay asks an animation state machine for, each state machine maps them to a clip
+enum AnimationTrigger : int
+{
+	ANIMATION_TRIGGER_NONE = -1,
+	ANIMATION_TRIGGER_UP = 0,
+	ANIMATION_TRIGGER_RIGHT,
+	ANIMATION_TRIGGER_DOWN,
+	ANIMATION_TRIGGER_LEFT,
+	ANIMATION_TRIGGER_COUNT
+};
+
+// a clip is a range of the flat frame arrays of the AssetStore
+struct AnimationClip
+{
+	int firstFrame;
+	int numFrames;
+	bool shouldLoop;
+};
 
 class AssetStore
 {
@@ -20,12 +42,30 @@ public:
 
 	void ClearAssets() noexcept;
 
+	// in headless mode no renderer exists, so assets are only registered as stubs (nullptr)
+	inline void SetHeadless(bool isHeadless) noexcept { this->isHeadless = isHeadless; }
+	inline bool IsHeadless() const noexcept { return isHeadless; }
+
 	void AddTexture(SDL_Renderer* renderer, const std::string& assetId, const std::string& filePath) noexcept;
+	void AddTexture(SDL_Renderer* renderer, const std::string& assetId, const std::string& filePath, SDL_Surface* surface) noexcept;
 	SDL_Texture* GetTexture(const std::string& assetId) const noexcept;
 
 	void AddFont(const std::string& assetId, const std::string& filePath, unsigned int fontSize) noexcept;
 	TTF_Font* GetFont(const std::string& assetId) const noexcept;
 
+	// Animation clips are compiled at load into flat arrays shared by all the entities playing them
+	int AddAnimationClip(const std::string& clipId, const std::vector<SDL_Point>& frames, const std::vector<float>& frameDurations, bool shouldLoop) noexcept;
+	int AddAnimationClipRow(const std::string& clipId, int row, int numFrames, int frameWidth, int frameHeight, int frameRate, bool shouldLoop) noexcept;
+	int GetAnimationClipIndex(const std::string& clipId) const noexcept;
+	inline const AnimationClip& GetAnimationClip(int clip) const noexcept { return animationClips[clip]; }
+	inline const SDL_Point& GetAnimationFrame(int frame) const noexcept { return animationFrames[frame]; }
+	inline float GetAnimationFrameDuration(int frame) const noexcept { return animationFrameDurations[frame]; }
+
+	// State machines are a flat table of clip indices, one row of ANIMATION_TRIGGER_COUNT entries per state machine
+	int AddAnimationStateMachine(const std::string& stateMachineId, const std::array<int, ANIMATION_TRIGGER_COUNT>& transitions) noexcept;
+	int GetAnimationStateMachineIndex(const std::string& stateMachineId) const noexcept;
+	inline int GetAnimationTransition(int stateMachine, int trigger) const noexcept { return animationTransitions[stateMachine * ANIMATION_TRIGGER_COUNT + trigger]; }
+
 private:
 	
 	std::map <std::string, SDL_Texture*> textures;
@@ -33,6 +73,15 @@ private:
 	// TODO: create a map for audio
 	std::map <std::string, Mix_Music*> audio;
 
+	std::vector<AnimationClip> animationClips;
+	std::vector<SDL_Point> animationFrames; // source rectangle position of every frame of every clip
+	std::vector<float> animationFrameDurations; // seconds, same index as animationFrames
+	std::unordered_map<std::string, int> animationClipIndices;
+	std::vector<int> animationTransitions; // clip index (-1: no transition) per state machine and trigger
+	std::unordered_map<std::string, int> animationStateMachineIndices;
+
+	bool isHeadless = false;
+
 };
 
 #endif // ASSETSTORE_H
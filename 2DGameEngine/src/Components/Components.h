@@ -3,12 +3,16 @@
 #define COMPONENTS_H
 
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <SDL.h>
 #include <SDL_image.h>
 #include <glm/glm.hpp>
 #include <sol/sol.hpp>
 
 #include "../Logger/Logger.h"
+#include "../GameEngine/Clock.h"
+#include "../AssetStore/AssetStore.h"
 
 struct TransformComponent
 {
@@ -57,37 +61,107 @@ struct SpriteComponent
 	};
 };
 
+// Whole tilemap on one entity, drawn by the RenderSystem without an entity per tile.
+// The sprite of the entity is the tileset (width/height of one tile), its transform the origin and scale of the map
+struct TilemapComponent
+{
+	std::vector<uint16_t> tiles; // tile indices, row by row
+	int numRows;
+	int numCols;
+	int tilesetColumns; // tiles per row of the tileset texture
+
+	TilemapComponent(std::vector<uint16_t> tiles = {}, int numRows = 0, int numCols = 0, int tilesetColumns = 10) noexcept :
+		tiles(std::move(tiles)),
+		numRows(numRows),
+		numCols(numCols),
+		tilesetColumns(tilesetColumns > 0 ? tilesetColumns : 1) {}
+};
+
+// Plays an animation clip of the AssetStore, the clip data is shared, the component only keeps the playback state
 struct AnimationComponent
 {
-	int numFrames;
-	int currentFrame;
-	int frameRateSpeed;
-	bool shouldLoop;
-	int startTime;
+	int clip; // index of the clip in the AssetStore
+	int currentFrame; // frame of the clip
+	float frameTimer; // seconds spent on the current frame
+	int displayedFrame; // frame written in the sprite source rectangle, -1 before the first update
+	int stateMachine; // index of the state machine in the AssetStore, -1: the clip never changes
+	int trigger; // AnimationTrigger fired since the last update, resolved by the AnimationSystem
+
+	AnimationComponent(int clip = -1, int stateMachine = -1) noexcept
+	{
+		this->clip = clip;
+		this->currentFrame = 0;
+		this->frameTimer = 0.0f;
+		this->displayedFrame = -1;
+		this->stateMachine = stateMachine;
+		this->trigger = ANIMATION_TRIGGER_NONE;
+	}
 
-	AnimationComponent(int numFrames = 1, int frameRateSpeed = 1, bool shouldLoop = true) noexcept
+	inline void Play(int clip) noexcept
 	{
-		this->numFrames = numFrames;
-		this->currentFrame = 1;
-		this->frameRateSpeed = frameRateSpeed;
-		this->shouldLoop = shouldLoop;
-		this->startTime = SDL_GetTicks();
+		if (clip < 0 || clip == this->clip) return;
+		this->clip = clip;
+		this->currentFrame = 0;
+		this->frameTimer = 0.0f;
+		this->displayedFrame = -1;
 	}
 };
 
+// Collision layers (bit flags). A pair of colliders is only tested when the layer of each collider is in the mask of the other one
+enum CollisionLayer : uint32_t
+{
+	COLLISION_LAYER_NONE = 0,
+	COLLISION_LAYER_DEFAULT = 1 << 0,
+	COLLISION_LAYER_PLAYER = 1 << 1,
+	COLLISION_LAYER_ENEMY = 1 << 2,
+	COLLISION_LAYER_PROJECTILE = 1 << 3,
+	COLLISION_LAYER_OBSTACLE = 1 << 4,
+	COLLISION_LAYER_ALL = 0xFFFFFFFF,
+};
+
+// Mask used when none is given: only the pairs that the DamageSystem and the MovementSystem handle
+inline uint32_t GetDefaultCollisionMask(uint32_t layer) noexcept
+{
+	switch (layer)
+	{
+		case COLLISION_LAYER_PLAYER: return COLLISION_LAYER_PROJECTILE;
+		case COLLISION_LAYER_ENEMY: return COLLISION_LAYER_PROJECTILE | COLLISION_LAYER_OBSTACLE;
+		case COLLISION_LAYER_PROJECTILE: return COLLISION_LAYER_PLAYER | COLLISION_LAYER_ENEMY;
+		case COLLISION_LAYER_OBSTACLE: return COLLISION_LAYER_ENEMY;
+		default: return COLLISION_LAYER_ALL;
+	}
+}
+
 struct BoxColliderComponent
 {
 	int m_width;
 	int m_height;
 	glm::vec2 m_offset;
 	bool m_isTrigger;
-
-	BoxColliderComponent(int width = 0, int height = 0, glm::vec2 offset = glm::vec2(0), bool isTrigger = false) noexcept
+	uint32_t m_layer; // layer the collider belongs to (one bit)
+	uint32_t m_mask; // layers the collider collides with
+	bool m_isContinuous; // fast collider, tested along its motion since the last collision update so it can not tunnel
+	glm::vec2 m_lastPosition; // box position at the last collision update (continuous colliders)
+	bool m_hasLastPosition;
+
+	// a mask of COLLISION_LAYER_NONE means the default mask of the layer
+	BoxColliderComponent(int width = 0, int height = 0, glm::vec2 offset = glm::vec2(0), bool isTrigger = false,
+						 uint32_t layer = COLLISION_LAYER_DEFAULT, uint32_t mask = COLLISION_LAYER_NONE, bool isContinuous = false) noexcept
 	{
 		this->m_width = width;
 		this->m_height = height;
 		this->m_offset = offset;
 		this->m_isTrigger = isTrigger;
+		this->m_layer = layer;
+		this->m_mask = mask != COLLISION_LAYER_NONE ? mask : GetDefaultCollisionMask(layer);
+		this->m_isContinuous = isContinuous;
+		this->m_lastPosition = glm::vec2(0);
+		this->m_hasLastPosition = false;
+	}
+
+	inline bool CanCollideWith(const BoxColliderComponent& other) const noexcept
+	{
+		return (m_layer & other.m_mask) != 0 && (other.m_layer & m_mask) != 0;
 	}
 };
 
@@ -111,6 +185,21 @@ struct KeyboardControlledComponent
 	}
 };
 
+// keeps the entity inside the map (the player), padding in pixels from each map border
+struct MapClampComponent
+{
+	int m_paddingLeft;
+	int m_paddingTop;
+	int m_paddingRight;
+	int m_paddingBottom;
+
+	constexpr MapClampComponent(int paddingLeft = 10, int paddingTop = 10, int paddingRight = 50, int paddingBottom = 50) noexcept :
+		m_paddingLeft(paddingLeft),
+		m_paddingTop(paddingTop),
+		m_paddingRight(paddingRight),
+		m_paddingBottom(paddingBottom) {}
+};
+
 struct CameraFollowComponent
 {
 	constexpr CameraFollowComponent() noexcept = default;
@@ -137,7 +226,7 @@ struct ProjectileEmitterComponent
 		m_projectileDuraiton(projectileDuration),
 		m_hitPercentDamage(hitPercentDamage),
 		m_isFriendly(isFriendly),
-		m_lastEmissionTime(SDL_GetTicks()),
+		m_lastEmissionTime(Clock::GetTicks()),
 		m_isManual(isManual) {}
 
 };
@@ -166,7 +255,7 @@ struct ProjectileComponent
 		m_isFriendly(isFriendly),
 		m_hitPercentDamage(hitPercentDamage),
 		m_duration(duration),
-		m_startTime(SDL_GetTicks()) {}
+		m_startTime(Clock::GetTicks()) {}
 
 };
 
@@ -189,13 +278,34 @@ struct TextLabelComponent
 	}
 };
 
-struct ScriptComponent
+// entity created by the region streaming: destroyed when the region it stands in is unloaded and created again,
+// with its saved state, when that region is loaded back
+struct StreamedComponent
 {
-	sol::function func;
+	int levelEntity; // index of the entity in Level.entities
+
+	constexpr StreamedComponent(int levelEntity = -1) noexcept :
+		levelEntity(levelEntity) {}
+};
 
-	ScriptComponent(sol::function func = sol::lua_nil) noexcept
+struct ScriptComponent
+{
+	sol::protected_function func; // per-entity script, called once per entity
+	int batch; // index of the batch script in the ScriptSystem, -1 for a per-entity script
+	int updateInterval; // the script runs every updateInterval ticks
+	int lastRunTick; // tick of the last start of the script
+	bool isCoroutine; // runs as a coroutine: it can yield (or run out of budget) and resume on the next frames
+	sol::thread thread; // suspended coroutine, nil when the script is not running
+	int levelEntity = -1; // index of the entity in Level.entities, to rebind the script when the level script is reloaded
+
+	ScriptComponent(sol::protected_function func = sol::lua_nil, int batch = -1, int updateInterval = 1, int tickOffset = 0, bool isCoroutine = false) noexcept
 	{
 		this->func = func;
+		this->batch = batch;
+		this->updateInterval = updateInterval > 0 ? updateInterval : 1;
+		// the offset spreads the scripts with the same interval over different ticks
+		this->lastRunTick = -(tickOffset % this->updateInterval);
+		this->isCoroutine = isCoroutine;
 	}
 };
 
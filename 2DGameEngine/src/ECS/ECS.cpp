@@ -1,11 +1,147 @@
 #include "ECS.h"
 
 #include <algorithm>
+#include <iterator>
 #include <string>
 
 // define static variables
 int IComponent::nextId = 0;
 
+namespace
+{
+	constexpr char SNAPSHOT_MAGIC[4] = { '2', 'D', 'S', 'N' };
+
+	// gives an id to every engine component type, so a snapshot can be read before they are first used
+	void RegisterEngineComponentTypes() noexcept
+	{
+		Component<TransformComponent>::GetID();
+		Component<RigidbodyComponent>::GetID();
+		Component<SpriteComponent>::GetID();
+		Component<TilemapComponent>::GetID();
+		Component<AnimationComponent>::GetID();
+		Component<BoxColliderComponent>::GetID();
+		Component<KeyboardControlledComponent>::GetID();
+		Component<MapClampComponent>::GetID();
+		Component<CameraFollowComponent>::GetID();
+		Component<ProjectileEmitterComponent>::GetID();
+		Component<HealthComponent>::GetID();
+		Component<ProjectileComponent>::GetID();
+		Component<TextLabelComponent>::GetID();
+		Component<StreamedComponent>::GetID();
+		Component<ScriptComponent>::GetID();
+	}
+
+	inline int32_t GetEntityId(int entityId) noexcept { return entityId; }
+	inline int32_t GetEntityId(const Entity& entity) noexcept { return entity.GetID(); }
+
+	// block writes through a small buffer instead of a temporary array: a large allocation right after an update
+	// freed many small blocks (the collision contacts) makes the allocator merge all of them first
+	template <typename TIterator, typename TGetValue>
+	void WriteValues(BlobWriter& writer, TIterator begin, TIterator end, TGetValue getValue) noexcept
+	{
+		uint32_t values[256];
+		size_t count = 0;
+		for (auto it = begin; it != end; ++it)
+		{
+			values[count++] = static_cast<uint32_t>(getValue(*it));
+			if (count == std::size(values))
+			{
+				writer.WriteBytes(values, sizeof(values));
+				count = 0;
+			}
+		}
+		writer.WriteBytes(values, count * sizeof(uint32_t));
+	}
+
+	template <typename TContainer>
+	void WriteEntityIds(BlobWriter& writer, const TContainer& entities) noexcept
+	{
+		writer.Write(static_cast<uint32_t>(entities.size()));
+		WriteValues(writer, entities.begin(), entities.end(), [](const auto& entity) { return GetEntityId(entity); });
+	}
+
+	// fails on an id that is not an entity of the snapshot
+	bool ReadEntityIds(BlobReader& reader, uint32_t numEntities, std::vector<int>& entityIds) noexcept
+	{
+		uint32_t count = 0;
+		if (!reader.Read(count) || count > numEntities)
+			return false;
+		entityIds.resize(count);
+		if (!reader.ReadBytes(entityIds.data(), entityIds.size() * sizeof(int)))
+			return false;
+		return std::all_of(entityIds.begin(), entityIds.end(),
+			[numEntities](int entityId) { return entityId >= 0 && static_cast<uint32_t>(entityId) < numEntities; });
+	}
+
+	void WriteTagsAndGroups(BlobWriter& writer, const std::unordered_map<int, std::string>& tagPerEntity,
+		const std::unordered_map<std::string, std::set<Entity>>& entitiesPerGroup) noexcept
+	{
+		writer.Write(static_cast<uint32_t>(tagPerEntity.size()));
+		for (const auto& tag : tagPerEntity)
+		{
+			writer.Write(static_cast<int32_t>(tag.first));
+			writer.WriteString(tag.second);
+		}
+
+		// the groups are kept even when empty, GetEntitiesByGroup expects them
+		writer.Write(static_cast<uint32_t>(entitiesPerGroup.size()));
+		for (const auto& group : entitiesPerGroup)
+		{
+			writer.WriteString(group.first);
+			WriteEntityIds(writer, group.second);
+		}
+	}
+
+	// the tags of ids that are not entities of the snapshot are skipped
+	bool ReadTagsAndGroups(BlobReader& reader, uint32_t numEntities, std::vector<std::pair<int, std::string>>& tags,
+		std::vector<std::pair<std::string, std::vector<int>>>& groups) noexcept
+	{
+		uint32_t count = 0;
+		reader.Read(count);
+		for (uint32_t i = 0; i < count && !reader.HasFailed(); ++i)
+		{
+			int32_t id = -1;
+			std::string name;
+			if (reader.Read(id) && reader.ReadString(name) && id >= 0 && static_cast<uint32_t>(id) < numEntities)
+				tags.emplace_back(id, std::move(name));
+		}
+		count = 0;
+		reader.Read(count);
+		for (uint32_t i = 0; i < count && !reader.HasFailed(); ++i)
+		{
+			groups.emplace_back();
+			if (!reader.ReadString(groups.back().first) || !ReadEntityIds(reader, numEntities, groups.back().second))
+				return false;
+		}
+		return !reader.HasFailed();
+	}
+}
+
+/////////////// Component type implementations ///////////////
+
+std::vector<ComponentTypeInfo>& IComponent::GetTypes() noexcept
+{
+	static std::vector<ComponentTypeInfo> types;
+	return types;
+}
+
+int IComponent::RegisterType(std::string name, size_t size, std::shared_ptr<IPool>(*createPool)()) noexcept
+{
+	GetTypes().push_back({ std::move(name), size, createPool });
+	return nextId++;
+}
+
+int IComponent::FindID(const std::string& name) noexcept
+{
+	const auto& types = GetTypes();
+	for (size_t id = 0; id < types.size(); ++id)
+	{
+		if (types[id].name == name)
+			return static_cast<int>(id);
+	}
+	return -1;
+}
+
 /////////////// Entity class implementations ///////////////
 
 /// <summary>
@@ -56,10 +192,56 @@ void System::AddEntityToSystem(Entity entity) noexcept
 /// <param name="entity"></param>
 void System::RemoveEntityFromSystem(Entity entity) noexcept
 {
-	m_entities.erase(std::remove_if(m_entities.begin(), m_entities.end(), [&entity](Entity other) 
+	auto removed = std::remove_if(m_entities.begin(), m_entities.end(), [&entity](Entity other) 
 		{
 			return entity == other;
-		}), m_entities.end());
+		});
+
+	if (removed == m_entities.end())
+		return;
+
+	m_entities.erase(removed, m_entities.end());
+	OnEntityRemoved(entity);
+}
+
+void System::RemoveAllEntities() noexcept
+{
+	std::vector<Entity> entities;
+	entities.swap(m_entities);
+	for (auto& entity : entities)
+		OnEntityRemoved(entity);
+}
+
+void System::RestoreEntities(const std::vector<int>& entityIds, Registry* registry) noexcept
+{
+	const bool isSame = m_entities.size() == entityIds.size() && std::equal(m_entities.begin(), m_entities.end(), entityIds.begin(),
+		[](const Entity& entity, int entityId) { return entity.GetID() == entityId; });
+	if (isSame)
+		return;
+
+	int maxEntityId = -1;
+	for (int entityId : entityIds)
+		maxEntityId = std::max(maxEntityId, entityId);
+	std::vector<bool> isKept(maxEntityId + 1, false);
+	for (int entityId : entityIds)
+		isKept[entityId] = true;
+
+	std::vector<Entity> removedEntities;
+	for (const auto& entity : m_entities)
+	{
+		if (entity.GetID() > maxEntityId || !isKept[entity.GetID()])
+			removedEntities.push_back(entity);
+	}
+
+	m_entities.clear();
+	for (int entityId : entityIds)
+	{
+		Entity entity(entityId);
+		entity.m_registry = registry;
+		m_entities.push_back(entity);
+	}
+	for (const auto& entity : removedEntities)
+		OnEntityRemoved(entity);
 }
 
 /////////////// Registry class implementations ///////////////
@@ -235,19 +417,29 @@ void Registry::Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_
 					  std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept
 {
 	// Add the entities that are waiting to be created to the active Systems
+	ProfileScope addEntitiesScope("Registry::AddEntities");
 	for (auto& entity : m_entitiesToBeAdded)
 	{
 		AddEntityToSystems(entity);
 	}
 	m_entitiesToBeAdded.clear();
+	addEntitiesScope.Stop();
 		
 	// Update all the active Systems
 	for (const auto& system : m_systems)
 	{
+		ProfileScope systemScope(system.second->GetName().c_str());
 		system.second->Update(deltaTime, eventBus, camera, registry, assetStore, renderer, elapsedTime);
 	}
 
+	// sync point: the events queued by the systems are dispatched in batches
+	// before the entities destroyed by their handlers are removed
+	ProfileScope dispatchScope("EventBus::DispatchQueuedEvents");
+	eventBus->DispatchQueuedEvents();
+	dispatchScope.Stop();
+
 	// Remove the entities that are waiting to be removed from the active Systems
+	ProfileScope killEntitiesScope("Registry::KillEntities");
 	for (auto& entity : m_entitiesToBeKilled)
 	{
 		/*if (entity.HasComponent<TransformComponent>())
@@ -285,6 +477,577 @@ void Registry::Render(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& asset
 	// Render all the active Systems
 	for (const auto& system : m_systems)
 	{
+		ProfileScope systemScope(system.second->GetName().c_str());
 		system.second->Render(renderer, assetStore, camera, registry, isDebugMode);
 	}
-}
\ No newline at end of file
+}
+/// <summary>
+/// Signatures (local component ids), free ids, ids waiting to be added or killed, tags and groups
+/// </summary>
+/// <param name="writer"></param>
+void Registry::WriteEntities(BlobWriter& writer) const noexcept
+{
+	WriteValues(writer, m_entityComponentSignatures.begin(), m_entityComponentSignatures.begin() + m_numEntities,
+		[](const Signature& signature) { return signature.to_ulong(); });
+
+	WriteEntityIds(writer, m_freeEntityIDs);
+	WriteEntityIds(writer, m_entitiesToBeAdded);
+	WriteEntityIds(writer, m_entitiesToBeKilled);
+
+	WriteTagsAndGroups(writer, m_tagPerEntity, m_entitiesPerGroup);
+}
+
+/// <summary>
+/// Writes the entity ids (count, free ids, ids waiting to be added or killed), the signatures, tags, groups and
+/// every component pool to a binary blob. Layout (native byte order):
+/// magic "2DSN" | u16 version | u32 entity count | u32 type count, per type: i32 id, name, u32 size |
+/// u32 signature per entity | free ids | ids to add | ids to kill | u32 tag count, per tag: i32 id, name |
+/// u32 group count, per group: name, ids | u32 pool count, per pool: i32 type id, pool |
+/// u32 script count, per script: bytecode. Strings are a u32 size and the characters, id lists a u32 count and i32 ids
+/// </summary>
+/// <param name="blob"></param>
+void Registry::Serialize(std::vector<uint8_t>& blob) const noexcept
+{
+	ProfileScope scope("Registry::Serialize");
+
+	blob.clear();
+	BlobWriter writer(blob);
+	writer.WriteBytes(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	writer.Write(SNAPSHOT_VERSION);
+	writer.Write(static_cast<uint32_t>(m_numEntities));
+
+	// the component ids of this process, a reader maps them to its own ids by name
+	std::vector<int> poolIds;
+	for (size_t id = 0; id < m_componentPools.size(); ++id)
+	{
+		if (m_componentPools[id])
+			poolIds.push_back(static_cast<int>(id));
+	}
+	writer.Write(static_cast<uint32_t>(poolIds.size()));
+	for (int id : poolIds)
+	{
+		const ComponentTypeInfo& type = IComponent::GetTypeInfo(id);
+		writer.Write(static_cast<int32_t>(id));
+		writer.WriteString(type.name);
+		writer.Write(static_cast<uint32_t>(type.size));
+	}
+
+	WriteEntities(writer);
+
+	writer.Write(static_cast<uint32_t>(poolIds.size()));
+	for (int id : poolIds)
+	{
+		writer.Write(static_cast<int32_t>(id));
+		m_componentPools[id]->Serialize(writer);
+	}
+
+	const auto& scripts = writer.GetScripts();
+	writer.Write(static_cast<uint32_t>(scripts.size()));
+	for (const auto& script : scripts)
+		writer.WriteString(script);
+}
+
+/// <summary>
+/// Replaces the entities, components, tags and groups with a snapshot written by Serialize and puts the living entities
+/// back in the systems. Nothing changes when the snapshot is invalid. The state the systems keep themselves is not restored
+/// </summary>
+/// <param name="blob"></param>
+/// <param name="lua">state the script functions are loaded in, nil functions without it</param>
+/// <returns></returns>
+bool Registry::Deserialize(const std::vector<uint8_t>& blob, lua_State* lua) noexcept
+{
+	ProfileScope scope("Registry::Deserialize");
+
+	RegisterEngineComponentTypes();
+	BlobReader reader(blob.data(), blob.size(), lua);
+
+	char magic[sizeof(SNAPSHOT_MAGIC)];
+	uint16_t version = 0;
+	uint32_t numEntities = 0;
+	if (!reader.ReadBytes(magic, sizeof(magic)) || !std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), magic) ||
+		!reader.Read(version) || !reader.Read(numEntities) || numEntities > static_cast<uint32_t>(std::numeric_limits<int>::max()))
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+	if (version != SNAPSHOT_VERSION)
+	{
+		Logger::Error("Unsupported registry snapshot version " + std::to_string(version));
+		return false;
+	}
+
+	// snapshot component id -> component id of this process
+	int localIds[MAX_COMPONENTS];
+	std::fill(std::begin(localIds), std::end(localIds), -1);
+	uint32_t typeCount = 0;
+	if (!reader.Read(typeCount) || typeCount > MAX_COMPONENTS)
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+	for (uint32_t i = 0; i < typeCount; ++i)
+	{
+		int32_t id = -1;
+		std::string name;
+		uint32_t size = 0;
+		if (!reader.Read(id) || !reader.ReadString(name) || !reader.Read(size) || id < 0 || id >= static_cast<int32_t>(MAX_COMPONENTS))
+		{
+			Logger::Error("Invalid registry snapshot");
+			return false;
+		}
+		const int localId = IComponent::FindID(name);
+		if (localId < 0 || localId >= static_cast<int>(MAX_COMPONENTS) || IComponent::GetTypeInfo(localId).size != size)
+		{
+			Logger::Error("Registry snapshot component " + name + " is unknown or has changed");
+			return false;
+		}
+		localIds[id] = localId;
+	}
+
+	// a signature per entity follows, a corrupted count must not size an allocation past the blob
+	if (numEntities > reader.GetRemainingSize() / sizeof(uint32_t))
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+	std::vector<uint32_t> snapshotSignatures(numEntities);
+	if (!reader.ReadBytes(snapshotSignatures.data(), snapshotSignatures.size() * sizeof(uint32_t)))
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+	std::vector<Signature> signatures(numEntities);
+	for (uint32_t entityId = 0; entityId < numEntities; ++entityId)
+	{
+		uint32_t bits = snapshotSignatures[entityId];
+		for (int id = 0; bits != 0; ++id, bits >>= 1)
+		{
+			if ((bits & 1) == 0)
+				continue;
+			if (localIds[id] < 0)
+			{
+				Logger::Error("Invalid registry snapshot");
+				return false;
+			}
+			signatures[entityId].set(localIds[id]);
+		}
+	}
+
+	std::vector<int> freeIds, addedIds, killedIds;
+	if (!ReadEntityIds(reader, numEntities, freeIds) || !ReadEntityIds(reader, numEntities, addedIds) ||
+		!ReadEntityIds(reader, numEntities, killedIds))
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+
+	std::vector<std::pair<int, std::string>> tags;
+	std::vector<std::pair<std::string, std::vector<int>>> groups;
+	if (!ReadTagsAndGroups(reader, numEntities, tags, groups))
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+
+	std::vector<std::shared_ptr<IPool>> componentPools;
+	uint32_t count = 0;
+	reader.Read(count);
+	for (uint32_t i = 0; i < count && !reader.HasFailed(); ++i)
+	{
+		int32_t id = -1;
+		if (!reader.Read(id) || id < 0 || id >= static_cast<int32_t>(MAX_COMPONENTS) || localIds[id] < 0)
+		{
+			Logger::Error("Invalid registry snapshot");
+			return false;
+		}
+		const int localId = localIds[id];
+		if (localId >= static_cast<int>(componentPools.size()))
+			componentPools.resize(localId + 1);
+		if (componentPools[localId])
+		{
+			Logger::Error("Invalid registry snapshot, duplicated pool: " + IComponent::GetTypeInfo(localId).name);
+			return false;
+		}
+		componentPools[localId] = IComponent::GetTypeInfo(localId).createPool();
+		if (!componentPools[localId]->Deserialize(reader, numEntities))
+		{
+			Logger::Error("Invalid registry snapshot pool: " + IComponent::GetTypeInfo(localId).name);
+			return false;
+		}
+	}
+
+	// every pool holds exactly the entities whose signature has its component (the ids of a pool are unique)
+	std::vector<uint32_t> componentCounts(MAX_COMPONENTS, 0);
+	for (const Signature& signature : signatures)
+	{
+		for (size_t localId = 0; localId < MAX_COMPONENTS; ++localId)
+			componentCounts[localId] += signature.test(localId) ? 1 : 0;
+	}
+	for (size_t localId = 0; localId < MAX_COMPONENTS; ++localId)
+	{
+		const IPool* pool = localId < componentPools.size() ? componentPools[localId].get() : nullptr;
+		const std::vector<int>* entityIds = pool ? &pool->GetEntityIds() : nullptr;
+		bool isConsistent = (entityIds ? entityIds->size() : 0) == componentCounts[localId];
+		for (size_t i = 0; isConsistent && entityIds && i < entityIds->size(); ++i)
+			isConsistent = signatures[(*entityIds)[i]].test(localId);
+		if (!isConsistent)
+		{
+			Logger::Error("Registry snapshot pool does not match the entity signatures: " + IComponent::GetTypeInfo(static_cast<int>(localId)).name);
+			return false;
+		}
+	}
+
+	if (!reader.ResolveScripts() || !reader.IsAtEnd())
+	{
+		Logger::Error("Invalid registry snapshot");
+		return false;
+	}
+
+	// the snapshot is valid, replace the registry content
+	for (auto& system : m_systems)
+		system.second->RemoveAllEntities();
+
+	if (componentPools.size() < m_componentPools.size())
+		componentPools.resize(m_componentPools.size());
+	m_componentPools = std::move(componentPools);
+	SetEntities(std::move(signatures), freeIds, addedIds, killedIds, tags, groups);
+
+	// the entities waiting to be added join the systems on the next Update
+	std::vector<bool> isInSystems(numEntities, true);
+	for (int entityId : freeIds)
+		isInSystems[entityId] = false;
+	for (int entityId : addedIds)
+		isInSystems[entityId] = false;
+	for (int entityId = 0; entityId < m_numEntities; ++entityId)
+	{
+		if (isInSystems[entityId])
+		{
+			Entity entity(entityId);
+			entity.m_registry = this;
+			AddEntityToSystems(entity);
+		}
+	}
+
+	Logger::Log("Registry restored from a snapshot of " + std::to_string(blob.size()) + " bytes");
+	return true;
+}
+
+/// <summary>
+/// Replaces the entity ids, signatures, tags and groups with the ones of a snapshot, the systems are left as they are
+/// </summary>
+void Registry::SetEntities(std::vector<Signature> signatures, const std::vector<int>& freeIds, const std::vector<int>& addedIds,
+	const std::vector<int>& killedIds, const std::vector<std::pair<int, std::string>>& tags,
+	const std::vector<std::pair<std::string, std::vector<int>>>& groups) noexcept
+{
+	m_numEntities = static_cast<int>(signatures.size());
+	m_entityComponentSignatures = std::move(signatures);
+
+	auto toEntity = [this](int entityId)
+	{
+		Entity entity(entityId);
+		entity.m_registry = this;
+		return entity;
+	};
+
+	m_freeEntityIDs.assign(freeIds.begin(), freeIds.end());
+	m_entitiesToBeAdded.clear();
+	for (int entityId : addedIds)
+		m_entitiesToBeAdded.insert(toEntity(entityId));
+	m_entitiesToBeKilled.clear();
+	for (int entityId : killedIds)
+		m_entitiesToBeKilled.insert(toEntity(entityId));
+
+	m_entityPerTag.clear();
+	m_tagPerEntity.clear();
+	for (const auto& tag : tags)
+		TagEntity(toEntity(tag.first), tag.second);
+
+	RestoreGroups(groups);
+}
+
+/// <summary>
+/// Sets the groups to the ones of a snapshot. A snapshot usually differs from the current groups by a few entities,
+/// so only the differences are applied instead of freeing and allocating every node of the sets and maps again
+/// </summary>
+/// <param name="groups">name and sorted entity ids of each group</param>
+void Registry::RestoreGroups(const std::vector<std::pair<std::string, std::vector<int>>>& groups) noexcept
+{
+	for (auto group = m_entitiesPerGroup.begin(); group != m_entitiesPerGroup.end();)
+	{
+		const bool isInSnapshot = std::any_of(groups.begin(), groups.end(),
+			[&group](const auto& snapshotGroup) { return snapshotGroup.first == group->first; });
+		group = isInSnapshot ? std::next(group) : m_entitiesPerGroup.erase(group);
+	}
+
+	std::vector<const std::string*> groupPerEntity(m_numEntities, nullptr);
+	for (const auto& snapshotGroup : groups)
+	{
+		auto& entities = m_entitiesPerGroup[snapshotGroup.first];
+		const auto& entityIds = snapshotGroup.second;
+		const bool isSame = entities.size() == entityIds.size() && std::equal(entities.begin(), entities.end(), entityIds.begin(),
+			[](const Entity& entity, int entityId) { return entity.GetID() == entityId; });
+		if (!isSame)
+		{
+			// the ids are sorted, each one is inserted at the end of the set
+			entities.clear();
+			for (int entityId : entityIds)
+			{
+				Entity entity(entityId);
+				entity.m_registry = this;
+				entities.emplace_hint(entities.end(), entity);
+			}
+		}
+
+		for (int entityId : entityIds)
+			groupPerEntity[entityId] = &snapshotGroup.first;
+	}
+
+	for (auto group = m_groupPerEntity.begin(); group != m_groupPerEntity.end();)
+	{
+		const int entityId = group->first;
+		if (entityId >= m_numEntities || !groupPerEntity[entityId])
+		{
+			group = m_groupPerEntity.erase(group);
+			continue;
+		}
+		if (group->second != *groupPerEntity[entityId])
+			group->second = *groupPerEntity[entityId];
+		groupPerEntity[entityId] = nullptr;
+		++group;
+	}
+	for (int entityId = 0; entityId < m_numEntities; ++entityId)
+	{
+		if (groupPerEntity[entityId])
+			m_groupPerEntity.emplace(entityId, *groupPerEntity[entityId]);
+	}
+}
+
+/////////////// Rollback snapshots ///////////////
+
+/// <summary>
+/// Captures the registry in sections: the entities (with the entities of each system, in their order), the state of
+/// the systems and one section per component pool. Each section is written to a scratch buffer first, when its bytes
+/// and scripts are the same as in the previous snapshot that section is shared instead of stored again
+/// </summary>
+/// <param name="snapshot"></param>
+/// <param name="previous">snapshot of the previous tick, nullptr to store every section</param>
+void Registry::Capture(RegistrySnapshot& snapshot, const RegistrySnapshot* previous) noexcept
+{
+	ProfileScope scope("Registry::Capture");
+
+	static const RegistrySnapshot empty;
+	const RegistrySnapshot& base = previous ? *previous : empty;
+
+	CaptureSection(snapshot.entities, base.entities, [this](BlobWriter& writer) { WriteEntitySection(writer); });
+	CaptureSection(snapshot.systems, base.systems, [this](BlobWriter& writer) { WriteSystemSection(writer); });
+
+	snapshot.pools.resize(m_componentPools.size());
+	for (size_t id = 0; id < m_componentPools.size(); ++id)
+	{
+		const auto& pool = m_componentPools[id];
+		if (!pool)
+		{
+			snapshot.pools[id].reset();
+			continue;
+		}
+		const auto& previousPool = id < base.pools.size() ? base.pools[id] : nullptr;
+		CaptureSection(snapshot.pools[id], previousPool, [&pool](BlobWriter& writer) { pool->Serialize(writer); });
+	}
+}
+
+/// <summary>
+/// Rewinds the registry to a snapshot. The registry must be in the state of current, then a section with the same
+/// pointer in both snapshots is already up to date and only the changed pools and entities are read.
+/// The snapshots are trusted (captured by this registry), a failed section leaves the registry partly restored
+/// </summary>
+/// <param name="snapshot"></param>
+/// <param name="current"></param>
+/// <returns></returns>
+bool Registry::Restore(const RegistrySnapshot& snapshot, const RegistrySnapshot& current) noexcept
+{
+	ProfileScope scope("Registry::Restore");
+
+	if (!snapshot.entities || !snapshot.systems)
+	{
+		Logger::Error("Empty registry snapshot");
+		return false;
+	}
+
+	// the entity count of the snapshot bounds the entity ids of its pools
+	uint32_t numEntities = 0;
+	BlobReader(snapshot.entities->bytes.data(), snapshot.entities->bytes.size()).Read(numEntities);
+
+	if (m_componentPools.size() < snapshot.pools.size())
+		m_componentPools.resize(snapshot.pools.size());
+	for (size_t id = 0; id < m_componentPools.size(); ++id)
+	{
+		const auto& section = id < snapshot.pools.size() ? snapshot.pools[id] : nullptr;
+		const auto& currentSection = id < current.pools.size() ? current.pools[id] : nullptr;
+		if (section == currentSection)
+			continue;
+
+		// the pool did not exist yet at the snapshot
+		if (!section)
+		{
+			m_componentPools[id].reset();
+			continue;
+		}
+
+		if (!m_componentPools[id])
+			m_componentPools[id] = IComponent::GetTypeInfo(static_cast<int>(id)).createPool();
+		BlobReader reader(section->bytes.data(), section->bytes.size());
+		reader.SetScriptReferences(&section->scripts);
+		if (!m_componentPools[id]->Deserialize(reader, numEntities))
+		{
+			Logger::Error("Invalid rollback snapshot pool: " + IComponent::GetTypeInfo(static_cast<int>(id)).name);
+			return false;
+		}
+	}
+
+	if (snapshot.entities != current.entities)
+	{
+		BlobReader reader(snapshot.entities->bytes.data(), snapshot.entities->bytes.size());
+		if (!ReadEntitySection(reader))
+		{
+			Logger::Error("Invalid rollback snapshot entities");
+			return false;
+		}
+	}
+
+	// after the entities: the systems drop what they kept for the entities they lost, then get their state back
+	if (snapshot.systems != current.systems)
+	{
+		BlobReader reader(snapshot.systems->bytes.data(), snapshot.systems->bytes.size());
+		if (!ReadSystemSection(reader))
+		{
+			Logger::Error("Invalid rollback snapshot systems");
+			return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Writes a section to the scratch and keeps it only if it differs from the previous one. The section being replaced
+/// (a snapshot captured over an old one) gives its buffers to the scratch when no other snapshot holds it
+/// </summary>
+template <typename TWrite>
+void Registry::CaptureSection(std::shared_ptr<const SnapshotSection>& section, const std::shared_ptr<const SnapshotSection>& previous, TWrite write) noexcept
+{
+	if (section && section != previous && section.use_count() == 1)
+		m_snapshotScratch = std::const_pointer_cast<SnapshotSection>(std::move(section));
+	section.reset();
+	if (!m_snapshotScratch)
+		m_snapshotScratch = std::make_shared<SnapshotSection>();
+
+	SnapshotSection& scratch = *m_snapshotScratch;
+	scratch.bytes.clear();
+	scratch.scripts.clear();
+	if (previous)
+		scratch.bytes.reserve(previous->bytes.size());
+
+	BlobWriter writer(scratch.bytes);
+	writer.SetScriptReferences(&scratch.scripts);
+	write(writer);
+
+	const bool isSame = previous && previous->bytes == scratch.bytes && previous->scripts.size() == scratch.scripts.size() &&
+		std::equal(previous->scripts.begin(), previous->scripts.end(), scratch.scripts.begin(),
+			[](const sol::protected_function& a, const sol::protected_function& b) { return a.pointer() == b.pointer(); });
+
+	// the scratch becomes the new section, the next one gets another buffer
+	if (isSame)
+		section = previous;
+	else
+		section = std::move(m_snapshotScratch);
+}
+
+/// <summary>
+/// u32 entity count | entities (see WriteEntities) | u32 system count, per system: name, ids
+/// </summary>
+/// <param name="writer"></param>
+void Registry::WriteEntitySection(BlobWriter& writer) const noexcept
+{
+	writer.Write(static_cast<uint32_t>(m_numEntities));
+	WriteEntities(writer);
+
+	writer.Write(static_cast<uint32_t>(m_systems.size()));
+	for (const auto& system : m_systems)
+	{
+		writer.WriteString(system.second->GetName());
+		WriteEntityIds(writer, system.second->GetSystemEntities());
+	}
+}
+
+bool Registry::ReadEntitySection(BlobReader& reader) noexcept
+{
+	uint32_t numEntities = 0;
+	if (!reader.Read(numEntities) || numEntities > reader.GetRemainingSize() / sizeof(uint32_t))
+		return false;
+
+	std::vector<uint32_t> bits(numEntities);
+	reader.ReadBytes(bits.data(), bits.size() * sizeof(uint32_t));
+	std::vector<Signature> signatures(bits.begin(), bits.end());
+
+	std::vector<int> freeIds, addedIds, killedIds;
+	std::vector<std::pair<int, std::string>> tags;
+	std::vector<std::pair<std::string, std::vector<int>>> groups;
+	if (!ReadEntityIds(reader, numEntities, freeIds) || !ReadEntityIds(reader, numEntities, addedIds) ||
+		!ReadEntityIds(reader, numEntities, killedIds) || !ReadTagsAndGroups(reader, numEntities, tags, groups))
+		return false;
+
+	uint32_t systemCount = 0;
+	if (!reader.Read(systemCount) || systemCount != m_systems.size())
+		return false;
+	std::vector<std::pair<System*, std::vector<int>>> systemEntities(systemCount);
+	for (auto& entities : systemEntities)
+	{
+		std::string name;
+		if (!reader.ReadString(name) || !ReadEntityIds(reader, numEntities, entities.second))
+			return false;
+		auto system = std::find_if(m_systems.begin(), m_systems.end(),
+			[&name](const auto& system) { return system.second->GetName() == name; });
+		if (system == m_systems.end())
+			return false;
+		entities.first = system->second.get();
+	}
+	if (!reader.IsAtEnd())
+		return false;
+
+	SetEntities(std::move(signatures), freeIds, addedIds, killedIds, tags, groups);
+	for (const auto& entities : systemEntities)
+		entities.first->RestoreEntities(entities.second, this);
+	return true;
+}
+
+/// <summary>
+/// u32 system count, per system: name, state (read back by the LoadState of the same system)
+/// </summary>
+/// <param name="writer"></param>
+void Registry::WriteSystemSection(BlobWriter& writer) const noexcept
+{
+	writer.Write(static_cast<uint32_t>(m_systems.size()));
+	for (const auto& system : m_systems)
+	{
+		writer.WriteString(system.second->GetName());
+		system.second->SaveState(writer);
+	}
+}
+
+bool Registry::ReadSystemSection(BlobReader& reader) noexcept
+{
+	uint32_t systemCount = 0;
+	if (!reader.Read(systemCount) || systemCount != m_systems.size())
+		return false;
+
+	for (uint32_t i = 0; i < systemCount; ++i)
+	{
+		std::string name;
+		if (!reader.ReadString(name))
+			return false;
+		auto system = std::find_if(m_systems.begin(), m_systems.end(),
+			[&name](const auto& system) { return system.second->GetName() == name; });
+		if (system == m_systems.end() || !system->second->LoadState(reader))
+			return false;
+	}
+	return reader.IsAtEnd();
+}
@@ -6,6 +6,8 @@
 #include "../AssetStore/AssetStore.h"
 #include "../EventBus/EventBus.h"
 #include "../Components/Components.h"
+#include "../Profiler/Profiler.h"
+#include "Serialization.h"
 
 #include <vector>
 #include <bitset>
@@ -16,6 +18,8 @@
 #include <memory>
 #include <deque>
 #include <iostream>
+#include <algorithm>
+#include <limits>
 
 #include <SDL.h>
 #include <SDL_image.h>
@@ -31,12 +35,32 @@ namespace
 /// </summary>
 typedef std::bitset<MAX_COMPONENTS> Signature;
 
+class IPool;
+
+// name, size and pool factory of a component type, the ids depend on the order the types are first used
+// so a serialized registry finds its pools by name
+struct ComponentTypeInfo
+{
+	std::string name;
+	size_t size;
+	std::shared_ptr<IPool>(*createPool)();
+};
+
 // Base class for all components - similar to interface
 struct IComponent
 {
+public:
+	static const ComponentTypeInfo& GetTypeInfo(int id) noexcept { return GetTypes()[id]; }
+	static int GetTypeCount() noexcept { return static_cast<int>(GetTypes().size()); }
+	// -1 when no component type has this name (yet)
+	static int FindID(const std::string& name) noexcept;
+
 protected:
 	// component will also have an id
 	static int nextId;
+
+	static std::vector<ComponentTypeInfo>& GetTypes() noexcept;
+	static int RegisterType(std::string name, size_t size, std::shared_ptr<IPool>(*createPool)()) noexcept;
 };
 
 // Used to assign a unique id to a different component type class (class template)
@@ -45,11 +69,7 @@ class Component : public IComponent
 {
 public:
 	// Returns the unique id of the Component<T>
-	static int GetID() noexcept
-	{
-		static auto id = nextId++;
-		return id;
-	}
+	static int GetID() noexcept;
 };
 
 class Entity
@@ -110,9 +130,25 @@ public:
 	inline const size_t GetSystemEntitiesSize() const noexcept { return m_entities.size(); }
 	inline const Signature& GetComponentSignature() const noexcept { return m_componentSignature; }
 
+	// readable name of the system type (used by the profiler)
+	inline const std::string& GetName() const noexcept { return m_name; }
+	inline void SetName(const std::string& name) noexcept { m_name = name; }
+
 	// Defines the component type TComponent that entities must have to be considered by the system
 	template<typename TComponent> void RequireComponent() noexcept;
 
+	// removes every entity from the system (OnEntityRemoved is called for each of them)
+	void RemoveAllEntities() noexcept;
+	// replaces the entities of the system in this order, OnEntityRemoved is called for the ones that are not kept
+	void RestoreEntities(const std::vector<int>& entityIds, class Registry* registry) noexcept;
+
+	// called when an entity of the system is removed from it (destroyed or lost a required component)
+	virtual void OnEntityRemoved(Entity entity) noexcept {}
+
+	// the state a system keeps between updates (contacts, tick counters...), saved with a rollback snapshot
+	virtual void SaveState(BlobWriter& writer) const noexcept {}
+	virtual bool LoadState(BlobReader& reader) noexcept { return true; }
+
 	virtual void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept = 0;
 	virtual void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, 
 						SDL_Rect& camera, std::unique_ptr<Registry>& registry,
@@ -126,6 +162,7 @@ private:
 
 	Signature m_componentSignature;
 	std::vector<Entity> m_entities;
+	std::string m_name;
 
 };
 
@@ -136,6 +173,12 @@ public:
 	// virtual destructor so that derived classes can be deleted through a pointer to the base class
 	virtual ~IPool() noexcept = default;
 	virtual void RemoveEntityFromPool(int entityId) noexcept = 0;
+
+	// packed array and the entity id of each element, the ids read back must be unique and below numEntities
+	virtual void Serialize(BlobWriter& writer) const noexcept = 0;
+	virtual bool Deserialize(BlobReader& reader, uint32_t numEntities) noexcept = 0;
+	// entity id of each element, in the packed order
+	virtual const std::vector<int>& GetEntityIds() const noexcept = 0;
 };
 
 // A pool is a just a vector (contiguous data) of object of type T
@@ -155,13 +198,18 @@ public:
 	inline bool IsEmpty() const noexcept { return m_size == 0; }
 	inline int GetSize() const noexcept { return m_size; }
 	inline void Resize(int n) noexcept { m_data.resize(n); }
-	inline void Clear() noexcept { m_data.clear(); m_size = 0; }
+	inline void Clear() noexcept { m_data.clear(); m_size = 0; m_entityIdToIndex.clear(); m_indexToEntityId.clear(); }
 
 	inline void Add(T object) noexcept { m_data.emplace_back(object); }
 
+	inline bool Has(int entityId) const noexcept
+	{
+		return entityId >= 0 && entityId < static_cast<int>(m_entityIdToIndex.size()) && m_entityIdToIndex[entityId] != INVALID_INDEX;
+	}
+
 	void Set(int entityId, T object) noexcept 
 	{ 
-		if (m_entityIdToIndex.find(entityId) != m_entityIdToIndex.end())
+		if (Has(entityId))
 		{
 			// if the entity id already exists, then just update the object
 			int index = m_entityIdToIndex[entityId];
@@ -171,12 +219,14 @@ public:
 		{
 			// when adding a new object, we keep track of the entity id and the index
 			int index = m_size;
-			m_entityIdToIndex.emplace(entityId, index);
-			m_indexToEntityId.emplace(index, entityId);
-			if (index >= m_data.capacity())
+			if (entityId >= static_cast<int>(m_entityIdToIndex.size()))
+				m_entityIdToIndex.resize(entityId + 1, INVALID_INDEX);
+			m_entityIdToIndex[entityId] = index;
+			m_indexToEntityId.push_back(entityId);
+			if (index >= static_cast<int>(m_data.size()))
 			{
 				// if necessary, resize the vector
-				m_data.resize(m_size * 2);
+				m_data.resize(std::max(m_size * 2, index + 1));
 			}
 			m_data[index] = object;
 			m_size++;
@@ -196,36 +246,96 @@ public:
 		m_indexToEntityId[indexOfRemoved] = entityIdOfLastElement;
 
 		// Remove the entity id from the maps
-		m_entityIdToIndex.erase(entityId);
-		m_indexToEntityId.erase(indexOfLast);
+		m_entityIdToIndex[entityId] = INVALID_INDEX;
+		m_indexToEntityId.pop_back();
 
 		m_size--;
 	}
 
 	void RemoveEntityFromPool(int entityId) noexcept override
 	{
-		if (m_entityIdToIndex.find(entityId) != m_entityIdToIndex.end())
+		if (Has(entityId))
 			Remove(entityId);
 	}
 
+	// the entity must have the component, the first element is returned otherwise
 	inline T& Get(int entityId) noexcept 
 	{ 
-		int index = m_entityIdToIndex[entityId];
+		int index = Has(entityId) ? m_entityIdToIndex[entityId] : 0;
 		return static_cast<T&>(m_data[index]); 
 	}
 	
 	T& operator[] (unsigned int index) noexcept { return m_data[index]; }
 
+	void Serialize(BlobWriter& writer) const noexcept override
+	{
+		writer.Write(static_cast<uint32_t>(m_size));
+		writer.WriteBytes(m_indexToEntityId.data(), m_indexToEntityId.size() * sizeof(int));
+		ComponentSerializer<T>::Write(writer, m_data.data(), m_size);
+	}
+
+	// replaces the content of the pool. The entity ids are checked before anything changes, the components are read
+	// in place: a truncated component array leaves the pool partly overwritten (Registry::Deserialize reads a new pool)
+	bool Deserialize(BlobReader& reader, uint32_t numEntities) noexcept override
+	{
+		uint32_t size = 0;
+		if (!reader.Read(size) || size > numEntities || size > reader.GetRemainingSize() / sizeof(int))
+			return false;
+
+		std::vector<int> entityIds(size);
+		if (!reader.ReadBytes(entityIds.data(), entityIds.size() * sizeof(int)))
+			return false;
+
+		std::vector<int> entityIdToIndex(numEntities, INVALID_INDEX);
+		for (uint32_t index = 0; index < size; ++index)
+		{
+			const int entityId = entityIds[index];
+			if (entityId < 0 || static_cast<uint32_t>(entityId) >= numEntities || entityIdToIndex[entityId] != INVALID_INDEX)
+				return false;
+			entityIdToIndex[entityId] = static_cast<int>(index);
+		}
+
+		if (m_data.size() < size)
+			m_data.resize(size);
+		if (!ComponentSerializer<T>::Read(reader, m_data.data(), size))
+			return false;
+
+		m_size = static_cast<int>(size);
+		m_indexToEntityId = std::move(entityIds);
+		m_entityIdToIndex = std::move(entityIdToIndex);
+		return true;
+	}
+
+	inline const std::vector<int>& GetEntityIds() const noexcept override { return m_indexToEntityId; }
+
 private:
 
+	static constexpr int INVALID_INDEX = -1;
+
 	// we keep track of the vector of component objects and their correct size
 	std::vector<T> m_data;
 	int m_size;
 
-	// map to keep track of entity ids per index so the vector is always packed
-	std::unordered_map<int, int> m_entityIdToIndex;
-	std::unordered_map<int, int> m_indexToEntityId;
+	// sparse array of the index per entity id (INVALID_INDEX without component) and the entity id per index,
+	// so the vector is always packed
+	std::vector<int> m_entityIdToIndex;
+	std::vector<int> m_indexToEntityId;
+
+};
+
+// part of a RegistrySnapshot, shared by the consecutive snapshots in which it did not change
+struct SnapshotSection
+{
+	std::vector<uint8_t> bytes;
+	std::vector<sol::protected_function> scripts; // functions of the script components, referenced by index in the bytes
+};
 
+// in-memory snapshot of a Registry for the rollback, it is only restored in the process that captured it
+struct RegistrySnapshot
+{
+	std::shared_ptr<const SnapshotSection> entities; // signatures, free and pending ids, tags, groups, entities per system
+	std::shared_ptr<const SnapshotSection> systems; // state of each system
+	std::vector<std::shared_ptr<const SnapshotSection>> pools; // [component id], null without pool
 };
 
 // Entity Manager or world class
@@ -286,6 +396,18 @@ public:
 	// iterate through all the system and subscribe to their events
 	void SubscribeToEvents(std::unique_ptr<EventBus>& eventBus) noexcept;
 
+	// Snapshot of the entities, their components, tags and groups (not the systems) in a versioned binary blob.
+	// The Lua functions of the scripts are loaded back in the given Lua state, the blob is only read by the same build
+	void Serialize(std::vector<uint8_t>& blob) const noexcept;
+	bool Deserialize(const std::vector<uint8_t>& blob, lua_State* lua = nullptr) noexcept;
+
+	// Rollback snapshot of the entities, the systems and each component pool in separate sections. A section with the
+	// same bytes as in the previous snapshot is shared with it, so a ring of snapshots mostly holds what changed
+	void Capture(RegistrySnapshot& snapshot, const RegistrySnapshot* previous = nullptr) noexcept;
+	// Rewinds the registry from current (the snapshot it was last captured in or restored to, unchanged since) to snapshot.
+	// Only the sections that differ between the two are read
+	bool Restore(const RegistrySnapshot& snapshot, const RegistrySnapshot& current) noexcept;
+
 	// Here is where we actually insert/delete the entities that are waiting to be added/removed
 	// We do this because we don't want to confuse our Systems by adding/removing entities in the middle
 	// of the frame logic. Therefore, we will wait until the end of the frame to perate and perform the
@@ -331,8 +453,36 @@ private:
 	
 	// deque of available free entity ids that were previously removed
 	std::deque<int> m_freeEntityIDs; 
+
+	// buffer Capture writes the sections to, kept while the captured sections are shared with the previous snapshot
+	std::shared_ptr<SnapshotSection> m_snapshotScratch;
+
+	void SetEntities(std::vector<Signature> signatures, const std::vector<int>& freeIds, const std::vector<int>& addedIds,
+		const std::vector<int>& killedIds, const std::vector<std::pair<int, std::string>>& tags,
+		const std::vector<std::pair<std::string, std::vector<int>>>& groups) noexcept;
+	void RestoreGroups(const std::vector<std::pair<std::string, std::vector<int>>>& groups) noexcept;
+
+	void WriteEntities(BlobWriter& writer) const noexcept;
+	void WriteEntitySection(BlobWriter& writer) const noexcept;
+	bool ReadEntitySection(BlobReader& reader) noexcept;
+	void WriteSystemSection(BlobWriter& writer) const noexcept;
+	bool ReadSystemSection(BlobReader& reader) noexcept;
+	template <typename TWrite>
+	void CaptureSection(std::shared_ptr<const SnapshotSection>& section, const std::shared_ptr<const SnapshotSection>& previous, TWrite write) noexcept;
+
+	static constexpr uint16_t SNAPSHOT_VERSION = 1;
 };
 
+/////////////// Component Template Methods Implementation ///////////////
+
+template <typename T>
+int Component<T>::GetID() noexcept
+{
+	static auto id = RegisterType(Profiler::GetTypeName(typeid(T)), sizeof(T),
+		[]() -> std::shared_ptr<IPool> { return std::make_shared<Pool<T>>(); });
+	return id;
+}
+
 /////////////// Pool Template Methods Implementation ///////////////
 
 
@@ -358,6 +508,7 @@ void Registry::AddSystem(TArgs&&... args) noexcept
 {
 	// Create a new system object of type TSystem, and forward the various parameters to the constructor
 	std::shared_ptr<TSystem> newSystem = std::make_shared<TSystem>(std::forward<TArgs>(args)...);
+	newSystem->SetName(Profiler::GetTypeName(typeid(TSystem)));
 
 	// Add the new system to the systems map
 	// key: typeid(TSystem) (type_index)
@@ -463,7 +614,7 @@ void Registry::RemoveComponent(Entity entity) noexcept
 	// Get the pool of component values for that component type
 	std::shared_ptr<Pool<TComponent>> componentPool = std::static_pointer_cast<Pool<TComponent>>(m_componentPools[componentId]);
 	// Remove the component from the the component list for that entity
-	componentId.Remove(entityId);
+	componentPool->RemoveEntityFromPool(entityId);
 	
 	// set this comonent signature for that entity to false
 	m_entityComponentSignatures[entityId].set(componentId, false);
@@ -0,0 +1,381 @@
+#include "Serialization.h"
+
+namespace
+{
+	// the fixed size members of a sprite, written in one block after its asset id
+	struct SpriteRecord
+	{
+		int width;
+		int height;
+		bool isFixed;
+		int zIndex;
+		SDL_RendererFlip flip;
+		SDL_Rect srcRect;
+	};
+}
+
+/////////////// BlobWriter ///////////////
+
+void BlobWriter::WriteString(const std::string& value) noexcept
+{
+	Write(static_cast<uint32_t>(value.size()));
+	WriteBytes(value.data(), value.size());
+}
+
+/// <summary>
+/// Writes the index of the function in the script table, the functions shared by many entities are dumped once
+/// </summary>
+/// <param name="func"></param>
+void BlobWriter::WriteScript(const sol::protected_function& func) noexcept
+{
+	int32_t index = -1;
+	if (func.valid())
+	{
+		const void* pointer = func.pointer();
+		auto found = m_scriptIndices.find(pointer);
+		if (found != m_scriptIndices.end())
+		{
+			index = found->second;
+		}
+		else
+		{
+			std::string bytecode = DumpLuaFunction(func);
+			if (!bytecode.empty())
+			{
+				index = static_cast<int32_t>(m_scripts.size());
+				m_scripts.push_back(std::move(bytecode));
+			}
+			m_scriptIndices.emplace(pointer, index);
+		}
+	}
+	Write(index);
+}
+
+/////////////// BlobReader ///////////////
+
+bool BlobReader::ReadString(std::string& value) noexcept
+{
+	uint32_t size = 0;
+	if (!Read(size) || size > m_size - m_offset)
+	{
+		m_hasFailed = true;
+		return false;
+	}
+	value.assign(reinterpret_cast<const char*>(m_data + m_offset), size);
+	m_offset += size;
+	return true;
+}
+
+void BlobReader::ReadScript(sol::protected_function& func) noexcept
+{
+	int32_t index = -1;
+	if (!Read(index))
+		return;
+	func = sol::lua_nil;
+	if (index < 0)
+		return;
+
+	if (m_scriptReferences)
+	{
+		if (index < static_cast<int32_t>(m_scriptReferences->size()))
+			func = (*m_scriptReferences)[index];
+		else
+			m_hasFailed = true;
+		return;
+	}
+	m_scriptFixups.push_back({ &func, index });
+}
+
+/// <summary>
+/// Reads the script table and sets the functions of the scripts read so far. The functions are loaded from
+/// their bytecode with the globals of the Lua state as environment (other upvalues are nil)
+/// </summary>
+/// <returns></returns>
+bool BlobReader::ResolveScripts() noexcept
+{
+	// every script is at least its u32 bytecode size, a corrupted count must not size an allocation past the blob
+	uint32_t scriptCount = 0;
+	if (!Read(scriptCount) || scriptCount > GetRemainingSize() / sizeof(uint32_t))
+	{
+		m_hasFailed = true;
+		return false;
+	}
+
+	std::vector<sol::protected_function> scripts(scriptCount);
+	std::string bytecode;
+	for (uint32_t i = 0; i < scriptCount; ++i)
+	{
+		if (!ReadString(bytecode))
+			return false;
+		if (!m_lua)
+			continue;
+
+		if (luaL_loadbuffer(m_lua, bytecode.data(), bytecode.size(), "=snapshot") != LUA_OK)
+		{
+			Logger::Error("Error loading a script of the registry snapshot: " + std::string(lua_tostring(m_lua, -1)));
+			lua_pop(m_lua, 1);
+			continue;
+		}
+		scripts[i] = sol::protected_function(m_lua, -1);
+		lua_pop(m_lua, 1);
+	}
+
+	if (!m_lua && !m_scriptFixups.empty())
+		Logger::Error("Registry snapshot restored without a Lua state, " + std::to_string(m_scriptFixups.size()) + " scripts are nil");
+
+	for (const auto& fixup : m_scriptFixups)
+	{
+		if (fixup.index >= static_cast<int32_t>(scriptCount))
+		{
+			m_hasFailed = true;
+			return false;
+		}
+		*fixup.func = scripts[fixup.index];
+	}
+	m_scriptFixups.clear();
+	return true;
+}
+
+/////////////// Lua functions ///////////////
+
+std::string DumpLuaFunction(const sol::protected_function& func) noexcept
+{
+	std::string bytecode;
+	if (!func.valid())
+		return bytecode;
+
+	lua_State* state = func.lua_state();
+	func.push(state);
+	if (lua_isfunction(state, -1) && !lua_iscfunction(state, -1))
+	{
+		const lua_Writer writer = [](lua_State*, const void* data, size_t size, void* output) -> int
+		{
+			static_cast<std::string*>(output)->append(static_cast<const char*>(data), size);
+			return 0;
+		};
+#ifdef ENGINE_USE_LUAJIT
+		lua_dump(state, writer, &bytecode);
+#else
+		lua_dump(state, writer, &bytecode, 0);
+#endif
+	}
+	lua_pop(state, 1);
+	return bytecode;
+}
+
+/////////////// Component serializers ///////////////
+
+void ComponentSerializer<SpriteComponent>::Write(BlobWriter& writer, const SpriteComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const SpriteComponent& sprite = components[i];
+		writer.WriteString(sprite.assetId);
+		// zeroed padding, the same registry always gives the same bytes
+		SpriteRecord record;
+		std::memset(&record, 0, sizeof(record));
+		record.width = sprite.m_width;
+		record.height = sprite.m_height;
+		record.isFixed = sprite.m_isFixed;
+		record.zIndex = sprite.m_zIndex;
+		record.flip = sprite.m_flip;
+		record.srcRect = sprite.m_srcRect;
+		writer.Write(record);
+	}
+}
+
+bool ComponentSerializer<SpriteComponent>::Read(BlobReader& reader, SpriteComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		SpriteComponent& sprite = components[i];
+		SpriteRecord record;
+		if (!reader.ReadString(sprite.assetId) || !reader.Read(record))
+			return false;
+		sprite.m_width = record.width;
+		sprite.m_height = record.height;
+		sprite.m_isFixed = record.isFixed;
+		sprite.m_zIndex = record.zIndex;
+		sprite.m_flip = record.flip;
+		sprite.m_srcRect = record.srcRect;
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<TilemapComponent>::Write(BlobWriter& writer, const TilemapComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const TilemapComponent& tilemap = components[i];
+		writer.Write(static_cast<uint32_t>(tilemap.tiles.size()));
+		writer.WriteBytes(tilemap.tiles.data(), tilemap.tiles.size() * sizeof(uint16_t));
+		writer.Write(tilemap.numRows);
+		writer.Write(tilemap.numCols);
+		writer.Write(tilemap.tilesetColumns);
+	}
+}
+
+bool ComponentSerializer<TilemapComponent>::Read(BlobReader& reader, TilemapComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		TilemapComponent& tilemap = components[i];
+		uint32_t tileCount = 0;
+		if (!reader.Read(tileCount) || tileCount > reader.GetRemainingSize() / sizeof(uint16_t))
+			return false;
+		tilemap.tiles.resize(tileCount);
+		reader.ReadBytes(tilemap.tiles.data(), tileCount * sizeof(uint16_t));
+		reader.Read(tilemap.numRows);
+		reader.Read(tilemap.numCols);
+		reader.Read(tilemap.tilesetColumns);
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<BoxColliderComponent>::Write(BlobWriter& writer, const BoxColliderComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const BoxColliderComponent& collider = components[i];
+		writer.Write(collider.m_width);
+		writer.Write(collider.m_height);
+		writer.Write(collider.m_offset);
+		writer.Write(collider.m_isTrigger);
+		writer.Write(collider.m_layer);
+		writer.Write(collider.m_mask);
+		writer.Write(collider.m_isContinuous);
+		writer.Write(collider.m_lastPosition);
+		writer.Write(collider.m_hasLastPosition);
+	}
+}
+
+bool ComponentSerializer<BoxColliderComponent>::Read(BlobReader& reader, BoxColliderComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		BoxColliderComponent& collider = components[i];
+		reader.Read(collider.m_width);
+		reader.Read(collider.m_height);
+		reader.Read(collider.m_offset);
+		reader.Read(collider.m_isTrigger);
+		reader.Read(collider.m_layer);
+		reader.Read(collider.m_mask);
+		reader.Read(collider.m_isContinuous);
+		reader.Read(collider.m_lastPosition);
+		reader.Read(collider.m_hasLastPosition);
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<ProjectileEmitterComponent>::Write(BlobWriter& writer, const ProjectileEmitterComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const ProjectileEmitterComponent& emitter = components[i];
+		writer.Write(emitter.m_projectileVelocity);
+		writer.Write(emitter.m_repeatFrequency);
+		writer.Write(emitter.m_projectileDuraiton);
+		writer.Write(emitter.m_hitPercentDamage);
+		writer.Write(emitter.m_isFriendly);
+		writer.Write(emitter.m_lastEmissionTime);
+		writer.Write(emitter.m_isManual);
+	}
+}
+
+bool ComponentSerializer<ProjectileEmitterComponent>::Read(BlobReader& reader, ProjectileEmitterComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		ProjectileEmitterComponent& emitter = components[i];
+		reader.Read(emitter.m_projectileVelocity);
+		reader.Read(emitter.m_repeatFrequency);
+		reader.Read(emitter.m_projectileDuraiton);
+		reader.Read(emitter.m_hitPercentDamage);
+		reader.Read(emitter.m_isFriendly);
+		reader.Read(emitter.m_lastEmissionTime);
+		reader.Read(emitter.m_isManual);
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<ProjectileComponent>::Write(BlobWriter& writer, const ProjectileComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const ProjectileComponent& projectile = components[i];
+		writer.Write(projectile.m_isFriendly);
+		writer.Write(projectile.m_hitPercentDamage);
+		writer.Write(projectile.m_duration);
+		writer.Write(projectile.m_startTime);
+	}
+}
+
+bool ComponentSerializer<ProjectileComponent>::Read(BlobReader& reader, ProjectileComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		ProjectileComponent& projectile = components[i];
+		reader.Read(projectile.m_isFriendly);
+		reader.Read(projectile.m_hitPercentDamage);
+		reader.Read(projectile.m_duration);
+		reader.Read(projectile.m_startTime);
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<TextLabelComponent>::Write(BlobWriter& writer, const TextLabelComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const TextLabelComponent& label = components[i];
+		writer.Write(label.m_position);
+		writer.WriteString(label.m_text);
+		writer.WriteString(label.assetId);
+		writer.Write(label.m_color);
+		writer.Write(label.m_isFixed);
+	}
+}
+
+bool ComponentSerializer<TextLabelComponent>::Read(BlobReader& reader, TextLabelComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		TextLabelComponent& label = components[i];
+		reader.Read(label.m_position);
+		reader.ReadString(label.m_text);
+		reader.ReadString(label.assetId);
+		reader.Read(label.m_color);
+		reader.Read(label.m_isFixed);
+	}
+	return !reader.HasFailed();
+}
+
+void ComponentSerializer<ScriptComponent>::Write(BlobWriter& writer, const ScriptComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const ScriptComponent& script = components[i];
+		writer.WriteScript(script.func);
+		writer.Write(script.batch);
+		writer.Write(script.updateInterval);
+		writer.Write(script.lastRunTick);
+		writer.Write(script.isCoroutine);
+		writer.Write(script.levelEntity);
+	}
+}
+
+bool ComponentSerializer<ScriptComponent>::Read(BlobReader& reader, ScriptComponent* components, size_t count) noexcept
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		ScriptComponent& script = components[i];
+		reader.ReadScript(script.func);
+		reader.Read(script.batch);
+		reader.Read(script.updateInterval);
+		reader.Read(script.lastRunTick);
+		reader.Read(script.isCoroutine);
+		reader.Read(script.levelEntity);
+		script.thread = sol::thread();
+	}
+	return !reader.HasFailed();
+}
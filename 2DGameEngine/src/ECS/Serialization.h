@@ -0,0 +1,203 @@
+#pragma once
+#ifndef SERIALIZATION_H
+#define SERIALIZATION_H
+
+#include "../Components/Components.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>
+/// Appends the values of a Registry snapshot to a byte buffer, in the native byte order
+/// (a snapshot is read back by the same build, not exchanged between platforms).
+/// Lua functions are kept once per function in a script table, written after the components,
+/// or in a table of references when the snapshot stays in the same process (rollback)
+/// </summary>
+class BlobWriter
+{
+public:
+
+	explicit BlobWriter(std::vector<uint8_t>& buffer) noexcept : m_buffer(buffer) {}
+
+	inline void WriteBytes(const void* data, size_t size) noexcept
+	{
+		const auto* bytes = static_cast<const uint8_t*>(data);
+		m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+	}
+
+	template <typename T>
+	void Write(const T& value) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be written as bytes");
+		WriteBytes(&value, sizeof(T));
+	}
+
+	void WriteString(const std::string& value) noexcept;
+
+	// index of the function in the script table, -1 for nil or a C function
+	void WriteScript(const sol::protected_function& func) noexcept;
+
+	inline const std::vector<std::string>& GetScripts() const noexcept { return m_scripts; }
+
+	// the functions are referenced instead of dumped, the bytes only hold their index in this table
+	inline void SetScriptReferences(std::vector<sol::protected_function>* references) noexcept { m_scriptReferences = references; }
+
+private:
+
+	std::vector<uint8_t>& m_buffer;
+	std::vector<sol::protected_function>* m_scriptReferences = nullptr;
+	std::vector<std::string> m_scripts; // bytecode per function
+	std::unordered_map<const void*, int32_t> m_scriptIndices; // Lua function -> index in m_scripts
+
+};
+
+/// <summary>
+/// Reads the values written by a BlobWriter. Every read checks the remaining size, a failed read leaves the reader failed.
+/// The script indices are resolved once the script table is read, by loading the bytecode in the given Lua state
+/// </summary>
+class BlobReader
+{
+public:
+
+	BlobReader(const uint8_t* data, size_t size, lua_State* lua = nullptr) noexcept :
+		m_data(data), m_size(size), m_lua(lua) {}
+
+	inline bool ReadBytes(void* output, size_t size) noexcept
+	{
+		if (m_hasFailed || size > m_size - m_offset)
+		{
+			m_hasFailed = true;
+			return false;
+		}
+		if (size > 0)
+			std::memcpy(output, m_data + m_offset, size);
+		m_offset += size;
+		return true;
+	}
+
+	template <typename T>
+	bool Read(T& value) noexcept
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable values can be read as bytes");
+		return ReadBytes(&value, sizeof(T));
+	}
+
+	bool ReadString(std::string& value) noexcept;
+
+	// the function is set by ResolveScripts, or right away from the table of references
+	void ReadScript(sol::protected_function& func) noexcept;
+	bool ResolveScripts() noexcept;
+
+	inline void SetScriptReferences(const std::vector<sol::protected_function>* references) noexcept { m_scriptReferences = references; }
+
+	inline bool HasFailed() const noexcept { return m_hasFailed; }
+	inline bool IsAtEnd() const noexcept { return m_offset == m_size; }
+	inline size_t GetRemainingSize() const noexcept { return m_size - m_offset; }
+
+private:
+
+	struct ScriptFixup
+	{
+		sol::protected_function* func;
+		int32_t index;
+	};
+
+	const uint8_t* m_data;
+	size_t m_size;
+	size_t m_offset = 0;
+	bool m_hasFailed = false;
+
+	lua_State* m_lua;
+	std::vector<ScriptFixup> m_scriptFixups;
+	const std::vector<sol::protected_function>* m_scriptReferences = nullptr;
+
+};
+
+// bytecode of a Lua function, empty for nil or a C function
+std::string DumpLuaFunction(const sol::protected_function& func) noexcept;
+
+/// <summary>
+/// Writes and reads the packed array of a component pool. Trivially copyable components are copied as one block,
+/// the components with strings, containers or Lua members have a specialization below, and so do the components
+/// with padding (written member by member, the same components always give the same bytes)
+/// </summary>
+template <typename T>
+struct ComponentSerializer
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+		"a component with std::string, container or Lua members needs a ComponentSerializer specialization");
+
+	static void Write(BlobWriter& writer, const T* components, size_t count) noexcept
+	{
+		writer.WriteBytes(components, sizeof(T) * count);
+	}
+
+	static bool Read(BlobReader& reader, T* components, size_t count) noexcept
+	{
+		return reader.ReadBytes(components, sizeof(T) * count);
+	}
+};
+
+template <>
+struct ComponentSerializer<SpriteComponent>
+{
+	static void Write(BlobWriter& writer, const SpriteComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, SpriteComponent* components, size_t count) noexcept;
+};
+
+template <>
+struct ComponentSerializer<TilemapComponent>
+{
+	static void Write(BlobWriter& writer, const TilemapComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, TilemapComponent* components, size_t count) noexcept;
+};
+
+template <>
+struct ComponentSerializer<TextLabelComponent>
+{
+	static void Write(BlobWriter& writer, const TextLabelComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, TextLabelComponent* components, size_t count) noexcept;
+};
+
+template <>
+struct ComponentSerializer<BoxColliderComponent>
+{
+	static void Write(BlobWriter& writer, const BoxColliderComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, BoxColliderComponent* components, size_t count) noexcept;
+};
+
+template <>
+struct ComponentSerializer<ProjectileEmitterComponent>
+{
+	static void Write(BlobWriter& writer, const ProjectileEmitterComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, ProjectileEmitterComponent* components, size_t count) noexcept;
+};
+
+template <>
+struct ComponentSerializer<ProjectileComponent>
+{
+	static void Write(BlobWriter& writer, const ProjectileComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, ProjectileComponent* components, size_t count) noexcept;
+};
+
+// no members, nothing to write
+template <>
+struct ComponentSerializer<CameraFollowComponent>
+{
+	static void Write(BlobWriter&, const CameraFollowComponent*, size_t) noexcept {}
+	static bool Read(BlobReader&, CameraFollowComponent*, size_t) noexcept { return true; }
+};
+
+// a running coroutine is not saved, the script starts over from its function
+template <>
+struct ComponentSerializer<ScriptComponent>
+{
+	static void Write(BlobWriter& writer, const ScriptComponent* components, size_t count) noexcept;
+	static bool Read(BlobReader& reader, ScriptComponent* components, size_t count) noexcept;
+};
+
+#endif // SERIALIZATION_H
@@ -0,0 +1,4 @@
+#include "Event.h"
+
+// define static variables
+int IEventType::nextId = 0;
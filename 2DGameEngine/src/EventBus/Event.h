@@ -8,4 +8,25 @@ public:
 	Event() noexcept = default;
 };
 
-#endif // EVENT_H
\ No newline at end of file
+// Base class of the event type ids
+struct IEventType
+{
+protected:
+	// event types also have an id
+	static int nextId;
+};
+
+// Used to assign a unique id to each event type (same idea as Component<T>::GetID)
+template <typename TEvent>
+class EventType : public IEventType
+{
+public:
+	// Returns the unique id of the EventType<TEvent>
+	static int GetID() noexcept
+	{
+		static auto id = nextId++;
+		return id;
+	}
+};
+
+#endif // EVENT_H
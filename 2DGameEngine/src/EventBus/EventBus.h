@@ -4,57 +4,169 @@
 
 #include "../Logger/Logger.h"
 #include "../EventBus/Event.h"
+#include "../Profiler/Profiler.h"
 
 #include <string>
 #include <vector>
-#include <functional>
-#include <map>
-#include <typeindex>
 #include <memory>
-#include <list>
+#include <utility>
+#include <iterator>
 
-class IEventCallback
+// splits a member function pointer type into its owner and argument types
+template<typename TCallback>
+struct MemberCallbackTraits;
+
+template<typename TOwner, typename TArgument>
+struct MemberCallbackTraits<void(TOwner::*)(TArgument&)>
+{
+	typedef TOwner Owner;
+	typedef TArgument Argument;
+};
+
+template<typename TOwner, typename TArgument>
+struct MemberCallbackTraits<void(TOwner::*)(TArgument&) noexcept>
+{
+	typedef TOwner Owner;
+	typedef TArgument Argument;
+};
+
+/// <summary>
+/// Small delegate: the owner object and a stub function generated for the member function (known at compile time).
+/// Stored by value in the handler arrays, so a subscription does not allocate and an invoke is one plain
+/// function pointer call with the handler body inlined into the stub
+/// </summary>
+class EventDelegate
 {
 public:
-	virtual ~IEventCallback() noexcept = default;
 
-	void Invoke(Event& e) noexcept
+	template<auto CallbackFunction>
+	static EventDelegate Create(typename MemberCallbackTraits<decltype(CallbackFunction)>::Owner* ownerInstance) noexcept
 	{
-		// invoke the callback function
-		Call(e);
+		EventDelegate delegate;
+		delegate.m_ownerInstance = ownerInstance;
+		delegate.m_stub = &Stub<CallbackFunction>;
+		return delegate;
 	}
 
+	inline void Invoke(void* argument) const noexcept { m_stub(m_ownerInstance, argument); }
+
 private:
 
-	virtual void Call(Event& e) noexcept = 0;
+	typedef void(*StubFunction)(void*, void*);
+
+	template<auto CallbackFunction>
+	static void Stub(void* ownerInstance, void* argument) noexcept
+	{
+		typedef MemberCallbackTraits<decltype(CallbackFunction)> Traits;
+		(static_cast<typename Traits::Owner*>(ownerInstance)->*CallbackFunction)(*static_cast<typename Traits::Argument*>(argument));
+	}
 
+	void* m_ownerInstance = nullptr;
+	StubFunction m_stub = nullptr;
 };
 
-// wrapper around the function pointer
-template<typename TOwner, typename TEvent>
-class EventCallback : public IEventCallback
+typedef std::vector<EventDelegate> DelegateList;
+
+// contiguous view over a batch of queued events of the same type
+template<typename TEvent>
+class EventSpan
 {
+public:
+
+	typedef TEvent EventType;
+
+	EventSpan(TEvent* events, size_t size) noexcept : m_events(events), m_size(size) {}
+
+	inline TEvent* begin() const noexcept { return m_events; }
+	inline TEvent* end() const noexcept { return m_events + m_size; }
+	inline size_t size() const noexcept { return m_size; }
+	inline bool empty() const noexcept { return m_size == 0; }
+	inline TEvent& operator[](size_t index) const noexcept { return m_events[index]; }
+
 private:
-	typedef void(TOwner::*CallbackFunction)(TEvent&);
 
-	TOwner* m_ownerInstance;
-	CallbackFunction m_callbackFunction;
+	TEvent* m_events;
+	size_t m_size;
+};
+
+// interface for all the event queues (one queue per event type)
+class IEventQueue
+{
+public:
+	virtual ~IEventQueue() noexcept = default;
+	// hands the queued events to the batch handlers, then to the single event handlers one by one
+	// (the tables are indexed on every call, a handler may subscribe and grow them)
+	virtual void Dispatch(const std::vector<DelegateList>& handlerTable, const std::vector<DelegateList>& batchHandlerTable, int eventId) noexcept = 0;
+	virtual void Clear() noexcept = 0;
+	virtual void SetProducerCount(size_t producerCount) noexcept = 0;
+};
+
+// contiguous queue of events of the type TEvent
+template<typename TEvent>
+class EventQueue : public IEventQueue
+{
+public:
 
-	virtual void Call(Event& e) noexcept override
+	template<typename... TArgs>
+	inline void Push(TArgs&&... args) noexcept { m_events.emplace_back(std::forward<TArgs>(args)...); }
+
+	// every producer only touches its own buffer, so pushing from several threads needs no lock and no atomic
+	template<typename... TArgs>
+	inline void PushConcurrent(size_t producerIndex, TArgs&&... args) noexcept
 	{
-		std::invoke(m_callbackFunction, m_ownerInstance, static_cast<TEvent&>(e));
+		m_producerBuffers[producerIndex].events.emplace_back(std::forward<TArgs>(args)...);
 	}
 
-public:
+	void Dispatch(const std::vector<DelegateList>& handlerTable, const std::vector<DelegateList>& batchHandlerTable, int eventId) noexcept override
+	{
+		// events queued by the handlers go to the other buffer and wait for the next sync point
+		m_dispatching.swap(m_events);
 
-	EventCallback(TOwner* ownerInstance, CallbackFunction callbackFunction) noexcept
-		: m_ownerInstance(ownerInstance), m_callbackFunction(callbackFunction) {}
+		// drain the producer buffers after the main thread events, in producer order,
+		// so the dispatch order does not depend on the thread scheduling
+		for (auto& producerBuffer : m_producerBuffers)
+		{
+			m_dispatching.insert(m_dispatching.end(), std::make_move_iterator(producerBuffer.events.begin()), std::make_move_iterator(producerBuffer.events.end()));
+			producerBuffer.events.clear();
+		}
 
-	virtual ~EventCallback() noexcept override = default;
+		if (m_dispatching.empty()) return;
 
-};
+		EventSpan<TEvent> events(m_dispatching.data(), m_dispatching.size());
+		for (size_t i = 0; i < batchHandlerTable[eventId].size(); ++i)
+			batchHandlerTable[eventId][i].Invoke(&events);
+
+		for (auto& event : m_dispatching)
+		{
+			for (size_t i = 0; i < handlerTable[eventId].size(); ++i)
+				handlerTable[eventId][i].Invoke(&event);
+		}
+
+		// clear() keeps the capacity, so a steady flow of events does not allocate
+		m_dispatching.clear();
+	}
+
+	void Clear() noexcept override
+	{
+		m_events.clear();
+		for (auto& producerBuffer : m_producerBuffers)
+			producerBuffer.events.clear();
+	}
 
-typedef std::list<std::unique_ptr<IEventCallback>> HandlerList;
+	void SetProducerCount(size_t producerCount) noexcept override { m_producerBuffers.resize(producerCount); }
+
+private:
+
+	// one cache line per producer buffer so the producers do not write to the same line
+	struct alignas(64) ProducerBuffer
+	{
+		std::vector<TEvent> events;
+	};
+
+	std::vector<TEvent> m_events;
+	std::vector<TEvent> m_dispatching;
+	std::vector<ProducerBuffer> m_producerBuffers;
+};
 
 class EventBus
 {
@@ -65,28 +177,40 @@ public:
 	~EventBus() noexcept { Logger::Log("EventBus destructor called"); }
 
 	/// <summary>
-	/// Clear all subscribers
+	/// Clear all subscribers and the queued events
 	/// </summary>
 	void Reset() noexcept
 	{
-		m_subscribers.clear();
+		for (auto& handlers : m_handlers)
+			handlers.clear();
+		for (auto& batchHandlers : m_batchHandlers)
+			batchHandlers.clear();
+		for (int eventId : m_queueOrder)
+			m_queues[eventId]->Clear();
 	}
 
 	/// <summary>
-	/// Subscribe to an event, a listener will be added to the event
+	/// Subscribe to an event, a listener will be added to the event (the event type is deduced from the callback)
 	/// </summary>
 	/// <typeparam name="T"></typeparam>
-	/// example: eventBus->SubscribeEvent<CollisionEvent>(this, &Game::OnCollision);
-	template<typename TEvent, typename TOwner>
-	void SubscribeEvent(TOwner* ownerInstance, void(TOwner::*callbackFunction)(TEvent&)) noexcept
+	/// example: eventBus->SubscribeEvent<&DamageSystem::OnCollision>(this);
+	template<auto CallbackFunction>
+	void SubscribeEvent(typename MemberCallbackTraits<decltype(CallbackFunction)>::Owner* ownerInstance) noexcept
 	{
-		if (!m_subscribers[typeid(TEvent)].get())
-		{
-			// create a new list of handlers for the event
-			m_subscribers[typeid(TEvent)] = std::make_unique<HandlerList>();
-		}
-		auto subscriber = std::make_unique<EventCallback<TOwner, TEvent>>(ownerInstance, callbackFunction);
-		m_subscribers[typeid(TEvent)]->push_back(std::move(subscriber));
+		typedef typename MemberCallbackTraits<decltype(CallbackFunction)>::Argument TEvent;
+		GetSlot(m_handlers, EventType<TEvent>::GetID()).push_back(EventDelegate::Create<CallbackFunction>(ownerInstance));
+	}
+
+	/// <summary>
+	/// Subscribe to batches of an event, the listener receives all the events queued since the last sync point in one call
+	/// (published events are received as batches of one)
+	/// </summary>
+	/// example: eventBus->SubscribeEventBatch<&DamageSystem::OnCollisions>(this);
+	template<auto CallbackFunction>
+	void SubscribeEventBatch(typename MemberCallbackTraits<decltype(CallbackFunction)>::Owner* ownerInstance) noexcept
+	{
+		typedef typename MemberCallbackTraits<decltype(CallbackFunction)>::Argument TEventSpan;
+		GetSlot(m_batchHandlers, EventType<typename TEventSpan::EventType>::GetID()).push_back(EventDelegate::Create<CallbackFunction>(ownerInstance));
 	}
 
 	/// <summary>
@@ -96,36 +220,165 @@ public:
 	template<typename TEvent>
 	void UnsubscribeEvent() noexcept
 	{
-		if (m_subscribers[typeid(TEvent)].get())
-		{
-			m_subscribers[typeid(TEvent)]->clear();
-		}
+		const int eventId = EventType<TEvent>::GetID();
+		if (eventId < static_cast<int>(m_handlers.size()))
+			m_handlers[eventId].clear();
+		if (eventId < static_cast<int>(m_batchHandlers.size()))
+			m_batchHandlers[eventId].clear();
 	}
 
 	/// <summary>
-	/// Publish an event, all listeners will be notified
+	/// Checks if anybody listens to an event type (single or batch handlers)
+	/// </summary>
+	template<typename TEvent>
+	bool HasSubscribers() const noexcept
+	{
+		const int eventId = EventType<TEvent>::GetID();
+		return (eventId < static_cast<int>(m_handlers.size()) && !m_handlers[eventId].empty()) ||
+			   (eventId < static_cast<int>(m_batchHandlers.size()) && !m_batchHandlers[eventId].empty());
+	}
+
+	/// <summary>
+	/// Publish an event, all listeners will be notified immediately
 	/// </summary>
 	/// example: eventBus->PublishEvent<CollisionEvent>(entityA, entityB);
 	template<typename TEvent, typename... TArgs>
 	void PublishEvent(TArgs&&... args) noexcept
 	{
-		auto handlers = m_subscribers[typeid(TEvent)].get();
-		if (handlers)
+		const int eventId = EventType<TEvent>::GetID();
+		const bool hasHandlers = eventId < static_cast<int>(m_handlers.size()) && !m_handlers[eventId].empty();
+		const bool hasBatchHandlers = eventId < static_cast<int>(m_batchHandlers.size()) && !m_batchHandlers[eventId].empty();
+		if (!hasHandlers && !hasBatchHandlers)
+			return;
+
+		ProfileScope dispatchScope(GetEventName<TEvent>());
+
+		// every handler receives the same event object
+		// the tables are indexed on every call, a handler may subscribe and grow them
+		TEvent event(std::forward<TArgs>(args)...);
+		if (hasHandlers)
+		{
+			for (size_t i = 0; i < m_handlers[eventId].size(); ++i)
+				m_handlers[eventId][i].Invoke(&event);
+		}
+		if (hasBatchHandlers)
+		{
+			EventSpan<TEvent> events(&event, 1);
+			for (size_t i = 0; i < m_batchHandlers[eventId].size(); ++i)
+				m_batchHandlers[eventId][i].Invoke(&events);
+		}
+	}
+
+	/// <summary>
+	/// Queue an event, the listeners will be notified at the next DispatchQueuedEvents() call (sync point)
+	/// example: eventBus->QueueEvent<CollisionEvent>(entityA, entityB);
+	/// </summary>
+	template<typename TEvent, typename... TArgs>
+	void QueueEvent(TArgs&&... args) noexcept
+	{
+		GetQueue<TEvent>().Push(std::forward<TArgs>(args)...);
+	}
+
+	/// <summary>
+	/// Sets the number of producers that can queue events concurrently (main thread, while no producer is running)
+	/// </summary>
+	void SetProducerCount(size_t producerCount) noexcept
+	{
+		m_producerCount = producerCount;
+		for (int eventId : m_queueOrder)
+			m_queues[eventId]->SetProducerCount(producerCount);
+	}
+
+	inline size_t GetProducerCount() const noexcept { return m_producerCount; }
+
+	/// <summary>
+	/// Creates the queue of an event type so worker threads can queue it concurrently.
+	/// Must be called on the main thread before the workers queue the event
+	/// </summary>
+	template<typename TEvent>
+	void RegisterConcurrentEvent() noexcept
+	{
+		GetQueue<TEvent>();
+	}
+
+	/// <summary>
+	/// Thread-safe queue for worker threads, each producer (worker/job index below GetProducerCount()) has its own buffer.
+	/// The event type must be registered with RegisterConcurrentEvent() first. At the sync point the producer buffers are
+	/// dispatched after the main thread events, in producer index order
+	/// example: eventBus->QueueEventConcurrent<CollisionEvent>(workerIndex, entityA, entityB);
+	/// </summary>
+	template<typename TEvent, typename... TArgs>
+	void QueueEventConcurrent(size_t producerIndex, TArgs&&... args) noexcept
+	{
+		// read only access to the tables, they do not grow while the workers run
+		static_cast<EventQueue<TEvent>*>(m_queues[EventType<TEvent>::GetID()].get())->PushConcurrent(producerIndex, std::forward<TArgs>(args)...);
+	}
+
+	/// <summary>
+	/// Sync point, dispatches the queued events type by type in the order the queues were created.
+	/// Events queued by the handlers are dispatched at the next sync point
+	/// </summary>
+	void DispatchQueuedEvents() noexcept
+	{
+		// a handler queuing an event type without a queue yet appends to m_queueOrder: index over the queues of the
+		// sync point start, the new queue is dispatched at the next one
+		const size_t queueCount = m_queueOrder.size();
+		for (size_t i = 0; i < queueCount; ++i)
 		{
-			for (auto it = handlers->begin(); it != handlers->end(); it++)
-			{
-				auto handler = it->get();
-				TEvent event(std::forward<TArgs>(args)...);
-				handler->Invoke(event);
-			}
+			const int eventId = m_queueOrder[i];
+			ProfileScope dispatchScope(m_queueNames[eventId]);
+			GetSlot(m_handlers, eventId);
+			GetSlot(m_batchHandlers, eventId);
+			m_queues[eventId]->Dispatch(m_handlers, m_batchHandlers, eventId);
 		}
 	}
 
 private:
 
-	// a map to hold a list of handlers for a specific event
-	std::map<std::type_index, std::unique_ptr<HandlerList>> m_subscribers;
+	// readable event type name for the profiler, built once per event type
+	template<typename TEvent>
+	static const char* GetEventName() noexcept
+	{
+		static const std::string name = Profiler::GetTypeName(typeid(TEvent));
+		return name.c_str();
+	}
+
+	// grows the table so that the event id has a slot
+	template<typename TSlot>
+	static TSlot& GetSlot(std::vector<TSlot>& table, int eventId) noexcept
+	{
+		if (eventId >= static_cast<int>(table.size()))
+			table.resize(eventId + 1);
+		return table[eventId];
+	}
+
+	template<typename TEvent>
+	EventQueue<TEvent>& GetQueue() noexcept
+	{
+		const int eventId = EventType<TEvent>::GetID();
+		auto& queue = GetSlot(m_queues, eventId);
+		if (!queue)
+		{
+			queue = std::make_unique<EventQueue<TEvent>>();
+			queue->SetProducerCount(m_producerCount);
+			GetSlot(m_queueNames, eventId) = GetEventName<TEvent>();
+			m_queueOrder.push_back(eventId);
+		}
+		return *static_cast<EventQueue<TEvent>*>(queue.get());
+	}
+
+	// flat handler tables [vector index = event type id]
+	std::vector<DelegateList> m_handlers;
+	std::vector<DelegateList> m_batchHandlers;
+
+	// a queue per event type for the deferred dispatch [vector index = event type id]
+	std::vector<std::unique_ptr<IEventQueue>> m_queues;
+	std::vector<const char*> m_queueNames;
+	// event ids of the queues in creation order
+	std::vector<int> m_queueOrder;
 
+	// number of concurrent producer buffers per queue
+	size_t m_producerCount = 0;
 };
 
 #endif // EVENTBUS_H
@@ -20,6 +20,30 @@ public:
 
 };
 
+// first frame two colliders overlap
+class CollisionEnterEvent : public CollisionEvent
+{
+public:
+	CollisionEnterEvent(Entity& entityA, Entity& entityB) noexcept
+		: CollisionEvent(entityA, entityB) {}
+};
+
+// every following frame the overlap persists (only sent when somebody subscribed to it)
+class CollisionStayEvent : public CollisionEvent
+{
+public:
+	CollisionStayEvent(Entity& entityA, Entity& entityB) noexcept
+		: CollisionEvent(entityA, entityB) {}
+};
+
+// first frame two colliders stop overlapping (not sent when one of them is destroyed)
+class CollisionExitEvent : public CollisionEvent
+{
+public:
+	CollisionExitEvent(Entity& entityA, Entity& entityB) noexcept
+		: CollisionEvent(entityA, entityB) {}
+};
+
 class KeyPressedEvent : public Event
 {
 public:
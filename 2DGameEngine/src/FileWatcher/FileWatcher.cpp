@@ -0,0 +1,143 @@
+#include "FileWatcher.h"
+
+#include "../Logger/Logger.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+FileWatcher::FileWatcher() noexcept
+{
+
+}
+
+FileWatcher::~FileWatcher() noexcept
+{
+#ifdef __linux__
+	if (m_inotifyFd >= 0)
+		close(m_inotifyFd);
+#endif
+}
+
+/// <summary>
+/// Starts watching the files of a directory (not its sub directories)
+/// </summary>
+/// <param name="directory"></param>
+/// <returns>false if the directory can not be watched</returns>
+bool FileWatcher::Watch(const std::string& directory) noexcept
+{
+	std::error_code error;
+	if (!std::filesystem::is_directory(directory, error))
+	{
+		Logger::Error("Can not watch the directory: " + directory);
+		return false;
+	}
+	m_directory = directory;
+
+#ifdef __linux__
+	m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotifyFd >= 0)
+	{
+		// editors either write the file in place or write a temporary file and rename it over the original one
+		m_watchDescriptor = inotify_add_watch(m_inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (m_watchDescriptor >= 0)
+		{
+			Logger::Log("Watching " + directory + " with inotify");
+			return true;
+		}
+		close(m_inotifyFd);
+		m_inotifyFd = -1;
+	}
+	Logger::Warning("inotify is not available, watching " + directory + " by polling the write times");
+#endif
+
+	// the current write times are the reference, the files are only reported once they change
+	std::vector<std::string> existingFiles;
+	PollWriteTimes(existingFiles, false);
+	m_nextPoll = std::chrono::steady_clock::now() + POLL_INTERVAL;
+	return true;
+}
+
+void FileWatcher::Poll(std::vector<std::string>& changedFiles) noexcept
+{
+	if (m_directory.empty())
+		return;
+
+	const size_t firstChange = changedFiles.size();
+	if (m_inotifyFd >= 0)
+	{
+		PollInotify(changedFiles);
+	}
+	else
+	{
+		const auto now = std::chrono::steady_clock::now();
+		if (now < m_nextPoll)
+			return;
+		m_nextPoll = now + POLL_INTERVAL;
+		PollWriteTimes(changedFiles, true);
+	}
+
+	// one save can produce several events for the same file
+	std::sort(changedFiles.begin() + firstChange, changedFiles.end());
+	changedFiles.erase(std::unique(changedFiles.begin() + firstChange, changedFiles.end()), changedFiles.end());
+}
+
+void FileWatcher::PollInotify(std::vector<std::string>& changedFiles) noexcept
+{
+#ifdef __linux__
+	alignas(inotify_event) char buffer[4096];
+	while (true)
+	{
+		const ssize_t length = read(m_inotifyFd, buffer, sizeof(buffer));
+		if (length <= 0)
+		{
+			if (length < 0 && errno != EAGAIN)
+				Logger::Error("Error reading the inotify events of " + m_directory);
+			return;
+		}
+
+		for (ssize_t offset = 0; offset < length; )
+		{
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			if (event->len > 0 && !(event->mask & IN_ISDIR))
+				changedFiles.push_back(m_directory + "/" + event->name);
+			offset += sizeof(inotify_event) + event->len;
+		}
+	}
+#else
+	(void)changedFiles;
+#endif
+}
+
+void FileWatcher::PollWriteTimes(std::vector<std::string>& changedFiles, bool shouldReport) noexcept
+{
+	std::error_code error;
+	for (const auto& entry : std::filesystem::directory_iterator(m_directory, error))
+	{
+		if (!entry.is_regular_file(error))
+			continue;
+
+		const auto writeTime = entry.last_write_time(error);
+		if (error)
+			continue;
+
+		const std::string path = m_directory + "/" + entry.path().filename().string();
+		auto known = m_writeTimes.find(path);
+		if (known == m_writeTimes.end())
+		{
+			m_writeTimes.emplace(path, writeTime);
+			if (shouldReport)
+				changedFiles.push_back(path);
+		}
+		else if (known->second != writeTime)
+		{
+			known->second = writeTime;
+			if (shouldReport)
+				changedFiles.push_back(path);
+		}
+	}
+}
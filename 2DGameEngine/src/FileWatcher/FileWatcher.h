@@ -0,0 +1,49 @@
+#pragma once
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// <summary>
+/// Reports the files of a directory written since the last poll, without blocking.
+/// Uses inotify on Linux, and elsewhere (or when inotify is not available) compares the last write times
+/// of the files every POLL_INTERVAL.
+/// </summary>
+class FileWatcher
+{
+public:
+
+	FileWatcher() noexcept;
+	~FileWatcher() noexcept;
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	bool Watch(const std::string& directory) noexcept;
+	// appends the paths (directory/file name) of the files changed since the last poll, each path once
+	void Poll(std::vector<std::string>& changedFiles) noexcept;
+
+	inline bool IsWatching() const noexcept { return !m_directory.empty(); }
+	inline bool IsUsingInotify() const noexcept { return m_inotifyFd >= 0; }
+
+	static constexpr std::chrono::milliseconds POLL_INTERVAL{ 250 };
+
+private:
+
+	void PollInotify(std::vector<std::string>& changedFiles) noexcept;
+	void PollWriteTimes(std::vector<std::string>& changedFiles, bool shouldReport) noexcept;
+
+	std::string m_directory;
+	int m_inotifyFd = -1;
+	int m_watchDescriptor = -1;
+
+	// write time fallback
+	std::unordered_map<std::string, std::filesystem::file_time_type> m_writeTimes;
+	std::chrono::steady_clock::time_point m_nextPoll;
+};
+
+#endif // FILEWATCHER_H
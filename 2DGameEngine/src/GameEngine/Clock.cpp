@@ -0,0 +1,4 @@
+#include "Clock.h"
+
+// define static variables
+Uint32 Clock::s_ticks = 0;
@@ -0,0 +1,27 @@
+#pragma once
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <SDL.h>
+
+/// <summary>
+/// Simulation clock shared by the components and systems.
+/// In windowed mode it follows SDL_GetTicks() once per frame, in headless mode it is advanced
+/// by a fixed step so simulated time does not depend on how fast the host machine runs the loop.
+/// </summary>
+class Clock
+{
+public:
+
+	// Returns the current simulation time in milliseconds
+	static inline Uint32 GetTicks() noexcept { return s_ticks; }
+
+	static inline void SetTicks(Uint32 ticks) noexcept { s_ticks = ticks; }
+	static inline void Advance(Uint32 milliseconds) noexcept { s_ticks += milliseconds; }
+
+private:
+
+	static Uint32 s_ticks;
+};
+
+#endif // CLOCK_H
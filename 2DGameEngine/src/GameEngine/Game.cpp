@@ -5,6 +5,10 @@
 #include "../Systems/Systems.h"
 #include "../GameEngine/LevelLoader.h"
 
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
 unsigned int Game::windowWidth;
 unsigned int Game::windowHeight;
 int Game::mapWidth;
@@ -18,7 +22,26 @@ Game::Game() noexcept :
 	m_eventBus(std::make_unique<EventBus>()),
 	isRunning(false),
 	isDebugMode(false),
-	currentLevel(0)
+	isHeadless(false),
+	maxTicks(0),
+	isFixedStep(false),
+	currentTick(0),
+	rngSeed(std::random_device{}()),
+	traceFrames(0),
+	scriptBudgetMs(0.0f),
+	scriptShards(0),
+	isHotReloading(false),
+	loadBudgetMs(8.0f),
+	rollbackTicks(0),
+	rollbackDelay(0),
+	hasLateInput(false),
+	earliestLateInputTick(0),
+	netPort(0),
+	netLoopbackClients(0),
+	netSendInterval(3),
+	netPacketLoss(0.0f),
+	traceFilePath("./profile_trace.json"),
+	currentLevel(2)
 {
 	Logger::Log("Game contructor is called");
 }
@@ -28,8 +51,191 @@ Game::~Game() noexcept
 	Logger::Log("Game destructor is called");
 }
 
+/// <summary>
+/// Reads the command line options
+/// --headless : run the simulation without a window (no video device needed)
+/// --ticks N  : number of ticks to simulate in headless mode
+/// --level N  : level to load
+/// --seed N   : seed of the lua random generator
+/// --record file : record the input events to a replay file
+/// --replay file : play back the input events (and seed/level) of a replay file
+/// --trace-frames N : capture the first N frames (level loading included) to a Chrome trace
+/// --trace-file file : path of the Chrome trace (F2 captures DEFAULT_TRACE_FRAMES frames to it)
+/// --script-budget-ms N : time the per-entity scripts can use per frame, the others run on the next frames
+/// --script-shards N : run the batch scripts in N Lua states on worker threads
+/// --hot-reload : reload the level script when it changes on disk
+/// --load-budget-ms N : time the level loading can use per frame behind the loading screen (0 = blocking load)
+/// --rollback-ticks N : keep the world state of the last N ticks, a late input rewinds and simulates them again
+/// --rollback-delay N : apply the live inputs N ticks late through a rollback (tests the rollback like a network latency)
+/// --net-port N : replicate the entities to the clients connecting to this UDP port
+/// --net-loopback-clients N : replicate the entities to N clients in this process, over a loopback network
+/// --net-send-interval N : ticks between two snapshots sent to the clients (default 3)
+/// --net-packet-loss P : part of the loopback packets dropped (0 to 1)
+/// </summary>
+/// <param name="argc"></param>
+/// <param name="argv"></param>
+void Game::ParseArguments(int argc, char* argv[]) noexcept
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string argument = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (argument == "--headless")
+		{
+			isHeadless = true;
+		}
+		else if (argument == "--ticks" && hasValue)
+		{
+			maxTicks = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--level" && hasValue)
+		{
+			currentLevel = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--seed" && hasValue)
+		{
+			rngSeed = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--record" && hasValue)
+		{
+			recordFilePath = argv[++i];
+		}
+		else if (argument == "--replay" && hasValue)
+		{
+			replayFilePath = argv[++i];
+		}
+		else if (argument == "--trace-frames" && hasValue)
+		{
+			traceFrames = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--trace-file" && hasValue)
+		{
+			traceFilePath = argv[++i];
+		}
+		else if (argument == "--script-budget-ms" && hasValue)
+		{
+			scriptBudgetMs = static_cast<float>(std::strtod(argv[++i], nullptr));
+		}
+		else if (argument == "--load-budget-ms" && hasValue)
+		{
+			loadBudgetMs = static_cast<float>(std::strtod(argv[++i], nullptr));
+		}
+		else if (argument == "--hot-reload")
+		{
+			isHotReloading = true;
+		}
+		else if (argument == "--script-shards" && hasValue)
+		{
+			scriptShards = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--rollback-ticks" && hasValue)
+		{
+			rollbackTicks = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--rollback-delay" && hasValue)
+		{
+			rollbackDelay = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--net-port" && hasValue)
+		{
+			netPort = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--net-loopback-clients" && hasValue)
+		{
+			netLoopbackClients = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--net-send-interval" && hasValue)
+		{
+			netSendInterval = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argument == "--net-packet-loss" && hasValue)
+		{
+			netPacketLoss = static_cast<float>(std::strtod(argv[++i], nullptr));
+		}
+		else
+		{
+			Logger::Warning("Unknown command line argument: " + argument);
+		}
+	}
+}
+
 void Game::Init() noexcept
 {
+	// replays only reproduce when every tick has the same length, so recording and playback force a fixed step
+	if (!replayFilePath.empty())
+	{
+		m_replay = std::make_unique<Replay>();
+		if (m_replay->LoadFromFile(replayFilePath))
+		{
+			currentLevel = m_replay->GetLevel();
+			rngSeed = m_replay->GetSeed();
+			isFixedStep = true;
+
+			if (m_replay->GetFixedStep() != MILLISECOND_PER_FRAME)
+				Logger::Warning("Replay was recorded with a different fixed step, playback may diverge");
+
+			// by default a headless playback simulates exactly the recorded ticks
+			if (isHeadless && maxTicks == 0)
+				maxTicks = m_replay->GetTickCount();
+		}
+		else
+		{
+			m_replay.reset();
+		}
+	}
+	else if (!recordFilePath.empty())
+	{
+		m_replay = std::make_unique<Replay>();
+		m_replay->StartRecording(rngSeed, currentLevel, MILLISECOND_PER_FRAME);
+		isFixedStep = true;
+	}
+
+	// the re-simulated ticks have the length of the ticks they replace, a rollback needs the fixed step too.
+	// A replay records the ticks the inputs were published on, the late inputs would not play back the same way
+	if (rollbackTicks > 0 || rollbackDelay > 0)
+	{
+		if (m_replay)
+		{
+			Logger::Warning("The rollback is disabled while recording or playing back a replay");
+		}
+		else
+		{
+			// the tick before the delayed input must still be in the buffer
+			rollbackTicks = std::max(rollbackTicks, rollbackDelay + 1);
+			m_rollback = std::make_unique<RollbackBuffer>(rollbackTicks);
+			m_inputHistory.resize(rollbackTicks + 1);
+			isFixedStep = true;
+		}
+	}
+
+	InitNetwork();
+
+	if (isHeadless)
+	{
+		// headless runs only need the timer and the event queue, so this works without a display
+		if (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) != 0)
+		{
+			Logger::Error("Error initializing SDL in headless mode");
+			return;
+		}
+
+		windowWidth = 800;
+		windowHeight = 600;
+
+		m_camera.x = 0;
+		m_camera.y = 0;
+		m_camera.w = windowWidth;
+		m_camera.h = windowHeight;
+
+		// textures and fonts will only be registered as stubs
+		m_assetStore->SetHeadless(true);
+
+		isFixedStep = true;
+		isRunning = true;
+		return;
+	}
+
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
 	{
 		Logger::Error("Error initializing SDL");
@@ -95,16 +301,100 @@ void Game::Init() noexcept
 
 void Game::Run() noexcept
 {
+	// started before SetUp() so the level loading phases end up in the first captured frame
+	if (traceFrames > 0)
+		Profiler::StartCapture(traceFrames, traceFilePath);
+
 	SetUp();
+
+	if (isHeadless)
+	{
+		RunHeadless();
+		return;
+	}
+
+	RunLoading();
+
 	// game loop
 	while (isRunning)
 	{
+		// every loop iteration is one profiler frame
+		Profiler::NextFrame();
 		ProcessInput();
 		Update();
 		Render();
 	}
 }
 
+/// <summary>
+/// Loads the rest of the level with loadBudgetMs per frame while a progress bar is shown.
+/// The simulation does not tick while loading, so a recording or a replay sees the same frames as a blocking load.
+/// </summary>
+void Game::RunLoading() noexcept
+{
+	while (isRunning && m_levelLoader->IsLoading())
+	{
+		Profiler::NextFrame();
+
+		// only the quit requests are handled, the inputs are not published before the level exists
+		SDL_Event sdlEvent;
+		while (SDL_PollEvent(&sdlEvent))
+		{
+			if (sdlEvent.type == SDL_QUIT || (sdlEvent.type == SDL_KEYDOWN && sdlEvent.key.keysym.sym == SDLK_ESCAPE))
+				isRunning = false;
+		}
+
+		m_levelLoader->ContinueLoad(m_registry, m_assetStore, m_eventBus, m_renderer, loadBudgetMs);
+		RenderLoadingScreen();
+	}
+
+	// the first frame of the level does not count the loading time
+	millisecondPreviousFrame = SDL_GetTicks();
+}
+
+void Game::RenderLoadingScreen() noexcept
+{
+	ProfileScope scope("Game::RenderLoadingScreen");
+	SDL_SetRenderDrawColor(m_renderer, 21, 21, 21, 255);
+	SDL_RenderClear(m_renderer);
+
+	const int barWidth = static_cast<int>(windowWidth) / 2;
+	const SDL_Rect frame = { static_cast<int>(windowWidth) / 4, static_cast<int>(windowHeight) / 2 - 10, barWidth, 20 };
+	const SDL_Rect progress = { frame.x + 2, frame.y + 2, static_cast<int>((barWidth - 4) * m_levelLoader->GetLoadProgress()), frame.h - 4 };
+
+	SDL_SetRenderDrawColor(m_renderer, 0, 255, 0, 255);
+	SDL_RenderDrawRect(m_renderer, &frame);
+	SDL_RenderFillRect(m_renderer, &progress);
+
+	SDL_RenderPresent(m_renderer);
+}
+
+/// <summary>
+/// Simulation loop without rendering and without frame capping.
+/// Every tick advances the simulation clock by a fixed step, so the results do not depend on the host speed
+/// </summary>
+void Game::RunHeadless() noexcept
+{
+	Logger::Log("Running headless simulation for " + (maxTicks > 0 ? std::to_string(maxTicks) : std::string("unlimited")) + " ticks");
+
+	const auto wallClockStart = std::chrono::steady_clock::now();
+	unsigned int tick = 0;
+
+	while (isRunning && (maxTicks == 0 || tick < maxTicks))
+	{
+		Profiler::NextFrame();
+		ProcessInput();
+		Update();
+		tick++;
+	}
+
+	const auto wallClockEnd = std::chrono::steady_clock::now();
+	const double elapsedSeconds = std::chrono::duration<double>(wallClockEnd - wallClockStart).count();
+
+	Logger::Log("Headless simulation finished: " + std::to_string(tick) + " ticks in " + std::to_string(elapsedSeconds) + 
+				" s (" + std::to_string(elapsedSeconds > 0.0 ? tick / elapsedSeconds : 0.0) + " ticks/s)");
+}
+
 void Game::SetUp() noexcept
 {
 	// Add the systems to that need to be processed in our game
@@ -122,19 +412,62 @@ void Game::SetUp() noexcept
 	m_registry->AddSystem<RenderHealthBarSystem>();
 	m_registry->AddSystem<RenderGUISystem>();
 	m_registry->AddSystem<ScriptSystem>();
+	if (m_replicationServer)
+		m_registry->AddSystem<ReplicationSystem>();
 
-	// create the bindings between C++ and Lua
-	// m_registry->GetSystem<ScriptSystem>().CreateLuaBindings(lua);
+	// the budget depends on the host speed, the replays need every script to run on the same ticks
+	if (scriptBudgetMs > 0.0f && m_replay)
+		Logger::Warning("The script budget is ignored while recording or playing back a replay");
+	else
+		m_registry->GetSystem<ScriptSystem>().SetFrameBudget(scriptBudgetMs);
+
+	// components created while loading take their start time from the simulation clock
+	// a fixed-step run always starts at zero so recordings and playbacks see the same times
+	if (!isFixedStep)
+		Clock::SetTicks(SDL_GetTicks());
 
 	// load first level
-	LevelLoader loader;
-	lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::os);
-	loader.LoadLevel(lua, m_registry, m_assetStore, m_eventBus, m_renderer, 2);
+	m_levelLoader = std::make_unique<LevelLoader>();
+	lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::os, sol::lib::coroutine);
+	lua["math"]["randomseed"](rngSeed);
+
+	// create the bindings between C++ and Lua
+	ScriptSystem::CreateLuaBindings(lua);
+	// the headless runs load everything before the first tick, the others go on behind the loading screen in Run()
+	if (m_levelLoader->BeginLoad(lua, m_assetStore, currentLevel) && (isHeadless || loadBudgetMs <= 0.0f))
+		m_levelLoader->ContinueLoad(m_registry, m_assetStore, m_eventBus, m_renderer, 0.0f);
+
+	// every shard loads its own copy of the level script, the batches are found by name in it
+	if (scriptShards > 0)
+	{
+		const std::string levelScriptPath = "./assets/scripts/Level" + std::to_string(currentLevel) + ".lua";
+		m_registry->GetSystem<ScriptSystem>().CreateShards(scriptShards, levelScriptPath, rngSeed);
+	}
+
+	// a replay needs the scripts it was recorded with
+	if (isHotReloading && m_replay)
+		Logger::Warning("The hot reload is disabled while recording or playing back a replay");
+	else if (isHotReloading)
+		m_scriptWatcher.Watch("./assets/scripts");
 }
 
 void Game::ProcessInput() noexcept
 {
+	ProfileScope scope("Game::ProcessInput");
 	SDL_Event sdlEvent;
+
+	// without a window the only event we care about is the quit request (e.g. Ctrl+C)
+	if (isHeadless)
+	{
+		while (SDL_PollEvent(&sdlEvent))
+		{
+			if (sdlEvent.type == SDL_QUIT)
+				isRunning = false;
+		}
+		DispatchReplayInputs();
+		return;
+	}
+
 	// SDL_PollEvent returns 1 if there is a pending event or 0 if there are none available
 	while (SDL_PollEvent(&sdlEvent))
 	{
@@ -160,28 +493,144 @@ void Game::ProcessInput() noexcept
 					isRunning = false;
 				if (sdlEvent.key.keysym.sym == SDLK_F1)
 					isDebugMode = !isDebugMode; // toggle debug mode, shows the colliders boxes
+				if (sdlEvent.key.keysym.sym == SDLK_F2 && !Profiler::IsCapturing())
+					Profiler::StartCapture(DEFAULT_TRACE_FRAMES, traceFilePath); // capture the next frames to a Chrome trace
+				// during a playback the gameplay input only comes from the replay file
+				if (m_replay && m_replay->IsPlayingBack())
+					break;
+				if (m_replay && m_replay->IsRecording())
+					m_replay->RecordInput(currentTick, sdlEvent.key.keysym.sym);
 				// Publish events on key pressed
-				m_eventBus->PublishEvent<KeyPressedEvent>(sdlEvent.key.keysym.sym);
+				if (m_rollback && rollbackDelay > 0)
+					AddLateInput(currentTick >= rollbackDelay ? currentTick - rollbackDelay : 0, sdlEvent.key.keysym.sym);
+				else
+					PublishInput(sdlEvent.key.keysym.sym);
 				// Logger::Log("Key pressed");
 				break;
 		}
 	}
+
+	DispatchReplayInputs();
+}
+
+/// <summary>
+/// Publishes a key press. While rolling back, the inputs are kept per tick and published at the start of their tick
+/// (in Update), so the ticks simulated again after a rollback get the same inputs
+/// </summary>
+/// <param name="keyCode"></param>
+void Game::PublishInput(SDL_Keycode keyCode) noexcept
+{
+	if (m_rollback)
+		m_inputHistory[currentTick % m_inputHistory.size()].push_back(keyCode);
+	else
+		m_eventBus->PublishEvent<KeyPressedEvent>(keyCode);
+}
+
+/// <summary>
+/// Adds an input published on a past tick. The input is applied on the current tick when that tick is not in the
+/// rollback buffer anymore (or the tick before it, the state the rollback starts from)
+/// </summary>
+/// <param name="tick"></param>
+/// <param name="keyCode"></param>
+void Game::AddLateInput(unsigned int tick, SDL_Keycode keyCode) noexcept
+{
+	if (!m_rollback || tick >= currentTick)
+	{
+		PublishInput(keyCode);
+		return;
+	}
+	if (tick == 0 || !m_rollback->HasTick(tick - 1))
+	{
+		Logger::Warning("Input of tick " + std::to_string(tick) + " is too late to roll back, applied on tick " + std::to_string(currentTick));
+		PublishInput(keyCode);
+		return;
+	}
+
+	m_inputHistory[tick % m_inputHistory.size()].push_back(keyCode);
+	earliestLateInputTick = hasLateInput ? std::min(earliestLateInputTick, tick) : tick;
+	hasLateInput = true;
+}
+
+/// <summary>
+/// Restores the state after the tick before the earliest late input and runs the ticks up to the current one again,
+/// with the inputs of the history. The regions are not streamed while re-simulating (the rollback is off on the
+/// streamed levels) and the Lua globals are not rewound, the scripts keeping state in them see the ticks twice
+/// </summary>
+void Game::Resimulate() noexcept
+{
+	if (!hasLateInput || !m_rollback)
+		return;
+
+	ProfileScope scope("Game::Resimulate");
+	hasLateInput = false;
+	if (!m_rollback->Restore(earliestLateInputTick - 1, *m_registry, m_camera))
+		return;
+
+	const unsigned int lastTick = currentTick;
+	for (currentTick = earliestLateInputTick; currentTick < lastTick; ++currentTick)
+	{
+		for (const SDL_Keycode keyCode : m_inputHistory[currentTick % m_inputHistory.size()])
+			m_eventBus->PublishEvent<KeyPressedEvent>(keyCode);
+		Clock::Advance(MILLISECOND_PER_FRAME);
+		m_registry->Update(MILLISECOND_PER_FRAME / 1000.0, m_eventBus, m_camera, m_registry, m_assetStore, m_renderer, Clock::GetTicks());
+		m_rollback->Capture(currentTick, *m_registry, m_camera);
+	}
+}
+
+/// <summary>
+/// Publishes the recorded inputs of the current tick, the same way ProcessInput publishes live key presses
+/// </summary>
+void Game::DispatchReplayInputs() noexcept
+{
+	if (!m_replay || !m_replay->IsPlayingBack())
+		return;
+
+	while (const ReplayInputRecord* input = m_replay->PollInput(currentTick))
+	{
+		m_eventBus->PublishEvent<KeyPressedEvent>(input->keyCode);
+	}
+
+	if (m_replay->IsPlaybackFinished(currentTick))
+	{
+		// hand the control back to the live input (the loop keeps the fixed step)
+		Logger::Log("Replay playback finished at tick " + std::to_string(currentTick));
+		m_replay.reset();
+	}
 }
 
 void Game::Update() noexcept
 {
-	// TODO: if we are too fast, waste some time until we reach the target frame time
-	int timeToWait = MILLISECOND_PER_FRAME - (SDL_GetTicks() - millisecondPreviousFrame);
-	if (timeToWait > 0 && timeToWait <= MILLISECOND_PER_FRAME)
+	double deltaTime = 0.0;
+
+	// headless runs do not wait: the simulation runs as fast as the CPU allows
+	if (!isHeadless)
 	{
-		SDL_Delay(timeToWait); // delay the execution until we reach the target frame time in milliseconds
+		// TODO: if we are too fast, waste some time until we reach the target frame time
+		int timeToWait = MILLISECOND_PER_FRAME - (SDL_GetTicks() - millisecondPreviousFrame);
+		if (timeToWait > 0 && timeToWait <= MILLISECOND_PER_FRAME)
+		{
+			SDL_Delay(timeToWait); // delay the execution until we reach the target frame time in milliseconds
+		}
+	}
+
+	// the late inputs change the past ticks, they are simulated again before the current one
+	Resimulate();
+
+	if (isFixedStep)
+	{
+		deltaTime = MILLISECOND_PER_FRAME / 1000.0;
+		Clock::Advance(MILLISECOND_PER_FRAME);
+	}
+	else
+	{
+		// the difference in ticks since the last frame, converted to seconds
+		deltaTime = (SDL_GetTicks() - millisecondPreviousFrame) / 1000.0;
+		Clock::SetTicks(SDL_GetTicks());
 	}
-	
-	// the difference in ticks since the last frame, converted to seconds
-	double deltaTime = (SDL_GetTicks() - millisecondPreviousFrame) / 1000.0;
 
 	// store the current frame time
-	millisecondPreviousFrame = SDL_GetTicks();
+	if (!isHeadless)
+		millisecondPreviousFrame = SDL_GetTicks();
 
 	// Reset all event handlers for the current frame
 	// m_eventBus->Reset();
@@ -192,11 +641,153 @@ void Game::Update() noexcept
 
 	// Updat the registry to process the entities that are waiting to be created/deleted
 	// Invoke all the systems that need to be updated
-	m_registry->Update(deltaTime, m_eventBus, m_camera, m_registry, m_assetStore, m_renderer, SDL_GetTicks());
+	ProfileScope scope("Game::Update");
+	ReloadChangedScripts();
+	// the regions follow the camera of the previous frame
+	m_levelLoader->StreamRegions(m_registry, m_assetStore, m_camera);
+
+	if (m_rollback)
+	{
+		for (const SDL_Keycode keyCode : m_inputHistory[currentTick % m_inputHistory.size()])
+			m_eventBus->PublishEvent<KeyPressedEvent>(keyCode);
+	}
+
+	m_registry->Update(deltaTime, m_eventBus, m_camera, m_registry, m_assetStore, m_renderer, Clock::GetTicks());
+
+	if (m_rollback)
+	{
+		// the level loader keeps track of the streamed entities, a rollback would bring back entities it unloaded
+		if (m_levelLoader->IsStreaming())
+		{
+			Logger::Warning("The rollback is disabled on the levels streaming their regions");
+			m_rollback.reset();
+		}
+		else
+		{
+			// the enemies spawned from the debug GUI are not inputs of the ticks, a rollback to a tick before them
+			// would lose them: the late inputs of the past ticks are applied on the current one instead
+			if (m_registry->HasSystem<RenderGUISystem>() && m_registry->GetSystem<RenderGUISystem>().GetSpawnedCount() > 0)
+				m_rollback->Clear();
+			m_rollback->Capture(currentTick, *m_registry, m_camera);
+			m_inputHistory[(currentTick + 1) % m_inputHistory.size()].clear();
+		}
+	}
+
+	UpdateNetwork();
+
+	currentTick++;
+}
+
+/// <summary>
+/// Creates the replication server (--net-port, --net-loopback-clients) and the loopback clients.
+/// The loopback clients share the camera of the game, each one mirrors the entities in its own registry
+/// </summary>
+void Game::InitNetwork() noexcept
+{
+	if (netLoopbackClients > 0)
+	{
+		if (netPort > 0)
+			Logger::Warning("--net-port is ignored with --net-loopback-clients");
+
+		m_loopbackNetwork = std::make_unique<LoopbackNetwork>(netPacketLoss, rngSeed);
+		m_serverTransport = m_loopbackNetwork->CreateEndpoint();
+		const uint32_t serverPeer = 0;
+		for (unsigned int i = 0; i < netLoopbackClients; ++i)
+		{
+			LoopbackClient loopbackClient;
+			loopbackClient.transport = m_loopbackNetwork->CreateEndpoint();
+			loopbackClient.registry = std::make_unique<Registry>();
+			loopbackClient.eventBus = std::make_unique<EventBus>();
+			loopbackClient.client = std::make_unique<ReplicationClient>(*loopbackClient.transport, serverPeer, *loopbackClient.registry);
+			m_loopbackClients.push_back(std::move(loopbackClient));
+		}
+	}
+	else if (netPort > 0)
+	{
+		auto transport = std::make_unique<UdpTransport>();
+		if (transport->Open(static_cast<uint16_t>(netPort)))
+			m_serverTransport = std::move(transport);
+	}
+
+	if (m_serverTransport)
+	{
+		m_replicationServer = std::make_unique<ReplicationServer>(*m_serverTransport, *m_registry);
+		m_replicationServer->SetSendInterval(netSendInterval);
+	}
+}
+
+/// <summary>
+/// Sends the state of the tick to the clients (after a rollback, the state simulated again) and updates the loopback clients
+/// </summary>
+void Game::UpdateNetwork() noexcept
+{
+	if (!m_replicationServer)
+		return;
+
+	m_replicationServer->Update(currentTick);
+
+	for (auto& loopbackClient : m_loopbackClients)
+	{
+		SDL_Rect view = m_camera;
+		loopbackClient.client->Update(view);
+		// adds the created entities and removes the destroyed ones, the client registry has no system
+		loopbackClient.registry->Update(0.0f, loopbackClient.eventBus, view, loopbackClient.registry, m_assetStore, nullptr, Clock::GetTicks());
+	}
+}
+
+/// <summary>
+/// Logs the traffic and the serialization time of the replication, per tick a snapshot was sent on
+/// </summary>
+void Game::LogNetworkStats() const noexcept
+{
+	const uint32_t sentTicks = m_replicationServer->GetSentTickCount();
+	if (sentTicks == 0)
+		return;
+
+	const NetworkStats& server = m_replicationServer->GetTotalStats();
+	std::string message = "Replication to " + std::to_string(m_replicationServer->GetClientCount()) + " clients: " +
+		std::to_string(server.bytesSent / sentTicks) + " bytes, " + std::to_string(server.packetsSent / sentTicks) + " packets, " +
+		std::to_string(server.entitiesWritten / sentTicks) + " entity records and " +
+		std::to_string(server.serializationNs / 1000.0 / sentTicks) + " us of serialization per snapshot tick";
+	if (!m_loopbackClients.empty())
+	{
+		NetworkStats clients;
+		for (const auto& loopbackClient : m_loopbackClients)
+			clients.Add(loopbackClient.client->GetTotalStats());
+		message += ", " + std::to_string(clients.serializationNs / 1000.0 / sentTicks) + " us of decoding on the clients";
+	}
+	Logger::Log(message);
+}
+
+/// <summary>
+/// Polls the script directory and reloads the level script when it was written since the last frame.
+/// The other scripts of the directory are ignored, the level script is the only one loaded.
+/// </summary>
+void Game::ReloadChangedScripts() noexcept
+{
+	if (!m_scriptWatcher.IsWatching())
+		return;
+
+	std::vector<std::string> changedFiles;
+	m_scriptWatcher.Poll(changedFiles);
+
+	const std::string levelScriptPath = "./assets/scripts/Level" + std::to_string(currentLevel) + ".lua";
+	for (const auto& changedFile : changedFiles)
+	{
+		if (changedFile == levelScriptPath)
+		{
+			m_levelLoader->ReloadScripts(lua, m_registry, m_assetStore, m_renderer);
+			// the snapshots hold the functions of the old script, a rollback would rebind them
+			if (m_rollback)
+				m_rollback->Clear();
+			return;
+		}
+	}
 }
 
 void Game::Render() noexcept
 {
+	ProfileScope scope("Game::Render");
 	SDL_SetRenderDrawColor(m_renderer, 21, 21, 21, 255); // select the color
 	SDL_RenderClear(m_renderer); // clear the previous frame
 	
@@ -208,10 +799,25 @@ void Game::Render() noexcept
 
 void Game::Destroy() noexcept
 {
-	ImGuiSDL::Deinitialize();
-	ImGui::DestroyContext();
-	SDL_DestroyRenderer(m_renderer);
-	SDL_DestroyWindow(m_window);
+	if (m_replay && m_replay->IsRecording())
+	{
+		m_replay->SetTickCount(currentTick);
+		m_replay->SaveToFile(recordFilePath);
+	}
+
+	// a capture cut short by quitting still writes its frames
+	Profiler::StopCapture();
+
+	if (m_replicationServer)
+		LogNetworkStats();
+
+	if (!isHeadless)
+	{
+		ImGuiSDL::Deinitialize();
+		ImGui::DestroyContext();
+		SDL_DestroyRenderer(m_renderer);
+		SDL_DestroyWindow(m_window);
+	}
 	SDL_Quit();
 }
 
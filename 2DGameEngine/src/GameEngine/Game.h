@@ -18,6 +18,12 @@
 #include "../AssetStore/AssetStore.h"
 #include "../EventBus/EventBus.h"
 #include "../Events/Events.h"
+#include "../GameEngine/Clock.h"
+#include "../Replay/Replay.h"
+#include "../Profiler/Profiler.h"
+#include "../FileWatcher/FileWatcher.h"
+#include "../Rollback/RollbackBuffer.h"
+#include "../Network/Replication.h"
 
 namespace
 {
@@ -36,6 +42,7 @@ namespace
 
 	static constexpr unsigned int FPS = 165;
 	static constexpr unsigned int MILLISECOND_PER_FRAME = 1000 / FPS;
+	static constexpr unsigned int DEFAULT_TRACE_FRAMES = 300; // frames captured by the F2 hotkey
 	static constexpr unsigned int IMAGE_SIZE_WIDTH = 32;
 	static constexpr unsigned int IMAGE_SIZE_HEIGHT = 32;
 
@@ -46,15 +53,22 @@ namespace
 	// static constexpr int mapNumRows = 20;
 }
 
+class LevelLoader;
+
 class Game
 {
 public:
 	Game() noexcept;
 	~Game() noexcept;
 
+	// reads the command line options (--headless, --ticks N, --level N, --seed N, --record file, --replay file...)
+	void ParseArguments(int argc, char* argv[]) noexcept;
+
 	void Init() noexcept;
 	void Run() noexcept;
 	void SetUp() noexcept;
+	// runs the simulation without rendering as fast as possible for a fixed number of ticks
+	void RunHeadless() noexcept;
 
 	// game loop functions
 	void ProcessInput() noexcept;
@@ -62,6 +76,24 @@ public:
 	void Render() noexcept;
 
 	void Destroy() noexcept;
+
+	// publishes the recorded inputs of the current tick while a replay is being played back
+	void DispatchReplayInputs() noexcept;
+	// reloads the level script when it changed on disk (--hot-reload)
+	void ReloadChangedScripts() noexcept;
+	// publishes a key press on the current tick, or keeps it in the input history the ticks publish when rolling back
+	void PublishInput(SDL_Keycode keyCode) noexcept;
+	// an input of a past tick (a late remote input): the ticks since are simulated again at the next update
+	void AddLateInput(unsigned int tick, SDL_Keycode keyCode) noexcept;
+	// rewinds to the tick before the earliest late input and simulates the following ticks again with it
+	void Resimulate() noexcept;
+	// replication server and loopback clients (--net-port, --net-loopback-clients)
+	void InitNetwork() noexcept;
+	void UpdateNetwork() noexcept;
+	void LogNetworkStats() const noexcept;
+	// loads the level over several frames behind a loading screen (--load-budget-ms)
+	void RunLoading() noexcept;
+	void RenderLoadingScreen() noexcept;
 	
 	sol::state lua;
 
@@ -77,11 +109,53 @@ private:
 	SDL_Rect m_camera;
 	bool isRunning; // flag to check if the game is running
 	bool isDebugMode; // flag to check if the game is in debug mode
+	bool isHeadless; // flag to run the simulation without window, renderer, fonts and ImGui
+	unsigned int maxTicks; // number of ticks to simulate in headless mode (0 = until quit)
+	bool isFixedStep; // every tick advances the simulation by MILLISECOND_PER_FRAME (headless, record and replay)
+	unsigned int currentTick; // number of simulated ticks since the level was loaded
+	unsigned int rngSeed; // seed of the lua random generator, stored in the replays
+	unsigned int traceFrames; // number of frames to capture to a Chrome trace from the start (0 = no capture)
+	float scriptBudgetMs; // time the per-entity scripts can use per frame (0 = no budget)
+	unsigned int scriptShards; // number of Lua states running the batch scripts on worker threads (0 = main state only)
+	bool isHotReloading; // reload the level script when it changes on disk
+	float loadBudgetMs; // time the level loading can use per frame (0 = load before the first frame)
+	unsigned int rollbackTicks; // number of past ticks kept to roll back to (0 = no rollback)
+	unsigned int rollbackDelay; // the live inputs are applied this many ticks late through a rollback (simulated latency)
+	bool hasLateInput; // an input was added on a past tick since the last update
+	unsigned int earliestLateInputTick;
+	unsigned int netPort; // UDP port of the replication server (0 = no server)
+	unsigned int netLoopbackClients; // clients replicated to in this process (replaces the UDP server)
+	unsigned int netSendInterval; // ticks between two snapshots
+	float netPacketLoss; // part of the loopback packets dropped
 	int millisecondPreviousFrame = 0;
 
 	std::unique_ptr<Registry> m_registry;
 	std::unique_ptr<AssetStore> m_assetStore;
 	std::unique_ptr<EventBus> m_eventBus;
+	std::unique_ptr<Replay> m_replay; // only created when recording or playing back inputs
+	std::unique_ptr<LevelLoader> m_levelLoader; // kept after loading to rebind the reloaded scripts
+	FileWatcher m_scriptWatcher;
+	std::unique_ptr<RollbackBuffer> m_rollback; // only created with --rollback-ticks or --rollback-delay
+	std::vector<std::vector<SDL_Keycode>> m_inputHistory; // inputs per tick while rolling back [tick % size]
+
+	// client in this process with its own registry, mirroring the entities around the camera
+	struct LoopbackClient
+	{
+		std::unique_ptr<LoopbackTransport> transport;
+		std::unique_ptr<Registry> registry;
+		std::unique_ptr<EventBus> eventBus;
+		std::unique_ptr<ReplicationClient> client;
+	};
+
+	// declared in the order they depend on each other, so they are destroyed the other way around
+	std::unique_ptr<LoopbackNetwork> m_loopbackNetwork;
+	std::unique_ptr<Transport> m_serverTransport;
+	std::unique_ptr<ReplicationServer> m_replicationServer;
+	std::vector<LoopbackClient> m_loopbackClients;
+
+	std::string recordFilePath;
+	std::string replayFilePath;
+	std::string traceFilePath;
 
 	unsigned int currentLevel;
 };
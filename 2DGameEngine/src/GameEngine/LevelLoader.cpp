@@ -1,44 +1,146 @@
 #include "LevelLoader.h"
+#include "TilemapParser.h"
 
-LevelLoader::LevelLoader() noexcept
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
+namespace
 {
+	// collision layer by its name in the level scripts, COLLISION_LAYER_NONE if unknown
+	uint32_t GetCollisionLayer(const std::string& name) noexcept
+	{
+		if (name == "default") return COLLISION_LAYER_DEFAULT;
+		if (name == "player") return COLLISION_LAYER_PLAYER;
+		if (name == "enemy") return COLLISION_LAYER_ENEMY;
+		if (name == "projectile") return COLLISION_LAYER_PROJECTILE;
+		if (name == "obstacle") return COLLISION_LAYER_OBSTACLE;
+		if (!name.empty()) Logger::Warning("Unknown collision layer: " + name);
+		return COLLISION_LAYER_NONE;
+	}
 
-}
+	uint32_t InferCollisionLayer(const std::string& tag, const std::string& group) noexcept
+	{
+		if (tag == "player") return COLLISION_LAYER_PLAYER;
+		if (group == "enemies") return COLLISION_LAYER_ENEMY;
+		if (group == "projectiles") return COLLISION_LAYER_PROJECTILE;
+		if (group == "obstacles") return COLLISION_LAYER_OBSTACLE;
+		return COLLISION_LAYER_DEFAULT;
+	}
 
-LevelLoader::~LevelLoader() noexcept
-{
+	AnimationTrigger GetAnimationTrigger(const std::string& name) noexcept
+	{
+		if (name == "up") return ANIMATION_TRIGGER_UP;
+		if (name == "right") return ANIMATION_TRIGGER_RIGHT;
+		if (name == "down") return ANIMATION_TRIGGER_DOWN;
+		if (name == "left") return ANIMATION_TRIGGER_LEFT;
+		Logger::Warning("Unknown animation trigger: " + name);
+		return ANIMATION_TRIGGER_NONE;
+	}
+
+	// { type = "animation", id, frames = { { x, y, duration }, ... }, loop }
+	// or { type = "animation", id, row, num_frames, frame_width, frame_height, frame_rate, loop } for one sprite sheet row
+	void LoadAnimationClip(AssetStore& assetStore, const sol::table& asset, const std::string& clipId) noexcept
+	{
+		const bool shouldLoop = asset["loop"].get_or(true);
+
+		sol::optional<sol::table> frameTable = asset["frames"];
+		if (frameTable == sol::nullopt)
+		{
+			assetStore.AddAnimationClipRow(clipId, asset["row"].get_or(0), asset["num_frames"].get_or(1),
+				asset["frame_width"].get_or(0), asset["frame_height"].get_or(0), asset["frame_rate"].get_or(1), shouldLoop);
+			return;
+		}
+
+		std::vector<SDL_Point> frames;
+		std::vector<float> frameDurations;
+		for (int i = 0; ; ++i)
+		{
+			sol::optional<sol::table> frame = frameTable.value()[i];
+			if (frame == sol::nullopt)
+			{
+				// the frames table may start at 1 (plain Lua array) or at 0 ([0] = ...)
+				if (i == 0) continue;
+				break;
+			}
+			frames.push_back({ frame.value()["x"].get_or(0), frame.value()["y"].get_or(0) });
+			frameDurations.push_back(frame.value()["duration"].get_or(0.1f));
+		}
+		assetStore.AddAnimationClip(clipId, frames, frameDurations, shouldLoop);
+	}
+
+	// { type = "animation_state_machine", id, transitions = { up = "clip-id", right = ..., down = ..., left = ... } }
+	// the clips must be declared before the state machine
+	void LoadAnimationStateMachine(AssetStore& assetStore, const sol::table& asset, const std::string& stateMachineId) noexcept
+	{
+		std::array<int, ANIMATION_TRIGGER_COUNT> transitions;
+		transitions.fill(-1);
+
+		sol::optional<sol::table> transitionTable = asset["transitions"];
+		if (transitionTable != sol::nullopt)
+		{
+			for (const auto& transition : transitionTable.value())
+			{
+				const AnimationTrigger trigger = GetAnimationTrigger(transition.first.as<std::string>());
+				const std::string clipId = transition.second.as<std::string>();
+				const int clip = assetStore.GetAnimationClipIndex(clipId);
+				if (clip < 0)
+					Logger::Warning("Unknown animation clip: " + clipId);
+				if (trigger != ANIMATION_TRIGGER_NONE)
+					transitions[trigger] = clip;
+			}
+		}
+		assetStore.AddAnimationStateMachine(stateMachineId, transitions);
+	}
 
+	// mask = "enemy" or mask = { "enemy", "obstacle" }, COLLISION_LAYER_NONE (default mask of the layer) when absent
+	uint32_t GetCollisionMask(const sol::object& mask) noexcept
+	{
+		uint32_t layers = COLLISION_LAYER_NONE;
+		if (mask.is<std::string>())
+		{
+			layers = GetCollisionLayer(mask.as<std::string>());
+		}
+		else if (mask.is<sol::table>())
+		{
+			for (const auto& layer : mask.as<sol::table>())
+			{
+				if (layer.second.is<std::string>())
+					layers |= GetCollisionLayer(layer.second.as<std::string>());
+			}
+		}
+		return layers;
+	}
 }
 
-void LevelLoader::TileMapSetUp(sol::state& lua, const std::unique_ptr<Registry>& m_registry) noexcept
+LevelLoader::LevelLoader() noexcept
 {
 
 }
 
-void LevelLoader::LoadLevel(sol::state& lua,
-							const std::unique_ptr<Registry>& m_registry,
-							const std::unique_ptr<AssetStore>& m_assetStore,
-							std::unique_ptr<EventBus>& m_eventBus,
-							SDL_Renderer* m_renderer,
-							unsigned int level) noexcept
+LevelLoader::~LevelLoader() noexcept
 {
-	currentLevel = level;
-	
-	sol::load_result script = lua.load_file("./assets/scripts/Level" + std::to_string(level) + ".lua");
-
-	// checks the syntax of the lua script but does not execute it
-	if (!script.valid())
+	// a load cut short still waits for its decoding workers
+	for (auto& decoding : decodingTextures)
 	{
-		sol::error err = script;
-		Logger::Error("Error loading the lua script: " + std::string(err.what()));
-		return;
+		SDL_Surface* surface = decoding.second.get();
+		if (surface)
+			SDL_FreeSurface(surface);
 	}
+}
 
-	lua.script_file("./assets/scripts/Level" + std::to_string(level) + ".lua");
+void LevelLoader::TileMapSetUp(sol::state& lua, const std::unique_ptr<Registry>& m_registry) noexcept
+{
 
-	sol::table levelmap = lua["Level"];
-	sol::table assets = levelmap["assets"];
+}
 
+/// <summary>
+/// Loads the textures, fonts and animations of Level.assets. A texture or font already loaded from the same
+/// file (and font size) is kept, so a reloaded level script only reloads the entries that changed.
+/// The animation clips and state machines are never replaced: an id already declared keeps its clip.
+/// </summary>
+void LevelLoader::LoadAssets(const sol::table& assets, const std::unique_ptr<AssetStore>& m_assetStore, SDL_Renderer* m_renderer) noexcept
+{
 	int i = 0;
 	while (true)
 	{
@@ -47,234 +149,64 @@ void LevelLoader::LoadLevel(sol::state& lua,
 		{
 			break;
 		}
-		sol::table asset = assets[i];
-		std::string assetType = assets[i]["type"];
-		std::string assetId = assets[i]["id"];
-		if (assetType == "texture")
-		{
-			m_assetStore->AddTexture(m_renderer, assetId, asset["file"]);
-			Logger::Log("Added texture: " + assetId);
-		}
-		else if (assetType == "font")
-		{
-			m_assetStore->AddFont(assetId, asset["file"], asset["font_size"]);
-			Logger::Log("Added font: " + assetId);
-		} 
+		LoadAsset(existsAssetIndexNode.value(), m_assetStore, m_renderer, true);
 		i++;
 	}
+}
 
-	// load the entities and components from the lua file and execute it
-	//  lua.script_file("./assets/scripts/Level" + std::to_string(level) + ".lua");
-
-	// Load the tilemap
-	sol::table map = levelmap["tilemap"];
-	std::string mapFilePath = map["map_file"];
-	std::string mapTextureAssestId = map["texture_asset_id"];
-	int mapNumRows = map["num_rows"];
-	int mapNumCols = map["num_cols"];
-	int tileSize = map["tile_size"];
-	double tileScale = map["scale"];
-	std::fstream mapFile;
-	mapFile.open(mapFilePath);
-
-	if (!mapFile.is_open())
-	{
-		Logger::Error("Error loading the tilemap file");
-		return;
-	}
-
-	////////////////////////////////////////////////////////////////////////////
-	// Read the level tilemap information
-	////////////////////////////////////////////////////////////////////////////
-	// reading the tilemap file
-	for (int row = 0; row < mapNumRows; ++row)
+bool LevelLoader::LoadAsset(const sol::table& asset, const std::unique_ptr<AssetStore>& m_assetStore, SDL_Renderer* m_renderer, bool shouldWait) noexcept
+{
+	std::string assetType = asset["type"];
+	std::string assetId = asset["id"];
+	if (assetType == "texture" || assetType == "font")
 	{
-		for (int col = 0; col < mapNumCols; ++col)
+		const LevelAsset levelAsset = { assetType, asset["file"], asset["font_size"].get_or(0) };
+		auto loaded = levelAssets.find(assetId);
+		if (loaded != levelAssets.end() && loaded->second.type == levelAsset.type &&
+			loaded->second.file == levelAsset.file && loaded->second.fontSize == levelAsset.fontSize)
 		{
-			// will give correct tile from the tilemap
-			char ch[2] = { 0, 0 };
-			mapFile.get(ch[0]);
-			int srcRectY = std::atoi(&ch[0]) * tileSize;
-			mapFile.get(ch[1]);
-			int srcRectX = std::atoi(&ch[1]) * tileSize;
-			mapFile.ignore(); // ignore the comma
-
-			// Create an entity for each tile
-			Entity tile = m_registry->CreateEntity();
-			tile.Group(tileGroup);
-			tile.AddComponent<TransformComponent>(glm::vec2(col * (tileScale * tileSize), row * (tileScale * tileSize)), glm::vec2(tileScale, tileScale), 0.0);
-			tile.AddComponent<SpriteComponent>(mapTextureAssestId, tileSize, tileSize, 0, false, srcRectX, srcRectY);
-		}
-	}
-	mapFile.close();
-
-	// calculate the map width and height
-	Game::mapWidth = mapNumCols * tileSize * tileScale;
-	Game::mapHeight = mapNumRows * tileSize * tileScale;
-
-	////////////////////////////////////////////////////////////////////////////
-	// Read the level entities and their components
-	////////////////////////////////////////////////////////////////////////////
-	sol::table entities = levelmap["entities"];
-	i = 0;
-	while (true) {
-		sol::optional<sol::table> hasEntity = entities[i];
-		if (hasEntity == sol::nullopt) {
-			break;
+			return true;
 		}
 
-		sol::table entity = entities[i];
-
-		Entity newEntity = m_registry->CreateEntity();
-
-		// Tag
-		sol::optional<std::string> tag = entity["tag"];
-		if (tag != sol::nullopt) {
-			newEntity.Tag(entity["tag"]);
+		auto decoding = decodingTextures.find(assetId);
+		if (assetType == "texture" && decoding != decodingTextures.end())
+		{
+			if (!shouldWait && decoding->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				return false;
+			m_assetStore->AddTexture(m_renderer, assetId, levelAsset.file, decoding->second.get());
+			decodingTextures.erase(decoding);
 		}
-
-		// Group
-		sol::optional<std::string> group = entity["group"];
-		if (group != sol::nullopt) {
-			newEntity.Group(entity["group"]);
+		else if (assetType == "texture")
+		{
+			m_assetStore->AddTexture(m_renderer, assetId, levelAsset.file);
 		}
-
-		// Components
-		sol::optional<sol::table> hasComponents = entity["components"];
-		if (hasComponents != sol::nullopt) {
-			// Transform
-			sol::optional<sol::table> transform = entity["components"]["transform"];
-			if (transform != sol::nullopt) {
-				newEntity.AddComponent<TransformComponent>(
-					glm::vec2(
-						entity["components"]["transform"]["position"]["x"],
-						entity["components"]["transform"]["position"]["y"]
-					),
-					glm::vec2(
-						entity["components"]["transform"]["scale"]["x"].get_or(1.0),
-						entity["components"]["transform"]["scale"]["y"].get_or(1.0)
-					),
-					entity["components"]["transform"]["rotation"].get_or(0.0)
-				);
-			}
-
-			// RigidBody
-			sol::optional<sol::table> rigidbody = entity["components"]["rigidbody"];
-			if (rigidbody != sol::nullopt) {
-				newEntity.AddComponent<RigidbodyComponent>(
-					glm::vec2(
-						entity["components"]["rigidbody"]["velocity"]["x"].get_or(0.0),
-						entity["components"]["rigidbody"]["velocity"]["y"].get_or(0.0)
-					)
-				);
-			}
-
-			// Sprite
-			sol::optional<sol::table> sprite = entity["components"]["sprite"];
-			if (sprite != sol::nullopt) {
-				newEntity.AddComponent<SpriteComponent>(
-					entity["components"]["sprite"]["texture_asset_id"],
-					entity["components"]["sprite"]["width"],
-					entity["components"]["sprite"]["height"],
-					entity["components"]["sprite"]["z_index"].get_or(1),
-					entity["components"]["sprite"]["fixed"].get_or(false),
-					entity["components"]["sprite"]["src_rect_x"].get_or(0),
-					entity["components"]["sprite"]["src_rect_y"].get_or(0)
-				);
-			}
-
-			// Animation
-			sol::optional<sol::table> animation = entity["components"]["animation"];
-			if (animation != sol::nullopt) {
-				newEntity.AddComponent<AnimationComponent>(
-					entity["components"]["animation"]["num_frames"].get_or(1),
-					entity["components"]["animation"]["speed_rate"].get_or(1)
-				);
-			}
-
-			// BoxCollider
-			sol::optional<sol::table> collider = entity["components"]["boxcollider"];
-			if (collider != sol::nullopt) {
-				newEntity.AddComponent<BoxColliderComponent>(
-					entity["components"]["boxcollider"]["width"],
-					entity["components"]["boxcollider"]["height"],
-					glm::vec2(
-						entity["components"]["boxcollider"]["offset"]["x"].get_or(0),
-						entity["components"]["boxcollider"]["offset"]["y"].get_or(0)
-					)
-				);
-			}
-
-
-			// ProjectileEmitter
-			sol::optional<sol::table> projectileEmitter = entity["components"]["projectile_emitter"];
-			if (projectileEmitter != sol::nullopt) {
-				newEntity.AddComponent<ProjectileEmitterComponent>(
-					glm::vec2(
-						entity["components"]["projectile_emitter"]["projectile_velocity"]["x"],
-						entity["components"]["projectile_emitter"]["projectile_velocity"]["y"]
-					),
-					static_cast<int>(entity["components"]["projectile_emitter"]["repeat_frequency"].get_or(1)) * 1000,
-					static_cast<int>(entity["components"]["projectile_emitter"]["projectile_duration"].get_or(10)) * 1000,
-					static_cast<int>(entity["components"]["projectile_emitter"]["hit_percentage_damage"].get_or(10)),
-					entity["components"]["projectile_emitter"]["friendly"].get_or(false),
-					entity["components"]["projectile_emitter"]["manual"].get_or(false)
-				);
-			}
-
-			// CameraFollow
-			sol::optional<sol::table> cameraFollow = entity["components"]["camera_follow"];
-			if (cameraFollow != sol::nullopt) {
-				newEntity.AddComponent<CameraFollowComponent>();
-			}
-
-			// KeyboardControlled
-			sol::optional<sol::table> keyboardControlled = entity["components"]["keyboard_controller"];
-			if (keyboardControlled != sol::nullopt) {
-				newEntity.AddComponent<KeyboardControlledComponent>(
-					glm::vec2(
-						entity["components"]["keyboard_controller"]["up_velocity"]["x"],
-						entity["components"]["keyboard_controller"]["up_velocity"]["y"]
-					),
-					glm::vec2(
-						entity["components"]["keyboard_controller"]["right_velocity"]["x"],
-						entity["components"]["keyboard_controller"]["right_velocity"]["y"]
-					),
-					glm::vec2(
-						entity["components"]["keyboard_controller"]["down_velocity"]["x"],
-						entity["components"]["keyboard_controller"]["down_velocity"]["y"]
-					),
-					glm::vec2(
-						entity["components"]["keyboard_controller"]["left_velocity"]["x"],
-						entity["components"]["keyboard_controller"]["left_velocity"]["y"]
-					)
-				);
-			}
-
-			// Health
-			sol::optional<sol::table> health = entity["components"]["health"];
-			if (health != sol::nullopt) {
-				newEntity.AddComponent<HealthComponent>(
-					static_cast<int>(entity["components"]["health"]["health_percentage"].get_or(100)),
-					static_cast<int>(entity["components"]["health"]["health_percentage"].get_or(100))
-				);
-			}
-
-			// Script
-			sol::optional<sol::table> script = entity["components"]["on_update_script"];
-			if (script != sol::nullopt) {
-				sol::function func = entity["components"]["on_update_script"][0];
-				newEntity.AddComponent<ScriptComponent>(func);
-			}
+		else
+		{
+			m_assetStore->AddFont(assetId, levelAsset.file, levelAsset.fontSize);
 		}
-		i++;
+		levelAssets[assetId] = levelAsset;
+		Logger::Log("Added " + assetType + ": " + assetId);
 	}
+	else if (assetType == "animation")
+	{
+		LoadAnimationClip(*m_assetStore, asset, assetId);
+	}
+	else if (assetType == "animation_state_machine")
+	{
+		LoadAnimationStateMachine(*m_assetStore, asset, assetId);
+	}
+	return true;
+}
 
-	Entity label = m_registry->CreateEntity();
-	SDL_Color green = { 0, 255, 0 };
-	label.AddComponent<TextLabelComponent>(glm::vec2(Game::windowWidth / 2 - 40, 10), "CHOPPER 1.0", "charriot-font", green, true);
-
-	m_registry->SubscribeToEvents(m_eventBus);
+void LevelLoader::LoadLevel(sol::state& lua,
+							const std::unique_ptr<Registry>& m_registry,
+							const std::unique_ptr<AssetStore>& m_assetStore,
+							std::unique_ptr<EventBus>& m_eventBus,
+							SDL_Renderer* m_renderer,
+							unsigned int level) noexcept
+{
+	if (BeginLoad(lua, m_assetStore, level))
+		ContinueLoad(m_registry, m_assetStore, m_eventBus, m_renderer, 0.0f);
 
 	//// Adding assets to the asset store
 	//m_assetStore->AddTexture(m_renderer, tankImage, "./assets/images/tank-panther-right.png");
@@ -348,3 +280,654 @@ void LevelLoader::LoadLevel(sol::state& lua,
 	//// Perform the subscription of the events that are waiting to be subscribed
 	// m_registry->SubscribeToEvents(m_eventBus);
 }
+
+/// <summary>
+/// Runs the level script and starts decoding its textures on worker threads (the textures themselves are created
+/// on the render thread by ContinueLoad)
+/// </summary>
+/// <returns>false if the level script can not be loaded</returns>
+bool LevelLoader::BeginLoad(sol::state& lua, const std::unique_ptr<AssetStore>& m_assetStore, unsigned int level) noexcept
+{
+	currentLevel = level;
+	stage = LEVEL_LOAD_STAGE_DONE;
+
+	ProfileScope scriptScope("LevelLoader::Script");
+	sol::load_result script = lua.load_file("./assets/scripts/Level" + std::to_string(level) + ".lua");
+
+	// checks the syntax of the lua script but does not execute it
+	if (!script.valid())
+	{
+		sol::error err = script;
+		Logger::Error("Error loading the lua script: " + std::string(err.what()));
+		return false;
+	}
+
+	lua.script_file("./assets/scripts/Level" + std::to_string(level) + ".lua");
+	levelmap = lua["Level"];
+
+	sol::table assets = levelmap["assets"];
+	assetCount = 0;
+	while (true)
+	{
+		sol::optional<sol::table> asset = assets[assetCount];
+		if (asset == sol::nullopt)
+			break;
+
+		// IMG_Load only touches its own surface, the decoding of every texture can overlap with the rest of the load
+		const std::string assetType = asset.value()["type"].get_or(std::string());
+		if (assetType == "texture" && !m_assetStore->IsHeadless())
+		{
+			const std::string file = asset.value()["file"];
+			decodingTextures[asset.value()["id"]] = std::async(std::launch::async, [file] { return IMG_Load(file.c_str()); });
+		}
+		assetCount++;
+	}
+
+	sol::table entities = levelmap["entities"];
+	entityCount = 0;
+	while (entities[entityCount].get_type() == sol::type::table)
+		entityCount++;
+
+	nextAsset = 0;
+	nextEntity = 0;
+	stage = LEVEL_LOAD_STAGE_ASSETS;
+	return true;
+}
+
+/// <summary>
+/// Loads the next assets, the tilemap and entities until the budget is spent (at least one step per call)
+/// </summary>
+/// <param name="budgetMs">time the call can take, 0 loads everything left</param>
+/// <returns>true once the level is loaded</returns>
+bool LevelLoader::ContinueLoad(const std::unique_ptr<Registry>& m_registry,
+							   const std::unique_ptr<AssetStore>& m_assetStore,
+							   std::unique_ptr<EventBus>& m_eventBus,
+							   SDL_Renderer* m_renderer,
+							   float budgetMs) noexcept
+{
+	ProfileScope scope("LevelLoader::ContinueLoad");
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<float, std::milli>(budgetMs));
+
+	while (IsLoading())
+	{
+		switch (stage)
+		{
+		case LEVEL_LOAD_STAGE_ASSETS:
+		{
+			if (nextAsset == assetCount)
+			{
+				stage = LEVEL_LOAD_STAGE_TILEMAP;
+				break;
+			}
+
+			ProfileScope assetsScope("LevelLoader::Assets");
+			sol::table assets = levelmap["assets"];
+			// a texture still decoding ends the step, the frame goes on and the next call picks it up
+			if (!LoadAsset(assets[nextAsset], m_assetStore, m_renderer, budgetMs <= 0.0f))
+				return false;
+			nextAsset++;
+			break;
+		}
+		case LEVEL_LOAD_STAGE_TILEMAP:
+		{
+			// one step: the whole map is parsed in one pass, no entity is created per tile
+			ProfileScope tilemapScope("LevelLoader::Tilemap");
+			stage = LoadTilemap(m_registry) ? LEVEL_LOAD_STAGE_ENTITIES : LEVEL_LOAD_STAGE_DONE;
+			break;
+		}
+		case LEVEL_LOAD_STAGE_ENTITIES:
+		{
+			if (nextEntity == entityCount)
+			{
+				stage = LEVEL_LOAD_STAGE_FINISH;
+				break;
+			}
+
+			ProfileScope entitiesScope("LevelLoader::Entities");
+			sol::table entities = levelmap["entities"];
+			sol::table entity = entities[nextEntity];
+			// a streamed entity waits in its region until the region is loaded
+			if (isStreaming && IsStreamedEntity(entity))
+			{
+				const glm::vec2 position(entity["components"]["transform"]["position"]["x"], entity["components"]["transform"]["position"]["y"]);
+				regions[GetRegionIndex(position)].levelEntities.push_back(nextEntity);
+			}
+			else
+			{
+				LoadEntity(entity, nextEntity, m_registry, m_assetStore);
+			}
+			nextEntity++;
+			break;
+		}
+		default:
+			FinishLoad(m_registry, m_eventBus);
+			stage = LEVEL_LOAD_STAGE_DONE;
+			break;
+		}
+
+		if (budgetMs > 0.0f && std::chrono::steady_clock::now() >= deadline)
+			break;
+	}
+	return !IsLoading();
+}
+
+float LevelLoader::GetLoadProgress() const noexcept
+{
+	if (stage == LEVEL_LOAD_STAGE_IDLE)
+		return 0.0f;
+	if (stage == LEVEL_LOAD_STAGE_DONE)
+		return 1.0f;
+
+	// one step for the tilemap, the last step subscribes the events
+	const int stepCount = assetCount + 1 + entityCount + 1;
+	const int tilemapStep = stage > LEVEL_LOAD_STAGE_TILEMAP ? 1 : 0;
+	return static_cast<float>(nextAsset + tilemapStep + nextEntity) / stepCount;
+}
+
+bool LevelLoader::LoadTilemap(const std::unique_ptr<Registry>& m_registry) noexcept
+{
+	sol::table map = levelmap["tilemap"];
+	std::string mapFilePath = map["map_file"];
+	mapTextureAssetId = map["texture_asset_id"].get<std::string>();
+	mapNumRows = map["num_rows"];
+	mapNumCols = map["num_cols"];
+	tileSize = map["tile_size"];
+	tileScale = map["scale"];
+	// the original maps use two digit tiles on a 10 tiles wide tileset
+	tilesetColumns = map["tileset_columns"].get_or(TilemapParser::DEFAULT_TILESET_COLUMNS);
+
+	// calculate the map width and height
+	Game::mapWidth = mapNumCols * tileSize * tileScale;
+	Game::mapHeight = mapNumRows * tileSize * tileScale;
+
+	// streamed map: the tiles and entities are created region by region around the camera, from a binary region file
+	// converted from the .map file the first time (and whenever the .map file is newer)
+	const int regionSize = map["region_size"].get_or(0);
+	isStreaming = regionSize > 0;
+	if (isStreaming)
+	{
+		const std::string regionFilePath = mapFilePath + ".regions";
+		std::error_code error;
+		const bool isConverted = std::filesystem::exists(regionFilePath, error) &&
+			std::filesystem::last_write_time(regionFilePath, error) >= std::filesystem::last_write_time(mapFilePath, error);
+		if (!isConverted && !RegionMap::Convert(mapFilePath, mapNumRows, mapNumCols, regionSize, regionFilePath))
+			return false;
+		if (!regionMap.Open(regionFilePath))
+			return false;
+		if (regionMap.GetNumRows() != mapNumRows || regionMap.GetNumCols() != mapNumCols || regionMap.GetRegionSize() != regionSize)
+		{
+			// the level changed the size of the map or of its regions
+			if (!RegionMap::Convert(mapFilePath, mapNumRows, mapNumCols, regionSize, regionFilePath) || !regionMap.Open(regionFilePath))
+				return false;
+		}
+
+		regions.clear();
+		regions.resize(static_cast<size_t>(regionMap.GetRegionRows()) * regionMap.GetRegionCols());
+		streamedEntities.clear();
+		streamedStates.clear();
+		return true;
+	}
+
+	std::vector<uint16_t> tiles;
+	if (!TilemapParser::ParseFile(mapFilePath, mapNumRows, mapNumCols, tiles))
+		return false;
+	CreateTilemap(m_registry, glm::vec2(0.0f), std::move(tiles), mapNumRows, mapNumCols);
+	return true;
+}
+
+// one entity for a whole tilemap (or region), the RenderSystem draws its tiles
+Entity LevelLoader::CreateTilemap(const std::unique_ptr<Registry>& m_registry, const glm::vec2& position, std::vector<uint16_t> tiles, int numRows, int numCols) noexcept
+{
+	Entity tilemap = m_registry->CreateEntity();
+	tilemap.Group(tileGroup);
+	tilemap.AddComponent<TransformComponent>(position, glm::vec2(tileScale, tileScale), 0.0);
+	tilemap.AddComponent<SpriteComponent>(mapTextureAssetId, tileSize, tileSize, 0);
+	tilemap.AddComponent<TilemapComponent>(std::move(tiles), numRows, numCols, tilesetColumns);
+	return tilemap;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Read the level entities and their components
+////////////////////////////////////////////////////////////////////////////
+Entity LevelLoader::LoadEntity(const sol::table& entity, int levelEntity, const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore) noexcept
+{
+	Entity newEntity = m_registry->CreateEntity();
+
+	// Tag
+	sol::optional<std::string> tag = entity["tag"];
+	if (tag != sol::nullopt) {
+		newEntity.Tag(entity["tag"]);
+	}
+
+	// Group
+	sol::optional<std::string> group = entity["group"];
+	if (group != sol::nullopt) {
+		newEntity.Group(entity["group"]);
+	}
+
+	// Components
+	sol::optional<sol::table> hasComponents = entity["components"];
+	if (hasComponents != sol::nullopt) {
+		// Transform
+		sol::optional<sol::table> transform = entity["components"]["transform"];
+		if (transform != sol::nullopt) {
+			newEntity.AddComponent<TransformComponent>(
+				glm::vec2(
+					entity["components"]["transform"]["position"]["x"],
+					entity["components"]["transform"]["position"]["y"]
+				),
+				glm::vec2(
+					entity["components"]["transform"]["scale"]["x"].get_or(1.0),
+					entity["components"]["transform"]["scale"]["y"].get_or(1.0)
+				),
+				entity["components"]["transform"]["rotation"].get_or(0.0)
+			);
+		}
+
+		// RigidBody
+		sol::optional<sol::table> rigidbody = entity["components"]["rigidbody"];
+		if (rigidbody != sol::nullopt) {
+			newEntity.AddComponent<RigidbodyComponent>(
+				glm::vec2(
+					entity["components"]["rigidbody"]["velocity"]["x"].get_or(0.0),
+					entity["components"]["rigidbody"]["velocity"]["y"].get_or(0.0)
+				)
+			);
+		}
+
+		// Sprite
+		sol::optional<sol::table> sprite = entity["components"]["sprite"];
+		if (sprite != sol::nullopt) {
+			newEntity.AddComponent<SpriteComponent>(
+				entity["components"]["sprite"]["texture_asset_id"],
+				entity["components"]["sprite"]["width"],
+				entity["components"]["sprite"]["height"],
+				entity["components"]["sprite"]["z_index"].get_or(1),
+				entity["components"]["sprite"]["fixed"].get_or(false),
+				entity["components"]["sprite"]["src_rect_x"].get_or(0),
+				entity["components"]["sprite"]["src_rect_y"].get_or(0)
+			);
+		}
+
+		// Animation
+		sol::optional<sol::table> animation = entity["components"]["animation"];
+		if (animation != sol::nullopt) {
+			int clip = -1;
+			int stateMachine = -1;
+			sol::optional<std::string> clipId = entity["components"]["animation"]["clip"];
+			sol::optional<std::string> stateMachineId = entity["components"]["animation"]["state_machine"];
+			if (clipId != sol::nullopt) {
+				clip = m_assetStore->GetAnimationClipIndex(clipId.value());
+				if (clip < 0) Logger::Warning("Unknown animation clip: " + clipId.value());
+			}
+			else if (newEntity.HasComponent<SpriteComponent>()) {
+				// num_frames/speed_rate on one sprite sheet row, the entities with the same animation share one clip
+				const auto& sprite = newEntity.GetComponent<SpriteComponent>();
+				const int numFrames = entity["components"]["animation"]["num_frames"].get_or(1);
+				const int frameRate = entity["components"]["animation"]["speed_rate"].get_or(1);
+				const int row = entity["components"]["animation"]["row"].get_or(sprite.m_height > 0 ? sprite.m_srcRect.y / sprite.m_height : 0);
+				const bool shouldLoop = entity["components"]["animation"]["loop"].get_or(true);
+				const std::string rowSuffix = "/" + std::to_string(numFrames) + "/" + std::to_string(frameRate) + (shouldLoop ? "/loop" : "/once");
+				const auto addRowClip = [&](int clipRow) {
+					return m_assetStore->AddAnimationClipRow(sprite.assetId + "/" + std::to_string(clipRow) + rowSuffix,
+						clipRow, numFrames, sprite.m_width, sprite.m_height, frameRate, shouldLoop);
+				};
+				clip = addRowClip(row);
+
+				// a keyboard controlled entity without a state machine keeps the sprite sheet layout of the direction rows
+				// (up, right, down, left), the keyboard triggers are the row indices
+				if (stateMachineId == sol::nullopt && entity["components"]["keyboard_controller"].get_type() == sol::type::table) {
+					std::array<int, ANIMATION_TRIGGER_COUNT> transitions;
+					for (int trigger = 0; trigger < ANIMATION_TRIGGER_COUNT; ++trigger)
+						transitions[trigger] = addRowClip(trigger);
+					stateMachine = m_assetStore->AddAnimationStateMachine(sprite.assetId + "/directions" + rowSuffix, transitions);
+				}
+			}
+
+			if (stateMachineId != sol::nullopt) {
+				stateMachine = m_assetStore->GetAnimationStateMachineIndex(stateMachineId.value());
+				if (stateMachine < 0) Logger::Warning("Unknown animation state machine: " + stateMachineId.value());
+			}
+
+			newEntity.AddComponent<AnimationComponent>(clip, stateMachine);
+		}
+
+		// BoxCollider
+		sol::optional<sol::table> collider = entity["components"]["boxcollider"];
+		if (collider != sol::nullopt) {
+			// the layer is inferred from the tag/group when the level does not give one
+			uint32_t layer = GetCollisionLayer(entity["components"]["boxcollider"]["layer"].get_or(std::string()));
+			if (layer == COLLISION_LAYER_NONE)
+				layer = InferCollisionLayer(tag.value_or(std::string()), group.value_or(std::string()));
+
+			newEntity.AddComponent<BoxColliderComponent>(
+				entity["components"]["boxcollider"]["width"],
+				entity["components"]["boxcollider"]["height"],
+				glm::vec2(
+					entity["components"]["boxcollider"]["offset"]["x"].get_or(0),
+					entity["components"]["boxcollider"]["offset"]["y"].get_or(0)
+				),
+				false,
+				layer,
+				GetCollisionMask(entity["components"]["boxcollider"]["mask"]),
+				// the projectiles are fast enough to tunnel through a thin collider in one frame
+				entity["components"]["boxcollider"]["continuous"].get_or(layer == COLLISION_LAYER_PROJECTILE)
+			);
+		}
+
+
+		// ProjectileEmitter
+		sol::optional<sol::table> projectileEmitter = entity["components"]["projectile_emitter"];
+		if (projectileEmitter != sol::nullopt) {
+			newEntity.AddComponent<ProjectileEmitterComponent>(
+				glm::vec2(
+					entity["components"]["projectile_emitter"]["projectile_velocity"]["x"],
+					entity["components"]["projectile_emitter"]["projectile_velocity"]["y"]
+				),
+				static_cast<int>(entity["components"]["projectile_emitter"]["repeat_frequency"].get_or(1)) * 1000,
+				static_cast<int>(entity["components"]["projectile_emitter"]["projectile_duration"].get_or(10)) * 1000,
+				static_cast<int>(entity["components"]["projectile_emitter"]["hit_percentage_damage"].get_or(10)),
+				entity["components"]["projectile_emitter"]["friendly"].get_or(false),
+				entity["components"]["projectile_emitter"]["manual"].get_or(false)
+			);
+		}
+
+		// CameraFollow
+		sol::optional<sol::table> cameraFollow = entity["components"]["camera_follow"];
+		if (cameraFollow != sol::nullopt) {
+			newEntity.AddComponent<CameraFollowComponent>();
+		}
+
+		// KeyboardControlled
+		sol::optional<sol::table> keyboardControlled = entity["components"]["keyboard_controller"];
+		if (keyboardControlled != sol::nullopt) {
+			newEntity.AddComponent<KeyboardControlledComponent>(
+				glm::vec2(
+					entity["components"]["keyboard_controller"]["up_velocity"]["x"],
+					entity["components"]["keyboard_controller"]["up_velocity"]["y"]
+				),
+				glm::vec2(
+					entity["components"]["keyboard_controller"]["right_velocity"]["x"],
+					entity["components"]["keyboard_controller"]["right_velocity"]["y"]
+				),
+				glm::vec2(
+					entity["components"]["keyboard_controller"]["down_velocity"]["x"],
+					entity["components"]["keyboard_controller"]["down_velocity"]["y"]
+				),
+				glm::vec2(
+					entity["components"]["keyboard_controller"]["left_velocity"]["x"],
+					entity["components"]["keyboard_controller"]["left_velocity"]["y"]
+				)
+			);
+		}
+
+		// MapClamp
+		sol::optional<sol::table> mapClamp = entity["components"]["map_clamp"];
+		if (mapClamp != sol::nullopt) {
+			newEntity.AddComponent<MapClampComponent>(
+				static_cast<int>(entity["components"]["map_clamp"]["padding_left"].get_or(10)),
+				static_cast<int>(entity["components"]["map_clamp"]["padding_top"].get_or(10)),
+				static_cast<int>(entity["components"]["map_clamp"]["padding_right"].get_or(50)),
+				static_cast<int>(entity["components"]["map_clamp"]["padding_bottom"].get_or(50))
+			);
+		}
+
+		// Health
+		sol::optional<sol::table> health = entity["components"]["health"];
+		if (health != sol::nullopt) {
+			newEntity.AddComponent<HealthComponent>(
+				static_cast<int>(entity["components"]["health"]["health_percentage"].get_or(100)),
+				static_cast<int>(entity["components"]["health"]["health_percentage"].get_or(100))
+			);
+		}
+
+		// Script
+		sol::optional<sol::table> script = entity["components"]["on_update_script"];
+		if (script != sol::nullopt) {
+			sol::protected_function func = entity["components"]["on_update_script"][0];
+			newEntity.AddComponent<ScriptComponent>(
+				func,
+				-1,
+				entity["components"]["on_update_script"]["interval"].get_or(1),
+				newEntity.GetID(),
+				entity["components"]["on_update_script"]["coroutine"].get_or(false)
+			);
+			newEntity.GetComponent<ScriptComponent>().levelEntity = levelEntity;
+		}
+
+		// Batch script: a function of Level.batch_scripts called once per frame for all the entities using it
+		sol::optional<std::string> batchScript = entity["components"]["batch_script"];
+		if (batchScript != sol::nullopt && m_registry->HasSystem<ScriptSystem>()) {
+			sol::optional<sol::protected_function> func = levelmap["batch_scripts"][batchScript.value()];
+			if (func != sol::nullopt) {
+				const int batch = m_registry->GetSystem<ScriptSystem>().AddScriptBatch(batchScript.value(), func.value());
+				newEntity.AddComponent<ScriptComponent>(sol::lua_nil, batch);
+			}
+			else {
+				Logger::Warning("Unknown batch script: " + batchScript.value());
+			}
+		}
+	}
+
+	return newEntity;
+}
+
+void LevelLoader::FinishLoad(const std::unique_ptr<Registry>& m_registry, std::unique_ptr<EventBus>& m_eventBus) noexcept
+{
+	Entity label = m_registry->CreateEntity();
+	SDL_Color green = { 0, 255, 0 };
+	label.AddComponent<TextLabelComponent>(glm::vec2(Game::windowWidth / 2 - 40, 10), "CHOPPER 1.0", "charriot-font", green, true);
+
+	ProfileScope subscribeScope("LevelLoader::SubscribeToEvents");
+	m_registry->SubscribeToEvents(m_eventBus);
+}
+
+// the entities with a transform are streamed, except the player (keyboard or camera) and the ones with streamed = false
+bool LevelLoader::IsStreamedEntity(const sol::table& entity) const noexcept
+{
+	sol::optional<sol::table> components = entity["components"];
+	if (components == sol::nullopt || !entity["streamed"].get_or(true))
+		return false;
+	return components.value()["transform"].get_type() == sol::type::table &&
+		components.value()["keyboard_controller"].get_type() != sol::type::table &&
+		components.value()["camera_follow"].get_type() != sol::type::table;
+}
+
+int LevelLoader::GetRegionIndex(const glm::vec2& position) const noexcept
+{
+	const double regionPixels = regionMap.GetRegionSize() * tileSize * tileScale;
+	const int regionRow = std::clamp(static_cast<int>(std::floor(position.y / regionPixels)), 0, regionMap.GetRegionRows() - 1);
+	const int regionCol = std::clamp(static_cast<int>(std::floor(position.x / regionPixels)), 0, regionMap.GetRegionCols() - 1);
+	return regionRow * regionMap.GetRegionCols() + regionCol;
+}
+
+/// <summary>
+/// Streams the regions of the map around the camera. The regions within REGION_LOAD_MARGIN regions of the camera
+/// are loaded (tiles and waiting entities) and the ones past REGION_UNLOAD_MARGIN are unloaded, the gap between the two
+/// keeps a region at the edge of the view from being loaded and unloaded on every frame.
+/// A streamed entity is saved and destroyed once it stands in an unloaded region, and waits in that region.
+/// </summary>
+void LevelLoader::StreamRegions(const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore, const SDL_Rect& camera) noexcept
+{
+	if (!isStreaming || regions.empty())
+		return;
+
+	ProfileScope scope("LevelLoader::StreamRegions");
+	const double regionPixels = regionMap.GetRegionSize() * tileSize * tileScale;
+	const int regionRows = regionMap.GetRegionRows();
+	const int regionCols = regionMap.GetRegionCols();
+
+	// regions overlapping the camera grown by margin regions
+	const auto isInRange = [&](int regionRow, int regionCol, float margin) noexcept
+	{
+		const double left = (regionCol - margin) * regionPixels;
+		const double top = (regionRow - margin) * regionPixels;
+		const double right = (regionCol + 1 + margin) * regionPixels;
+		const double bottom = (regionRow + 1 + margin) * regionPixels;
+		return left < camera.x + camera.w && right > camera.x && top < camera.y + camera.h && bottom > camera.y;
+	};
+
+	for (int regionRow = 0; regionRow < regionRows; ++regionRow)
+	{
+		for (int regionCol = 0; regionCol < regionCols; ++regionCol)
+		{
+			const int region = regionRow * regionCols + regionCol;
+			if (regions[region].isLoaded && !isInRange(regionRow, regionCol, REGION_UNLOAD_MARGIN))
+				UnloadRegion(region);
+		}
+	}
+
+	// the entities destroyed by the game are never created again, the others follow the region they stand in
+	for (auto streamed = streamedEntities.begin(); streamed != streamedEntities.end(); )
+	{
+		Entity& entity = streamed->second;
+		const int levelEntity = streamed->first;
+		// the id of a destroyed entity can be reused, the component tells if it is still the same entity
+		if (!entity.HasComponent<StreamedComponent>() || entity.GetComponent<StreamedComponent>().levelEntity != levelEntity)
+		{
+			streamedStates[levelEntity].isDestroyed = true;
+			streamed = streamedEntities.erase(streamed);
+			continue;
+		}
+
+		const auto& transform = entity.GetComponent<TransformComponent>();
+		const int region = GetRegionIndex(transform.m_position);
+		if (regions[region].isLoaded)
+		{
+			++streamed;
+			continue;
+		}
+
+		StreamedEntityState& state = streamedStates[levelEntity];
+		state.position = transform.m_position;
+		state.rotation = transform.m_rotation;
+		state.velocity = entity.HasComponent<RigidbodyComponent>() ? entity.GetComponent<RigidbodyComponent>().m_velocity : glm::vec2(0.0f);
+		state.health = entity.HasComponent<HealthComponent>() ? entity.GetComponent<HealthComponent>().m_currentHealth : 0;
+		state.isDestroyed = false;
+		regions[region].levelEntities.push_back(levelEntity);
+		entity.Destroy();
+		streamed = streamedEntities.erase(streamed);
+	}
+
+	for (int regionRow = 0; regionRow < regionRows; ++regionRow)
+	{
+		for (int regionCol = 0; regionCol < regionCols; ++regionCol)
+		{
+			const int region = regionRow * regionCols + regionCol;
+			if (!regions[region].isLoaded && isInRange(regionRow, regionCol, REGION_LOAD_MARGIN))
+				LoadRegion(region, m_registry, m_assetStore);
+		}
+	}
+}
+
+void LevelLoader::LoadRegion(int region, const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore) noexcept
+{
+	ProfileScope scope("LevelLoader::LoadRegion");
+	StreamedRegion& streamedRegion = regions[region];
+	streamedRegion.isLoaded = true;
+
+	const int regionRow = region / regionMap.GetRegionCols();
+	const int regionCol = region % regionMap.GetRegionCols();
+	if (regionMap.ReadRegion(regionRow, regionCol, regionTiles))
+	{
+		const double regionPixels = regionMap.GetRegionSize() * tileSize * tileScale;
+		streamedRegion.tilemap = CreateTilemap(m_registry, glm::vec2(regionCol * regionPixels, regionRow * regionPixels), regionTiles,
+			regionMap.GetRegionHeight(regionRow), regionMap.GetRegionWidth(regionCol));
+		streamedRegion.hasTilemap = true;
+	}
+
+	sol::table entities = levelmap["entities"];
+	for (int levelEntity : streamedRegion.levelEntities)
+	{
+		Entity entity = LoadEntity(entities[levelEntity], levelEntity, m_registry, m_assetStore);
+		entity.AddComponent<StreamedComponent>(levelEntity);
+		streamedEntities.emplace(levelEntity, entity);
+
+		auto state = streamedStates.find(levelEntity);
+		if (state == streamedStates.end())
+			continue;
+
+		auto& transform = entity.GetComponent<TransformComponent>();
+		transform.m_position = state->second.position;
+		transform.m_rotation = state->second.rotation;
+		if (entity.HasComponent<RigidbodyComponent>())
+			entity.GetComponent<RigidbodyComponent>().m_velocity = state->second.velocity;
+		if (entity.HasComponent<HealthComponent>())
+			entity.GetComponent<HealthComponent>().m_currentHealth = state->second.health;
+	}
+	streamedRegion.levelEntities.clear();
+}
+
+void LevelLoader::UnloadRegion(int region) noexcept
+{
+	ProfileScope scope("LevelLoader::UnloadRegion");
+	StreamedRegion& streamedRegion = regions[region];
+	if (streamedRegion.hasTilemap)
+		streamedRegion.tilemap.Destroy();
+	streamedRegion.hasTilemap = false;
+	streamedRegion.isLoaded = false;
+}
+
+/// <summary>
+/// Runs the level script again and rebinds what changed in the running level: the on_update_script functions of the
+/// level entities, the batch scripts and the texture/font entries of Level.assets. The entities, components and tilemap
+/// are not created again, they need a level reload.
+/// </summary>
+void LevelLoader::ReloadScripts(sol::state& lua,
+								const std::unique_ptr<Registry>& m_registry,
+								const std::unique_ptr<AssetStore>& m_assetStore,
+								SDL_Renderer* m_renderer) noexcept
+{
+	ProfileScope scope("LevelLoader::ReloadScripts");
+	const std::string scriptPath = "./assets/scripts/Level" + std::to_string(currentLevel) + ".lua";
+
+	// a script with an error keeps the previous functions running
+	const sol::protected_function_result result = lua.safe_script_file(scriptPath, sol::script_pass_on_error);
+	if (!result.valid())
+	{
+		const sol::error error = result;
+		Logger::Error("Error reloading the lua script: " + std::string(error.what()));
+		return;
+	}
+
+	sol::table levelmap = lua["Level"];
+	LoadAssets(levelmap["assets"], m_assetStore, m_renderer);
+
+	if (!m_registry->HasSystem<ScriptSystem>())
+		return;
+
+	ScriptSystem& scriptSystem = m_registry->GetSystem<ScriptSystem>();
+	int reloadedScripts = 0;
+
+	sol::table entities = levelmap["entities"];
+	for (auto& entity : scriptSystem.GetSystemEntities())
+	{
+		auto& script = entity.GetComponent<ScriptComponent>();
+		if (script.levelEntity < 0 || script.batch >= 0)
+			continue;
+
+		sol::optional<sol::protected_function> func = entities[script.levelEntity]["components"]["on_update_script"][0];
+		if (func == sol::nullopt || ScriptSystem::IsSameScript(script.func, func.value()))
+			continue;
+
+		// a suspended coroutine of the previous function is dropped, the new function starts on its next run
+		script.func = func.value();
+		script.thread = sol::thread();
+		reloadedScripts++;
+	}
+
+	sol::optional<sol::table> batchScripts = levelmap["batch_scripts"];
+	if (batchScripts != sol::nullopt)
+	{
+		for (const auto& batchScript : batchScripts.value())
+		{
+			if (batchScript.first.is<std::string>() && batchScript.second.is<sol::protected_function>() &&
+				scriptSystem.ReloadScriptBatch(batchScript.first.as<std::string>(), batchScript.second.as<sol::protected_function>()))
+				reloadedScripts++;
+		}
+	}
+	scriptSystem.ReloadShards();
+
+	Logger::Log("Reloaded " + scriptPath + ": " + std::to_string(reloadedScripts) + " scripts rebound");
+}
@@ -5,6 +5,8 @@
 #include <string>
 #include <fstream>
 #include <memory>
+#include <future>
+#include <unordered_map>
 #include <SDL.h>
 #include <SDL_image.h>
 #include <sol/sol.hpp>
@@ -18,7 +20,24 @@
 #include "../EventBus/EventBus.h"
 #include "../EventBus/Event.h"
 #include "../Events/Events.h"
+#include "RegionMap.h"
 
+// the steps of a level load, in order
+enum LevelLoadStage
+{
+	LEVEL_LOAD_STAGE_IDLE,
+	LEVEL_LOAD_STAGE_ASSETS,
+	LEVEL_LOAD_STAGE_TILEMAP,
+	LEVEL_LOAD_STAGE_ENTITIES,
+	LEVEL_LOAD_STAGE_FINISH,
+	LEVEL_LOAD_STAGE_DONE
+};
+
+/// <summary>
+/// Loads a level in bounded steps: BeginLoad runs the level script and starts decoding the textures on worker threads,
+/// then every ContinueLoad call loads assets, the tilemap and entities until its time budget is spent.
+/// LoadLevel does both in one blocking call.
+/// </summary>
 class LevelLoader
 {
 public:
@@ -34,9 +53,95 @@ public:
 				   SDL_Renderer* m_renderer,
 				   unsigned int level) noexcept;
 
+	bool BeginLoad(sol::state& lua, const std::unique_ptr<AssetStore>& m_assetStore, unsigned int level) noexcept;
+	// returns true once the level is loaded (or failed to load), a budget of 0 loads everything left
+	bool ContinueLoad(const std::unique_ptr<Registry>& m_registry,
+					  const std::unique_ptr<AssetStore>& m_assetStore,
+					  std::unique_ptr<EventBus>& m_eventBus,
+					  SDL_Renderer* m_renderer,
+					  float budgetMs) noexcept;
+	inline bool IsLoading() const noexcept { return stage != LEVEL_LOAD_STAGE_IDLE && stage != LEVEL_LOAD_STAGE_DONE; }
+	// 0 to 1, one step per asset and entity, one for the tilemap and one to finish
+	float GetLoadProgress() const noexcept;
+
+	// loads the regions around the camera and unloads the far ones (tilemap.region_size levels only)
+	void StreamRegions(const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore, const SDL_Rect& camera) noexcept;
+	inline bool IsStreaming() const noexcept { return isStreaming; }
+
+	// a region is loaded when it comes within LOAD margin of the camera and unloaded past UNLOAD margin (in regions)
+	static constexpr float REGION_LOAD_MARGIN = 0.5f;
+	static constexpr float REGION_UNLOAD_MARGIN = 1.5f;
+
+	void ReloadScripts(sol::state& lua,
+					   const std::unique_ptr<Registry>& m_registry,
+					   const std::unique_ptr<AssetStore>& m_assetStore,
+					   SDL_Renderer* m_renderer) noexcept;
+
 private:
 
+	// texture/font entry of Level.assets, to reload only the entries that changed
+	struct LevelAsset
+	{
+		std::string type;
+		std::string file;
+		int fontSize;
+	};
+
+	void LoadAssets(const sol::table& assets, const std::unique_ptr<AssetStore>& m_assetStore, SDL_Renderer* m_renderer) noexcept;
+	// returns false while the texture of the asset is still decoded by a worker and shouldWait is false
+	bool LoadAsset(const sol::table& asset, const std::unique_ptr<AssetStore>& m_assetStore, SDL_Renderer* m_renderer, bool shouldWait) noexcept;
+	bool LoadTilemap(const std::unique_ptr<Registry>& m_registry) noexcept;
+	Entity CreateTilemap(const std::unique_ptr<Registry>& m_registry, const glm::vec2& position, std::vector<uint16_t> tiles, int numRows, int numCols) noexcept;
+	Entity LoadEntity(const sol::table& entity, int levelEntity, const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore) noexcept;
+	bool IsStreamedEntity(const sol::table& entity) const noexcept;
+	int GetRegionIndex(const glm::vec2& position) const noexcept;
+	void LoadRegion(int region, const std::unique_ptr<Registry>& m_registry, const std::unique_ptr<AssetStore>& m_assetStore) noexcept;
+	void UnloadRegion(int region) noexcept;
+	void FinishLoad(const std::unique_ptr<Registry>& m_registry, std::unique_ptr<EventBus>& m_eventBus) noexcept;
+
 	unsigned int currentLevel;
+	std::unordered_map<std::string, LevelAsset> levelAssets;
+
+	// state of the load in progress
+	LevelLoadStage stage = LEVEL_LOAD_STAGE_IDLE;
+	sol::table levelmap;
+	std::unordered_map<std::string, std::future<SDL_Surface*>> decodingTextures; // textures decoded on worker threads
+	int assetCount = 0;
+	int nextAsset = 0;
+	std::string mapTextureAssetId;
+	int mapNumRows = 0;
+	int mapNumCols = 0;
+	int tileSize = 0;
+	double tileScale = 1.0;
+	int tilesetColumns = 0;
+	int entityCount = 0;
+	int nextEntity = 0;
+
+	// saved when a streamed entity is unloaded, restored when it is created again
+	struct StreamedEntityState
+	{
+		glm::vec2 position;
+		glm::vec2 velocity;
+		double rotation;
+		int health;
+		bool isDestroyed; // destroyed by the game, never created again
+	};
+
+	struct StreamedRegion
+	{
+		bool isLoaded = false;
+		bool hasTilemap = false;
+		Entity tilemap = Entity(0);
+		std::vector<int> levelEntities; // entities waiting in the region while it is unloaded
+	};
+
+	// region streaming
+	bool isStreaming = false;
+	RegionMap regionMap;
+	std::vector<StreamedRegion> regions;
+	std::unordered_map<int, Entity> streamedEntities; // level entity -> live entity
+	std::unordered_map<int, StreamedEntityState> streamedStates;
+	std::vector<uint16_t> regionTiles;
 
 };
 
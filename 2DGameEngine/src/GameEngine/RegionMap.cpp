@@ -0,0 +1,298 @@
+#include "RegionMap.h"
+
+#include "TilemapParser.h"
+#include "../Logger/Logger.h"
+
+#include <algorithm>
+#include <climits>
+
+namespace
+{
+	constexpr char REGION_MAP_MAGIC[4] = { '2', 'D', 'R', 'G' };
+	constexpr size_t REGION_MAP_HEADER_SIZE = 4 + 2 + 2 + 4 + 4;
+
+	void WriteU16(std::vector<uint8_t>& buffer, uint16_t value) noexcept
+	{
+		buffer.push_back(static_cast<uint8_t>(value));
+		buffer.push_back(static_cast<uint8_t>(value >> 8));
+	}
+
+	void WriteU32(std::vector<uint8_t>& buffer, uint32_t value) noexcept
+	{
+		for (int i = 0; i < 4; ++i)
+			buffer.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+
+	void WriteVarint(std::vector<uint8_t>& buffer, uint32_t value) noexcept
+	{
+		while (value >= 0x80)
+		{
+			buffer.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back(static_cast<uint8_t>(value));
+	}
+
+	uint32_t ReadU32(const uint8_t* data) noexcept
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < 4; ++i)
+			value |= static_cast<uint32_t>(data[i]) << (i * 8);
+		return value;
+	}
+
+	bool ReadVarint(const std::vector<uint8_t>& buffer, size_t& offset, uint32_t& value) noexcept
+	{
+		value = 0;
+		for (int shift = 0; shift < 35; shift += 7)
+		{
+			if (offset >= buffer.size()) return false;
+			const uint8_t byte = buffer[offset++];
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+
+	// run-length encodes the tiles of one region
+	void WriteRegion(std::vector<uint8_t>& buffer, const std::vector<uint16_t>& band, int numCols, int firstCol, int width, int height) noexcept
+	{
+		uint32_t runLength = 0;
+		uint16_t runTile = 0;
+		for (int row = 0; row < height; ++row)
+		{
+			for (int col = firstCol; col < firstCol + width; ++col)
+			{
+				const uint16_t tile = band[row * numCols + col];
+				if (runLength > 0 && tile == runTile)
+				{
+					runLength++;
+					continue;
+				}
+				if (runLength > 0)
+				{
+					WriteVarint(buffer, runLength);
+					WriteVarint(buffer, runTile);
+				}
+				runTile = tile;
+				runLength = 1;
+			}
+		}
+		WriteVarint(buffer, runLength);
+		WriteVarint(buffer, runTile);
+	}
+}
+
+RegionMap::RegionMap() noexcept
+{
+
+}
+
+RegionMap::~RegionMap() noexcept
+{
+
+}
+
+/// <summary>
+/// Reads a text .map file one band of regionSize rows at a time and writes its regions to a binary region file
+/// </summary>
+/// <returns>false if the map can not be read or the region file can not be written</returns>
+bool RegionMap::Convert(const std::string& mapFilePath, int numRows, int numCols, int regionSize, const std::string& regionFilePath) noexcept
+{
+	if (numRows <= 0 || numCols <= 0 || regionSize <= 0 || regionSize > UINT16_MAX)
+	{
+		Logger::Error("Invalid tilemap size to convert to regions: " + mapFilePath);
+		return false;
+	}
+
+	std::ifstream mapFile(mapFilePath, std::ios::binary);
+	std::ofstream regionFile(regionFilePath, std::ios::binary | std::ios::trunc);
+	if (!mapFile.is_open() || !regionFile.is_open())
+	{
+		Logger::Error("Error converting the tilemap " + mapFilePath + " to " + regionFilePath);
+		return false;
+	}
+
+	const int regionRows = (numRows + regionSize - 1) / regionSize;
+	const int regionCols = (numCols + regionSize - 1) / regionSize;
+
+	std::vector<uint8_t> header;
+	header.insert(header.end(), std::begin(REGION_MAP_MAGIC), std::end(REGION_MAP_MAGIC));
+	WriteU16(header, VERSION);
+	WriteU16(header, static_cast<uint16_t>(regionSize));
+	WriteU32(header, static_cast<uint32_t>(numRows));
+	WriteU32(header, static_cast<uint32_t>(numCols));
+
+	// the offset table is written once every region size is known, the regions follow it
+	const size_t tableSize = (static_cast<size_t>(regionRows) * regionCols + 1) * 4;
+	std::vector<uint32_t> offsets;
+	offsets.reserve(static_cast<size_t>(regionRows) * regionCols + 1);
+	regionFile.seekp(REGION_MAP_HEADER_SIZE + tableSize);
+	uint32_t offset = static_cast<uint32_t>(REGION_MAP_HEADER_SIZE + tableSize);
+
+	std::vector<uint16_t> band;
+	std::string bandText;
+	std::string line;
+	std::string error;
+	std::vector<uint8_t> regions;
+	for (int regionRow = 0; regionRow < regionRows; ++regionRow)
+	{
+		// the lines of the band (the empty ones do not count as rows) are parsed together
+		const int height = std::min(regionSize, numRows - regionRow * regionSize);
+		bandText.clear();
+		for (int row = 0; row < height && std::getline(mapFile, line); )
+		{
+			if (line.find_first_not_of(" \t\r") == std::string::npos)
+				continue;
+			bandText += line;
+			bandText += '\n';
+			++row;
+		}
+
+		band.clear();
+		if (!TilemapParser::Parse(bandText.data(), bandText.size(), height, numCols, band, error))
+		{
+			Logger::Error("Invalid tilemap " + mapFilePath + " (rows from " + std::to_string(regionRow * regionSize + 1) + "): " + error);
+			return false;
+		}
+
+		regions.clear();
+		for (int regionCol = 0; regionCol < regionCols; ++regionCol)
+		{
+			offsets.push_back(offset + static_cast<uint32_t>(regions.size()));
+			const int width = std::min(regionSize, numCols - regionCol * regionSize);
+			WriteRegion(regions, band, numCols, regionCol * regionSize, width, height);
+		}
+		regionFile.write(reinterpret_cast<const char*>(regions.data()), regions.size());
+		offset += static_cast<uint32_t>(regions.size());
+	}
+	offsets.push_back(offset);
+
+	while (std::getline(mapFile, line))
+	{
+		if (line.find_first_not_of(" \t\r") != std::string::npos)
+		{
+			Logger::Error("Invalid tilemap " + mapFilePath + ": the tilemap has more than " + std::to_string(numRows) + " rows");
+			return false;
+		}
+	}
+
+	for (uint32_t regionOffset : offsets)
+		WriteU32(header, regionOffset);
+	regionFile.seekp(0);
+	regionFile.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+	if (!regionFile.good())
+	{
+		Logger::Error("Error writing the region file: " + regionFilePath);
+		return false;
+	}
+	Logger::Log("Converted " + mapFilePath + " to " + std::to_string(regionRows * regionCols) + " regions (" +
+				std::to_string(offset) + " bytes)");
+	return true;
+}
+
+/// <summary>
+/// Reads the header and the offset table, the regions are read on demand
+/// </summary>
+bool RegionMap::Open(const std::string& regionFilePath) noexcept
+{
+	m_file.close();
+	m_offsets.clear();
+	m_file.open(regionFilePath, std::ios::binary);
+	if (!m_file.is_open())
+	{
+		Logger::Error("Error opening the region file: " + regionFilePath);
+		return false;
+	}
+
+	uint8_t header[REGION_MAP_HEADER_SIZE];
+	if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)) || !std::equal(std::begin(REGION_MAP_MAGIC), std::end(REGION_MAP_MAGIC), header))
+	{
+		Logger::Error("Invalid region file: " + regionFilePath);
+		return false;
+	}
+
+	const uint16_t version = static_cast<uint16_t>(header[4] | (header[5] << 8));
+	if (version != VERSION)
+	{
+		Logger::Error("Unsupported region file version: " + std::to_string(version));
+		return false;
+	}
+	m_regionSize = header[6] | (header[7] << 8);
+	m_numRows = static_cast<int>(ReadU32(header + 8));
+	m_numCols = static_cast<int>(ReadU32(header + 12));
+	if (m_regionSize <= 0 || m_numRows <= 0 || m_numCols <= 0 || m_numRows > INT_MAX - m_regionSize || m_numCols > INT_MAX - m_regionSize)
+	{
+		Logger::Error("Invalid region file: " + regionFilePath);
+		return false;
+	}
+
+	// the offset table and the regions must fit in the file, a corrupted header is not trusted with an allocation
+	m_file.seekg(0, std::ios::end);
+	const uint64_t fileSize = static_cast<uint64_t>(m_file.tellg());
+	m_file.seekg(REGION_MAP_HEADER_SIZE);
+	const uint64_t tableSize = (static_cast<uint64_t>(GetRegionRows()) * GetRegionCols() + 1) * 4;
+	if (tableSize > fileSize - REGION_MAP_HEADER_SIZE)
+	{
+		Logger::Error("Truncated region file: " + regionFilePath);
+		return false;
+	}
+
+	std::vector<uint8_t> table(static_cast<size_t>(tableSize));
+	if (!m_file.read(reinterpret_cast<char*>(table.data()), table.size()))
+	{
+		Logger::Error("Truncated region file: " + regionFilePath);
+		return false;
+	}
+	m_offsets.resize(table.size() / 4);
+	for (size_t i = 0; i < m_offsets.size(); ++i)
+		m_offsets[i] = ReadU32(table.data() + i * 4);
+
+	// the regions follow the table in order, ReadRegion sizes its buffer from two consecutive offsets
+	bool areOffsetsValid = m_offsets.front() >= REGION_MAP_HEADER_SIZE + tableSize && m_offsets.back() <= fileSize;
+	for (size_t i = 1; areOffsetsValid && i < m_offsets.size(); ++i)
+		areOffsetsValid = m_offsets[i] >= m_offsets[i - 1];
+	if (!areOffsetsValid)
+	{
+		Logger::Error("Invalid region offsets in the region file: " + regionFilePath);
+		m_offsets.clear();
+		return false;
+	}
+	return true;
+}
+
+bool RegionMap::ReadRegion(int regionRow, int regionCol, std::vector<uint16_t>& tiles) noexcept
+{
+	if (regionRow < 0 || regionRow >= GetRegionRows() || regionCol < 0 || regionCol >= GetRegionCols())
+		return false;
+
+	const size_t region = static_cast<size_t>(regionRow) * GetRegionCols() + regionCol;
+	if (region + 1 >= m_offsets.size())
+		return false;
+	m_buffer.resize(m_offsets[region + 1] - m_offsets[region]);
+	m_file.clear();
+	m_file.seekg(m_offsets[region]);
+	if (!m_file.read(reinterpret_cast<char*>(m_buffer.data()), m_buffer.size()))
+	{
+		Logger::Error("Error reading the region " + std::to_string(regionRow) + "," + std::to_string(regionCol));
+		return false;
+	}
+
+	const size_t tileCount = static_cast<size_t>(GetRegionWidth(regionCol)) * GetRegionHeight(regionRow);
+	tiles.clear();
+	size_t offset = 0;
+	while (tiles.size() < tileCount)
+	{
+		uint32_t runLength = 0;
+		uint32_t tile = 0;
+		if (!ReadVarint(m_buffer, offset, runLength) || !ReadVarint(m_buffer, offset, tile) ||
+			tiles.size() + runLength > tileCount || tile > UINT16_MAX)
+		{
+			Logger::Error("Corrupted region " + std::to_string(regionRow) + "," + std::to_string(regionCol));
+			return false;
+		}
+		tiles.insert(tiles.end(), runLength, static_cast<uint16_t>(tile));
+	}
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef REGIONMAP_H
+#define REGIONMAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Binary tilemap split into square regions of regionSize x regionSize tiles, read one region at a time
+/// so a map does not have to fit in memory. Built from a text .map file by Convert.
+///
+/// File layout (little-endian):
+/// magic "2DRG" | u16 version | u16 region size (tiles) | u32 rows | u32 columns |
+/// u32 offset of every region (row-major) + u32 end offset |
+/// per region: runs of (varint count, varint tile index) covering its tiles row by row
+/// </summary>
+class RegionMap
+{
+public:
+
+	RegionMap() noexcept;
+	~RegionMap() noexcept;
+
+	// converts a text .map file (see TilemapParser), one band of regionSize rows at a time
+	static bool Convert(const std::string& mapFilePath, int numRows, int numCols, int regionSize, const std::string& regionFilePath) noexcept;
+
+	bool Open(const std::string& regionFilePath) noexcept;
+	// tiles of a region, row by row (GetRegionWidth x GetRegionHeight)
+	bool ReadRegion(int regionRow, int regionCol, std::vector<uint16_t>& tiles) noexcept;
+
+	inline int GetNumRows() const noexcept { return m_numRows; }
+	inline int GetNumCols() const noexcept { return m_numCols; }
+	inline int GetRegionSize() const noexcept { return m_regionSize; }
+	inline int GetRegionRows() const noexcept { return (m_numRows + m_regionSize - 1) / m_regionSize; }
+	inline int GetRegionCols() const noexcept { return (m_numCols + m_regionSize - 1) / m_regionSize; }
+	// the regions of the last row/column are cut by the map edges
+	inline int GetRegionWidth(int regionCol) const noexcept { return std::min(m_regionSize, m_numCols - regionCol * m_regionSize); }
+	inline int GetRegionHeight(int regionRow) const noexcept { return std::min(m_regionSize, m_numRows - regionRow * m_regionSize); }
+
+	static constexpr uint16_t VERSION = 2;
+
+private:
+
+	std::ifstream m_file;
+	int m_numRows = 0;
+	int m_numCols = 0;
+	int m_regionSize = 0;
+	std::vector<uint32_t> m_offsets; // region count + 1
+	std::vector<uint8_t> m_buffer;
+};
+
+#endif // REGIONMAP_H
@@ -0,0 +1,123 @@
+#include "TilemapParser.h"
+
+#include "../Logger/Logger.h"
+
+#include <fstream>
+
+namespace
+{
+	inline bool IsDigit(char c) noexcept { return c >= '0' && c <= '9'; }
+	inline bool IsBlank(char c) noexcept { return c == ' ' || c == '\t'; }
+	inline bool IsEndOfLine(char c) noexcept { return c == '\n' || c == '\r'; }
+
+	std::string GetPosition(int row, int col) noexcept
+	{
+		return "row " + std::to_string(row + 1) + ", column " + std::to_string(col + 1);
+	}
+}
+
+/// <summary>
+/// Parses numRows lines of numCols tile indices. Blanks around the indices, a trailing comma at the end of a line,
+/// \r\n line ends and empty lines are accepted.
+/// </summary>
+bool TilemapParser::Parse(const char* data, size_t size, int numRows, int numCols, std::vector<uint16_t>& tiles, std::string& error) noexcept
+{
+	if (numRows <= 0 || numCols <= 0)
+	{
+		error = "invalid tilemap size " + std::to_string(numRows) + "x" + std::to_string(numCols);
+		return false;
+	}
+
+	const size_t firstTile = tiles.size();
+	tiles.resize(firstTile + static_cast<size_t>(numRows) * numCols);
+	uint16_t* tile = tiles.data() + firstTile;
+
+	const char* cursor = data;
+	const char* const end = data + size;
+	for (int row = 0; row < numRows; ++row)
+	{
+		while (cursor < end && (IsEndOfLine(*cursor) || IsBlank(*cursor)))
+			++cursor;
+
+		for (int col = 0; col < numCols; ++col)
+		{
+			while (cursor < end && IsBlank(*cursor))
+				++cursor;
+
+			if (cursor == end || !IsDigit(*cursor))
+			{
+				tiles.resize(firstTile);
+				if (cursor == end || IsEndOfLine(*cursor))
+					error = GetPosition(row, col) + ": the row has " + std::to_string(col) + " columns, expected " + std::to_string(numCols);
+				else
+					error = GetPosition(row, col) + ": unexpected character '" + std::string(1, *cursor) + "'";
+				return false;
+			}
+
+			uint32_t index = 0;
+			while (cursor < end && IsDigit(*cursor))
+			{
+				index = index * 10 + static_cast<uint32_t>(*cursor - '0');
+				if (index > UINT16_MAX)
+				{
+					tiles.resize(firstTile);
+					error = GetPosition(row, col) + ": tile index larger than " + std::to_string(UINT16_MAX);
+					return false;
+				}
+				++cursor;
+			}
+			*tile++ = static_cast<uint16_t>(index);
+
+			while (cursor < end && IsBlank(*cursor))
+				++cursor;
+			if (cursor < end && *cursor == ',')
+				++cursor;
+		}
+
+		// the row must end here
+		while (cursor < end && IsBlank(*cursor))
+			++cursor;
+		if (cursor < end && !IsEndOfLine(*cursor))
+		{
+			tiles.resize(firstTile);
+			error = GetPosition(row, numCols) + ": the row has more than " + std::to_string(numCols) + " columns";
+			return false;
+		}
+	}
+
+	while (cursor < end && (IsEndOfLine(*cursor) || IsBlank(*cursor)))
+		++cursor;
+	if (cursor != end)
+	{
+		tiles.resize(firstTile);
+		error = GetPosition(numRows, 0) + ": the tilemap has more than " + std::to_string(numRows) + " rows";
+		return false;
+	}
+	return true;
+}
+
+bool TilemapParser::ParseFile(const std::string& filePath, int numRows, int numCols, std::vector<uint16_t>& tiles) noexcept
+{
+	std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		Logger::Error("Error loading the tilemap file: " + filePath);
+		return false;
+	}
+
+	std::string text(static_cast<size_t>(file.tellg()), '\0');
+	file.seekg(0);
+	if (!file.read(text.data(), text.size()))
+	{
+		Logger::Error("Error reading the tilemap file: " + filePath);
+		return false;
+	}
+
+	std::string error;
+	if (!Parse(text.data(), text.size(), numRows, numCols, tiles, error))
+	{
+		Logger::Error("Invalid tilemap " + filePath + ": " + error);
+		return false;
+	}
+	return true;
+}
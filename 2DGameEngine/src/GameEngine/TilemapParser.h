@@ -0,0 +1,28 @@
+#pragma once
+#ifndef TILEMAPPARSER_H
+#define TILEMAPPARSER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Parses the .map tilemaps: one line per row of comma separated tile indices, of any number of digits.
+/// A tile index is the position of the tile in the tileset, row by row: with the default 10 tileset columns the
+/// two digit tiles of the original maps ("21" = row 2, column 1) keep their meaning.
+/// Single pass over the whole file, the tiles end up in a packed row-major uint16_t grid.
+/// </summary>
+class TilemapParser
+{
+public:
+
+	// appends numRows x numCols tiles, false (with the row and column of the problem in error) if the text does not match
+	static bool Parse(const char* data, size_t size, int numRows, int numCols, std::vector<uint16_t>& tiles, std::string& error) noexcept;
+	// reads the whole file then parses it, the errors are logged
+	static bool ParseFile(const std::string& filePath, int numRows, int numCols, std::vector<uint16_t>& tiles) noexcept;
+
+	static constexpr int DEFAULT_TILESET_COLUMNS = 10;
+};
+
+#endif // TILEMAPPARSER_H
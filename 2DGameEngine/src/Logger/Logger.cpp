@@ -10,6 +10,7 @@
 //}
 
 std::vector<LogEntry> Logger::messagesStack;
+bool Logger::isMuted = false;
 
 /// <summary>
 /// Returns the current date and time as a string
@@ -20,7 +21,11 @@ std::string Logger::CurrentDateTimeToString() noexcept
 	std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
 	std::string output(30, '\0');
 	struct tm timeInfo;
+#ifdef _WIN32
 	localtime_s(&timeInfo, &now);
+#else
+	localtime_r(&now, &timeInfo);
+#endif
 	std::strftime(&output[0], output.size(), "%d-%b-%Y %H:%M:%S", &timeInfo);
 	return output;
 }
@@ -32,6 +37,8 @@ std::string Logger::CurrentDateTimeToString() noexcept
 /// <param name="message"></param>
 void Logger::Log(const std::string& message) noexcept
 {
+	if (isMuted) return;
+
 	LogEntry logEntry;
 	logEntry.type = LogType::LOG_INFO;
 	logEntry.message = "LOG: [" + CurrentDateTimeToString() + "]: " + message;
@@ -47,6 +54,8 @@ void Logger::Log(const std::string& message) noexcept
 /// <param name="message"></param>
 void Logger::Warning(const std::string& message) noexcept
 {
+	if (isMuted) return;
+
 	LogEntry logEntry;
 	logEntry.type = LogType::LOG_WARNING;
 	logEntry.message = "WAR: [" + CurrentDateTimeToString() + "]: " + message;
@@ -29,8 +29,16 @@ public:
 	static void Warning(const std::string& message) noexcept;
 	static void Error(const std::string& message) noexcept;
 
+	// muted logs and warnings are dropped (errors are always printed), used by the benchmarks
+	static inline void SetMuted(bool muted) noexcept { isMuted = muted; }
+	static inline bool IsMuted() noexcept { return isMuted; }
+
 	// one big container that contains all the messages
 	static std::vector<LogEntry> messagesStack;
+
+private:
+
+	static bool isMuted;
 };
 
 #endif // LOGGER_H
@@ -50,6 +50,7 @@ int main(int argc, char* args[])
 {   
     Game gameEngine;
 
+    gameEngine.ParseArguments(argc, args);
     gameEngine.Init();
     gameEngine.Run();
     gameEngine.Destroy();
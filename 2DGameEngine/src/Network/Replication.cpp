@@ -0,0 +1,952 @@
+#include "Replication.h"
+
+#include "../Logger/Logger.h"
+#include "../Profiler/Profiler.h"
+#include "../Systems/Systems.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+
+namespace
+{
+	enum NetworkMessageType : uint8_t
+	{
+		NETWORK_MESSAGE_SNAPSHOT = 1,
+		NETWORK_MESSAGE_ACK = 2,
+		NETWORK_MESSAGE_CHALLENGE = 3
+	};
+
+	constexpr uint32_t CLIENT_TIMEOUT_TICKS = 5 * FPS; // a client without acknowledgment for this long is dropped
+	constexpr uint32_t HANDSHAKE_TIMEOUT_TICKS = FPS; // a challenge not answered for this long is dropped
+
+	// fields of an entity record, only the ones that changed since the baseline are written
+	enum ReplicatedField : uint8_t
+	{
+		REPLICATED_FIELD_POSITION = 1 << 0,
+		REPLICATED_FIELD_SCALE = 1 << 1,
+		REPLICATED_FIELD_ROTATION = 1 << 2,
+		REPLICATED_FIELD_HEALTH = 1 << 3,
+		REPLICATED_FIELD_PROJECTILE = 1 << 4,
+		REPLICATED_FIELD_COMPONENTS = 1 << 5 // new entity or components added/removed: u8 REPLICATED_COMPONENT_* flags
+	};
+
+	constexpr size_t SNAPSHOT_HEADER_SIZE = 7;
+	constexpr uint32_t MAX_FRAGMENTS = 255;
+
+	// little-endian values and varints (7 bits per byte, the high bit tells if another byte follows)
+	class PacketWriter
+	{
+	public:
+
+		explicit PacketWriter(std::vector<uint8_t>& buffer) noexcept : m_buffer(buffer) {}
+
+		inline void WriteU8(uint8_t value) noexcept { m_buffer.push_back(value); }
+
+		void WriteU32(uint32_t value) noexcept
+		{
+			for (int i = 0; i < 4; ++i)
+				m_buffer.push_back(static_cast<uint8_t>(value >> (i * 8)));
+		}
+
+		void WriteVarint(uint32_t value) noexcept
+		{
+			while (value >= 0x80)
+			{
+				m_buffer.push_back(static_cast<uint8_t>(value | 0x80));
+				value >>= 7;
+			}
+			m_buffer.push_back(static_cast<uint8_t>(value));
+		}
+
+		// zigzag: the small negative values stay short too
+		inline void WriteInt(int32_t value) noexcept
+		{
+			WriteVarint((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+		}
+
+		inline void WriteFloat(float value) noexcept
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			WriteU32(bits);
+		}
+
+	private:
+
+		std::vector<uint8_t>& m_buffer;
+	};
+
+	// reads what a PacketWriter wrote, a read past the end leaves the reader failed
+	class PacketReader
+	{
+	public:
+
+		PacketReader(const uint8_t* data, size_t size) noexcept : m_data(data), m_size(size) {}
+
+		uint8_t ReadU8() noexcept
+		{
+			if (m_offset >= m_size)
+			{
+				m_hasFailed = true;
+				return 0;
+			}
+			return m_data[m_offset++];
+		}
+
+		uint32_t ReadU32() noexcept
+		{
+			uint32_t value = 0;
+			for (int i = 0; i < 4; ++i)
+				value |= static_cast<uint32_t>(ReadU8()) << (i * 8);
+			return value;
+		}
+
+		uint32_t ReadVarint() noexcept
+		{
+			uint32_t value = 0;
+			for (int shift = 0; shift < 35; shift += 7)
+			{
+				const uint8_t byte = ReadU8();
+				value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0)
+					return value;
+			}
+			m_hasFailed = true;
+			return 0;
+		}
+
+		inline int32_t ReadInt() noexcept
+		{
+			const uint32_t value = ReadVarint();
+			return static_cast<int32_t>((value >> 1) ^ (~(value & 1) + 1));
+		}
+
+		inline float ReadFloat() noexcept
+		{
+			const uint32_t bits = ReadU32();
+			float value;
+			std::memcpy(&value, &bits, sizeof(value));
+			return value;
+		}
+
+		inline bool HasFailed() const noexcept { return m_hasFailed; }
+		inline bool IsAtEnd() const noexcept { return m_offset == m_size; }
+		inline size_t GetOffset() const noexcept { return m_offset; }
+		inline size_t GetRemainingSize() const noexcept { return m_size - m_offset; }
+
+	private:
+
+		const uint8_t* m_data;
+		size_t m_size;
+		size_t m_offset = 0;
+		bool m_hasFailed = false;
+	};
+
+	inline bool HasSameHealth(const ReplicatedEntity& a, const ReplicatedEntity& b) noexcept
+	{
+		return a.maxHealth == b.maxHealth && a.currentHealth == b.currentHealth;
+	}
+
+	inline bool HasSameProjectile(const ReplicatedEntity& a, const ReplicatedEntity& b) noexcept
+	{
+		return a.isFriendly == b.isFriendly && a.hitPercentDamage == b.hitPercentDamage &&
+			a.duration == b.duration && a.startTime == b.startTime;
+	}
+
+	// fields of state to write, previous is the state in the baseline (null for an entity the baseline does not have)
+	uint8_t GetChangedFields(const ReplicatedEntity& state, const ReplicatedEntity* previous) noexcept
+	{
+		uint8_t fields = 0;
+		if (!previous || previous->components != state.components)
+			fields |= REPLICATED_FIELD_COMPONENTS;
+		if (!previous || previous->position != state.position)
+			fields |= REPLICATED_FIELD_POSITION;
+		if (!previous || previous->scale != state.scale)
+			fields |= REPLICATED_FIELD_SCALE;
+		if (!previous || previous->rotation != state.rotation)
+			fields |= REPLICATED_FIELD_ROTATION;
+
+		// a component the baseline did not have is written whole
+		const uint8_t previousComponents = previous ? previous->components : 0;
+		if ((state.components & REPLICATED_COMPONENT_HEALTH) &&
+			(!(previousComponents & REPLICATED_COMPONENT_HEALTH) || !HasSameHealth(state, *previous)))
+			fields |= REPLICATED_FIELD_HEALTH;
+		if ((state.components & REPLICATED_COMPONENT_PROJECTILE) &&
+			(!(previousComponents & REPLICATED_COMPONENT_PROJECTILE) || !HasSameProjectile(state, *previous)))
+			fields |= REPLICATED_FIELD_PROJECTILE;
+		return fields;
+	}
+
+	void WriteEntity(PacketWriter& writer, const ReplicatedEntity& state, uint8_t fields, int previousId) noexcept
+	{
+		writer.WriteVarint(static_cast<uint32_t>(state.id - previousId - 1));
+		writer.WriteU8(fields);
+		if (fields & REPLICATED_FIELD_COMPONENTS)
+			writer.WriteU8(state.components);
+		if (fields & REPLICATED_FIELD_POSITION)
+		{
+			writer.WriteFloat(state.position.x);
+			writer.WriteFloat(state.position.y);
+		}
+		if (fields & REPLICATED_FIELD_SCALE)
+		{
+			writer.WriteFloat(state.scale.x);
+			writer.WriteFloat(state.scale.y);
+		}
+		if (fields & REPLICATED_FIELD_ROTATION)
+			writer.WriteFloat(state.rotation);
+		if (fields & REPLICATED_FIELD_HEALTH)
+		{
+			writer.WriteInt(state.maxHealth);
+			writer.WriteInt(state.currentHealth);
+		}
+		if (fields & REPLICATED_FIELD_PROJECTILE)
+		{
+			writer.WriteU8(state.isFriendly ? 1 : 0);
+			writer.WriteInt(state.hitPercentDamage);
+			writer.WriteInt(state.duration);
+			writer.WriteInt(state.startTime);
+		}
+	}
+
+	// reads the fields of a record over the baseline state of the entity
+	bool ReadEntityFields(PacketReader& reader, ReplicatedEntity& state, uint8_t fields) noexcept
+	{
+		if (fields & REPLICATED_FIELD_COMPONENTS)
+			state.components = reader.ReadU8();
+		if (fields & REPLICATED_FIELD_POSITION)
+		{
+			state.position.x = reader.ReadFloat();
+			state.position.y = reader.ReadFloat();
+		}
+		if (fields & REPLICATED_FIELD_SCALE)
+		{
+			state.scale.x = reader.ReadFloat();
+			state.scale.y = reader.ReadFloat();
+		}
+		if (fields & REPLICATED_FIELD_ROTATION)
+			state.rotation = reader.ReadFloat();
+		if (fields & REPLICATED_FIELD_HEALTH)
+		{
+			state.maxHealth = reader.ReadInt();
+			state.currentHealth = reader.ReadInt();
+		}
+		if (fields & REPLICATED_FIELD_PROJECTILE)
+		{
+			state.isFriendly = reader.ReadU8() != 0;
+			state.hitPercentDamage = reader.ReadInt();
+			state.duration = reader.ReadInt();
+			state.startTime = reader.ReadInt();
+		}
+		return !reader.HasFailed();
+	}
+
+	inline bool IsSameState(const ReplicatedEntity& a, const ReplicatedEntity& b) noexcept
+	{
+		return a.components == b.components && a.position == b.position && a.scale == b.scale && a.rotation == b.rotation &&
+			(!(a.components & REPLICATED_COMPONENT_HEALTH) || HasSameHealth(a, b)) &&
+			(!(a.components & REPLICATED_COMPONENT_PROJECTILE) || HasSameProjectile(a, b));
+	}
+}
+
+void NetworkStats::Add(const NetworkStats& stats) noexcept
+{
+	bytesSent += stats.bytesSent;
+	packetsSent += stats.packetsSent;
+	bytesReceived += stats.bytesReceived;
+	packetsReceived += stats.packetsReceived;
+	entitiesWritten += stats.entitiesWritten;
+	serializationNs += stats.serializationNs;
+}
+
+ReplicationServer::ReplicationServer(Transport& transport, Registry& registry) noexcept :
+	m_transport(transport),
+	m_registry(registry)
+{
+}
+
+/// <summary>
+/// Reads the acknowledgments and, on the send ticks, sends every client the snapshot of its view
+/// </summary>
+/// <param name="tick">simulation tick the snapshot is the state of</param>
+void ReplicationServer::Update(uint32_t tick) noexcept
+{
+	ProfileScope scope("ReplicationServer::Update");
+	m_tickStats = NetworkStats();
+
+	ReceiveAcks(tick);
+	DropTimedOutPeers(tick);
+
+	if (!m_clients.empty() && tick % m_sendInterval == 0)
+	{
+		++m_sequence;
+		const uint64_t gatherStartNs = Profiler::Now();
+		GatherEntities();
+		m_tickStats.serializationNs += Profiler::Now() - gatherStartNs;
+
+		for (auto& client : m_clients)
+			SendSnapshot(*client, tick);
+		++m_sentTickCount;
+	}
+
+	m_totalStats.Add(m_tickStats);
+}
+
+void ReplicationServer::ReceiveAcks(uint32_t tick) noexcept
+{
+	while (m_transport.Receive(m_received))
+	{
+		m_tickStats.bytesReceived += m_received.bytes.size();
+		++m_tickStats.packetsReceived;
+
+		PacketReader reader(m_received.bytes.data(), m_received.bytes.size());
+		const uint8_t type = reader.ReadU8();
+		const uint32_t token = reader.ReadU32();
+		const uint32_t ackedSequence = reader.ReadU32();
+		SDL_Rect view;
+		view.x = static_cast<int32_t>(reader.ReadU32());
+		view.y = static_cast<int32_t>(reader.ReadU32());
+		view.w = static_cast<int32_t>(reader.ReadU32());
+		view.h = static_cast<int32_t>(reader.ReadU32());
+		if (reader.HasFailed() || type != NETWORK_MESSAGE_ACK)
+		{
+			// the transport keeps a peer for every address, a stranger sending garbage does not keep one
+			if (!IsKnownPeer(m_received.peer))
+				m_transport.ReleasePeer(m_received.peer);
+			continue;
+		}
+
+		auto client = std::find_if(m_clients.begin(), m_clients.end(),
+			[this](const std::unique_ptr<Client>& client) { return client->peer == m_received.peer; });
+		if (client == m_clients.end())
+		{
+			Handshake(m_received.peer, token, tick);
+			client = std::find_if(m_clients.begin(), m_clients.end(),
+				[this](const std::unique_ptr<Client>& client) { return client->peer == m_received.peer; });
+			if (client == m_clients.end())
+				continue;
+		}
+		// a packet spoofing the address of a client does not know its token
+		if ((*client)->token != token)
+			continue;
+
+		// the acknowledgments can arrive out of order, only the newest one is a baseline
+		if (ackedSequence > (*client)->ackedSequence && ackedSequence <= m_sequence)
+			(*client)->ackedSequence = ackedSequence;
+		(*client)->view = view;
+		(*client)->lastAckTick = tick;
+	}
+}
+
+bool ReplicationServer::IsKnownPeer(uint32_t peer) const noexcept
+{
+	return std::any_of(m_clients.begin(), m_clients.end(), [peer](const std::unique_ptr<Client>& client) { return client->peer == peer; }) ||
+		std::any_of(m_pendingClients.begin(), m_pendingClients.end(), [peer](const PendingClient& pending) { return pending.peer == peer; });
+}
+
+void ReplicationServer::Handshake(uint32_t peer, uint32_t token, uint32_t tick) noexcept
+{
+	auto pending = std::find_if(m_pendingClients.begin(), m_pendingClients.end(),
+		[peer](const PendingClient& pending) { return pending.peer == peer; });
+
+	if (pending != m_pendingClients.end() && token == pending->token)
+	{
+		// the peer received the challenge at its address, it is a client now
+		if (m_clients.size() >= m_maxClientCount)
+			return;
+		Logger::Log("Client of peer " + std::to_string(peer) + " connected");
+		m_clients.push_back(std::make_unique<Client>());
+		Client& client = *m_clients.back();
+		client.peer = peer;
+		client.token = token;
+		client.lastAckTick = tick;
+		m_pendingClients.erase(pending);
+		return;
+	}
+
+	if (pending != m_pendingClients.end())
+	{
+		// the challenge or its answer was lost, the same token is sent again
+		SendChallenge(peer, pending->token);
+		return;
+	}
+
+	// nothing is kept for a peer that can not become a client, its transport peer goes away right away
+	if (m_clients.size() >= m_maxClientCount || m_pendingClients.size() >= MAX_PENDING_CLIENTS)
+	{
+		m_transport.ReleasePeer(peer);
+		return;
+	}
+
+	PendingClient newPending;
+	newPending.peer = peer;
+	do
+	{
+		newPending.token = m_tokenRng();
+	} while (newPending.token == 0);
+	newPending.challengeTick = tick;
+	m_pendingClients.push_back(newPending);
+	SendChallenge(peer, newPending.token);
+}
+
+void ReplicationServer::SendChallenge(uint32_t peer, uint32_t token) noexcept
+{
+	m_packet.clear();
+	PacketWriter writer(m_packet);
+	writer.WriteU8(NETWORK_MESSAGE_CHALLENGE);
+	writer.WriteU32(token);
+	if (m_transport.Send(peer, m_packet.data(), m_packet.size()))
+	{
+		m_tickStats.bytesSent += m_packet.size();
+		++m_tickStats.packetsSent;
+	}
+}
+
+/// <summary>
+/// Drops the clients without acknowledgment and the challenges without answer for too long, and releases their peers
+/// </summary>
+/// <param name="tick"></param>
+void ReplicationServer::DropTimedOutPeers(uint32_t tick) noexcept
+{
+	for (auto client = m_clients.begin(); client != m_clients.end();)
+	{
+		if (tick - (*client)->lastAckTick > CLIENT_TIMEOUT_TICKS)
+		{
+			Logger::Log("Client of peer " + std::to_string((*client)->peer) + " timed out");
+			m_transport.ReleasePeer((*client)->peer);
+			client = m_clients.erase(client);
+		}
+		else
+		{
+			++client;
+		}
+	}
+
+	for (auto pending = m_pendingClients.begin(); pending != m_pendingClients.end();)
+	{
+		if (tick - pending->challengeTick > HANDSHAKE_TIMEOUT_TICKS)
+		{
+			m_transport.ReleasePeer(pending->peer);
+			pending = m_pendingClients.erase(pending);
+		}
+		else
+		{
+			++pending;
+		}
+	}
+}
+
+void ReplicationServer::GatherEntities() noexcept
+{
+	m_entities.clear();
+	if (!m_registry.HasSystem<ReplicationSystem>())
+		return;
+
+	for (const Entity entity : m_registry.GetSystem<ReplicationSystem>().GetSystemEntities())
+	{
+		uint8_t components = 0;
+		if (m_registry.HasComponent<HealthComponent>(entity))
+			components |= REPLICATED_COMPONENT_HEALTH;
+		if (m_registry.HasComponent<ProjectileComponent>(entity))
+			components |= REPLICATED_COMPONENT_PROJECTILE;
+		if (components == 0)
+			continue;
+
+		ReplicatedEntity state{};
+		state.id = entity.GetID();
+		state.components = components;
+		const auto& transform = m_registry.GetComponent<TransformComponent>(entity);
+		state.position = transform.m_position;
+		state.scale = transform.m_scale;
+		state.rotation = static_cast<float>(transform.m_rotation);
+		if (components & REPLICATED_COMPONENT_HEALTH)
+		{
+			const auto& health = m_registry.GetComponent<HealthComponent>(entity);
+			state.maxHealth = health.m_maxHealth;
+			state.currentHealth = health.m_currentHealth;
+		}
+		if (components & REPLICATED_COMPONENT_PROJECTILE)
+		{
+			const auto& projectile = m_registry.GetComponent<ProjectileComponent>(entity);
+			state.isFriendly = projectile.m_isFriendly;
+			state.hitPercentDamage = projectile.m_hitPercentDamage;
+			state.duration = projectile.m_duration;
+			state.startTime = projectile.m_startTime;
+		}
+		m_entities.push_back(state);
+	}
+
+	BuildGrid();
+}
+
+/// <summary>
+/// Sorts the entities into a uniform grid over their bounds (counting sort), so the view of a client only visits the
+/// cells it overlaps. The cells grow when the entities are spread out, there are never many more cells than entities
+/// </summary>
+void ReplicationServer::BuildGrid() noexcept
+{
+	m_gridColumns = 0;
+	m_gridRows = 0;
+	if (m_entities.empty())
+		return;
+
+	glm::vec2 minPosition = m_entities.front().position;
+	glm::vec2 maxPosition = minPosition;
+	for (const auto& state : m_entities)
+	{
+		minPosition = glm::min(minPosition, state.position);
+		maxPosition = glm::max(maxPosition, state.position);
+	}
+
+	const size_t maxCellCount = m_entities.size() * 4 + 64;
+	m_cellSize = INTEREST_CELL_SIZE;
+	while (true)
+	{
+		m_gridColumns = static_cast<int>((maxPosition.x - minPosition.x) / m_cellSize) + 1;
+		m_gridRows = static_cast<int>((maxPosition.y - minPosition.y) / m_cellSize) + 1;
+		if (static_cast<size_t>(m_gridColumns) * m_gridRows <= maxCellCount)
+			break;
+		m_cellSize *= 2.0f;
+	}
+	m_gridOrigin = minPosition;
+
+	const size_t cellCount = static_cast<size_t>(m_gridColumns) * m_gridRows;
+	m_cellStarts.assign(cellCount + 1, 0);
+	m_entityCells.resize(m_entities.size());
+	for (size_t i = 0; i < m_entities.size(); ++i)
+	{
+		m_entityCells[i] = GetCell(m_entities[i].position);
+		++m_cellStarts[m_entityCells[i] + 1];
+	}
+	for (size_t cell = 0; cell < cellCount; ++cell)
+		m_cellStarts[cell + 1] += m_cellStarts[cell];
+
+	m_cellEntities.resize(m_entities.size());
+	m_cellFill.assign(m_cellStarts.begin(), m_cellStarts.end() - 1);
+	for (size_t i = 0; i < m_entities.size(); ++i)
+		m_cellEntities[m_cellFill[m_entityCells[i]]++] = static_cast<uint32_t>(i);
+}
+
+/// <summary>
+/// Writes the entities of the client view that changed since the snapshot the client acknowledged last (all of them
+/// without baseline) and the ones that left the view or were destroyed, and sends it in fragments
+/// </summary>
+/// <param name="client"></param>
+/// <param name="tick"></param>
+void ReplicationServer::SendSnapshot(Client& client, uint32_t tick) noexcept
+{
+	const uint64_t encodeStartNs = Profiler::Now();
+
+	const SentSnapshot* baseline = nullptr;
+	if (client.ackedSequence != 0 && m_sequence - client.ackedSequence < SNAPSHOT_HISTORY)
+	{
+		const SentSnapshot& acked = client.history[client.ackedSequence % SNAPSHOT_HISTORY];
+		if (acked.sequence == client.ackedSequence)
+			baseline = &acked;
+	}
+
+	// interest management: the entities in the view of the client (and the margin around it)
+	SentSnapshot& snapshot = client.history[m_sequence % SNAPSHOT_HISTORY];
+	snapshot.sequence = m_sequence;
+	snapshot.entities.clear();
+	const float left = static_cast<float>(client.view.x - m_interestMargin);
+	const float top = static_cast<float>(client.view.y - m_interestMargin);
+	const float right = static_cast<float>(client.view.x + client.view.w + m_interestMargin);
+	const float bottom = static_cast<float>(client.view.y + client.view.h + m_interestMargin);
+	if (m_gridColumns > 0)
+	{
+		const int firstColumn = std::max(static_cast<int>(std::floor((left - m_gridOrigin.x) / m_cellSize)), 0);
+		const int lastColumn = std::min(static_cast<int>(std::floor((right - m_gridOrigin.x) / m_cellSize)), m_gridColumns - 1);
+		const int firstRow = std::max(static_cast<int>(std::floor((top - m_gridOrigin.y) / m_cellSize)), 0);
+		const int lastRow = std::min(static_cast<int>(std::floor((bottom - m_gridOrigin.y) / m_cellSize)), m_gridRows - 1);
+		for (int row = firstRow; row <= lastRow; ++row)
+		{
+			for (int column = firstColumn; column <= lastColumn; ++column)
+			{
+				const size_t cell = static_cast<size_t>(row) * m_gridColumns + column;
+				for (uint32_t i = m_cellStarts[cell]; i < m_cellStarts[cell + 1]; ++i)
+				{
+					const ReplicatedEntity& state = m_entities[m_cellEntities[i]];
+					if (state.position.x >= left && state.position.x <= right && state.position.y >= top && state.position.y <= bottom)
+						snapshot.entities.push_back(state);
+				}
+			}
+		}
+	}
+	// the snapshots are compared to their baseline in id order
+	std::sort(snapshot.entities.begin(), snapshot.entities.end(),
+		[](const ReplicatedEntity& a, const ReplicatedEntity& b) { return a.id < b.id; });
+
+	// both lists are sorted by id: one pass finds the removed, new and changed entities
+	m_removedIds.clear();
+	m_records.clear();
+	PacketWriter recordWriter(m_records);
+	uint32_t recordCount = 0;
+	int previousId = -1;
+	size_t baselineIndex = 0;
+	const size_t baselineSize = baseline ? baseline->entities.size() : 0;
+	for (const auto& state : snapshot.entities)
+	{
+		while (baselineIndex < baselineSize && baseline->entities[baselineIndex].id < state.id)
+			m_removedIds.push_back(baseline->entities[baselineIndex++].id);
+
+		const ReplicatedEntity* previous = nullptr;
+		if (baselineIndex < baselineSize && baseline->entities[baselineIndex].id == state.id)
+			previous = &baseline->entities[baselineIndex++];
+
+		const uint8_t fields = GetChangedFields(state, previous);
+		if (fields == 0)
+			continue;
+
+		WriteEntity(recordWriter, state, fields, previousId);
+		previousId = state.id;
+		++recordCount;
+	}
+	while (baselineIndex < baselineSize)
+		m_removedIds.push_back(baseline->entities[baselineIndex++].id);
+
+	m_payload.clear();
+	PacketWriter writer(m_payload);
+	writer.WriteVarint(baseline ? baseline->sequence : 0);
+	writer.WriteVarint(tick);
+	writer.WriteVarint(static_cast<uint32_t>(m_removedIds.size()));
+	previousId = -1;
+	for (const int id : m_removedIds)
+	{
+		writer.WriteVarint(static_cast<uint32_t>(id - previousId - 1));
+		previousId = id;
+	}
+	writer.WriteVarint(recordCount);
+	m_payload.insert(m_payload.end(), m_records.begin(), m_records.end());
+
+	m_tickStats.serializationNs += Profiler::Now() - encodeStartNs;
+	m_tickStats.entitiesWritten += recordCount;
+
+	const size_t fragmentSize = Transport::MAX_PACKET_SIZE - SNAPSHOT_HEADER_SIZE;
+	const size_t fragmentCount = (m_payload.size() + fragmentSize - 1) / fragmentSize;
+	if (fragmentCount > MAX_FRAGMENTS)
+	{
+		// never acknowledged, the next snapshot is based on the previous baseline
+		Logger::Warning("Snapshot of " + std::to_string(m_payload.size()) + " bytes for peer " + std::to_string(client.peer) +
+			" is too large, " + std::to_string(snapshot.entities.size()) + " entities in view");
+		snapshot.sequence = 0;
+		return;
+	}
+
+	for (size_t fragment = 0; fragment < fragmentCount; ++fragment)
+	{
+		const size_t offset = fragment * fragmentSize;
+		const size_t size = std::min(fragmentSize, m_payload.size() - offset);
+
+		m_packet.clear();
+		PacketWriter packetWriter(m_packet);
+		packetWriter.WriteU8(NETWORK_MESSAGE_SNAPSHOT);
+		packetWriter.WriteU32(m_sequence);
+		packetWriter.WriteU8(static_cast<uint8_t>(fragment));
+		packetWriter.WriteU8(static_cast<uint8_t>(fragmentCount));
+		m_packet.insert(m_packet.end(), m_payload.begin() + offset, m_payload.begin() + offset + size);
+
+		if (m_transport.Send(client.peer, m_packet.data(), m_packet.size()))
+		{
+			m_tickStats.bytesSent += m_packet.size();
+			++m_tickStats.packetsSent;
+		}
+	}
+}
+
+ReplicationClient::ReplicationClient(Transport& transport, uint32_t serverPeer, Registry& registry) noexcept :
+	m_transport(transport),
+	m_serverPeer(serverPeer),
+	m_registry(registry)
+{
+}
+
+/// <summary>
+/// Reads the received packets, applies the newest snapshot decoded and sends the acknowledgment. Until the server
+/// answered with a challenge, the acknowledgment (without token) asks it for one
+/// </summary>
+/// <param name="view">camera of the client, the server only sends the entities around it</param>
+void ReplicationClient::Update(const SDL_Rect& view) noexcept
+{
+	ProfileScope scope("ReplicationClient::Update");
+	m_tickStats = NetworkStats();
+
+	while (m_transport.Receive(m_received))
+	{
+		if (m_received.peer != m_serverPeer || m_received.bytes.empty())
+			continue;
+		m_tickStats.bytesReceived += m_received.bytes.size();
+		++m_tickStats.packetsReceived;
+
+		// a new challenge also reconnects a client the server dropped
+		if (m_received.bytes[0] == NETWORK_MESSAGE_CHALLENGE)
+		{
+			PacketReader reader(m_received.bytes.data(), m_received.bytes.size());
+			reader.ReadU8();
+			const uint32_t token = reader.ReadU32();
+			if (!reader.HasFailed() && reader.IsAtEnd() && token != 0)
+				m_token = token;
+			continue;
+		}
+		ReceiveFragment(m_received);
+	}
+
+	if (m_decodedSequence > m_appliedSequence)
+	{
+		const uint64_t applyStartNs = Profiler::Now();
+		ApplySnapshot(m_history[m_decodedSequence % ReplicationServer::SNAPSHOT_HISTORY]);
+		m_tickStats.serializationNs += Profiler::Now() - applyStartNs;
+	}
+
+	m_packet.clear();
+	PacketWriter writer(m_packet);
+	writer.WriteU8(NETWORK_MESSAGE_ACK);
+	writer.WriteU32(m_token);
+	writer.WriteU32(m_appliedSequence);
+	writer.WriteU32(static_cast<uint32_t>(view.x));
+	writer.WriteU32(static_cast<uint32_t>(view.y));
+	writer.WriteU32(static_cast<uint32_t>(view.w));
+	writer.WriteU32(static_cast<uint32_t>(view.h));
+	if (m_transport.Send(m_serverPeer, m_packet.data(), m_packet.size()))
+	{
+		m_tickStats.bytesSent += m_packet.size();
+		++m_tickStats.packetsSent;
+	}
+
+	m_totalStats.Add(m_tickStats);
+}
+
+Entity ReplicationClient::GetEntity(int serverId) const noexcept
+{
+	const auto entity = m_entities.find(serverId);
+	return entity != m_entities.end() ? entity->second : Entity(-1);
+}
+
+/// <summary>
+/// Keeps the fragments of the newest snapshot and decodes it once they all arrived.
+/// The fragments of an older snapshot are dropped, a newer snapshot replaces an incomplete one
+/// </summary>
+/// <param name="packet"></param>
+void ReplicationClient::ReceiveFragment(const NetworkPacket& packet) noexcept
+{
+	PacketReader reader(packet.bytes.data(), packet.bytes.size());
+	const uint8_t type = reader.ReadU8();
+	const uint32_t sequence = reader.ReadU32();
+	const uint32_t fragment = reader.ReadU8();
+	const uint32_t fragmentCount = reader.ReadU8();
+	if (reader.HasFailed() || type != NETWORK_MESSAGE_SNAPSHOT || fragment >= fragmentCount || reader.IsAtEnd())
+		return;
+	if (sequence <= m_decodedSequence || sequence < m_pendingSequence)
+		return;
+
+	if (sequence != m_pendingSequence)
+	{
+		m_pendingSequence = sequence;
+		m_pendingFragmentCount = fragmentCount;
+		m_receivedFragmentCount = 0;
+		m_fragments.resize(fragmentCount);
+		for (auto& bytes : m_fragments)
+			bytes.clear();
+	}
+	if (fragmentCount != m_pendingFragmentCount || !m_fragments[fragment].empty())
+		return;
+
+	m_fragments[fragment].assign(packet.bytes.begin() + reader.GetOffset(), packet.bytes.end());
+	if (++m_receivedFragmentCount < m_pendingFragmentCount)
+		return;
+
+	m_payload.clear();
+	for (const auto& bytes : m_fragments)
+		m_payload.insert(m_payload.end(), bytes.begin(), bytes.end());
+
+	const uint64_t decodeStartNs = Profiler::Now();
+	if (!DecodeSnapshot(sequence))
+		Logger::Warning("Snapshot " + std::to_string(sequence) + " dropped, invalid or its baseline is gone");
+	m_tickStats.serializationNs += Profiler::Now() - decodeStartNs;
+}
+
+/// <summary>
+/// Rebuilds the whole state of the snapshot in m_payload from its baseline and stores it in the history
+/// </summary>
+/// <param name="sequence"></param>
+/// <returns>false if the payload is invalid or the baseline is not in the history anymore</returns>
+bool ReplicationClient::DecodeSnapshot(uint32_t sequence) noexcept
+{
+	PacketReader reader(m_payload.data(), m_payload.size());
+	const uint32_t baselineSequence = reader.ReadVarint();
+	const uint32_t tick = reader.ReadVarint();
+
+	const ReceivedSnapshot* baseline = nullptr;
+	if (baselineSequence != 0)
+	{
+		baseline = &m_history[baselineSequence % ReplicationServer::SNAPSHOT_HISTORY];
+		if (baseline->sequence != baselineSequence || baselineSequence >= sequence)
+			return false;
+	}
+
+	const uint32_t removedCount = reader.ReadVarint();
+	if (reader.HasFailed() || removedCount > reader.GetRemainingSize())
+		return false;
+	// the ids are accumulated in 64 bits so a hostile delta can neither overflow nor wrap them out of order
+	m_removedIds.clear();
+	int64_t previousId = -1;
+	for (uint32_t i = 0; i < removedCount; ++i)
+	{
+		previousId += static_cast<int64_t>(reader.ReadVarint()) + 1;
+		if (reader.HasFailed() || previousId > INT32_MAX)
+			return false;
+		m_removedIds.push_back(static_cast<int>(previousId));
+	}
+
+	// the records and the baseline are sorted by id: the entities of the baseline without record are copied
+	const uint32_t recordCount = reader.ReadVarint();
+	if (reader.HasFailed() || recordCount > reader.GetRemainingSize())
+		return false;
+
+	m_decoded.clear();
+	size_t baselineIndex = 0;
+	size_t removedIndex = 0;
+	const size_t baselineSize = baseline ? baseline->entities.size() : 0;
+	auto copyBaselineUntil = [&](int64_t id)
+	{
+		for (; baselineIndex < baselineSize && baseline->entities[baselineIndex].id < id; ++baselineIndex)
+		{
+			const int baselineId = baseline->entities[baselineIndex].id;
+			while (removedIndex < m_removedIds.size() && m_removedIds[removedIndex] < baselineId)
+				++removedIndex;
+			if (removedIndex < m_removedIds.size() && m_removedIds[removedIndex] == baselineId)
+				continue;
+			m_decoded.push_back(baseline->entities[baselineIndex]);
+		}
+	};
+
+	previousId = -1;
+	for (uint32_t i = 0; i < recordCount; ++i)
+	{
+		const int64_t nextId = previousId + static_cast<int64_t>(reader.ReadVarint()) + 1;
+		const uint8_t fields = reader.ReadU8();
+		if (reader.HasFailed() || nextId > INT32_MAX)
+			return false;
+		previousId = nextId;
+		const int id = static_cast<int>(nextId);
+
+		copyBaselineUntil(id);
+		ReplicatedEntity state{};
+		if (baselineIndex < baselineSize && baseline->entities[baselineIndex].id == id)
+			state = baseline->entities[baselineIndex++];
+		else if (!(fields & REPLICATED_FIELD_COMPONENTS))
+			return false; // an entity the baseline does not have is written whole
+		state.id = id;
+		if (!ReadEntityFields(reader, state, fields))
+			return false;
+		m_decoded.push_back(state);
+	}
+	copyBaselineUntil(INT64_MAX);
+
+	if (reader.HasFailed() || !reader.IsAtEnd())
+		return false;
+
+	ReceivedSnapshot& snapshot = m_history[sequence % ReplicationServer::SNAPSHOT_HISTORY];
+	snapshot.sequence = sequence;
+	snapshot.tick = tick;
+	snapshot.entities.swap(m_decoded);
+	m_decodedSequence = sequence;
+	m_tickStats.entitiesWritten += recordCount;
+	return true;
+}
+
+/// <summary>
+/// Creates, updates and destroys the client entities so the registry mirrors the snapshot
+/// </summary>
+/// <param name="snapshot"></param>
+void ReplicationClient::ApplySnapshot(const ReceivedSnapshot& snapshot) noexcept
+{
+	size_t previousIndex = 0;
+	const auto& previousEntities = m_appliedEntities;
+	for (const auto& state : snapshot.entities)
+	{
+		for (; previousIndex < previousEntities.size() && previousEntities[previousIndex].id < state.id; ++previousIndex)
+		{
+			const auto entity = m_entities.find(previousEntities[previousIndex].id);
+			m_registry.DestroyEntity(entity->second);
+			m_entities.erase(entity);
+		}
+
+		if (previousIndex < previousEntities.size() && previousEntities[previousIndex].id == state.id)
+		{
+			const auto& previous = previousEntities[previousIndex++];
+			if (!IsSameState(state, previous))
+				UpdateEntity(m_entities.at(state.id), state, previous);
+		}
+		else
+		{
+			CreateEntity(state);
+		}
+	}
+	for (; previousIndex < previousEntities.size(); ++previousIndex)
+	{
+		const auto entity = m_entities.find(previousEntities[previousIndex].id);
+		m_registry.DestroyEntity(entity->second);
+		m_entities.erase(entity);
+	}
+
+	m_appliedEntities = snapshot.entities;
+	m_appliedSequence = snapshot.sequence;
+	m_appliedTick = snapshot.tick;
+}
+
+void ReplicationClient::CreateEntity(const ReplicatedEntity& state) noexcept
+{
+	Entity entity = m_registry.CreateEntity();
+	m_registry.AddComponent<TransformComponent>(entity, state.position, state.scale, static_cast<double>(state.rotation));
+	if (state.components & REPLICATED_COMPONENT_HEALTH)
+		m_registry.AddComponent<HealthComponent>(entity, state.maxHealth, state.currentHealth);
+	if (state.components & REPLICATED_COMPONENT_PROJECTILE)
+	{
+		m_registry.AddComponent<ProjectileComponent>(entity, state.isFriendly, state.hitPercentDamage, state.duration);
+		m_registry.GetComponent<ProjectileComponent>(entity).m_startTime = state.startTime;
+	}
+	m_entities.emplace(state.id, entity);
+}
+
+void ReplicationClient::UpdateEntity(Entity entity, const ReplicatedEntity& state, const ReplicatedEntity& previous) noexcept
+{
+	auto& transform = m_registry.GetComponent<TransformComponent>(entity);
+	transform.m_position = state.position;
+	transform.m_scale = state.scale;
+	transform.m_rotation = static_cast<double>(state.rotation);
+
+	if (state.components & REPLICATED_COMPONENT_HEALTH)
+	{
+		if (previous.components & REPLICATED_COMPONENT_HEALTH)
+		{
+			auto& health = m_registry.GetComponent<HealthComponent>(entity);
+			health.m_maxHealth = state.maxHealth;
+			health.m_currentHealth = state.currentHealth;
+		}
+		else
+		{
+			m_registry.AddComponent<HealthComponent>(entity, state.maxHealth, state.currentHealth);
+		}
+	}
+	else if (previous.components & REPLICATED_COMPONENT_HEALTH)
+	{
+		m_registry.RemoveComponent<HealthComponent>(entity);
+	}
+
+	if (state.components & REPLICATED_COMPONENT_PROJECTILE)
+	{
+		if (!(previous.components & REPLICATED_COMPONENT_PROJECTILE))
+			m_registry.AddComponent<ProjectileComponent>(entity);
+		auto& projectile = m_registry.GetComponent<ProjectileComponent>(entity);
+		projectile.m_isFriendly = state.isFriendly;
+		projectile.m_hitPercentDamage = state.hitPercentDamage;
+		projectile.m_duration = state.duration;
+		projectile.m_startTime = state.startTime;
+	}
+	else if (previous.components & REPLICATED_COMPONENT_PROJECTILE)
+	{
+		m_registry.RemoveComponent<ProjectileComponent>(entity);
+	}
+}
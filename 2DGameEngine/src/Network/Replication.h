@@ -0,0 +1,240 @@
+#pragma once
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "Transport.h"
+#include "../ECS/ECS.h"
+
+#include <SDL.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// replicated state of an entity: its transform and, when it has them, its health and projectile components
+struct ReplicatedEntity
+{
+	int id; // entity id on the server
+	uint8_t components; // REPLICATED_COMPONENT_* flags
+	glm::vec2 position;
+	glm::vec2 scale;
+	float rotation;
+	int maxHealth;
+	int currentHealth;
+	bool isFriendly;
+	int hitPercentDamage;
+	int duration;
+	int startTime;
+};
+
+enum ReplicatedComponent : uint8_t
+{
+	REPLICATED_COMPONENT_HEALTH = 1 << 0,
+	REPLICATED_COMPONENT_PROJECTILE = 1 << 1
+};
+
+// traffic and time of one tick (or the sum of the ticks), per server or client
+struct NetworkStats
+{
+	uint64_t bytesSent = 0;
+	uint64_t packetsSent = 0;
+	uint64_t bytesReceived = 0;
+	uint64_t packetsReceived = 0;
+	uint64_t entitiesWritten = 0; // entity records in the sent (server) or received (client) snapshots
+	uint64_t serializationNs = 0; // gathering and encoding (server) or decoding and applying (client) the snapshots
+
+	void Add(const NetworkStats& stats) noexcept;
+};
+
+/// <summary>
+/// Sends the state of the entities of a Registry (ReplicationSystem: transform, health, projectile) to the clients.
+/// Every client gets its own snapshot of the entities in its view (interest management), the camera rectangle the
+/// client sends with its acknowledgments, and the snapshot only holds what changed since the last snapshot the client
+/// acknowledged (delta compression). A lost snapshot is never resent: the next ones are based on the last one that
+/// arrived. A snapshot larger than a packet is sent in fragments.
+/// A peer becomes a client with a handshake: its first acknowledgments get a challenge with a random token, and the
+/// client is only created once an acknowledgment carries that token back, so a spoofed address never gets a client.
+/// The clients and the handshakes in progress are capped, and their peers are released when they time out.
+///
+/// Snapshot packet (little-endian): u8 type | u32 sequence | u8 fragment | u8 fragment count | payload part
+/// payload: varint baseline sequence (0 = none) | varint tick | varint removed count, varint id deltas |
+/// varint entity count, per entity: varint id delta, u8 changed fields, the changed fields
+/// Ack packet: u8 type | u32 token (0 before the challenge) | u32 newest snapshot sequence received | i32 view x, y, w, h
+/// Challenge packet: u8 type | u32 token
+/// </summary>
+class ReplicationServer
+{
+public:
+
+	ReplicationServer(Transport& transport, Registry& registry) noexcept;
+
+	// reads the acknowledgments (and the handshakes of the new clients) and sends the snapshots of this tick
+	void Update(uint32_t tick) noexcept;
+
+	// the snapshots are sent every sendInterval ticks (1 = every tick)
+	inline void SetSendInterval(uint32_t sendInterval) noexcept { m_sendInterval = std::max<uint32_t>(sendInterval, 1); }
+	// the view of the clients is extended by this margin, so the entities do not pop in at the edges
+	inline void SetInterestMargin(int margin) noexcept { m_interestMargin = margin; }
+	// the peers connecting past this many clients are ignored until a client leaves
+	inline void SetMaxClientCount(uint32_t maxClientCount) noexcept { m_maxClientCount = maxClientCount; }
+
+	inline size_t GetClientCount() const noexcept { return m_clients.size(); }
+	inline const NetworkStats& GetTickStats() const noexcept { return m_tickStats; }
+	inline const NetworkStats& GetTotalStats() const noexcept { return m_totalStats; }
+	inline uint32_t GetSentTickCount() const noexcept { return m_sentTickCount; }
+
+	static constexpr uint32_t SNAPSHOT_HISTORY = 64; // snapshots a client can acknowledge late and still be a baseline
+	static constexpr uint32_t MAX_CLIENTS = 32; // default of SetMaxClientCount
+	static constexpr uint32_t MAX_PENDING_CLIENTS = 16; // handshakes in progress at once
+	static constexpr float INTEREST_CELL_SIZE = 256.0f; // smallest cell of the interest grid
+
+private:
+
+	struct SentSnapshot
+	{
+		uint32_t sequence = 0;
+		std::vector<ReplicatedEntity> entities; // sorted by id
+	};
+
+	// peer that got a challenge and did not answer it yet
+	struct PendingClient
+	{
+		uint32_t peer;
+		uint32_t token;
+		uint32_t challengeTick;
+	};
+
+	struct Client
+	{
+		uint32_t peer;
+		uint32_t token;
+		SDL_Rect view;
+		uint32_t ackedSequence = 0;
+		uint32_t lastAckTick = 0;
+		std::array<SentSnapshot, SNAPSHOT_HISTORY> history; // [sequence % SNAPSHOT_HISTORY]
+	};
+
+	void ReceiveAcks(uint32_t tick) noexcept;
+	// challenges a peer that is not a client yet, or makes it one when the token is the one of its challenge
+	void Handshake(uint32_t peer, uint32_t token, uint32_t tick) noexcept;
+	void SendChallenge(uint32_t peer, uint32_t token) noexcept;
+	bool IsKnownPeer(uint32_t peer) const noexcept;
+	void DropTimedOutPeers(uint32_t tick) noexcept;
+	void GatherEntities() noexcept;
+	void BuildGrid() noexcept;
+	inline uint32_t GetCell(const glm::vec2& position) const noexcept
+	{
+		const int column = std::min(static_cast<int>((position.x - m_gridOrigin.x) / m_cellSize), m_gridColumns - 1);
+		const int row = std::min(static_cast<int>((position.y - m_gridOrigin.y) / m_cellSize), m_gridRows - 1);
+		return static_cast<uint32_t>(std::max(row, 0) * m_gridColumns + std::max(column, 0));
+	}
+	void SendSnapshot(Client& client, uint32_t tick) noexcept;
+
+	Transport& m_transport;
+	Registry& m_registry;
+	std::vector<std::unique_ptr<Client>> m_clients;
+	std::vector<PendingClient> m_pendingClients;
+	uint32_t m_maxClientCount = MAX_CLIENTS;
+	std::mt19937 m_tokenRng{ std::random_device{}() };
+	std::vector<ReplicatedEntity> m_entities; // state of this tick
+
+	// grid of the entities of this tick, for the interest management
+	glm::vec2 m_gridOrigin{ 0.0f, 0.0f };
+	float m_cellSize = INTEREST_CELL_SIZE;
+	int m_gridColumns = 0;
+	int m_gridRows = 0;
+	std::vector<uint32_t> m_cellStarts; // [cell] first index in m_cellEntities, [cell count] = entity count
+	std::vector<uint32_t> m_cellEntities; // indices in m_entities, cell by cell
+	std::vector<uint32_t> m_entityCells; // [index in m_entities] cell
+	std::vector<uint32_t> m_cellFill;
+	std::vector<int> m_removedIds;
+	std::vector<uint8_t> m_records;
+	std::vector<uint8_t> m_payload;
+	std::vector<uint8_t> m_packet;
+	NetworkPacket m_received;
+
+	uint32_t m_sequence = 0;
+	uint32_t m_sendInterval = 1;
+	int m_interestMargin = 128;
+
+	NetworkStats m_tickStats;
+	NetworkStats m_totalStats;
+	uint32_t m_sentTickCount = 0;
+};
+
+/// <summary>
+/// Receives the snapshots of a ReplicationServer and mirrors the entities in a Registry: an entity is created with a
+/// transform (and a health and a projectile component when the server entity has them) when it enters the view,
+/// updated, and destroyed when it leaves the view or is destroyed on the server. The registry owner adds what the
+/// entities are drawn with and runs Registry::Update so the created entities reach the systems.
+/// A server entity id reused by a new entity updates the same client entity
+/// </summary>
+class ReplicationClient
+{
+public:
+
+	ReplicationClient(Transport& transport, uint32_t serverPeer, Registry& registry) noexcept;
+
+	// applies the newest complete snapshot received, then acknowledges it with the view of the client
+	void Update(const SDL_Rect& view) noexcept;
+
+	// true once the server answered the handshake (the snapshots can still be on their way)
+	inline bool IsConnected() const noexcept { return m_token != 0; }
+
+	// client entity of a server entity id, null entity (-1) if it is not replicated
+	Entity GetEntity(int serverId) const noexcept;
+
+	inline uint32_t GetAppliedSequence() const noexcept { return m_appliedSequence; }
+	inline uint32_t GetAppliedTick() const noexcept { return m_appliedTick; }
+	inline size_t GetEntityCount() const noexcept { return m_entities.size(); }
+	inline const NetworkStats& GetTickStats() const noexcept { return m_tickStats; }
+	inline const NetworkStats& GetTotalStats() const noexcept { return m_totalStats; }
+
+private:
+
+	struct ReceivedSnapshot
+	{
+		uint32_t sequence = 0;
+		uint32_t tick = 0;
+		std::vector<ReplicatedEntity> entities; // sorted by id
+	};
+
+	void ReceiveFragment(const NetworkPacket& packet) noexcept;
+	bool DecodeSnapshot(uint32_t sequence) noexcept;
+	void ApplySnapshot(const ReceivedSnapshot& snapshot) noexcept;
+	void CreateEntity(const ReplicatedEntity& state) noexcept;
+	void UpdateEntity(Entity entity, const ReplicatedEntity& state, const ReplicatedEntity& previous) noexcept;
+
+	Transport& m_transport;
+	uint32_t m_serverPeer;
+	Registry& m_registry;
+	uint32_t m_token = 0; // token of the challenge of the server, sent back with the acknowledgments
+
+	std::array<ReceivedSnapshot, ReplicationServer::SNAPSHOT_HISTORY> m_history; // [sequence % SNAPSHOT_HISTORY]
+	uint32_t m_decodedSequence = 0; // newest snapshot received whole and decoded
+	uint32_t m_appliedSequence = 0;
+	uint32_t m_appliedTick = 0;
+	std::vector<ReplicatedEntity> m_appliedEntities; // the state the registry mirrors, sorted by id
+	std::vector<ReplicatedEntity> m_decoded;
+	std::vector<int> m_removedIds;
+	std::unordered_map<int, Entity> m_entities; // server entity id -> client entity
+
+	// fragments of the snapshot being received
+	uint32_t m_pendingSequence = 0;
+	uint32_t m_pendingFragmentCount = 0;
+	uint32_t m_receivedFragmentCount = 0;
+	std::vector<std::vector<uint8_t>> m_fragments;
+	std::vector<uint8_t> m_payload;
+	std::vector<uint8_t> m_packet;
+	NetworkPacket m_received;
+
+	NetworkStats m_tickStats;
+	NetworkStats m_totalStats;
+};
+
+#endif // REPLICATION_H
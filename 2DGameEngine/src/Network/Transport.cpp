@@ -0,0 +1,270 @@
+#include "Transport.h"
+
+#include "../Logger/Logger.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	constexpr size_t MAX_DATAGRAM_SIZE = 65536;
+
+#ifdef _WIN32
+	inline SOCKET GetSocket(intptr_t handle) noexcept { return static_cast<SOCKET>(handle); }
+	inline bool IsWouldBlock() noexcept { return WSAGetLastError() == WSAEWOULDBLOCK; }
+	// an ICMP port unreachable of a previous send is reported on the next receive, the socket still works
+	inline bool IsConnectionReset() noexcept { return WSAGetLastError() == WSAECONNRESET; }
+#else
+	inline int GetSocket(intptr_t handle) noexcept { return static_cast<int>(handle); }
+	inline bool IsWouldBlock() noexcept { return errno == EAGAIN || errno == EWOULDBLOCK; }
+	inline bool IsConnectionReset() noexcept { return errno == ECONNREFUSED; }
+#endif
+}
+
+LoopbackNetwork::LoopbackNetwork(float packetLoss, uint32_t seed) noexcept :
+	m_packetLoss(packetLoss),
+	m_rng(seed)
+{
+}
+
+std::unique_ptr<LoopbackTransport> LoopbackNetwork::CreateEndpoint() noexcept
+{
+	m_queues.emplace_back();
+	return std::make_unique<LoopbackTransport>(*this, static_cast<uint32_t>(m_queues.size() - 1));
+}
+
+bool LoopbackNetwork::Deliver(uint32_t sender, uint32_t peer, const uint8_t* data, size_t size) noexcept
+{
+	if (peer >= m_queues.size() || size > Transport::MAX_PACKET_SIZE)
+		return false;
+
+	// a lost packet was still sent as far as the sender knows
+	if (m_packetLoss > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(m_rng) < m_packetLoss)
+		return true;
+
+	NetworkPacket packet;
+	packet.peer = sender;
+	if (!m_freeBuffers.empty())
+	{
+		packet.bytes = std::move(m_freeBuffers.back());
+		m_freeBuffers.pop_back();
+	}
+	packet.bytes.assign(data, data + size);
+	m_queues[peer].push_back(std::move(packet));
+	return true;
+}
+
+bool LoopbackNetwork::Receive(uint32_t peer, NetworkPacket& packet) noexcept
+{
+	auto& queue = m_queues[peer];
+	if (queue.empty())
+		return false;
+
+	// the caller's previous buffer goes back to the free list, the packet keeps the queued one
+	if (packet.bytes.capacity() > 0)
+		m_freeBuffers.push_back(std::move(packet.bytes));
+	packet = std::move(queue.front());
+	queue.pop_front();
+	return true;
+}
+
+bool LoopbackTransport::Send(uint32_t peer, const uint8_t* data, size_t size) noexcept
+{
+	return m_network.Deliver(m_peer, peer, data, size);
+}
+
+bool LoopbackTransport::Receive(NetworkPacket& packet) noexcept
+{
+	return m_network.Receive(m_peer, packet);
+}
+
+UdpTransport::UdpTransport() noexcept
+{
+}
+
+UdpTransport::~UdpTransport() noexcept
+{
+	Close();
+}
+
+/// <summary>
+/// Creates a non-blocking UDP socket bound to the port on every interface
+/// </summary>
+/// <param name="port">0 lets the system pick a port</param>
+/// <returns>false if the socket can not be created or bound</returns>
+bool UdpTransport::Open(uint16_t port) noexcept
+{
+	Close();
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		Logger::Error("Error initializing Winsock");
+		return false;
+	}
+	const SOCKET handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (handle == INVALID_SOCKET)
+	{
+		Logger::Error("Error creating the UDP socket");
+		WSACleanup();
+		return false;
+	}
+	m_socket = static_cast<intptr_t>(handle);
+	u_long isNonBlocking = 1;
+	const bool isConfigured = ioctlsocket(handle, FIONBIO, &isNonBlocking) == 0;
+#else
+	const int handle = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (handle < 0)
+	{
+		Logger::Error("Error creating the UDP socket");
+		return false;
+	}
+	m_socket = handle;
+	const int flags = fcntl(handle, F_GETFL, 0);
+	const bool isConfigured = flags >= 0 && fcntl(handle, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (!isConfigured || bind(GetSocket(m_socket), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		Logger::Error("Error binding the UDP socket to port " + std::to_string(port));
+		Close();
+		return false;
+	}
+
+	m_receiveBuffer.resize(MAX_DATAGRAM_SIZE);
+	Logger::Log("UDP socket open on port " + std::to_string(port));
+	return true;
+}
+
+void UdpTransport::Close() noexcept
+{
+	if (m_socket == INVALID_SOCKET_HANDLE)
+		return;
+
+#ifdef _WIN32
+	closesocket(GetSocket(m_socket));
+	WSACleanup();
+#else
+	close(GetSocket(m_socket));
+#endif
+	m_socket = INVALID_SOCKET_HANDLE;
+	m_peers.clear();
+	m_isPeerUsed.clear();
+	m_freePeers.clear();
+	m_peerIds.clear();
+}
+
+uint32_t UdpTransport::AddPeer(const std::string& host, uint16_t port) noexcept
+{
+	addrinfo hints{};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo* result = nullptr;
+	if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0 || !result)
+	{
+		Logger::Error("Can not resolve the host " + host);
+		return INVALID_PEER;
+	}
+
+	const auto* address = reinterpret_cast<const sockaddr_in*>(result->ai_addr);
+	const PeerAddress peerAddress = { address->sin_addr.s_addr, htons(port) };
+	freeaddrinfo(result);
+	return FindOrAddPeer(peerAddress);
+}
+
+bool UdpTransport::Send(uint32_t peer, const uint8_t* data, size_t size) noexcept
+{
+	if (!IsOpen() || peer >= m_peers.size() || !m_isPeerUsed[peer] || size > MAX_PACKET_SIZE)
+		return false;
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = m_peers[peer].address;
+	address.sin_port = m_peers[peer].port;
+	const auto sent = sendto(GetSocket(m_socket), reinterpret_cast<const char*>(data), static_cast<int>(size), 0,
+		reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+	return sent >= 0 && static_cast<size_t>(sent) == size;
+}
+
+bool UdpTransport::Receive(NetworkPacket& packet) noexcept
+{
+	if (!IsOpen())
+		return false;
+
+	while (true)
+	{
+		sockaddr_in address{};
+		socklen_t addressSize = sizeof(address);
+		const auto received = recvfrom(GetSocket(m_socket), reinterpret_cast<char*>(m_receiveBuffer.data()),
+			static_cast<int>(m_receiveBuffer.size()), 0, reinterpret_cast<sockaddr*>(&address), &addressSize);
+		if (received < 0)
+		{
+			if (IsConnectionReset())
+				continue;
+			if (!IsWouldBlock())
+				Logger::Error("Error receiving from the UDP socket");
+			return false;
+		}
+
+		// the packets of new addresses are dropped while the peer table is full
+		packet.peer = FindOrAddPeer({ address.sin_addr.s_addr, address.sin_port });
+		if (packet.peer == INVALID_PEER)
+			continue;
+		packet.bytes.assign(m_receiveBuffer.begin(), m_receiveBuffer.begin() + received);
+		return true;
+	}
+}
+
+void UdpTransport::ReleasePeer(uint32_t peer) noexcept
+{
+	if (peer >= m_peers.size() || !m_isPeerUsed[peer])
+		return;
+	m_peerIds.erase(GetPeerKey(m_peers[peer]));
+	m_isPeerUsed[peer] = false;
+	m_freePeers.push_back(peer);
+}
+
+uint32_t UdpTransport::FindOrAddPeer(const PeerAddress& address) noexcept
+{
+	const auto found = m_peerIds.find(GetPeerKey(address));
+	if (found != m_peerIds.end())
+		return found->second;
+
+	uint32_t peer = INVALID_PEER;
+	if (!m_freePeers.empty())
+	{
+		peer = m_freePeers.back();
+		m_freePeers.pop_back();
+		m_peers[peer] = address;
+		m_isPeerUsed[peer] = true;
+	}
+	else if (m_peers.size() < MAX_PEERS)
+	{
+		peer = static_cast<uint32_t>(m_peers.size());
+		m_peers.push_back(address);
+		m_isPeerUsed.push_back(true);
+	}
+	else
+	{
+		return INVALID_PEER;
+	}
+	m_peerIds.emplace(GetPeerKey(address), peer);
+	return peer;
+}
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// a datagram and the peer it came from (Transport::Receive)
+struct NetworkPacket
+{
+	uint32_t peer = 0;
+	std::vector<uint8_t> bytes;
+};
+
+/// <summary>
+/// Unreliable datagram transport between peers, like UDP: a packet can be dropped, duplicated or arrive out of order,
+/// the replication resends what was not acknowledged. Send and Receive never block
+/// </summary>
+class Transport
+{
+public:
+
+	virtual ~Transport() noexcept = default;
+
+	// false when the packet could not be sent (unknown peer, too large, socket error)
+	virtual bool Send(uint32_t peer, const uint8_t* data, size_t size) noexcept = 0;
+	// next received packet, false when there is none
+	virtual bool Receive(NetworkPacket& packet) noexcept = 0;
+	// forgets a peer that is not used anymore, its id can be given to another address
+	virtual void ReleasePeer(uint32_t /*peer*/) noexcept {}
+
+	// payload that fits in one datagram without IP fragmentation on common links
+	static constexpr size_t MAX_PACKET_SIZE = 1200;
+	static constexpr uint32_t INVALID_PEER = UINT32_MAX;
+};
+
+class LoopbackTransport;
+
+/// <summary>
+/// In-process network connecting loopback endpoints, so a server and its clients can run on one machine (tests,
+/// benchmarks) without sockets. A packet is delivered on the next Receive of its destination, or dropped with
+/// the packet loss rate. The network must outlive its endpoints, and they are used from one thread
+/// </summary>
+class LoopbackNetwork
+{
+public:
+
+	explicit LoopbackNetwork(float packetLoss = 0.0f, uint32_t seed = 0) noexcept;
+
+	LoopbackNetwork(const LoopbackNetwork&) = delete;
+	LoopbackNetwork& operator=(const LoopbackNetwork&) = delete;
+
+	// the peer id of an endpoint is its creation index (the first endpoint, usually the server, is peer 0)
+	std::unique_ptr<LoopbackTransport> CreateEndpoint() noexcept;
+
+	inline void SetPacketLoss(float packetLoss) noexcept { m_packetLoss = packetLoss; }
+
+private:
+
+	friend class LoopbackTransport;
+
+	bool Deliver(uint32_t sender, uint32_t peer, const uint8_t* data, size_t size) noexcept;
+	bool Receive(uint32_t peer, NetworkPacket& packet) noexcept;
+
+	std::vector<std::deque<NetworkPacket>> m_queues; // [peer] packets waiting to be received
+	std::vector<std::vector<uint8_t>> m_freeBuffers; // buffers of the received packets, reused by the next ones
+	float m_packetLoss;
+	std::mt19937 m_rng;
+};
+
+class LoopbackTransport : public Transport
+{
+public:
+
+	LoopbackTransport(LoopbackNetwork& network, uint32_t peer) noexcept : m_network(network), m_peer(peer) {}
+
+	bool Send(uint32_t peer, const uint8_t* data, size_t size) noexcept override;
+	bool Receive(NetworkPacket& packet) noexcept override;
+
+	inline uint32_t GetPeer() const noexcept { return m_peer; }
+
+private:
+
+	LoopbackNetwork& m_network;
+	uint32_t m_peer;
+};
+
+/// <summary>
+/// IPv4 UDP socket (BSD sockets, Winsock on Windows) in non-blocking mode. The peers are the addresses added with
+/// AddPeer, and the unknown addresses packets are received from get the free peer ids. The peer table is capped:
+/// once it is full, the packets of new addresses are dropped until a peer is released
+/// </summary>
+class UdpTransport : public Transport
+{
+public:
+
+	UdpTransport() noexcept;
+	~UdpTransport() noexcept;
+
+	UdpTransport(const UdpTransport&) = delete;
+	UdpTransport& operator=(const UdpTransport&) = delete;
+
+	// binds the socket to the port (0 = any port, for a client)
+	bool Open(uint16_t port) noexcept;
+	void Close() noexcept;
+	// resolves the host name (or dotted address), INVALID_PEER if it can not be resolved or the peer table is full
+	uint32_t AddPeer(const std::string& host, uint16_t port) noexcept;
+
+	bool Send(uint32_t peer, const uint8_t* data, size_t size) noexcept override;
+	bool Receive(NetworkPacket& packet) noexcept override;
+	void ReleasePeer(uint32_t peer) noexcept override;
+
+	inline bool IsOpen() const noexcept { return m_socket != INVALID_SOCKET_HANDLE; }
+	inline size_t GetPeerCount() const noexcept { return m_peerIds.size(); }
+
+	static constexpr uint32_t MAX_PEERS = 256;
+
+private:
+
+	// IPv4 address and port, in network byte order
+	struct PeerAddress
+	{
+		uint32_t address;
+		uint16_t port;
+	};
+
+	static inline uint64_t GetPeerKey(const PeerAddress& address) noexcept
+	{
+		return (static_cast<uint64_t>(address.address) << 16) | address.port;
+	}
+
+	// INVALID_PEER when the table is full
+	uint32_t FindOrAddPeer(const PeerAddress& address) noexcept;
+
+	static constexpr intptr_t INVALID_SOCKET_HANDLE = -1;
+
+	intptr_t m_socket = INVALID_SOCKET_HANDLE; // SOCKET on Windows, file descriptor elsewhere
+	std::vector<PeerAddress> m_peers; // [peer], a released peer keeps its slot until it is reused
+	std::vector<bool> m_isPeerUsed; // [peer]
+	std::vector<uint32_t> m_freePeers;
+	std::unordered_map<uint64_t, uint32_t> m_peerIds; // address and port -> peer
+	std::vector<uint8_t> m_receiveBuffer;
+};
+
+#endif // TRANSPORT_H
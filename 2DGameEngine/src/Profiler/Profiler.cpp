@@ -0,0 +1,311 @@
+#include "Profiler.h"
+
+#include "../Logger/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+namespace
+{
+	const std::chrono::steady_clock::time_point profilerEpoch = std::chrono::steady_clock::now();
+
+	// nesting level of the scopes currently open on this thread
+	thread_local uint16_t scopeDepth = 0;
+
+	std::atomic<uint32_t> nextThreadId{ 0 };
+
+	std::unique_ptr<ProfileFrame[]> CreateFrames() noexcept
+	{
+		auto frames = std::make_unique<ProfileFrame[]>(Profiler::MAX_FRAMES);
+		for (size_t i = 0; i < Profiler::MAX_FRAMES; ++i)
+		{
+			frames[i].samples = std::make_unique<ProfileSample[]>(Profiler::MAX_SAMPLES_PER_FRAME);
+		}
+		return frames;
+	}
+
+	bool IsSameName(const char* a, const char* b) noexcept
+	{
+		return a == b || std::strcmp(a, b) == 0;
+	}
+
+	double Percentile(const std::vector<double>& sortedValues, double percentile) noexcept
+	{
+		if (sortedValues.empty()) return 0.0;
+		const size_t index = static_cast<size_t>(percentile * (sortedValues.size() - 1) + 0.5);
+		return sortedValues[std::min(index, sortedValues.size() - 1)];
+	}
+}
+
+// define static variables
+std::atomic<bool> Profiler::s_isEnabled{ true };
+std::atomic<uint64_t> Profiler::s_completedFrames{ 0 };
+std::unique_ptr<ProfileFrame[]> Profiler::s_frames = CreateFrames();
+size_t Profiler::s_captureFramesLeft = 0;
+std::string Profiler::s_captureFilePath;
+std::unique_ptr<ProfileCapture> Profiler::s_capture;
+std::vector<std::pair<const char*, uint32_t>> Profiler::s_captureNameIndices;
+
+/////////////// Profiler class implementations ///////////////
+
+uint64_t Profiler::Now() noexcept
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - profilerEpoch).count());
+}
+
+uint32_t Profiler::GetThreadId() noexcept
+{
+	thread_local const uint32_t threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+	return threadId;
+}
+
+/// <summary>
+/// Closes the frame being recorded and opens the next slot of the ring buffer
+/// </summary>
+void Profiler::NextFrame() noexcept
+{
+	const uint64_t now = Now();
+	const uint64_t frameIndex = s_completedFrames.load(std::memory_order_relaxed);
+
+	ProfileFrame& frame = s_frames[frameIndex % MAX_FRAMES];
+	frame.endNs = now;
+	const uint32_t count = frame.sampleCount.load(std::memory_order_relaxed);
+	frame.droppedSamples = count > MAX_SAMPLES_PER_FRAME ? count - MAX_SAMPLES_PER_FRAME : 0;
+
+	// prepare the next slot before publishing the completed frame
+	ProfileFrame& nextFrame = s_frames[(frameIndex + 1) % MAX_FRAMES];
+	nextFrame.frameIndex = frameIndex + 1;
+	nextFrame.startNs = now;
+	nextFrame.endNs = now;
+	nextFrame.droppedSamples = 0;
+	nextFrame.sampleCount.store(0, std::memory_order_relaxed);
+
+	s_completedFrames.store(frameIndex + 1, std::memory_order_release);
+
+	if (s_captureFramesLeft > 0)
+	{
+		CaptureFrame(frame);
+		if (--s_captureFramesLeft == 0)
+			StopCapture();
+	}
+}
+
+/// <summary>
+/// Pushes a sample into the frame being recorded, samples above the frame capacity are dropped
+/// </summary>
+void Profiler::AddSample(const char* name, uint64_t startNs, uint64_t endNs, uint16_t depth) noexcept
+{
+	ProfileFrame& frame = s_frames[s_completedFrames.load(std::memory_order_acquire) % MAX_FRAMES];
+
+	const uint32_t slot = frame.sampleCount.fetch_add(1, std::memory_order_acq_rel);
+	if (slot >= MAX_SAMPLES_PER_FRAME)
+		return;
+
+	frame.samples[slot] = { name, startNs, endNs, GetThreadId(), depth };
+}
+
+const ProfileFrame* Profiler::GetCompletedFrame(size_t framesAgo) noexcept
+{
+	const uint64_t completedFrames = GetCompletedFrameCount();
+
+	// the slot right after the current frame may be overwritten next, so keep one slot of margin
+	if (framesAgo == 0 || framesAgo > completedFrames || framesAgo >= MAX_FRAMES)
+		return nullptr;
+
+	return &s_frames[(completedFrames - framesAgo) % MAX_FRAMES];
+}
+
+/// <summary>
+/// Sums the time of every scope name per frame, then computes the rolling average and percentiles
+/// </summary>
+/// <param name="numFrames"></param>
+/// <param name="stats"></param>
+void Profiler::CollectStats(size_t numFrames, std::vector<ProfileStats>& stats) noexcept
+{
+	struct ScopeTimes
+	{
+		const char* name;
+		std::vector<double> perFrame; // milliseconds per frame
+	};
+	std::vector<ScopeTimes> scopes;
+
+	numFrames = std::min<size_t>(numFrames, MAX_FRAMES - 1);
+	size_t frameSlot = 0;
+	for (size_t framesAgo = 1; framesAgo <= numFrames; ++framesAgo)
+	{
+		const ProfileFrame* frame = GetCompletedFrame(framesAgo);
+		if (!frame) break;
+
+		const uint32_t count = frame->GetSampleCount();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const ProfileSample& sample = frame->samples[i];
+			auto scope = std::find_if(scopes.begin(), scopes.end(), [&sample](const ScopeTimes& other)
+				{
+					return IsSameName(other.name, sample.name);
+				});
+			if (scope == scopes.end())
+			{
+				scopes.push_back({ sample.name, std::vector<double>(numFrames, 0.0) });
+				scope = scopes.end() - 1;
+			}
+			scope->perFrame[frameSlot] += (sample.endNs - sample.startNs) / 1000000.0;
+		}
+		frameSlot++;
+	}
+
+	stats.clear();
+	for (auto& scope : scopes)
+	{
+		// only the frames where the scope was recorded count for its statistics
+		std::vector<double> values;
+		values.reserve(frameSlot);
+		for (size_t i = 0; i < frameSlot; ++i)
+		{
+			if (scope.perFrame[i] > 0.0)
+				values.push_back(scope.perFrame[i]);
+		}
+		if (values.empty()) continue;
+
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (double value : values) sum += value;
+
+		stats.push_back({ scope.name, sum / values.size(), Percentile(values, 0.50), Percentile(values, 0.95),
+						  Percentile(values, 0.99), values.back(), static_cast<uint32_t>(values.size()) });
+	}
+
+	std::sort(stats.begin(), stats.end(), [](const ProfileStats& a, const ProfileStats& b)
+		{
+			return a.average > b.average;
+		});
+}
+
+/// <summary>
+/// Demangles the type name on GCC/Clang and removes the "class "/"struct " prefix on MSVC
+/// </summary>
+std::string Profiler::GetTypeName(const std::type_info& type) noexcept
+{
+	std::string name = type.name();
+
+#ifdef __GNUG__
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+	if (status == 0 && demangled)
+		name = demangled;
+	std::free(demangled);
+#else
+	for (const char* prefix : { "class ", "struct " })
+	{
+		const size_t length = std::strlen(prefix);
+		if (name.compare(0, length, prefix) == 0)
+			name.erase(0, length);
+	}
+#endif
+
+	return name;
+}
+
+/// <summary>
+/// Starts copying the completed frames, a running capture is written first
+/// </summary>
+/// <param name="numFrames"></param>
+/// <param name="filePath"></param>
+void Profiler::StartCapture(size_t numFrames, const std::string& filePath) noexcept
+{
+	StopCapture();
+	if (numFrames == 0) return;
+
+	if (numFrames > MAX_CAPTURE_FRAMES)
+	{
+		Logger::Warning("Trace capture limited to " + std::to_string(MAX_CAPTURE_FRAMES) + " frames (" +
+						std::to_string(numFrames) + " requested)");
+		numFrames = MAX_CAPTURE_FRAMES;
+	}
+
+	s_capture = std::make_unique<ProfileCapture>();
+	s_capture->frames.reserve(numFrames);
+	s_captureNameIndices.clear();
+	s_captureFilePath = filePath;
+	s_captureFramesLeft = numFrames;
+}
+
+void Profiler::StopCapture() noexcept
+{
+	if (!s_capture) return;
+
+	TraceExporter::WriteChromeTrace(s_captureFilePath, *s_capture);
+	s_capture.reset();
+	s_captureFramesLeft = 0;
+}
+
+/// <summary>
+/// Copies a completed frame into the capture, the sample names are interned
+/// so the capture does not depend on the lifetime of the name pointers
+/// </summary>
+/// <param name="frame"></param>
+void Profiler::CaptureFrame(const ProfileFrame& frame) noexcept
+{
+	s_capture->frames.push_back({ frame.frameIndex, frame.startNs, frame.endNs });
+
+	const uint32_t count = frame.GetSampleCount();
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const ProfileSample& sample = frame.samples[i];
+
+		auto cached = std::find_if(s_captureNameIndices.begin(), s_captureNameIndices.end(), [&sample](const std::pair<const char*, uint32_t>& entry)
+			{
+				return entry.first == sample.name;
+			});
+
+		// a pointer can be freed and reused for another name, the cached name is checked before it is trusted
+		uint32_t nameIndex;
+		if (cached != s_captureNameIndices.end() && s_capture->names[cached->second] == sample.name)
+		{
+			nameIndex = cached->second;
+		}
+		else
+		{
+			auto name = std::find(s_capture->names.begin(), s_capture->names.end(), sample.name);
+			nameIndex = static_cast<uint32_t>(name - s_capture->names.begin());
+			if (name == s_capture->names.end())
+				s_capture->names.emplace_back(sample.name);
+			if (cached != s_captureNameIndices.end())
+				cached->second = nameIndex;
+			else
+				s_captureNameIndices.emplace_back(sample.name, nameIndex);
+		}
+
+		s_capture->samples.push_back({ nameIndex, sample.startNs, sample.endNs, sample.threadId });
+	}
+}
+
+/////////////// ProfileScope class implementations ///////////////
+
+ProfileScope::ProfileScope(const char* name) noexcept :
+	m_name(name),
+	m_startNs(0),
+	m_depth(0),
+	m_isRunning(Profiler::IsEnabled())
+{
+	if (m_isRunning)
+	{
+		m_depth = scopeDepth++;
+		m_startNs = Profiler::Now();
+	}
+}
+
+void ProfileScope::Stop() noexcept
+{
+	if (!m_isRunning) return;
+
+	Profiler::AddSample(m_name, m_startNs, Profiler::Now(), m_depth);
+	scopeDepth--;
+	m_isRunning = false;
+}
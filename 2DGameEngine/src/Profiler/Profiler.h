@@ -0,0 +1,137 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "TraceExporter.h"
+
+// One timed scope (system update/render, event dispatch, level load phase...)
+struct ProfileSample
+{
+	const char* name; // must outlive the profiler capture (string literals, system names, event type names)
+	uint64_t startNs; // nanoseconds since the profiler epoch
+	uint64_t endNs;
+	uint32_t threadId;
+	uint16_t depth; // nesting level of the scope on its thread
+};
+
+// All the samples recorded between two Profiler::NextFrame() calls
+struct ProfileFrame
+{
+	uint64_t frameIndex = 0;
+	uint64_t startNs = 0;
+	uint64_t endNs = 0;
+	std::atomic<uint32_t> sampleCount{ 0 };
+	uint32_t droppedSamples = 0;
+	std::unique_ptr<ProfileSample[]> samples;
+
+	inline uint32_t GetSampleCount() const noexcept;
+};
+
+// Rolling statistics of a scope name over the last frames (times in milliseconds)
+struct ProfileStats
+{
+	const char* name;
+	double average;
+	double p50;
+	double p95;
+	double p99;
+	double max;
+	uint32_t frames; // number of frames in which the scope was recorded
+};
+
+/// <summary>
+/// Frame profiler. Scoped timers push their samples into the current frame of a ring buffer of frames.
+/// Pushing a sample is lock-free (one atomic increment), so worker threads can record samples too.
+/// Only completed frames are read back (ImGui overlay, trace export).
+/// </summary>
+class Profiler
+{
+public:
+
+	static constexpr size_t MAX_FRAMES = 128;
+	static constexpr uint32_t MAX_SAMPLES_PER_FRAME = 1024;
+	static constexpr size_t MAX_CAPTURE_FRAMES = 3600; // one minute at 60 FPS, longer captures are cut
+
+	static inline void SetEnabled(bool isEnabled) noexcept { s_isEnabled.store(isEnabled, std::memory_order_relaxed); }
+	static inline bool IsEnabled() noexcept { return s_isEnabled.load(std::memory_order_relaxed); }
+
+	// Closes the current frame and opens the next one (called once per game loop iteration)
+	static void NextFrame() noexcept;
+
+	static uint64_t Now() noexcept;
+	static void AddSample(const char* name, uint64_t startNs, uint64_t endNs, uint16_t depth) noexcept;
+
+	// Small sequential id of the calling thread (the first thread that asks gets 0)
+	static uint32_t GetThreadId() noexcept;
+
+	// number of frames that were completed since the start
+	static inline uint64_t GetCompletedFrameCount() noexcept { return s_completedFrames.load(std::memory_order_acquire); }
+	// 1 = last completed frame, 2 = the one before... returns nullptr if it is not available anymore
+	static const ProfileFrame* GetCompletedFrame(size_t framesAgo) noexcept;
+
+	// per scope name average/percentiles over the last completed frames, sorted by average time
+	static void CollectStats(size_t numFrames, std::vector<ProfileStats>& stats) noexcept;
+
+	// readable name of a type (used for the system and event names)
+	static std::string GetTypeName(const std::type_info& type) noexcept;
+
+	// Copies the next numFrames (at most MAX_CAPTURE_FRAMES) completed frames and writes them as a Chrome trace when done
+	static void StartCapture(size_t numFrames, const std::string& filePath) noexcept;
+	// Writes what was captured so far (no-op when no capture is running)
+	static void StopCapture() noexcept;
+	static inline bool IsCapturing() noexcept { return s_captureFramesLeft > 0; }
+
+private:
+
+	static void CaptureFrame(const ProfileFrame& frame) noexcept;
+
+	static std::atomic<bool> s_isEnabled;
+	static std::atomic<uint64_t> s_completedFrames;
+	static std::unique_ptr<ProfileFrame[]> s_frames;
+
+	// trace capture, only touched by the thread calling NextFrame()
+	static size_t s_captureFramesLeft;
+	static std::string s_captureFilePath;
+	static std::unique_ptr<ProfileCapture> s_capture;
+	// name pointer -> index in s_capture->names, name pointers repeat every frame so most lookups skip the string compares
+	static std::vector<std::pair<const char*, uint32_t>> s_captureNameIndices;
+};
+
+/// <summary>
+/// RAII timer, records a sample from construction to destruction (or to Stop())
+/// </summary>
+class ProfileScope
+{
+public:
+
+	explicit ProfileScope(const char* name) noexcept;
+	~ProfileScope() noexcept { Stop(); }
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	void Stop() noexcept;
+
+private:
+
+	const char* m_name;
+	uint64_t m_startNs;
+	uint16_t m_depth;
+	bool m_isRunning;
+};
+
+inline uint32_t ProfileFrame::GetSampleCount() const noexcept
+{
+	const uint32_t count = sampleCount.load(std::memory_order_acquire);
+	return count < Profiler::MAX_SAMPLES_PER_FRAME ? count : Profiler::MAX_SAMPLES_PER_FRAME;
+}
+
+#endif // PROFILER_H
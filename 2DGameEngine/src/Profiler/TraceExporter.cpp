@@ -0,0 +1,101 @@
+#include "TraceExporter.h"
+
+#include "../Logger/Logger.h"
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+
+namespace
+{
+	// trace timestamps are in microseconds
+	inline double ToMicroseconds(uint64_t ns) noexcept
+	{
+		return ns / 1000.0;
+	}
+}
+
+/// <summary>
+/// Writes the capture to a JSON file
+/// </summary>
+/// <param name="filePath"></param>
+/// <param name="capture"></param>
+/// <returns></returns>
+bool TraceExporter::WriteChromeTrace(const std::string& filePath, const ProfileCapture& capture) noexcept
+{
+	std::ofstream file(filePath, std::ios::trunc);
+	if (!file.is_open())
+	{
+		Logger::Error("Error opening the trace file for writing: " + filePath);
+		return false;
+	}
+
+	std::vector<std::string> escapedNames;
+	escapedNames.reserve(capture.names.size());
+	for (const auto& name : capture.names)
+		escapedNames.emplace_back(EscapeJson(name));
+
+	char buffer[128];
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"2DGameEngine\"}}";
+
+	// name the threads so parallel system runs are easy to tell apart
+	std::set<uint32_t> threadIds;
+	for (const auto& sample : capture.samples)
+		threadIds.insert(sample.threadId);
+	threadIds.insert(0);
+	for (uint32_t threadId : threadIds)
+	{
+		file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << threadId
+			 << ",\"args\":{\"name\":\"" << (threadId == 0 ? std::string("Main") : "Worker " + std::to_string(threadId)) << "\"}}";
+	}
+
+	for (const auto& frame : capture.frames)
+	{
+		std::snprintf(buffer, sizeof(buffer), "\"ts\":%.3f,\"dur\":%.3f", ToMicroseconds(frame.startNs), ToMicroseconds(frame.endNs - frame.startNs));
+		file << ",\n{\"name\":\"Frame\",\"cat\":\"frame\",\"ph\":\"X\"," << buffer
+			 << ",\"pid\":1,\"tid\":0,\"args\":{\"index\":" << frame.frameIndex << "}}";
+	}
+
+	for (const auto& sample : capture.samples)
+	{
+		std::snprintf(buffer, sizeof(buffer), "\"ts\":%.3f,\"dur\":%.3f", ToMicroseconds(sample.startNs), ToMicroseconds(sample.endNs - sample.startNs));
+		file << ",\n{\"name\":\"" << escapedNames[sample.nameIndex] << "\",\"cat\":\"engine\",\"ph\":\"X\"," << buffer
+			 << ",\"pid\":1,\"tid\":" << sample.threadId << "}";
+	}
+
+	file << "\n]}\n";
+
+	Logger::Log("Trace with " + std::to_string(capture.frames.size()) + " frames and " + std::to_string(capture.samples.size()) +
+				" samples written to " + filePath);
+	return file.good();
+}
+
+std::string TraceExporter::EscapeJson(const std::string& text) noexcept
+{
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (char c : text)
+	{
+		switch (c)
+		{
+			case '"': escaped += "\\\""; break;
+			case '\\': escaped += "\\\\"; break;
+			case '\n': escaped += "\\n"; break;
+			case '\t': escaped += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char code[8];
+					std::snprintf(code, sizeof(code), "\\u%04x", c);
+					escaped += code;
+				}
+				else
+				{
+					escaped += c;
+				}
+				break;
+		}
+	}
+	return escaped;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef TRACEEXPORTER_H
+#define TRACEEXPORTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// a sample copied out of the profiler ring buffer, names are interned in ProfileCapture::names
+struct CapturedSample
+{
+	uint32_t nameIndex;
+	uint64_t startNs;
+	uint64_t endNs;
+	uint32_t threadId;
+};
+
+struct CapturedFrame
+{
+	uint64_t frameIndex;
+	uint64_t startNs;
+	uint64_t endNs;
+};
+
+// frames and samples collected by Profiler::StartCapture
+struct ProfileCapture
+{
+	std::vector<std::string> names;
+	std::vector<CapturedSample> samples;
+	std::vector<CapturedFrame> frames;
+};
+
+/// <summary>
+/// Writes a profiler capture as Chrome Trace Event JSON (chrome://tracing, https://ui.perfetto.dev)
+/// Every sample becomes a complete event ("ph":"X") on its thread, every frame an enclosing event on the main thread
+/// </summary>
+class TraceExporter
+{
+public:
+
+	static bool WriteChromeTrace(const std::string& filePath, const ProfileCapture& capture) noexcept;
+
+private:
+
+	static std::string EscapeJson(const std::string& text) noexcept;
+};
+
+#endif // TRACEEXPORTER_H
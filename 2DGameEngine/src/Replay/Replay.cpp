@@ -0,0 +1,233 @@
+#include "Replay.h"
+
+#include "../Logger/Logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+namespace
+{
+	constexpr char REPLAY_MAGIC[4] = { '2', 'D', 'R', 'P' };
+
+	void WriteU16(std::vector<uint8_t>& buffer, uint16_t value) noexcept
+	{
+		buffer.push_back(static_cast<uint8_t>(value));
+		buffer.push_back(static_cast<uint8_t>(value >> 8));
+	}
+
+	void WriteU32(std::vector<uint8_t>& buffer, uint32_t value) noexcept
+	{
+		for (int i = 0; i < 4; ++i)
+			buffer.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+
+	// 7 bits per byte, the high bit tells if another byte follows
+	void WriteVarint(std::vector<uint8_t>& buffer, uint32_t value) noexcept
+	{
+		while (value >= 0x80)
+		{
+			buffer.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back(static_cast<uint8_t>(value));
+	}
+
+	bool ReadU16(const std::vector<uint8_t>& buffer, size_t& offset, uint16_t& value) noexcept
+	{
+		if (offset + 2 > buffer.size()) return false;
+		value = static_cast<uint16_t>(buffer[offset] | (buffer[offset + 1] << 8));
+		offset += 2;
+		return true;
+	}
+
+	bool ReadU32(const std::vector<uint8_t>& buffer, size_t& offset, uint32_t& value) noexcept
+	{
+		if (offset + 4 > buffer.size()) return false;
+		value = 0;
+		for (int i = 0; i < 4; ++i)
+			value |= static_cast<uint32_t>(buffer[offset + i]) << (i * 8);
+		offset += 4;
+		return true;
+	}
+
+	bool ReadVarint(const std::vector<uint8_t>& buffer, size_t& offset, uint32_t& value) noexcept
+	{
+		value = 0;
+		for (int shift = 0; shift < 35; shift += 7)
+		{
+			if (offset >= buffer.size()) return false;
+			const uint8_t byte = buffer[offset++];
+			value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) return true;
+		}
+		return false;
+	}
+}
+
+Replay::Replay() noexcept
+{
+	Logger::Log("Replay constructor called");
+}
+
+Replay::~Replay() noexcept
+{
+	Logger::Log("Replay destructor called");
+}
+
+/// <summary>
+/// Clears any previous data and starts recording inputs
+/// </summary>
+/// <param name="seed"></param>
+/// <param name="level"></param>
+/// <param name="fixedStepMs"></param>
+void Replay::StartRecording(uint32_t seed, uint32_t level, uint32_t fixedStepMs) noexcept
+{
+	m_inputs.clear();
+	m_playbackCursor = 0;
+	m_seed = seed;
+	m_level = level;
+	m_fixedStepMs = fixedStepMs;
+	m_tickCount = 0;
+	m_isRecording = true;
+	m_isPlayingBack = false;
+}
+
+/// <summary>
+/// Appends an input event, ticks must be recorded in increasing order
+/// </summary>
+/// <param name="tick"></param>
+/// <param name="keyCode"></param>
+void Replay::RecordInput(uint32_t tick, SDL_Keycode keyCode) noexcept
+{
+	if (!m_isRecording) return;
+
+	m_inputs.push_back({ tick, keyCode });
+	if (tick + 1 > m_tickCount)
+		m_tickCount = tick + 1;
+}
+
+/// <summary>
+/// Writes the recording to a binary file
+/// </summary>
+/// <param name="filePath"></param>
+/// <returns></returns>
+bool Replay::SaveToFile(const std::string& filePath) const noexcept
+{
+	std::vector<uint8_t> buffer;
+	buffer.reserve(26 + m_inputs.size() * 4);
+
+	buffer.insert(buffer.end(), std::begin(REPLAY_MAGIC), std::end(REPLAY_MAGIC));
+	WriteU16(buffer, REPLAY_VERSION);
+	WriteU32(buffer, m_seed);
+	WriteU32(buffer, m_level);
+	WriteU32(buffer, m_fixedStepMs);
+	WriteU32(buffer, m_tickCount);
+	WriteU32(buffer, static_cast<uint32_t>(m_inputs.size()));
+
+	uint32_t previousTick = 0;
+	for (const auto& input : m_inputs)
+	{
+		WriteVarint(buffer, input.tick - previousTick);
+		WriteVarint(buffer, static_cast<uint32_t>(input.keyCode));
+		previousTick = input.tick;
+	}
+
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		Logger::Error("Error opening the replay file for writing: " + filePath);
+		return false;
+	}
+	file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+
+	Logger::Log("Replay saved to " + filePath + " (" + std::to_string(m_inputs.size()) + " inputs, " +
+				std::to_string(m_tickCount) + " ticks, " + std::to_string(buffer.size()) + " bytes)");
+	return file.good();
+}
+
+/// <summary>
+/// Reads a recording from a binary file and prepares it for playback
+/// </summary>
+/// <param name="filePath"></param>
+/// <returns></returns>
+bool Replay::LoadFromFile(const std::string& filePath) noexcept
+{
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open())
+	{
+		Logger::Error("Error opening the replay file: " + filePath);
+		return false;
+	}
+
+	const std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	size_t offset = 0;
+	if (buffer.size() < sizeof(REPLAY_MAGIC) || !std::equal(std::begin(REPLAY_MAGIC), std::end(REPLAY_MAGIC), buffer.begin()))
+	{
+		Logger::Error("Invalid replay file: " + filePath);
+		return false;
+	}
+	offset += sizeof(REPLAY_MAGIC);
+
+	uint16_t version = 0;
+	uint32_t seed = 0, level = 0, fixedStepMs = 0, tickCount = 0, inputCount = 0;
+	if (!ReadU16(buffer, offset, version) || version != REPLAY_VERSION ||
+		!ReadU32(buffer, offset, seed) || !ReadU32(buffer, offset, level) ||
+		!ReadU32(buffer, offset, fixedStepMs) || !ReadU32(buffer, offset, tickCount) ||
+		!ReadU32(buffer, offset, inputCount))
+	{
+		Logger::Error("Unsupported or truncated replay header: " + filePath);
+		return false;
+	}
+
+	// every record takes at least two varint bytes, so a larger count cannot be in the file
+	if (inputCount > (buffer.size() - offset) / 2)
+	{
+		Logger::Error("Truncated replay input stream: " + filePath);
+		return false;
+	}
+
+	std::vector<ReplayInputRecord> inputs;
+	inputs.reserve(inputCount);
+
+	uint32_t tick = 0;
+	for (uint32_t i = 0; i < inputCount; ++i)
+	{
+		uint32_t tickDelta = 0, keyCode = 0;
+		if (!ReadVarint(buffer, offset, tickDelta) || !ReadVarint(buffer, offset, keyCode))
+		{
+			Logger::Error("Truncated replay input stream: " + filePath);
+			return false;
+		}
+		tick += tickDelta;
+		inputs.push_back({ tick, static_cast<SDL_Keycode>(keyCode) });
+	}
+
+	m_inputs = std::move(inputs);
+	m_playbackCursor = 0;
+	m_seed = seed;
+	m_level = level;
+	m_fixedStepMs = fixedStepMs;
+	m_tickCount = tickCount;
+	m_isRecording = false;
+	m_isPlayingBack = true;
+
+	Logger::Log("Replay loaded from " + filePath + " (" + std::to_string(m_inputs.size()) + " inputs, " +
+				std::to_string(m_tickCount) + " ticks)");
+	return true;
+}
+
+const ReplayInputRecord* Replay::PollInput(uint32_t tick) noexcept
+{
+	if (!m_isPlayingBack || m_playbackCursor >= m_inputs.size())
+		return nullptr;
+
+	// inputs of later ticks stay in the stream until their tick is reached
+	const ReplayInputRecord& input = m_inputs[m_playbackCursor];
+	if (input.tick > tick)
+		return nullptr;
+
+	m_playbackCursor++;
+	return &input;
+}
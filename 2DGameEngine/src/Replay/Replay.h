@@ -0,0 +1,72 @@
+#pragma once
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <SDL.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// a single input event tagged with the simulation tick it was published on
+struct ReplayInputRecord
+{
+	uint32_t tick;
+	SDL_Keycode keyCode;
+};
+
+/// <summary>
+/// Records the tick-stamped KeyPressedEvent stream (plus RNG seed and level id) to a compact binary file
+/// and feeds it back under the fixed-step loop, so the exact same frame sequence can be reproduced.
+/// 
+/// File layout (little-endian):
+/// magic "2DRP" | u16 version | u32 seed | u32 level | u32 fixed step (ms) | u32 tick count | u32 input count |
+/// per input: varint tick delta, varint key code
+/// </summary>
+class Replay
+{
+public:
+
+	Replay() noexcept;
+	~Replay() noexcept;
+
+	// Recording
+	void StartRecording(uint32_t seed, uint32_t level, uint32_t fixedStepMs) noexcept;
+	void RecordInput(uint32_t tick, SDL_Keycode keyCode) noexcept;
+	// Stores the total number of simulated ticks, so a playback knows when the recording ends
+	inline void SetTickCount(uint32_t tickCount) noexcept { m_tickCount = tickCount; }
+	bool SaveToFile(const std::string& filePath) const noexcept;
+
+	// Playback
+	bool LoadFromFile(const std::string& filePath) noexcept;
+	// Returns the next recorded input for this tick or nullptr when there are no more inputs on this tick
+	const ReplayInputRecord* PollInput(uint32_t tick) noexcept;
+	inline bool IsPlaybackFinished(uint32_t tick) const noexcept { return tick >= m_tickCount && m_playbackCursor >= m_inputs.size(); }
+
+	inline bool IsRecording() const noexcept { return m_isRecording; }
+	inline bool IsPlayingBack() const noexcept { return m_isPlayingBack; }
+
+	inline uint32_t GetSeed() const noexcept { return m_seed; }
+	inline uint32_t GetLevel() const noexcept { return m_level; }
+	inline uint32_t GetFixedStep() const noexcept { return m_fixedStepMs; }
+	inline uint32_t GetTickCount() const noexcept { return m_tickCount; }
+	inline size_t GetInputCount() const noexcept { return m_inputs.size(); }
+
+private:
+
+	static constexpr uint16_t REPLAY_VERSION = 1;
+
+	std::vector<ReplayInputRecord> m_inputs;
+	size_t m_playbackCursor = 0;
+
+	uint32_t m_seed = 0;
+	uint32_t m_level = 0;
+	uint32_t m_fixedStepMs = 0;
+	uint32_t m_tickCount = 0;
+
+	bool m_isRecording = false;
+	bool m_isPlayingBack = false;
+
+};
+
+#endif // REPLAY_H
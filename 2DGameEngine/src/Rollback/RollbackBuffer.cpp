@@ -0,0 +1,92 @@
+#include "RollbackBuffer.h"
+
+#include "../GameEngine/Clock.h"
+#include "../Logger/Logger.h"
+#include "../Profiler/Profiler.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+
+RollbackBuffer::RollbackBuffer(size_t capacity) noexcept :
+	m_frames(std::max<size_t>(capacity, 1))
+{
+}
+
+void RollbackBuffer::Capture(uint32_t tick, Registry& registry, const SDL_Rect& camera) noexcept
+{
+	ProfileScope scope("RollbackBuffer::Capture");
+
+	if (m_count > 0 && tick != GetNewestTick() + 1)
+		Clear();
+
+	// the registry is still in m_current, the sections it did not change since are shared
+	const size_t index = m_count > 0 ? (m_newest + 1) % m_frames.size() : 0;
+	Frame& frame = m_frames[index];
+	frame.tick = tick;
+	frame.clockTicks = Clock::GetTicks();
+	frame.camera = camera;
+	registry.Capture(frame.snapshot, m_count > 0 ? &m_current : nullptr);
+
+	m_current = frame.snapshot;
+	m_newest = index;
+	m_count = std::min(m_count + 1, m_frames.size());
+}
+
+bool RollbackBuffer::Restore(uint32_t tick, Registry& registry, SDL_Rect& camera) noexcept
+{
+	ProfileScope scope("RollbackBuffer::Restore");
+
+	if (!HasTick(tick))
+	{
+		Logger::Error("Tick " + std::to_string(tick) + " is not in the rollback buffer");
+		return false;
+	}
+
+	const Frame& frame = GetFrame(tick);
+	if (!registry.Restore(frame.snapshot, m_current))
+	{
+		// the registry is partly restored, none of the frames can be trusted as a starting point anymore
+		Clear();
+		return false;
+	}
+	Clock::SetTicks(frame.clockTicks);
+	camera = frame.camera;
+	m_current = frame.snapshot;
+
+	// the later ticks are simulated again, their frames are captured again over the dropped ones (reusing their buffers)
+	const uint32_t droppedCount = GetNewestTick() - tick;
+	m_newest = (m_newest + m_frames.size() - droppedCount) % m_frames.size();
+	m_count -= droppedCount;
+	return true;
+}
+
+void RollbackBuffer::Clear() noexcept
+{
+	for (auto& frame : m_frames)
+		frame.snapshot = RegistrySnapshot();
+	m_current = RegistrySnapshot();
+	m_newest = 0;
+	m_count = 0;
+}
+
+size_t RollbackBuffer::GetMemoryUsage() const noexcept
+{
+	std::unordered_set<const SnapshotSection*> sections;
+	size_t size = 0;
+	auto addSection = [&sections, &size](const std::shared_ptr<const SnapshotSection>& section)
+	{
+		if (section && sections.insert(section.get()).second)
+			size += section->bytes.size();
+	};
+
+	for (size_t i = 0; i < m_count; ++i)
+	{
+		const Frame& frame = m_frames[(m_newest + m_frames.size() - i) % m_frames.size()];
+		addSection(frame.snapshot.entities);
+		addSection(frame.snapshot.systems);
+		for (const auto& pool : frame.snapshot.pools)
+			addSection(pool);
+	}
+	return size;
+}
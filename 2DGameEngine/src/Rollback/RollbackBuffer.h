@@ -0,0 +1,65 @@
+#pragma once
+#ifndef ROLLBACKBUFFER_H
+#define ROLLBACKBUFFER_H
+
+#include "../ECS/ECS.h"
+
+#include <SDL.h>
+
+#include <cstdint>
+#include <vector>
+
+/// <summary>
+/// Ring of the world states of the last ticks, captured after each Registry::Update, so a late input can rewind
+/// the simulation a few ticks and simulate them again. A frame holds a RegistrySnapshot (its unchanged sections are
+/// shared with the previous frame), the simulation clock and the camera.
+/// The registry must not change between the last Capture or Restore and the next Restore: that is the state the
+/// restore starts from, only the sections that changed since the restored tick are read.
+/// </summary>
+class RollbackBuffer
+{
+public:
+
+	explicit RollbackBuffer(size_t capacity) noexcept;
+
+	// state after the update of this tick, the oldest frame is dropped once the ring is full.
+	// A tick that does not follow the newest frame clears the ring first
+	void Capture(uint32_t tick, Registry& registry, const SDL_Rect& camera) noexcept;
+	// back to the state after the update of this tick, the frames of the later ticks are dropped (captured again when re-simulated)
+	bool Restore(uint32_t tick, Registry& registry, SDL_Rect& camera) noexcept;
+	void Clear() noexcept;
+
+	inline bool IsEmpty() const noexcept { return m_count == 0; }
+	inline bool HasTick(uint32_t tick) const noexcept { return m_count > 0 && tick >= GetOldestTick() && tick <= GetNewestTick(); }
+	inline uint32_t GetNewestTick() const noexcept { return m_frames[m_newest].tick; }
+	inline uint32_t GetOldestTick() const noexcept { return GetNewestTick() - static_cast<uint32_t>(m_count - 1); }
+	inline size_t GetCapacity() const noexcept { return m_frames.size(); }
+	inline size_t GetCount() const noexcept { return m_count; }
+
+	// bytes held by the frames, a section shared by several frames is counted once
+	size_t GetMemoryUsage() const noexcept;
+
+private:
+
+	struct Frame
+	{
+		uint32_t tick = 0;
+		Uint32 clockTicks = 0;
+		SDL_Rect camera{};
+		RegistrySnapshot snapshot;
+	};
+
+	inline Frame& GetFrame(uint32_t tick) noexcept
+	{
+		return m_frames[(m_newest + m_frames.size() - (GetNewestTick() - tick)) % m_frames.size()];
+	}
+
+	std::vector<Frame> m_frames;
+	size_t m_newest = 0;
+	size_t m_count = 0;
+
+	// snapshot of the state the registry is in: the last captured or restored frame
+	RegistrySnapshot m_current;
+};
+
+#endif // ROLLBACKBUFFER_H
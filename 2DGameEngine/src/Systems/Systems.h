@@ -10,14 +10,31 @@
 #include <memory>
 #include <algorithm>
 #include <stdint.h>
+#include <cstddef>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
 
 #include "../GameEngine/Game.h"
+#include "../GameEngine/Clock.h"
 #include "../ECS/ECS.h"
 #include "../Components/Components.h"
 #include "../Logger/Logger.h"
 #include "../AssetStore/AssetStore.h"
 #include "../Events/Events.h"
 #include "../EventBus/EventBus.h"
+#include "../Profiler/Profiler.h"
+
+// SSE2 is part of every x64 target, the other targets use the scalar loops
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENGINE_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define ENGINE_USE_SSE2 0
+#endif
 
 class MovementSystem : public System
 {
@@ -32,7 +49,14 @@ public:
 
 	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
 	{
-		eventBus->SubscribeEvent<CollisionEvent>(this, &MovementSystem::OnEntityCollide);
+		eventBus->SubscribeEventBatch<&MovementSystem::OnEntitiesCollide>(this);
+	}
+
+	// only the first frame of a contact flips the enemy, a lasting overlap would flip it back and forth
+	void OnEntitiesCollide(EventSpan<CollisionEnterEvent>& events) noexcept
+	{
+		for (auto& event : events)
+			OnEntityCollide(event);
 	}
 
 	void OnEntityCollide(CollisionEvent& event) noexcept
@@ -75,48 +99,55 @@ public:
 	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera, 
 		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
 	{
-		//TODO:
-		//loop all entities with the system is interested in
-		for (auto& entity : GetSystemEntities())
+		auto& entities = GetSystemEntities();
+		const size_t count = entities.size();
+
+		// gather the positions and velocities into SoA arrays, the integration and the map test then run 4 entities at a time
+		m_positionsX.resize(count);
+		m_positionsY.resize(count);
+		m_velocitiesX.resize(count);
+		m_velocitiesY.resize(count);
+		m_transforms.resize(count);
+		m_clampedEntities.clear();
+		for (size_t i = 0; i < count; ++i)
 		{
-			// Update entity position based on its velocity
-			auto& transform = entity.GetComponent<TransformComponent>();
-			auto& sprite = entity.GetComponent<SpriteComponent>();
-			const auto rigidbody = entity.GetComponent<RigidbodyComponent>();
-
-			transform.m_position.x += rigidbody.m_velocity.x * deltaTime;
-			transform.m_position.y += rigidbody.m_velocity.y * deltaTime;
-			
-			// constraint the position of the entity to the map limits
-			if (entity.HasTag("player"))
-			{
-				constexpr int paddingLeft = 10;
-				constexpr int paddingTop = 10;
-				constexpr int paddingRight = 50;
-				constexpr int paddingBottom = 50;
-				transform.m_position.x = transform.m_position.x < paddingLeft ? paddingLeft : transform.m_position.x;
-				transform.m_position.x = transform.m_position.x > Game::mapWidth - paddingRight ? Game::mapWidth - paddingRight : transform.m_position.x;
-				transform.m_position.y = transform.m_position.y < paddingTop ? paddingTop : transform.m_position.y;
-				transform.m_position.y = transform.m_position.y > Game::mapHeight - paddingBottom ? Game::mapHeight - paddingBottom : transform.m_position.y;
-			}
+			// the pools do not change during the update, the pointers stay valid until the scatter
+			auto& transform = entities[i].GetComponent<TransformComponent>();
+			const auto& rigidbody = entities[i].GetComponent<RigidbodyComponent>();
+			m_positionsX[i] = transform.m_position.x;
+			m_positionsY[i] = transform.m_position.y;
+			m_velocitiesX[i] = rigidbody.m_velocity.x;
+			m_velocitiesY[i] = rigidbody.m_velocity.y;
+			m_transforms[i] = &transform;
+			if (entities[i].HasComponent<MapClampComponent>())
+				m_clampedEntities.push_back(static_cast<uint32_t>(i));
+		}
 
-			// check fi entity is outside the map limits with 100 pixels of margin
-			constexpr int margin = 100;
+		Integrate(m_positionsX.data(), m_velocitiesX.data(), count, deltaTime);
+		Integrate(m_positionsY.data(), m_velocitiesY.data(), count, deltaTime);
 
-			bool isEntityOustideMap =
-				(
-					transform.m_position.x < -margin ||
-					transform.m_position.x > Game::mapWidth + margin ||
-					transform.m_position.y < -margin ||
-					transform.m_position.y > Game::mapHeight + margin
-				);
+		// constraint the position of the clamped entities (the player) to the map limits, they never leave the map
+		for (const uint32_t i : m_clampedEntities)
+		{
+			const auto& clamp = entities[i].GetComponent<MapClampComponent>();
+			m_positionsX[i] = std::min(std::max(m_positionsX[i], static_cast<float>(clamp.m_paddingLeft)), static_cast<float>(Game::mapWidth - clamp.m_paddingRight));
+			m_positionsY[i] = std::min(std::max(m_positionsY[i], static_cast<float>(clamp.m_paddingTop)), static_cast<float>(Game::mapHeight - clamp.m_paddingBottom));
+		}
 
-			// kill entities that are outside the map limits
-			if (!entity.HasTag("player") && isEntityOustideMap)
-			{
-				entity.Destroy();
-			}
+		for (size_t i = 0; i < count; ++i)
+		{
+			m_transforms[i]->m_position.x = m_positionsX[i];
+			m_transforms[i]->m_position.y = m_positionsY[i];
+		}
 
+		// kill entities that are outside the map limits with 100 pixels of margin,
+		// the player is never killed, even in a level where it has no map clamp
+		constexpr float margin = 100.0f;
+		FindOutsideMap(-margin, -margin, Game::mapWidth + margin, Game::mapHeight + margin);
+		for (const uint32_t i : m_entitiesOutsideMap)
+		{
+			if (!entities[i].HasTag("player"))
+				entities[i].Destroy();
 		}
 	}
 
@@ -125,6 +156,77 @@ public:
 
 	};
 
+	/// <summary>
+	/// positions[i] += velocities[i] * deltaTime, with SSE2 when available
+	/// </summary>
+	static void Integrate(float* positions, const float* velocities, size_t count, float deltaTime) noexcept
+	{
+		size_t i = 0;
+#if ENGINE_USE_SSE2
+		const __m128 delta = _mm_set1_ps(deltaTime);
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 position = _mm_loadu_ps(positions + i);
+			const __m128 velocity = _mm_loadu_ps(velocities + i);
+			_mm_storeu_ps(positions + i, _mm_add_ps(position, _mm_mul_ps(velocity, delta)));
+		}
+#endif
+		for (; i < count; ++i)
+			positions[i] += velocities[i] * deltaTime;
+	}
+
+	inline const std::vector<uint32_t>& GetEntitiesOutsideMap() const noexcept { return m_entitiesOutsideMap; }
+
+private:
+
+	/// <summary>
+	/// Fills m_entitiesOutsideMap with the indices of the positions outside [minX, maxX] x [minY, maxY]
+	/// </summary>
+	void FindOutsideMap(float minX, float minY, float maxX, float maxY) noexcept
+	{
+		m_entitiesOutsideMap.clear();
+		const size_t count = m_positionsX.size();
+		size_t i = 0;
+#if ENGINE_USE_SSE2
+		const __m128 lowX = _mm_set1_ps(minX);
+		const __m128 lowY = _mm_set1_ps(minY);
+		const __m128 highX = _mm_set1_ps(maxX);
+		const __m128 highY = _mm_set1_ps(maxY);
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 x = _mm_loadu_ps(m_positionsX.data() + i);
+			const __m128 y = _mm_loadu_ps(m_positionsY.data() + i);
+			const __m128 outside = _mm_or_ps(
+				_mm_or_ps(_mm_cmplt_ps(x, lowX), _mm_cmpgt_ps(x, highX)),
+				_mm_or_ps(_mm_cmplt_ps(y, lowY), _mm_cmpgt_ps(y, highY)));
+
+			// one bit per lane, almost always 0
+			const int mask = _mm_movemask_ps(outside);
+			if (mask == 0) continue;
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				if (mask & (1 << lane))
+					m_entitiesOutsideMap.push_back(static_cast<uint32_t>(i + lane));
+			}
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			if (m_positionsX[i] < minX || m_positionsX[i] > maxX || m_positionsY[i] < minY || m_positionsY[i] > maxY)
+				m_entitiesOutsideMap.push_back(static_cast<uint32_t>(i));
+		}
+	}
+
+	// SoA copies of the entities data, same order as the system entities (kept to reuse the allocations)
+	std::vector<float> m_positionsX;
+	std::vector<float> m_positionsY;
+	std::vector<float> m_velocitiesX;
+	std::vector<float> m_velocitiesY;
+	std::vector<TransformComponent*> m_transforms;
+	// indices of the entities with a MapClampComponent
+	std::vector<uint32_t> m_clampedEntities;
+	// indices of the entities to destroy
+	std::vector<uint32_t> m_entitiesOutsideMap;
 };
 
 class RenderSystem : public System
@@ -178,15 +280,18 @@ public:
 			RenderaableEntitesCopy.emplace_back(entity);
 		}*/
 
-		std::sort(RenderableEntities.begin(), RenderableEntities.end(), [](const Entity& entity1, const Entity& entity2)
-			{
-				return entity1.GetComponent<SpriteComponent>().m_zIndex < entity2.GetComponent<SpriteComponent>().m_zIndex;
-			});
+		SortByZIndex(RenderableEntities);
 
 		for (const auto& entity : RenderableEntities)
 		{
 			const auto& tranform = entity.GetComponent<TransformComponent>();
-			const auto sprite = entity.GetComponent<SpriteComponent>();
+			const auto& sprite = entity.GetComponent<SpriteComponent>();
+
+			if (entity.HasComponent<TilemapComponent>())
+			{
+				RenderTilemap(renderer, assetStore->GetTexture(sprite.assetId), entity.GetComponent<TilemapComponent>(), tranform, sprite, camera);
+				continue;
+			}
 
 			// Set the source rectangle of our original texture
 			SDL_Rect srcRect = sprite.m_srcRect;
@@ -213,6 +318,48 @@ public:
 			);
 		}
 	}
+
+	// draws the tiles under the camera only, the source rectangle of a tile comes from its index in the tileset
+	static void RenderTilemap(SDL_Renderer* renderer, SDL_Texture* texture, const TilemapComponent& tilemap,
+							  const TransformComponent& transform, const SpriteComponent& sprite, const SDL_Rect& camera) noexcept
+	{
+		const float tileWidth = sprite.m_width * transform.m_scale.x;
+		const float tileHeight = sprite.m_height * transform.m_scale.y;
+		if (tileWidth <= 0.0f || tileHeight <= 0.0f)
+			return;
+
+		const int firstCol = std::max(0, static_cast<int>(std::floor((camera.x - transform.m_position.x) / tileWidth)));
+		const int lastCol = std::min(tilemap.numCols - 1, static_cast<int>(std::floor((camera.x + camera.w - transform.m_position.x) / tileWidth)));
+		const int firstRow = std::max(0, static_cast<int>(std::floor((camera.y - transform.m_position.y) / tileHeight)));
+		const int lastRow = std::min(tilemap.numRows - 1, static_cast<int>(std::floor((camera.y + camera.h - transform.m_position.y) / tileHeight)));
+
+		for (int row = firstRow; row <= lastRow; ++row)
+		{
+			const uint16_t* tiles = tilemap.tiles.data() + static_cast<size_t>(row) * tilemap.numCols;
+			for (int col = firstCol; col <= lastCol; ++col)
+			{
+				const int index = tiles[col];
+				const SDL_Rect srcRect = { (index % tilemap.tilesetColumns) * sprite.m_width, (index / tilemap.tilesetColumns) * sprite.m_height, sprite.m_width, sprite.m_height };
+				const SDL_Rect dstRect =
+				{
+					static_cast<int>(transform.m_position.x + col * tileWidth) - camera.x,
+					static_cast<int>(transform.m_position.y + row * tileHeight) - camera.y,
+					static_cast<int>(tileWidth),
+					static_cast<int>(tileHeight)
+				};
+				SDL_RenderCopy(renderer, texture, &srcRect, &dstRect);
+			}
+		}
+	}
+
+	// sorts the entities from back to front (exposed for the benchmarks)
+	void SortByZIndex(std::vector<Entity>& entities) const noexcept
+	{
+		std::sort(entities.begin(), entities.end(), [](const Entity& entity1, const Entity& entity2)
+			{
+				return entity1.GetComponent<SpriteComponent>().m_zIndex < entity2.GetComponent<SpriteComponent>().m_zIndex;
+			});
+	}
 };
 
 class AnimationSystem : public System
@@ -233,31 +380,50 @@ public:
 	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera, 
 		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
 	{
+		// the animations advance with the frame time, no clock read per entity
 		for (const auto& entity : GetSystemEntities())
 		{
 			auto& animation = entity.GetComponent<AnimationComponent>();
-			auto& sprite = entity.GetComponent<SpriteComponent>();
 
-			// TODO:
-			// change the current frame
-			// change the src rectangle of the sprite
-			if (animation.shouldLoop)
+			// a transition is one table lookup
+			if (animation.trigger != ANIMATION_TRIGGER_NONE)
 			{
-				animation.currentFrame = ((SDL_GetTicks() - animation.startTime) * animation.frameRateSpeed / 1000) % animation.numFrames;
-				sprite.m_srcRect.x = animation.currentFrame * sprite.m_width;
+				if (animation.stateMachine >= 0)
+					animation.Play(assetStore->GetAnimationTransition(animation.stateMachine, animation.trigger));
+				animation.trigger = ANIMATION_TRIGGER_NONE;
 			}
-			else
+
+			if (animation.clip < 0)
+				continue;
+
+			const AnimationClip& clip = assetStore->GetAnimationClip(animation.clip);
+			animation.frameTimer += deltaTime;
+
+			// a long frame can skip several animation frames, a duration of 0 holds the frame
+			float frameDuration = assetStore->GetAnimationFrameDuration(clip.firstFrame + animation.currentFrame);
+			while (frameDuration > 0.0f && animation.frameTimer >= frameDuration)
 			{
-				if (animation.currentFrame < animation.numFrames)
+				if (!clip.shouldLoop && animation.currentFrame == clip.numFrames - 1)
 				{
-					animation.currentFrame = ((SDL_GetTicks() - animation.startTime) * animation.frameRateSpeed / 1000) % animation.numFrames;
-					sprite.m_srcRect.x = animation.currentFrame * sprite.m_width;
-					return;
+					// stays on the last frame
+					animation.frameTimer = 0.0f;
+					break;
 				}
+				animation.frameTimer -= frameDuration;
+				animation.currentFrame = animation.currentFrame + 1 < clip.numFrames ? animation.currentFrame + 1 : 0;
+				frameDuration = assetStore->GetAnimationFrameDuration(clip.firstFrame + animation.currentFrame);
 			}
-			//animation.startTime += deltaTime * animation.frameRateSpeed;
-			//animation.currentFrame = static_cast<int>(animation.startTime) % animation.numFrames;
-			//sprite.m_srcRect.x = animation.currentFrame * sprite.m_width;
+
+			// most frames the animation frame does not change, the sprite is left untouched
+			const int frame = clip.firstFrame + animation.currentFrame;
+			if (frame == animation.displayedFrame)
+				continue;
+
+			auto& sprite = entity.GetComponent<SpriteComponent>();
+			const SDL_Point& source = assetStore->GetAnimationFrame(frame);
+			sprite.m_srcRect.x = source.x;
+			sprite.m_srcRect.y = source.y;
+			animation.displayedFrame = frame;
 		}
 	}
 
@@ -282,52 +448,124 @@ public:
 
 	}
 
+	/// <summary>
+	/// The contacts of a destroyed entity are dropped without exit event, its id may be reused by a new entity
+	/// </summary>
+	/// <param name="entity"></param>
+	void OnEntityRemoved(Entity entity) noexcept override
+	{
+		m_removedEntities.push_back(entity.GetID());
+	}
+
+	// the contacts of the last update decide between enter and stay events
+	void SaveState(BlobWriter& writer) const noexcept override
+	{
+		writer.Write(static_cast<uint32_t>(m_previousContacts.size()));
+		for (const uint64_t contact : m_previousContacts)
+			writer.Write(contact);
+		writer.Write(static_cast<uint32_t>(m_removedEntities.size()));
+		writer.WriteBytes(m_removedEntities.data(), m_removedEntities.size() * sizeof(int));
+	}
+
+	bool LoadState(BlobReader& reader) noexcept override
+	{
+		uint32_t count = 0;
+		if (!reader.Read(count) || count > reader.GetRemainingSize() / sizeof(uint64_t))
+			return false;
+		m_previousContacts.clear();
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint64_t contact = 0;
+			reader.Read(contact);
+			m_previousContacts.insert(contact);
+		}
+
+		if (!reader.Read(count) || count > reader.GetRemainingSize() / sizeof(int))
+			return false;
+		m_removedEntities.resize(count);
+		return reader.ReadBytes(m_removedEntities.data(), m_removedEntities.size() * sizeof(int));
+	}
+
 	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera, 
 		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
 	{
-		auto& entities = GetSystemEntities();
-		// check all entities that have a boxcollider component
-		// to see if they are colliding with each other
-		// Use AABB collision detection
-		
-		// loop all the entities that the system is interested in
-		for (auto i = entities.begin(); i != entities.end(); i++)
+		RemoveContactsOfRemovedEntities();
+
+		const bool sendStayEvents = eventBus->HasSubscribers<CollisionStayEvent>();
+
+		// gather the boxes once per frame instead of once per pair
+		GatherColliders();
+
+		// broadphase: sort and sweep on the x axis, only the boxes whose x intervals overlap are paired
+		std::sort(m_colliders.begin(), m_colliders.end(), [](const ColliderProxy& a, const ColliderProxy& b)
+			{
+				// the entity id breaks the ties so the pair order does not depend on the sort implementation
+				return a.minX < b.minX || (a.minX == b.minX && a.entity.GetID() < b.entity.GetID());
+			});
+
+		for (size_t i = 0; i < m_colliders.size(); ++i)
 		{
-			Entity a = *i;
-			auto& aTransform = a.GetComponent<TransformComponent>();
-			auto& aBoxCollider = a.GetComponent<BoxColliderComponent>();
+			ColliderProxy& a = m_colliders[i];
 
-			// loop all the entities that still need to be checked (to the right of it)
-			for (auto j = i + 1; j != entities.end(); j++)
+			for (size_t j = i + 1; j < m_colliders.size(); ++j)
 			{
-				Entity b = *j;
-
-				// bypass the entity if it is the same as the outer loop entity
-				// if (a == b) continue;
-
-				auto& bTransform = b.GetComponent<TransformComponent>();
-				auto& bBoxCollider = b.GetComponent<BoxColliderComponent>();
-
-				// check for collision between a and b
-				bool isCollided = CheckAABBCollision
-				(
-					aTransform.m_position.x + aBoxCollider.m_offset.x,
-					aTransform.m_position.y + aBoxCollider.m_offset.y,
-					aBoxCollider.m_width,
-					aBoxCollider.m_height,
-					bTransform.m_position.x + bBoxCollider.m_offset.x,
-					bTransform.m_position.y + bBoxCollider.m_offset.y,
-					bBoxCollider.m_width,
-					bBoxCollider.m_height
-				);
-				
+				ColliderProxy& b = m_colliders[j];
+
+				// every following box starts further right, none of them can overlap a
+				if (b.minX >= a.maxX)
+					break;
+
+				// reject the pairs nobody handles before the narrow phase (projectile vs projectile, enemy vs enemy...)
+				if (!a.collider->CanCollideWith(*b.collider))
+					continue;
+
+				if (b.minY >= a.maxY || b.maxY <= a.minY)
+					continue;
+
+				// narrow phase, a fast box is tested along its whole motion since the last update so it can not tunnel
+				const bool isCollided = (a.isContinuous || b.isContinuous) ?
+					CheckSweptAABBCollision(a, b) :
+					CheckAABBCollision(a.x, a.y, a.width, a.height, b.x, b.y, b.width, b.height);
+
 				if (isCollided)
 				{
-					// TODO: emit an event that a collision has occured
-					eventBus->PublishEvent<CollisionEvent>(a, b);		
+					// the events are queued, the handlers receive all the contacts of the frame in one batch at the sync point
+					const uint64_t contact = GetContactKey(a.entity, b.entity);
+					m_contacts.insert(contact);
+					if (m_previousContacts.find(contact) == m_previousContacts.end())
+						eventBus->QueueEvent<CollisionEnterEvent>(a.entity, b.entity);
+					else if (sendStayEvents)
+						eventBus->QueueEvent<CollisionStayEvent>(a.entity, b.entity);
 				}
 			}
 		}
+
+		// the next swept tests start from the positions of this update
+		for (auto& collider : m_colliders)
+		{
+			if (collider.isContinuous)
+			{
+				collider.collider->m_lastPosition = glm::vec2(collider.x, collider.y);
+				collider.collider->m_hasLastPosition = true;
+			}
+		}
+
+		// the contacts of the last frame that are gone
+		for (const uint64_t contact : m_previousContacts)
+		{
+			if (m_contacts.find(contact) != m_contacts.end())
+				continue;
+
+			Entity a(static_cast<int>(contact >> 32));
+			Entity b(static_cast<int>(contact & 0xFFFFFFFF));
+			a.m_registry = registry.get();
+			b.m_registry = registry.get();
+			eventBus->QueueEvent<CollisionExitEvent>(a, b);
+		}
+
+		// clear() keeps the buckets, the sets do not allocate once they reached the usual number of contacts
+		m_previousContacts.swap(m_contacts);
+		m_contacts.clear();
 	}
 
 	void Render(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore, SDL_Rect& camera, std::unique_ptr<Registry>& registry, bool isDebugMode) noexcept override
@@ -346,6 +584,109 @@ public:
 		};
 	}
 
+private:
+
+	// box of a collider for the current update
+	struct ColliderProxy
+	{
+		Entity entity;
+		BoxColliderComponent* collider;
+		float x, y, width, height; // current box
+		float lastX, lastY; // box position at the last update (same as x, y for the colliders that are not continuous)
+		float minX, maxX, minY, maxY; // broadphase bounds (the whole motion for the continuous colliders)
+		bool isContinuous;
+	};
+
+	void GatherColliders() noexcept
+	{
+		m_colliders.clear();
+		for (auto& entity : GetSystemEntities())
+		{
+			const auto& transform = entity.GetComponent<TransformComponent>();
+			auto& boxCollider = entity.GetComponent<BoxColliderComponent>();
+
+			ColliderProxy proxy{ entity, &boxCollider };
+			proxy.x = transform.m_position.x + boxCollider.m_offset.x;
+			proxy.y = transform.m_position.y + boxCollider.m_offset.y;
+			proxy.width = static_cast<float>(boxCollider.m_width);
+			proxy.height = static_cast<float>(boxCollider.m_height);
+			proxy.isContinuous = boxCollider.m_isContinuous;
+			// a new continuous collider has no motion yet
+			const bool hasMotion = boxCollider.m_isContinuous && boxCollider.m_hasLastPosition;
+			proxy.lastX = hasMotion ? boxCollider.m_lastPosition.x : proxy.x;
+			proxy.lastY = hasMotion ? boxCollider.m_lastPosition.y : proxy.y;
+			proxy.minX = std::min(proxy.x, proxy.lastX);
+			proxy.maxX = std::max(proxy.x, proxy.lastX) + proxy.width;
+			proxy.minY = std::min(proxy.y, proxy.lastY);
+			proxy.maxY = std::max(proxy.y, proxy.lastY) + proxy.height;
+
+			m_colliders.push_back(proxy);
+		}
+	}
+
+	// swept AABB: slab test of the motion of a relative to b (since the last update) against b grown by the size of a,
+	// true if the boxes overlap at any time of the motion
+	static bool CheckSweptAABBCollision(const ColliderProxy& a, const ColliderProxy& b) noexcept
+	{
+		const float startX = a.lastX - b.lastX;
+		const float startY = a.lastY - b.lastY;
+		const float motionX = (a.x - a.lastX) - (b.x - b.lastX);
+		const float motionY = (a.y - a.lastY) - (b.y - b.lastY);
+
+		float entryTime = 0.0f;
+		float exitTime = 1.0f;
+		if (!ClipSweptAxis(startX, motionX, -a.width, b.width, entryTime, exitTime)) return false;
+		if (!ClipSweptAxis(startY, motionY, -a.height, b.height, entryTime, exitTime)) return false;
+		return entryTime < exitTime;
+	}
+
+	// narrows [entryTime, exitTime] to the times where start + motion * t is strictly inside (low, high)
+	static bool ClipSweptAxis(float start, float motion, float low, float high, float& entryTime, float& exitTime) noexcept
+	{
+		if (motion == 0.0f)
+			return start > low && start < high;
+
+		float t1 = (low - start) / motion;
+		float t2 = (high - start) / motion;
+		if (t1 > t2) std::swap(t1, t2);
+		entryTime = std::max(entryTime, t1);
+		exitTime = std::min(exitTime, t2);
+		return entryTime < exitTime;
+	}
+
+	// sorted entity ids of a pair, the same pair always gives the same key
+	static uint64_t GetContactKey(const Entity& a, const Entity& b) noexcept
+	{
+		const uint32_t low = static_cast<uint32_t>(std::min(a.GetID(), b.GetID()));
+		const uint32_t high = static_cast<uint32_t>(std::max(a.GetID(), b.GetID()));
+		return (static_cast<uint64_t>(low) << 32) | high;
+	}
+
+	void RemoveContactsOfRemovedEntities() noexcept
+	{
+		if (m_removedEntities.empty()) return;
+
+		std::sort(m_removedEntities.begin(), m_removedEntities.end());
+		for (auto contact = m_previousContacts.begin(); contact != m_previousContacts.end();)
+		{
+			const int idA = static_cast<int>(*contact >> 32);
+			const int idB = static_cast<int>(*contact & 0xFFFFFFFF);
+			if (std::binary_search(m_removedEntities.begin(), m_removedEntities.end(), idA) ||
+				std::binary_search(m_removedEntities.begin(), m_removedEntities.end(), idB))
+				contact = m_previousContacts.erase(contact);
+			else
+				++contact;
+		}
+		m_removedEntities.clear();
+	}
+
+	// pairs overlapping in this frame and in the last frame
+	std::unordered_set<uint64_t> m_contacts;
+	std::unordered_set<uint64_t> m_previousContacts;
+	// entities removed from the system since the last update
+	std::vector<int> m_removedEntities;
+	// colliders of the current update, kept to reuse the allocation
+	std::vector<ColliderProxy> m_colliders;
 };
 
 class RenderColliderSystem : public System
@@ -408,7 +749,18 @@ public:
 
 	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
 	{
-		eventBus->SubscribeEvent<CollisionEvent>(this, &DamageSystem::OnCollision);
+		eventBus->SubscribeEventBatch<&DamageSystem::OnCollisions>(this);
+	}
+
+	/// <summary>
+	/// Gets executed at the sync point with all the new contacts of the frame
+	/// (a projectile overlapping a target for several frames only hits once)
+	/// </summary>
+	/// <param name="events"></param>
+	void OnCollisions(EventSpan<CollisionEnterEvent>& events) noexcept
+	{
+		for (auto& event : events)
+			OnCollision(event);
 	}
 
 	/// <summary>
@@ -507,7 +859,7 @@ public:
 
 	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
 	{
-		eventBus->SubscribeEvent<KeyPressedEvent>(this, &KeyboardControlSystem::OnKeyPressed);
+		eventBus->SubscribeEvent<&KeyboardControlSystem::OnKeyPressed>(this);
 		Logger::Log("Key pressed event received. Key code: ");
 	}
 
@@ -521,34 +873,49 @@ public:
 		for (const auto& entity : GetSystemEntities())
 		{
 			const auto& keyboardControlled = entity.GetComponent<KeyboardControlledComponent>();
-			auto& sprite = entity.GetComponent<SpriteComponent>();
 			auto& rigidbody = entity.GetComponent<RigidbodyComponent>();
 			
+			AnimationTrigger trigger = ANIMATION_TRIGGER_NONE;
 			switch (e.m_keyCode)
 			{
 				case SDLK_w:
 				case SDLK_UP:
 					rigidbody.m_velocity = keyboardControlled.m_upVelocity;
-					sprite.m_srcRect.y = sprite.m_height * 0;
+					trigger = ANIMATION_TRIGGER_UP;
 					break;
 				case SDLK_d:
 				case SDLK_RIGHT:
 					rigidbody.m_velocity = keyboardControlled.m_rightVelocity;
-					sprite.m_srcRect.y = sprite.m_height * 1;
+					trigger = ANIMATION_TRIGGER_RIGHT;
 					break;
 				case SDLK_s:
 				case SDLK_DOWN:
 					rigidbody.m_velocity = keyboardControlled.m_downVelocity;
-					sprite.m_srcRect.y = sprite.m_height * 2;
+					trigger = ANIMATION_TRIGGER_DOWN;
 					break;
 				case SDLK_a:
 				case SDLK_LEFT:
 					rigidbody.m_velocity = keyboardControlled.m_leftVelocity;
-					sprite.m_srcRect.y = sprite.m_height * 3;
+					trigger = ANIMATION_TRIGGER_LEFT;
 					break;
 				default: 
 					break;
 			}
+
+			if (trigger == ANIMATION_TRIGGER_NONE)
+				continue;
+
+			// the animation state machine of the entity picks the clip of the direction,
+			// without one the sprite sheet row of the direction is shown (up, right, down, left)
+			if (entity.HasComponent<AnimationComponent>() && entity.GetComponent<AnimationComponent>().stateMachine >= 0)
+			{
+				entity.GetComponent<AnimationComponent>().trigger = trigger;
+			}
+			else
+			{
+				auto& sprite = entity.GetComponent<SpriteComponent>();
+				sprite.m_srcRect.y = sprite.m_height * trigger;
+			}
 		}
 
 	}
@@ -622,7 +989,7 @@ public:
 
 	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
 	{
-		eventBus->SubscribeEvent<KeyPressedEvent>(this, &ProjectileEmitSystem::OnShootProjectile);
+		eventBus->SubscribeEvent<&ProjectileEmitSystem::OnShootProjectile>(this);
 	}
 
 	void OnShootProjectile(KeyPressedEvent& event) noexcept
@@ -637,7 +1004,7 @@ public:
 					auto& projectileEmitter = entity.GetComponent<ProjectileEmitterComponent>();
 					const auto& transform = entity.GetComponent<TransformComponent>();
 
-					if (projectileEmitter.m_isManual && SDL_GetTicks() - projectileEmitter.m_lastEmissionTime > projectileEmitter.m_repeatFrequency)
+					if (projectileEmitter.m_isManual && Clock::GetTicks() - projectileEmitter.m_lastEmissionTime > projectileEmitter.m_repeatFrequency)
 					{
 						Logger::Log("Shoot projectile event received.");
 
@@ -660,7 +1027,7 @@ public:
 			if (projectileEmitter.m_isManual) continue;
 
 			// TODO: check if its time to re-emit a new projectile
-			if (SDL_GetTicks() - projectileEmitter.m_lastEmissionTime > projectileEmitter.m_repeatFrequency)
+			if (Clock::GetTicks() - projectileEmitter.m_lastEmissionTime > projectileEmitter.m_repeatFrequency)
 			{
 				CreateProjectileHelper(entity, projectileEmitter, transform, false);
 			}
@@ -704,13 +1071,13 @@ public:
 		projectile.AddComponent<TransformComponent>(projectilePosition, glm::vec2(1.0, 1.0), 0.0f);
 		projectile.AddComponent<RigidbodyComponent>(projectileVelocity);
 		projectile.AddComponent<SpriteComponent>("bullet-image", 4, 4, 4);
-		projectile.AddComponent<BoxColliderComponent>(4, 4);
+		projectile.AddComponent<BoxColliderComponent>(4, 4, glm::vec2(0), false, COLLISION_LAYER_PROJECTILE, COLLISION_LAYER_NONE, true);
 		projectile.AddComponent<ProjectileComponent>(projectileEmitter.m_isFriendly,
 													 projectileEmitter.m_hitPercentDamage,
 													 projectileEmitter.m_projectileDuraiton);
 
 		// update the projectile emitter component last emission to the current milisecond time
-		projectileEmitter.m_lastEmissionTime = SDL_GetTicks();
+		projectileEmitter.m_lastEmissionTime = Clock::GetTicks();
 	}
 
 };
@@ -737,7 +1104,7 @@ public:
 			auto& projectile = entity.GetComponent<ProjectileComponent>();
 
 			// TODO: Kill projectile after they reach their duration limit
-			if (SDL_GetTicks() - projectile.m_startTime >= projectile.m_duration)
+			if (Clock::GetTicks() - projectile.m_startTime >= projectile.m_duration)
 			{
 				entity.Destroy();
 			}
@@ -905,12 +1272,31 @@ public:
 
 	}
 
+	/// <summary>
+	/// Creates the enemies requested from the GUI since the last update. The registry only changes during the update,
+	/// so the snapshots captured after it (rollback, replication) see the new enemies
+	/// </summary>
 	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera,
 		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
 	{
-
+		m_spawnedCount = m_pendingSpawns.size();
+		for (const EnemySpawn& spawn : m_pendingSpawns)
+		{
+			Entity enemy = registry->CreateEntity();
+			enemy.Group("enemies");
+			enemy.AddComponent<TransformComponent>(spawn.position, spawn.scale, spawn.rotation);
+			enemy.AddComponent<RigidbodyComponent>(spawn.velocity);
+			enemy.AddComponent<SpriteComponent>(spawn.spriteId, IMAGE_SIZE_WIDTH, IMAGE_SIZE_HEIGHT, 2);
+			enemy.AddComponent<BoxColliderComponent>(25, 20, glm::vec2(5, 5), false, COLLISION_LAYER_ENEMY);
+			enemy.AddComponent<ProjectileEmitterComponent>(spawn.projectileVelocity, spawn.projectileRepeat, spawn.projectileDuration, 10, false, false);
+			enemy.AddComponent<HealthComponent>(spawn.health, spawn.health);
+		}
+		m_pendingSpawns.clear();
 	}
 
+	// enemies created by the last update, the game does not roll back past them
+	inline size_t GetSpawnedCount() const noexcept { return m_spawnedCount; }
+
 	void Render(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore, SDL_Rect& camera, std::unique_ptr<Registry>& registry, bool isDebugMode) noexcept override
 	{
 		if (!isDebugMode) return;
@@ -981,18 +1367,21 @@ public:
 			
 			if (ImGui::Button("Spawn New Enemy"))
 			{
-				Entity enemy = registry->CreateEntity();
-				enemy.Group("enemies");
-				enemy.AddComponent<TransformComponent>(glm::vec2(enemyXPos, enemyYPos), glm::vec2(enemyScaleX, enemyScaleY), glm::degrees(enemyRotation));
-				enemy.AddComponent<RigidbodyComponent>(glm::vec2(enemyXVel, enemyYVel));
-				enemy.AddComponent<SpriteComponent>(sprites[selectedSpriteIndex], IMAGE_SIZE_WIDTH, IMAGE_SIZE_HEIGHT, 2);
-				enemy.AddComponent<BoxColliderComponent>(25, 20, glm::vec2(5, 5));
-				
 				double projVelX = cos(enemyProjAngle) * enemyProjSpeed; // convert angle to radians
 				double projVelY = sin(enemyProjAngle) * enemyProjSpeed; // convert angle to radians
-				
-				enemy.AddComponent<ProjectileEmitterComponent>(glm::vec2(projVelX, projVelY), enemyProjRepeat * 1000, enemyProjDuration * 1000, 10, false, false);
-				enemy.AddComponent<HealthComponent>(enemyHealth, enemyHealth);
+
+				// the enemy is created by the next update, the registry is not changed while rendering
+				EnemySpawn spawn;
+				spawn.spriteId = sprites[selectedSpriteIndex];
+				spawn.position = glm::vec2(enemyXPos, enemyYPos);
+				spawn.scale = glm::vec2(enemyScaleX, enemyScaleY);
+				spawn.rotation = glm::degrees(enemyRotation);
+				spawn.velocity = glm::vec2(enemyXVel, enemyYVel);
+				spawn.projectileVelocity = glm::vec2(projVelX, projVelY);
+				spawn.projectileRepeat = enemyProjRepeat * 1000;
+				spawn.projectileDuration = enemyProjDuration * 1000;
+				spawn.health = enemyHealth;
+				m_pendingSpawns.push_back(spawn);
 			
 				// reset all input values after we create a new enemy
 				enemyXPos = enemyYPos = enemyRotation = enemyProjAngle = 0;
@@ -1014,9 +1403,120 @@ public:
 		}
 		ImGui::End();
 
+		RenderProfilerWindow();
+
 		ImGui::Render();
 		ImGuiSDL::Render(ImGui::GetDrawData());
 	}
+
+	/// <summary>
+	/// Draws a flame-style timeline of the last completed frame and the rolling
+	/// average/percentiles of every profiled scope over the last frames
+	/// </summary>
+	void RenderProfilerWindow() noexcept
+	{
+		constexpr size_t statsFrameCount = 120;
+		constexpr float rowHeight = 18.0f;
+
+		const ProfileFrame* frame = Profiler::GetCompletedFrame(1);
+		if (!frame) return;
+
+		ImGui::SetNextWindowSize(ImVec2(560, 420), ImGuiCond_FirstUseEver);
+		if (ImGui::Begin("Profiler"))
+		{
+			const double frameMs = (frame->endNs - frame->startNs) / 1000000.0;
+			ImGui::Text("Frame %llu: %.3f ms (%.1f fps)", static_cast<unsigned long long>(frame->frameIndex), frameMs, frameMs > 0.0 ? 1000.0 / frameMs : 0.0);
+			if (frame->droppedSamples > 0)
+				ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.0f, 1.0f), "%u samples dropped", frame->droppedSamples);
+
+			// timeline of the last frame, one row per nesting level
+			uint16_t maxDepth = 0;
+			const uint32_t sampleCount = frame->GetSampleCount();
+			for (uint32_t i = 0; i < sampleCount; ++i)
+				maxDepth = std::max(maxDepth, frame->samples[i].depth);
+
+			const ImVec2 origin = ImGui::GetCursorScreenPos();
+			const float width = std::max(ImGui::GetContentRegionAvail().x, 100.0f);
+			const float height = (maxDepth + 1) * rowHeight;
+			const double frameNs = static_cast<double>(std::max<uint64_t>(frame->endNs - frame->startNs, 1));
+			ImDrawList* drawList = ImGui::GetWindowDrawList();
+
+			for (uint32_t i = 0; i < sampleCount; ++i)
+			{
+				const ProfileSample& sample = frame->samples[i];
+				const float x0 = origin.x + static_cast<float>((sample.startNs - frame->startNs) / frameNs) * width;
+				const float x1 = origin.x + static_cast<float>((sample.endNs - frame->startNs) / frameNs) * width;
+				const float y0 = origin.y + sample.depth * rowHeight;
+				const ImVec2 rectMin(x0, y0);
+				const ImVec2 rectMax(std::max(x1, x0 + 1.0f), y0 + rowHeight - 1.0f);
+
+				// stable color per scope name (FNV-1a hash of the name)
+				ImU32 hash = 2166136261u;
+				for (const char* c = sample.name; *c; ++c)
+					hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+				const ImU32 color = IM_COL32(80 + (hash & 0x7F), 80 + ((hash >> 8) & 0x7F), 80 + ((hash >> 16) & 0x7F), 255);
+				drawList->AddRectFilled(rectMin, rectMax, color);
+
+				if (rectMax.x - rectMin.x > 40.0f)
+				{
+					drawList->PushClipRect(rectMin, rectMax, true);
+					drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32(0, 0, 0, 255), sample.name);
+					drawList->PopClipRect();
+				}
+
+				if (ImGui::IsMouseHoveringRect(rectMin, rectMax))
+					ImGui::SetTooltip("%s: %.3f ms", sample.name, (sample.endNs - sample.startNs) / 1000000.0);
+			}
+			ImGui::Dummy(ImVec2(width, height));
+
+			ImGui::Separator();
+
+			// rolling statistics
+			Profiler::CollectStats(statsFrameCount, m_profileStats);
+
+			ImGui::Columns(6, "profilerStats");
+			ImGui::Text("scope"); ImGui::NextColumn();
+			ImGui::Text("avg ms"); ImGui::NextColumn();
+			ImGui::Text("p50"); ImGui::NextColumn();
+			ImGui::Text("p95"); ImGui::NextColumn();
+			ImGui::Text("p99"); ImGui::NextColumn();
+			ImGui::Text("max"); ImGui::NextColumn();
+			ImGui::Separator();
+			for (const auto& stats : m_profileStats)
+			{
+				ImGui::Text("%s", stats.name); ImGui::NextColumn();
+				ImGui::Text("%.3f", stats.average); ImGui::NextColumn();
+				ImGui::Text("%.3f", stats.p50); ImGui::NextColumn();
+				ImGui::Text("%.3f", stats.p95); ImGui::NextColumn();
+				ImGui::Text("%.3f", stats.p99); ImGui::NextColumn();
+				ImGui::Text("%.3f", stats.max); ImGui::NextColumn();
+			}
+			ImGui::Columns(1);
+		}
+		ImGui::End();
+	}
+
+private:
+
+	// an enemy requested with the "Spawn New Enemy" button
+	struct EnemySpawn
+	{
+		std::string spriteId;
+		glm::vec2 position;
+		glm::vec2 scale;
+		double rotation;
+		glm::vec2 velocity;
+		glm::vec2 projectileVelocity;
+		int projectileRepeat;
+		int projectileDuration;
+		int health;
+	};
+
+	std::vector<EnemySpawn> m_pendingSpawns;
+	size_t m_spawnedCount = 0;
+
+	// reused between frames to avoid allocating the statistics every frame
+	std::vector<ProfileStats> m_profileStats;
 };
 
 //////////////////////////////// LUA SCRIPTING SYSTEM //////////////////////////////////////
@@ -1095,6 +1595,25 @@ public:
 //	}
 //}
 
+// Components of one entity of a script batch, the batch array is handed to Lua as light userdata.
+// A missing component points to a scratch component, so the native bindings never check
+struct ScriptEntityView
+{
+	int entityId;
+	TransformComponent* transform;
+	RigidbodyComponent* rigidbody;
+};
+
+#ifdef ENGINE_USE_LUAJIT
+// the FFI declarations of ScriptSystem::CreateLuaBindings mirror these layouts
+static_assert(sizeof(glm::vec2) == 2 * sizeof(float), "FFI engine_vec2 layout");
+static_assert(offsetof(TransformComponent, m_position) == 0 && offsetof(TransformComponent, m_scale) == 8 &&
+	offsetof(TransformComponent, m_rotation) == 16, "FFI TransformComponent layout");
+static_assert(offsetof(RigidbodyComponent, m_velocity) == 0, "FFI RigidbodyComponent layout");
+static_assert(offsetof(ScriptEntityView, transform) == sizeof(void*) && offsetof(ScriptEntityView, rigidbody) == 2 * sizeof(void*),
+	"FFI ScriptEntityView layout");
+#endif
+
 class ScriptSystem : public System
 {
 public:
@@ -1104,19 +1623,216 @@ public:
 		RequireComponent<ScriptComponent>();
 	}
 
+	~ScriptSystem() noexcept
+	{
+		StopShards();
+	}
+
+	/// <summary>
+	/// Shards the batch script entities across shardCount independent Lua states, each one running on its own worker thread.
+	/// Every state loads the level script and gets the same bindings, the batch functions are looked up by name in its
+	/// Level.batch_scripts. The shards write to buffered copies of the components, the changes are applied on the main
+	/// thread at the end of the update. The per-entity scripts stay on the main Lua state (and run while the shards work).
+	/// </summary>
+	/// <param name="shardCount">0 runs the batches on the main Lua state</param>
+	/// <param name="levelScriptPath"></param>
+	/// <param name="seed">seed of the random generator of the shard states (shard i uses seed + i)</param>
+	void CreateShards(unsigned int shardCount, const std::string& levelScriptPath, unsigned int seed) noexcept
+	{
+		StopShards();
+		m_shardScriptPath = levelScriptPath;
+
+		for (unsigned int i = 0; i < shardCount; ++i)
+		{
+			auto shard = std::make_unique<ScriptShard>();
+			shard->generation = m_shardGeneration;
+			shard->lua.open_libraries(sol::lib::base, sol::lib::math, sol::lib::os, sol::lib::coroutine);
+			shard->lua["math"]["randomseed"](seed + i);
+			CreateLuaBindings(shard->lua);
+
+			const sol::protected_function_result result = shard->lua.safe_script_file(levelScriptPath, sol::script_pass_on_error);
+			if (!result.valid())
+			{
+				const sol::error error = result;
+				Logger::Error("Error loading the level script in a script shard: " + std::string(error.what()));
+				StopShards();
+				return;
+			}
+			m_shards.push_back(std::move(shard));
+		}
+
+		// the workers start once all the states exist
+		m_isStopping = false;
+		for (auto& shard : m_shards)
+		{
+			ScriptShard* worker = shard.get();
+			shard->thread = std::thread([this, worker] { RunShardWorker(*worker); });
+		}
+		Logger::Log("Script batches sharded across " + std::to_string(m_shards.size()) + " Lua states");
+	}
+
+	inline size_t GetShardCount() const noexcept { return m_shards.size(); }
+
 	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
 	{
 
 	}
 
+	/// <summary>
+	/// Registers a batch script, called once per frame with all the entities using it:
+	/// function(entities, count, delta_time, elapsed_time), entities being the light userdata read by the batch_* bindings
+	/// </summary>
+	/// <param name="name"></param>
+	/// <param name="func"></param>
+	/// <returns>index of the batch, the same name always gives the same batch</returns>
+	int AddScriptBatch(const std::string& name, sol::protected_function func) noexcept
+	{
+		for (size_t i = 0; i < m_batches.size(); ++i)
+		{
+			if (m_batches[i].name == name)
+				return static_cast<int>(i);
+		}
+		m_batches.push_back({ name, std::move(func), {} });
+		return static_cast<int>(m_batches.size() - 1);
+	}
+
+	/// <summary>
+	/// Rebinds a batch script to the function of a reloaded level script, the shards reload their own copy with ReloadShards
+	/// </summary>
+	/// <returns>true if the function changed</returns>
+	bool ReloadScriptBatch(const std::string& name, sol::protected_function func) noexcept
+	{
+		for (auto& batch : m_batches)
+		{
+			if (batch.name == name && !IsSameScript(batch.func, func))
+			{
+				batch.func = std::move(func);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Runs the level script again in every shard state, between two updates (the workers are waiting)
+	/// </summary>
+	void ReloadShards() noexcept
+	{
+		for (auto& shard : m_shards)
+		{
+			const sol::protected_function_result result = shard->lua.safe_script_file(m_shardScriptPath, sol::script_pass_on_error);
+			if (!result.valid())
+			{
+				const sol::error error = result;
+				Logger::Error("Error reloading the level script in a script shard: " + std::string(error.what()));
+				continue;
+			}
+			shard->batchFunctions.clear();
+		}
+	}
+
+	/// <summary>
+	/// Compares the bytecode of two Lua functions, so reloading a script only rebinds the functions whose code changed.
+	/// Moving a function to other lines changes its debug information, it counts as a change.
+	/// </summary>
+	static bool IsSameScript(const sol::protected_function& first, const sol::protected_function& second) noexcept
+	{
+		const std::string firstBytecode = DumpLuaFunction(first);
+		return !firstBytecode.empty() && firstBytecode == DumpLuaFunction(second);
+	}
+
+	/// <summary>
+	/// Time the per-entity scripts can use per frame (0 = no budget). The scripts left when it is spent run on the next frames
+	/// and the coroutine scripts are suspended in the middle by an instruction count hook (Lua 5.3 only)
+	/// </summary>
+	inline void SetFrameBudget(float milliseconds) noexcept { m_frameBudgetMs = milliseconds; }
+	inline float GetFrameBudget() const noexcept { return m_frameBudgetMs; }
+
+	// the tick decides which interval scripts run, the cursor which scripts run first under a frame budget
+	void SaveState(BlobWriter& writer) const noexcept override
+	{
+		writer.Write(static_cast<int32_t>(m_tick));
+		writer.Write(static_cast<uint64_t>(m_nextScript));
+	}
+
+	bool LoadState(BlobReader& reader) noexcept override
+	{
+		int32_t tick = 0;
+		uint64_t nextScript = 0;
+		if (!reader.Read(tick) || !reader.Read(nextScript))
+			return false;
+		m_tick = tick;
+		m_nextScript = static_cast<size_t>(nextScript);
+		return true;
+	}
+
 	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera,
 		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
 	{
-		// loop all entities that have a script component and invoke their lua function
-		for (auto& entity : GetSystemEntities())
+		++m_tick;
+		auto& entities = GetSystemEntities();
+
+		if (m_shards.empty())
 		{
-			const auto& script = entity.GetComponent<ScriptComponent>();
-			script.func(/*entity, deltaTime, elapsedTime*/); // here is where we invoke the lua function
+			for (auto& batch : m_batches)
+				batch.views.clear();
+			for (auto& entity : entities)
+			{
+				const auto& script = entity.GetComponent<ScriptComponent>();
+				if (script.batch >= 0)
+					m_batches[script.batch].views.push_back(CreateEntityView(entity));
+			}
+		}
+		else
+		{
+			// the shards work while the main thread runs the per-entity scripts
+			GatherShards(entities);
+			StartShards(deltaTime, elapsedTime);
+		}
+
+		// loop all entities that have a per-entity script and invoke their lua function.
+		// With a budget, the loop stops once the time is spent and the next frame starts where it stopped (round robin)
+		const bool hasBudget = m_frameBudgetMs > 0.0f;
+		s_deadline = hasBudget ?
+			std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float, std::milli>(m_frameBudgetMs)) :
+			std::chrono::steady_clock::time_point::max();
+
+		const size_t count = entities.size();
+		size_t ranScripts = 0;
+		for (; ranScripts < count; ++ranScripts)
+		{
+			// at least one script progresses every frame
+			if (hasBudget && ranScripts > 0 && std::chrono::steady_clock::now() >= s_deadline)
+				break;
+
+			const Entity& entity = entities[(m_nextScript + ranScripts) % count];
+			auto& script = entity.GetComponent<ScriptComponent>();
+			if (script.batch < 0 && script.func.valid())
+				RunScript(entity, script);
+		}
+		m_nextScript = count > 0 ? (m_nextScript + ranScripts) % count : 0;
+
+		if (!m_shards.empty())
+		{
+			// sync point: wait for the shards and apply their changes to the components
+			WaitForShards();
+			ApplyShardDeltas();
+			return;
+		}
+
+		// one call per batch instead of one per entity, the script reads and writes the components through the views
+		for (auto& batch : m_batches)
+		{
+			if (batch.views.empty())
+				continue;
+
+			const sol::protected_function_result result = batch.func(sol::lightuserdata_value(batch.views.data()),
+				static_cast<int>(batch.views.size()), deltaTime, elapsedTime);
+			if (!result.valid())
+			{
+				const sol::error error = result;
+				Logger::Error("Script error in batch " + batch.name + ": " + error.what());
+			}
 		}
 	}
 
@@ -1126,25 +1842,411 @@ public:
 
 	}
 
-	//void CreateLuaBindings(sol::state& lua)
-	//{
-	//	// Create entity usertype so lua knows what an entity is
-	//	lua.new_usertype<Entity>(
-	//		"entity",
-	//		"get_id", &Entity::GetID,
-	//		"destroy", &Entity::Destroy,
-	//		"has_tag", &Entity::HasTag,
-	//		"belongs_to_group", &Entity::BelongsToGroup
-	//	);
+	/// <summary>
+	/// Registers the batch bindings as raw lua_CFunctions: no sol2 wrapper and no argument checks,
+	/// they index the light userdata of the batch directly (i from 1 to count)
+	/// </summary>
+	/// <param name="lua"></param>
+	static void CreateLuaBindings(sol::state& lua) noexcept
+	{
+		lua_State* L = lua.lua_state();
+		lua_register(L, "batch_get_id", &BatchGetId);
+		lua_register(L, "batch_get_position", &BatchGetPosition);
+		lua_register(L, "batch_set_position", &BatchSetPosition);
+		lua_register(L, "batch_get_velocity", &BatchGetVelocity);
+		lua_register(L, "batch_set_velocity", &BatchSetVelocity);
+		lua_register(L, "batch_get_rotation", &BatchGetRotation);
+		lua_register(L, "batch_set_rotation", &BatchSetRotation);
+
+#ifdef ENGINE_USE_LUAJIT
+		// LuaJIT: batch_views(entities) casts the batch to FFI cdata, the JIT-compiled script then reads and writes
+		// the components in place without any call into C (views are 0-based: views[i - 1].transform.position.x)
+		lua.open_libraries(sol::lib::package, sol::lib::ffi, sol::lib::jit);
+		lua.script(R"(
+			local ffi = require("ffi")
+			ffi.cdef[[
+				typedef struct { float x, y; } engine_vec2;
+				typedef struct { engine_vec2 position; engine_vec2 scale; double rotation; } TransformComponent;
+				typedef struct { engine_vec2 velocity; } RigidbodyComponent;
+				typedef struct { int entity_id; TransformComponent* transform; RigidbodyComponent* rigidbody; } ScriptEntityView;
+			]]
+			local view_pointer = ffi.typeof("ScriptEntityView*")
+			function batch_views(entities) return ffi.cast(view_pointer, entities) end
+		)");
+#endif
+	}
+
+private:
+
+	struct ScriptBatch
+	{
+		std::string name;
+		sol::protected_function func;
+		std::vector<ScriptEntityView> views; // rebuilt every frame, keeps its allocation
+	};
+
+	// the pools do not change while the scripts run, the pointers stay valid until the end of the update
+	ScriptEntityView CreateEntityView(const Entity& entity) noexcept
+	{
+		ScriptEntityView view;
+		view.entityId = entity.GetID();
+		view.transform = entity.HasComponent<TransformComponent>() ? &entity.GetComponent<TransformComponent>() : &m_scratchTransform;
+		view.rigidbody = entity.HasComponent<RigidbodyComponent>() ? &entity.GetComponent<RigidbodyComponent>() : &m_scratchRigidbody;
+		return view;
+	}
+
+	static inline ScriptEntityView& GetEntityView(lua_State* L) noexcept
+	{
+		return static_cast<ScriptEntityView*>(lua_touserdata(L, 1))[lua_tointeger(L, 2) - 1];
+	}
+
+	// batch_get_id(entities, i) -> id
+	static int BatchGetId(lua_State* L) noexcept
+	{
+		lua_pushinteger(L, GetEntityView(L).entityId);
+		return 1;
+	}
+
+	// batch_get_position(entities, i) -> x, y
+	static int BatchGetPosition(lua_State* L) noexcept
+	{
+		const glm::vec2& position = GetEntityView(L).transform->m_position;
+		lua_pushnumber(L, position.x);
+		lua_pushnumber(L, position.y);
+		return 2;
+	}
+
+	// batch_set_position(entities, i, x, y)
+	static int BatchSetPosition(lua_State* L) noexcept
+	{
+		glm::vec2& position = GetEntityView(L).transform->m_position;
+		position.x = static_cast<float>(lua_tonumber(L, 3));
+		position.y = static_cast<float>(lua_tonumber(L, 4));
+		return 0;
+	}
+
+	// batch_get_velocity(entities, i) -> x, y
+	static int BatchGetVelocity(lua_State* L) noexcept
+	{
+		const glm::vec2& velocity = GetEntityView(L).rigidbody->m_velocity;
+		lua_pushnumber(L, velocity.x);
+		lua_pushnumber(L, velocity.y);
+		return 2;
+	}
+
+	// batch_set_velocity(entities, i, x, y)
+	static int BatchSetVelocity(lua_State* L) noexcept
+	{
+		glm::vec2& velocity = GetEntityView(L).rigidbody->m_velocity;
+		velocity.x = static_cast<float>(lua_tonumber(L, 3));
+		velocity.y = static_cast<float>(lua_tonumber(L, 4));
+		return 0;
+	}
+
+	// batch_get_rotation(entities, i) -> degrees
+	static int BatchGetRotation(lua_State* L) noexcept
+	{
+		lua_pushnumber(L, GetEntityView(L).transform->m_rotation);
+		return 1;
+	}
+
+	// batch_set_rotation(entities, i, degrees)
+	static int BatchSetRotation(lua_State* L) noexcept
+	{
+		GetEntityView(L).transform->m_rotation = lua_tonumber(L, 3);
+		return 0;
+	}
+
+	// one Lua state and its share of the batch entities
+	struct ScriptShard
+	{
+		sol::state lua;
+		std::vector<sol::protected_function> batchFunctions; // same index as m_batches, resolved on the first use
+		std::vector<std::vector<ScriptEntityView>> views; // per batch, pointing to the buffered components
+		std::vector<TransformComponent> transforms; // buffered copies written by the scripts
+		std::vector<RigidbodyComponent> rigidbodies;
+		std::vector<TransformComponent*> sourceTransforms; // components the copies come from
+		std::vector<RigidbodyComponent*> sourceRigidbodies;
+		std::vector<std::string> errors; // the Logger is not thread safe, errors are logged by the main thread
+		std::thread thread;
+		uint64_t generation = 0; // last update run by the worker
+	};
+
+	// splits the batch entities between the shards (entity index % shard count) and copies their components
+	void GatherShards(std::vector<Entity>& entities) noexcept
+	{
+		for (auto& shard : m_shards)
+		{
+			shard->views.resize(m_batches.size());
+			for (auto& views : shard->views)
+				views.clear();
+			shard->transforms.clear();
+			shard->rigidbodies.clear();
+			shard->sourceTransforms.clear();
+			shard->sourceRigidbodies.clear();
+		}
+
+		size_t nextShard = 0;
+		for (auto& entity : entities)
+		{
+			const auto& script = entity.GetComponent<ScriptComponent>();
+			if (script.batch < 0)
+				continue;
+
+			ScriptShard& shard = *m_shards[nextShard];
+			nextShard = (nextShard + 1) % m_shards.size();
+
+			shard.views[script.batch].push_back(CreateEntityView(entity));
+		}
+
+		// the views are moved to the copies of their components, reserved first so they do not move anymore
+		for (auto& shard : m_shards)
+		{
+			size_t count = 0;
+			for (const auto& views : shard->views)
+				count += views.size();
+			shard->transforms.reserve(count);
+			shard->rigidbodies.reserve(count);
+
+			for (auto& views : shard->views)
+			{
+				for (auto& view : views)
+				{
+					shard->sourceTransforms.push_back(view.transform);
+					shard->sourceRigidbodies.push_back(view.rigidbody);
+					shard->transforms.push_back(*view.transform);
+					shard->rigidbodies.push_back(*view.rigidbody);
+					view.transform = &shard->transforms.back();
+					view.rigidbody = &shard->rigidbodies.back();
+				}
+			}
+		}
+	}
+
+	void StartShards(float deltaTime, int elapsedTime) noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_shardMutex);
+			m_shardDeltaTime = deltaTime;
+			m_shardElapsedTime = elapsedTime;
+			m_pendingShards = m_shards.size();
+			++m_shardGeneration;
+		}
+		m_shardWorkReady.notify_all();
+	}
+
+	void WaitForShards() noexcept
+	{
+		ProfileScope scope("ScriptSystem::WaitForShards");
+		std::unique_lock<std::mutex> lock(m_shardMutex);
+		m_shardWorkDone.wait(lock, [this] { return m_pendingShards == 0; });
+	}
 
-	//	// bind the native c++ functions with lua functions
-	/*lua.set_function("get_velocity", GetEntityVelocity);
-	lua.set_function("set_position", SetEntityPosition);
-	lua.set_function("set_velocity", SetEntityVelocity);
-	lua.set_function("set_rotation", SetEntityRotation);
-	lua.set_function("set_projectile_velocity", SetProjectileVelocity);
-	lua.set_function("set_animation_frame", SetEntityAnimationFrame);*/
-	//}
+	void RunShardWorker(ScriptShard& shard) noexcept
+	{
+		std::unique_lock<std::mutex> lock(m_shardMutex);
+		while (true)
+		{
+			m_shardWorkReady.wait(lock, [this, &shard] { return m_isStopping || shard.generation != m_shardGeneration; });
+			if (m_isStopping)
+				return;
+			shard.generation = m_shardGeneration;
+			const float deltaTime = m_shardDeltaTime;
+			const int elapsedTime = m_shardElapsedTime;
+			lock.unlock();
+
+			RunShardBatches(shard, deltaTime, elapsedTime);
+
+			lock.lock();
+			if (--m_pendingShards == 0)
+				m_shardWorkDone.notify_one();
+		}
+	}
+
+	void RunShardBatches(ScriptShard& shard, float deltaTime, int elapsedTime) noexcept
+	{
+		ProfileScope scope("ScriptSystem::Shard");
+
+		// m_batches only grows while loading, on the main thread, before any update
+		shard.batchFunctions.resize(m_batches.size());
+		for (size_t batch = 0; batch < m_batches.size(); ++batch)
+		{
+			auto& views = shard.views[batch];
+			if (views.empty())
+				continue;
+
+			sol::protected_function& func = shard.batchFunctions[batch];
+			if (!func.valid())
+			{
+				sol::optional<sol::protected_function> found = shard.lua["Level"]["batch_scripts"][m_batches[batch].name];
+				if (found == sol::nullopt)
+				{
+					shard.errors.push_back("Unknown batch script in a script shard: " + m_batches[batch].name);
+					continue;
+				}
+				func = found.value();
+			}
+
+			const sol::protected_function_result result = func(sol::lightuserdata_value(views.data()),
+				static_cast<int>(views.size()), deltaTime, elapsedTime);
+			if (!result.valid())
+			{
+				const sol::error error = result;
+				shard.errors.push_back("Script error in batch " + m_batches[batch].name + ": " + error.what());
+			}
+		}
+	}
+
+	// writes back only the fields the scripts changed
+	void ApplyShardDeltas() noexcept
+	{
+		for (auto& shard : m_shards)
+		{
+			for (size_t i = 0; i < shard->transforms.size(); ++i)
+			{
+				const TransformComponent& copy = shard->transforms[i];
+				TransformComponent& transform = *shard->sourceTransforms[i];
+				if (copy.m_position != transform.m_position) transform.m_position = copy.m_position;
+				if (copy.m_scale != transform.m_scale) transform.m_scale = copy.m_scale;
+				if (copy.m_rotation != transform.m_rotation) transform.m_rotation = copy.m_rotation;
+
+				const RigidbodyComponent& rigidbodyCopy = shard->rigidbodies[i];
+				RigidbodyComponent& rigidbody = *shard->sourceRigidbodies[i];
+				if (rigidbodyCopy.m_velocity != rigidbody.m_velocity) rigidbody.m_velocity = rigidbodyCopy.m_velocity;
+			}
+
+			for (const auto& error : shard->errors)
+				Logger::Error(error);
+			shard->errors.clear();
+		}
+	}
+
+	void StopShards() noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_shardMutex);
+			m_isStopping = true;
+		}
+		m_shardWorkReady.notify_all();
+		for (auto& shard : m_shards)
+		{
+			if (shard->thread.joinable())
+				shard->thread.join();
+		}
+		m_shards.clear();
+	}
+
+	void RunScript(const Entity& entity, ScriptComponent& script) noexcept
+	{
+		if (!script.thread.valid())
+		{
+			if (m_tick - script.lastRunTick < script.updateInterval)
+				return;
+			script.lastRunTick = m_tick;
+
+			if (!script.isCoroutine)
+			{
+				// here is where we invoke the lua function, a script error is logged instead of unwinding through the game loop
+				const sol::protected_function_result result = script.func(/*entity, deltaTime, elapsedTime*/);
+				if (!result.valid())
+				{
+					const sol::error error = result;
+					Logger::Error("Script error on entity " + std::to_string(entity.GetID()) + ": " + error.what());
+				}
+				return;
+			}
+
+			script.thread = sol::thread::create(script.func.lua_state());
+			script.func.push(script.thread.thread_state());
+		}
+
+		lua_State* coroutine = script.thread.thread_state();
+#ifndef ENGINE_USE_LUAJIT
+		// LuaJIT can not yield from a hook, its coroutines only stop at coroutine.yield()
+		if (m_frameBudgetMs > 0.0f)
+			lua_sethook(coroutine, &BudgetHook, LUA_MASKCOUNT, SCRIPT_HOOK_INSTRUCTIONS);
+		else
+			lua_sethook(coroutine, nullptr, 0, 0);
+		const int status = lua_resume(coroutine, script.func.lua_state(), 0);
+#else
+		const int status = lua_resume(coroutine, 0);
+#endif
+
+		if (status == LUA_YIELD)
+		{
+			// resumed on one of the next frames, the yielded values are dropped
+			lua_settop(coroutine, 0);
+			return;
+		}
+		if (status != LUA_OK)
+		{
+			// error() can raise any value, or none, lua_tostring only converts the strings and numbers
+			const char* message = lua_tostring(coroutine, -1);
+			Logger::Error("Script error on entity " + std::to_string(entity.GetID()) + ": " +
+				(message ? std::string(message) : std::string("error object is a ") + luaL_typename(coroutine, -1) + " value"));
+		}
+		script.thread = sol::thread();
+	}
+
+	// count hook of the coroutine scripts, suspends the script once the frame budget is spent. The script can not be
+	// suspended while it runs inside a C call (a callback of table.sort, pcall, a bound C++ function calling back into
+	// Lua): yielding there raises "attempt to yield across a C-call boundary", so the hook waits for the next check
+	static void BudgetHook(lua_State* L, lua_Debug* debug) noexcept
+	{
+		if (std::chrono::steady_clock::now() >= s_deadline && lua_isyieldable(L))
+			lua_yield(L, 0);
+	}
+
+	// instructions between two budget checks of a running coroutine
+	static constexpr int SCRIPT_HOOK_INSTRUCTIONS = 1000;
+	// end of the script time of the current frame (thread local, the hook has no user data)
+	static inline thread_local std::chrono::steady_clock::time_point s_deadline;
+
+	int m_tick = 0;
+	size_t m_nextScript = 0; // first per-entity script of the next frame
+	float m_frameBudgetMs = 0.0f; // 0: no budget
+	std::vector<ScriptBatch> m_batches;
+	std::vector<std::unique_ptr<ScriptShard>> m_shards;
+	std::string m_shardScriptPath;
+	std::mutex m_shardMutex;
+	std::condition_variable m_shardWorkReady;
+	std::condition_variable m_shardWorkDone;
+	uint64_t m_shardGeneration = 0;
+	size_t m_pendingShards = 0;
+	float m_shardDeltaTime = 0.0f;
+	int m_shardElapsedTime = 0;
+	bool m_isStopping = false;
+	TransformComponent m_scratchTransform;
+	RigidbodyComponent m_scratchRigidbody;
+};
+
+
+// entities with a transform, the ReplicationServer sends the ones with a health or a projectile component to the
+// clients (the static entities are created by the level on both sides). The server reads the list, nothing is updated
+class ReplicationSystem : public System
+{
+public:
+
+	ReplicationSystem() noexcept
+	{
+		RequireComponent<TransformComponent>();
+	}
+
+	void SubscribeToEvent(std::unique_ptr<EventBus>& eventBus) noexcept override
+	{
+
+	}
+
+	void Update(float deltaTime, std::unique_ptr<EventBus>& eventBus, SDL_Rect& camera,
+		std::unique_ptr<Registry>& registry, std::unique_ptr<AssetStore>& assetStore, SDL_Renderer* renderer, int elapsedTime) noexcept override
+	{
+
+	}
+
+	void Render(SDL_Renderer* renderer, std::unique_ptr<AssetStore>& assetStore, SDL_Rect& camera, std::unique_ptr<Registry>& registry, bool isDebugMode) noexcept override
+	{
+
+	}
 
 };
 